@@ -0,0 +1,628 @@
+#include "compare.h"
+
+#include <cmath>
+#include <cstring>
+
+#include "contenthash.h"
+#include "db.h"
+#include "errors.h"
+#include "lazydict.h"
+
+//
+// Numbers
+//
+
+bool OOCMap_inlineNumber(const EncodedValue& value, InlineNumber* const dest) {
+    switch(value.typeCode) {
+    case TYPE_CODE_HARDCODED:
+        dest->isFloat = false;
+        switch(value.asInt) {
+        case 1:     // 0
+        case 4:     // False
+            dest->asInt = 0;
+            return true;
+        case 3:     // True
+            dest->asInt = 1;
+            return true;
+        default:
+            return false;
+        }
+    case TYPE_CODE_SHORT_POSITIVE_INT:
+    case TYPE_CODE_SHORT_NEGATIVE_INT: {
+        // These are the digits of a PyLongObject, so there are at most 60 bits of them.
+        digit digits[sizeof(value.asChars) / sizeof(digit)];
+        memcpy(digits, value.asChars, sizeof(digits));
+        const size_t digitCount = (value.lengthMinusOne + 1) / sizeof(digit);
+        int64_t magnitude = 0;
+        for(size_t i = digitCount; i > 0; --i)
+            magnitude = (magnitude << PyLong_SHIFT) | digits[i - 1];
+        dest->isFloat = false;
+        dest->asInt = value.typeCode == TYPE_CODE_SHORT_NEGATIVE_INT ? -magnitude : magnitude;
+        return true;
+    }
+    case TYPE_CODE_FLOAT:
+        if(std::isnan(value.asFloat)) return false;
+        dest->isFloat = true;
+        dest->asFloat = value.asFloat;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool OOCMap_inlineNumberLess(const InlineNumber& a, const InlineNumber& b) {
+    if(a.isFloat && b.isFloat) return a.asFloat < b.asFloat;
+    if(!a.isFloat && !b.isFloat) return a.asInt < b.asInt;
+
+    // Inline ints are smaller than 2^60, so beyond 2^62 we know the answer, and closer to 0 the
+    // float's floor and ceiling fit into an int64.
+    static const double limit = 4611686018427387904.0;
+    if(a.isFloat) {
+        if(a.asFloat < -limit) return true;
+        if(a.asFloat > limit) return false;
+        return static_cast<int64_t>(std::floor(a.asFloat)) < b.asInt;
+    } else {
+        if(b.asFloat > limit) return true;
+        if(b.asFloat < -limit) return false;
+        return a.asInt < static_cast<int64_t>(std::ceil(b.asFloat));
+    }
+}
+
+//
+// What the encodings tell us
+//
+
+// Values of different kinds are never equal. Values we don't know anything about are OTHER, and
+// have to be decoded.
+enum EncodedKind {
+    KIND_NONE,
+    KIND_NUMBER,
+    KIND_STRING,
+    KIND_TUPLE,
+    KIND_LIST,
+    KIND_DICT,
+    KIND_OTHER
+};
+
+static EncodedKind encodedKind(const EncodedValue& value) {
+    switch(value.typeCode) {
+    case TYPE_CODE_HARDCODED:
+        switch(value.asInt) {
+        case 0:
+            return KIND_NONE;
+        case 1:
+        case 3:
+        case 4:
+            return KIND_NUMBER;
+        case 5:
+            return KIND_TUPLE;
+        case 6:
+            return KIND_STRING;
+        default:
+            return KIND_OTHER;
+        }
+    case TYPE_CODE_SHORT_POSITIVE_INT:
+    case TYPE_CODE_SHORT_NEGATIVE_INT:
+    case TYPE_CODE_LONG_POSITIVE_INT:
+    case TYPE_CODE_LONG_NEGATIVE_INT:
+    case TYPE_CODE_FLOAT:
+        return KIND_NUMBER;
+    case TYPE_CODE_UNICODE_SHORT_WCHAR:
+    case TYPE_CODE_UNICODE_SHORT_1BYTE:
+    case TYPE_CODE_UNICODE_SHORT_2BYTE:
+    case TYPE_CODE_UNICODE_SHORT_4BYTE:
+    case TYPE_CODE_UNICODE_LONG_WCHAR:
+    case TYPE_CODE_UNICODE_LONG_1BYTE:
+    case TYPE_CODE_UNICODE_LONG_2BYTE:
+    case TYPE_CODE_UNICODE_LONG_4BYTE:
+        return KIND_STRING;
+    case TYPE_CODE_TUPLE:
+        return KIND_TUPLE;
+    case TYPE_CODE_LIST:
+        return KIND_LIST;
+    case TYPE_CODE_DICT:
+        return KIND_DICT;
+    default:
+        return KIND_OTHER;
+    }
+}
+
+static PyObject* decode(OOCMapObject* const ooc, MDB_txn* const txn, const EncodedValue& value) {
+    EncodedValue copy = value;
+    return OOCMap_decode(ooc, &copy, txn);
+}
+
+static PyObject* newBool(const bool value) {
+    GilLocker gil;
+    return PyBool_FromLong(value);
+}
+
+// The items of a stored list or tuple, in order
+class EncodedItems {
+    const EncodedValue* m_tupleItems;   // points into the map, which stays put during a read txn
+    Py_ssize_t m_tupleLength;
+    MDB_cursor* m_cursor;
+    uint32_t m_listId;
+    uint32_t m_pos;
+
+public:
+    EncodedItems(OOCMapObject* const ooc, MDB_txn* const txn, const EncodedValue& value) :
+        m_tupleItems(nullptr),
+        m_tupleLength(0),
+        m_cursor(nullptr),
+        m_listId(0),
+        m_pos(0)
+    {
+        if(value.typeCode == TYPE_CODE_TUPLE) {
+            uint64_t tupleId = value.asUInt;
+            MDB_val mdbKey = { .mv_size = sizeof(tupleId), .mv_data = &tupleId };
+            MDB_val mdbValue;
+            if(!get(txn, ooc->tuplesDb, &mdbKey, &mdbValue)) throw OocError(OocError::UnexpectedData);
+            if(mdbValue.mv_size % sizeof(EncodedValue) != 0) throw OocError(OocError::UnexpectedData);
+            m_tupleItems = static_cast<const EncodedValue*>(mdbValue.mv_data);
+            m_tupleLength = mdbValue.mv_size / sizeof(EncodedValue);
+        } else if(value.typeCode == TYPE_CODE_LIST) {
+            m_listId = value.asListKey.listId;
+            m_cursor = cursor_open(txn, ooc->listsDb);
+        }
+        // Otherwise this is the empty tuple.
+    }
+
+    ~EncodedItems() {
+        if(m_cursor != nullptr)
+            cursor_close(m_cursor);
+    }
+
+    // Reads the next item into dest. Returns false after the last one.
+    bool next(EncodedValue* const dest) {
+        if(m_cursor == nullptr) {
+            if(m_pos >= m_tupleLength) return false;
+            memcpy(dest, m_tupleItems + m_pos, sizeof(EncodedValue));
+            m_pos += 1;
+            return true;
+        }
+
+        // A list's length record sorts right after its items, so we don't have to look it up.
+        if(m_pos == ListKey::listIndexLength) return false;
+        ListKey listKey = { .listIndex = m_pos, .listId = m_listId };
+        MDB_val mdbKey = { .mv_size = sizeof(listKey), .mv_data = &listKey };
+        MDB_val mdbValue;
+        const bool found = cursor_get(m_cursor, &mdbKey, &mdbValue, m_pos == 0 ? MDB_SET_RANGE : MDB_NEXT);
+        if(!found || mdbKey.mv_size != sizeof(ListKey)) throw OocError(OocError::UnexpectedData);
+        const ListKey* const itemKey = static_cast<const ListKey*>(mdbKey.mv_data);
+        if(itemKey->listId != m_listId) throw OocError(OocError::UnexpectedData);
+        if(itemKey->listIndex == ListKey::listIndexLength) {
+            // With content hashes or copies, the length is followed by more.
+            if(mdbValue.mv_size < sizeof(uint32_t)) throw OocError(OocError::UnexpectedData);
+            if(*static_cast<const uint32_t*>(mdbValue.mv_data) != m_pos)
+                throw OocError(OocError::UnexpectedData);
+            m_pos = ListKey::listIndexLength;
+            return false;
+        }
+        if(itemKey->listIndex != m_pos || mdbValue.mv_size != sizeof(EncodedValue))
+            throw OocError(OocError::UnexpectedData);
+        memcpy(dest, mdbValue.mv_data, sizeof(EncodedValue));
+        m_pos += 1;
+        return true;
+    }
+};
+
+// One comparison, with everything it needs along the way. This runs without the GIL, and only
+// takes it to decode values and hand them to Python.
+class EncodedComparison {
+    OOCMapObject* const m_ooc;
+    MDB_txn* const m_txn;
+    const int m_maxDepth;
+    int m_depth;
+
+    // Lists and dicts can contain themselves, so Python's recursion limit applies to comparing them.
+    class Nested {
+        EncodedComparison& m_comparison;
+
+    public:
+        explicit Nested(EncodedComparison& comparison) : m_comparison(comparison) {
+            if(m_comparison.m_depth >= m_comparison.m_maxDepth) {
+                GilLocker gil;
+                PyErr_SetString(PyExc_RecursionError, "maximum recursion depth exceeded in comparison");
+                throw OocError(OocError::AlreadyPythonizedError);
+            }
+            m_comparison.m_depth += 1;
+        }
+        ~Nested() {
+            m_comparison.m_depth -= 1;
+        }
+    };
+
+    bool decodedEqual(const EncodedValue& a, const EncodedValue& b) {
+        GilLocker gil;
+        PyObject* const pyA = decode(m_ooc, m_txn, a);
+        PyObject* pyB;
+        try {
+            pyB = decode(m_ooc, m_txn, b);
+        } catch(...) {
+            Py_DECREF(pyA);
+            throw;
+        }
+        const int result = PyObject_RichCompareBool(pyA, pyB, Py_EQ);
+        Py_DECREF(pyA);
+        Py_DECREF(pyB);
+        if(result < 0) throw OocError(OocError::AlreadyPythonizedError);
+        return result;
+    }
+
+    bool numbersEqual(const EncodedValue& a, const EncodedValue& b) {
+        InlineNumber aNumber;
+        InlineNumber bNumber;
+        const bool aInline = OOCMap_inlineNumber(a, &aNumber);
+        const bool bInline = OOCMap_inlineNumber(b, &bNumber);
+        if(aInline && bInline)
+            return !OOCMap_inlineNumberLess(aNumber, bNumber) && !OOCMap_inlineNumberLess(bNumber, aNumber);
+
+        // NaN is not equal to anything.
+        if(a.typeCode == TYPE_CODE_FLOAT && !aInline) return false;
+        if(b.typeCode == TYPE_CODE_FLOAT && !bInline) return false;
+
+        // At least one of them is a long int. Those are stored once for each value, and inline ints
+        // are too small to be equal to any of them. Only a float can be.
+        if(a.typeCode != TYPE_CODE_FLOAT && b.typeCode != TYPE_CODE_FLOAT) return false;
+        return decodedEqual(a, b);
+    }
+
+    bool sequencesEqual(const EncodedValue& a, const EncodedValue& b) {
+        Nested nested(*this);
+        if(m_ooc->contentHashes && a.typeCode == TYPE_CODE_LIST && b.typeCode == TYPE_CODE_LIST) {
+            ContentHash aHash;
+            ContentHash bHash;
+            const Py_ssize_t aLength = OOCMap_getListHeader(m_ooc, m_txn, a.asListKey.listId, &aHash);
+            const Py_ssize_t bLength = OOCMap_getListHeader(m_ooc, m_txn, b.asListKey.listId, &bHash);
+            if(aLength != bLength) return false;
+            if(aHash.provesEqual(bHash)) return true;
+        }
+        EncodedItems aItems(m_ooc, m_txn, a);
+        EncodedItems bItems(m_ooc, m_txn, b);
+        EncodedValue aItem;
+        EncodedValue bItem;
+        while(true) {
+            const bool aMore = aItems.next(&aItem);
+            const bool bMore = bItems.next(&bItem);
+            if(!aMore || !bMore) return aMore == bMore;
+            if(!equal(aItem, bItem)) return false;
+        }
+    }
+
+    // Compares two dicts by decoding them completely
+    bool eagerDictsEqual(const EncodedValue& a, const EncodedValue& b) {
+        GilLocker gil;
+        PyObject* aDict = nullptr;
+        PyObject* bDict = nullptr;
+        OOCLazyDictObject* lazy = nullptr;
+        try {
+            lazy = OOCLazyDict_fastnew(m_ooc, a.asDictKey.dictId);
+            aDict = OOCLazyDictObject_eager(lazy, m_txn);
+            Py_CLEAR(lazy);
+            lazy = OOCLazyDict_fastnew(m_ooc, b.asDictKey.dictId);
+            bDict = OOCLazyDictObject_eager(lazy, m_txn);
+            Py_CLEAR(lazy);
+        } catch(...) {
+            Py_XDECREF(lazy);
+            Py_XDECREF(aDict);
+            throw;
+        }
+        const int result = PyObject_RichCompareBool(aDict, bDict, Py_EQ);
+        Py_DECREF(aDict);
+        Py_DECREF(bDict);
+        if(result < 0) throw OocError(OocError::AlreadyPythonizedError);
+        return result;
+    }
+
+    bool dictsEqual(const EncodedValue& a, const EncodedValue& b) {
+        Nested nested(*this);
+        ContentHash aHash;
+        ContentHash bHash;
+        if(
+            OOCMap_getDictHeader(m_ooc, m_txn, a.asDictKey.dictId, &aHash) !=
+            OOCMap_getDictHeader(m_ooc, m_txn, b.asDictKey.dictId, &bHash)
+        ) {
+            return false;
+        }
+        if(m_ooc->contentHashes && aHash.provesEqual(bHash)) return true;
+
+        // We look up each of a's keys in b by its encoding, so we don't decode keys at all.
+        MDB_cursor* const cursor = cursor_open(m_txn, m_ooc->dictsDb);
+        try {
+            uint32_t dictId = a.asDictKey.dictId;
+            MDB_val mdbKey = { .mv_size = sizeof(dictId), .mv_data = &dictId };
+            MDB_val mdbValue;
+            if(!cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET)) throw OocError(OocError::UnexpectedData);
+            while(cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT)) {
+                if(mdbKey.mv_size != sizeof(DictItemKey)) break;
+                const DictItemKey* const aItemKey = static_cast<const DictItemKey*>(mdbKey.mv_data);
+                if(aItemKey->dictId != a.asDictKey.dictId) break;
+                if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+                EncodedValue aValue;
+                memcpy(&aValue, mdbValue.mv_data, sizeof(aValue));
+
+                DictItemKey bItemKey = { .dictId = b.asDictKey.dictId, .key = aItemKey->key };
+                MDB_val mdbBKey = { .mv_size = sizeof(bItemKey), .mv_data = &bItemKey };
+                MDB_val mdbBValue;
+                if(get(m_txn, m_ooc->dictsDb, &mdbBKey, &mdbBValue)) {
+                    if(mdbBValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+                    EncodedValue bValue;
+                    memcpy(&bValue, mdbBValue.mv_data, sizeof(bValue));
+                    if(!equal(aValue, bValue)) {
+                        cursor_close(cursor);
+                        return false;
+                    }
+                    continue;
+                }
+
+                // A string or None has only one encoding, so b doesn't have this key. A number or a
+                // tuple might be in b as an equal value with a different encoding, like 1 and 1.0.
+                const EncodedKind keyKind = encodedKind(bItemKey.key);
+                cursor_close(cursor);
+                if(keyKind == KIND_STRING || keyKind == KIND_NONE) return false;
+                return eagerDictsEqual(a, b);
+            }
+        } catch(...) {
+            cursor_close(cursor);
+            throw;
+        }
+        cursor_close(cursor);
+        return true;
+    }
+
+    PyObject* sequencesRichcompare(const EncodedValue& a, const EncodedValue& b, const int op) {
+        Nested nested(*this);
+        EncodedItems aItems(m_ooc, m_txn, a);
+        EncodedItems bItems(m_ooc, m_txn, b);
+        EncodedValue aItem;
+        EncodedValue bItem;
+        while(true) {
+            const bool aMore = aItems.next(&aItem);
+            const bool bMore = bItems.next(&bItem);
+            if(!aMore || !bMore) {
+                // One is a prefix of the other, and the longer one is greater.
+                switch(op) {
+                case Py_LT: return newBool(bMore);
+                case Py_LE: return newBool(!aMore);
+                case Py_GT: return newBool(aMore);
+                default: return newBool(!bMore);
+                }
+            }
+            if(!equal(aItem, bItem))
+                return richcompare(aItem, bItem, op);
+        }
+    }
+
+public:
+    EncodedComparison(OOCMapObject* const ooc, MDB_txn* const txn) :
+        m_ooc(ooc),
+        m_txn(txn),
+        m_maxDepth(Py_GetRecursionLimit()),
+        m_depth(0)
+    { }
+
+    bool equal(const EncodedValue& a, const EncodedValue& b) {
+        // Decoding a float makes a new object every time, so NaN never equals itself here.
+        if(a == b) return a.typeCode != TYPE_CODE_FLOAT || !std::isnan(a.asFloat);
+
+        const EncodedKind kind = encodedKind(a);
+        const EncodedKind bKind = encodedKind(b);
+        if(kind == KIND_OTHER || bKind == KIND_OTHER)
+            return decodedEqual(a, b);
+        if(kind != bKind) return false;
+
+        switch(kind) {
+        case KIND_NUMBER:
+            return numbersEqual(a, b);
+        case KIND_TUPLE:
+        case KIND_LIST:
+            return sequencesEqual(a, b);
+        case KIND_DICT:
+            return dictsEqual(a, b);
+        default:
+            // There is only one None, and strings are stored once for each value.
+            return false;
+        }
+    }
+
+    PyObject* richcompare(const EncodedValue& a, const EncodedValue& b, const int op) {
+        if(op == Py_EQ || op == Py_NE)
+            return newBool(equal(a, b) == (op == Py_EQ));
+
+        const EncodedKind kind = encodedKind(a);
+        if(kind == encodedKind(b) && (kind == KIND_LIST || kind == KIND_TUPLE))
+            return sequencesRichcompare(a, b, op);
+
+        InlineNumber aNumber;
+        InlineNumber bNumber;
+        if(OOCMap_inlineNumber(a, &aNumber) && OOCMap_inlineNumber(b, &bNumber)) {
+            switch(op) {
+            case Py_LT: return newBool(OOCMap_inlineNumberLess(aNumber, bNumber));
+            case Py_LE: return newBool(!OOCMap_inlineNumberLess(bNumber, aNumber));
+            case Py_GT: return newBool(OOCMap_inlineNumberLess(bNumber, aNumber));
+            default: return newBool(!OOCMap_inlineNumberLess(aNumber, bNumber));
+            }
+        }
+
+        GilLocker gil;
+        PyObject* const pyA = decode(m_ooc, m_txn, a);
+        PyObject* pyB;
+        try {
+            pyB = decode(m_ooc, m_txn, b);
+        } catch(...) {
+            Py_DECREF(pyA);
+            throw;
+        }
+        PyObject* const result = PyObject_RichCompare(pyA, pyB, op);
+        Py_DECREF(pyA);
+        Py_DECREF(pyB);
+        if(result == nullptr) throw OocError(OocError::AlreadyPythonizedError);
+        return result;
+    }
+};
+
+//
+// Comparisons
+//
+
+bool OOCMap_encodedEqual(OOCMapObject* const ooc, MDB_txn* const txn, const EncodedValue& a, const EncodedValue& b) {
+    EncodedComparison comparison(ooc, txn);
+    GilUnlocker gil;
+    return comparison.equal(a, b);
+}
+
+PyObject* OOCMap_encodedRichcompare(
+    OOCMapObject* const ooc,
+    MDB_txn* const txn,
+    const EncodedValue& a,
+    const EncodedValue& b,
+    const int op
+) {
+    if(op < Py_LT || op > Py_GE) {
+        PyErr_BadInternalCall();
+        throw OocError(OocError::AlreadyPythonizedError);
+    }
+    EncodedComparison comparison(ooc, txn);
+    GilUnlocker gil;
+    return comparison.richcompare(a, b, op);
+}
+
+//
+// Hashes
+//
+
+// Python's hash of an int is its value modulo _PyHASH_MODULUS, which it computes from the digits of
+// the PyLongObject. Ours are the same digits, so we do the same.
+static Py_hash_t hashDigits(const void* const digits, const size_t digitCount, const bool negative) {
+    Py_uhash_t x = 0;
+    for(size_t i = digitCount; i > 0; --i) {
+        digit d;
+        memcpy(&d, static_cast<const uint8_t*>(digits) + (i - 1) * sizeof(digit), sizeof(d));
+        x = ((x << PyLong_SHIFT) & _PyHASH_MODULUS) | (x >> (_PyHASH_BITS - PyLong_SHIFT));
+        x += d;
+        if(x >= _PyHASH_MODULUS) x -= _PyHASH_MODULUS;
+    }
+    if(negative) x = -x;
+    if(x == static_cast<Py_uhash_t>(-1)) x = static_cast<Py_uhash_t>(-2);
+    return static_cast<Py_hash_t>(x);
+}
+
+// The constants of the xxHash variant that CPython uses to hash tuples
+#if SIZEOF_PY_UHASH_T > 4
+static const Py_uhash_t xxPrime1 = 11400714785074694791ULL;
+static const Py_uhash_t xxPrime2 = 14029467366897019727ULL;
+static const Py_uhash_t xxPrime5 = 2870177450012600261ULL;
+static inline Py_uhash_t xxRotate(const Py_uhash_t x) { return (x << 31) | (x >> 33); }
+#else
+static const Py_uhash_t xxPrime1 = 2654435761UL;
+static const Py_uhash_t xxPrime2 = 2246822519UL;
+static const Py_uhash_t xxPrime5 = 374761393UL;
+static inline Py_uhash_t xxRotate(const Py_uhash_t x) { return (x << 13) | (x >> 19); }
+#endif
+
+// One hash() of a value, with everything it needs along the way. This runs without the GIL, and
+// only takes it to hash values that have to be decoded.
+class EncodedHash {
+    OOCMapObject* const m_ooc;
+    MDB_txn* const m_txn;
+
+    Py_hash_t decodedHash(const EncodedValue& value) {
+        GilLocker gil;
+        PyObject* const decoded = decode(m_ooc, m_txn, value);
+        const Py_hash_t result = PyObject_Hash(decoded);
+        Py_DECREF(decoded);
+        if(result == -1) throw OocError(OocError::AlreadyPythonizedError);
+        return result;
+    }
+
+    // Reads the value of a long int or a long string
+    MDB_val immutable(const MDB_dbi dbi, const EncodedValue& value) {
+        uint64_t key = value.asUInt;
+        MDB_val mdbKey = { .mv_size = sizeof(key), .mv_data = &key };
+        MDB_val mdbValue;
+        if(!get(m_txn, dbi, &mdbKey, &mdbValue)) throw OocError(OocError::UnexpectedData);
+        return mdbValue;
+    }
+
+    // This is the same as tuplehash() in CPython's Objects/tupleobject.c.
+    Py_hash_t tupleHash(const EncodedValue* const items, const size_t length) {
+        Py_uhash_t acc = xxPrime5;
+        for(size_t i = 0; i < length; ++i) {
+            EncodedValue item;
+            memcpy(&item, items + i, sizeof(item));
+            const Py_uhash_t lane = hash(item);
+            acc += lane * xxPrime2;
+            acc = xxRotate(acc);
+            acc *= xxPrime1;
+        }
+        acc += length ^ (xxPrime5 ^ 3527539UL);
+        if(acc == static_cast<Py_uhash_t>(-1)) return 1546275796;
+        return static_cast<Py_hash_t>(acc);
+    }
+
+public:
+    EncodedHash(OOCMapObject* const ooc, MDB_txn* const txn) : m_ooc(ooc), m_txn(txn) { }
+
+    Py_hash_t hash(const EncodedValue& value) {
+        switch(value.typeCode) {
+        case TYPE_CODE_HARDCODED:
+            switch(value.asInt) {
+            case 1:     // 0
+            case 4:     // False
+            case 6:     // ""
+                return 0;
+            case 3:     // True
+                return 1;
+            case 5:     // ()
+                return tupleHash(nullptr, 0);
+            default:
+                return decodedHash(value);
+            }
+        case TYPE_CODE_SHORT_POSITIVE_INT:
+        case TYPE_CODE_SHORT_NEGATIVE_INT:
+            return hashDigits(
+                value.asChars,
+                (value.lengthMinusOne + 1) / sizeof(digit),
+                value.typeCode == TYPE_CODE_SHORT_NEGATIVE_INT);
+        case TYPE_CODE_LONG_POSITIVE_INT:
+        case TYPE_CODE_LONG_NEGATIVE_INT: {
+            const MDB_val digits = immutable(m_ooc->intsDb, value);
+            if(digits.mv_size % sizeof(digit) != 0) throw OocError(OocError::UnexpectedData);
+            return hashDigits(
+                digits.mv_data,
+                digits.mv_size / sizeof(digit),
+                value.typeCode == TYPE_CODE_LONG_NEGATIVE_INT);
+        }
+        case TYPE_CODE_FLOAT:
+            // NaN hashes by identity, so only a decoded object has a hash.
+            if(std::isnan(value.asFloat)) return decodedHash(value);
+            return _Py_HashDouble(nullptr, value.asFloat);
+        // Python hashes the bytes of a string in its canonical representation, which is the one we
+        // store.
+        case TYPE_CODE_UNICODE_SHORT_1BYTE:
+        case TYPE_CODE_UNICODE_SHORT_2BYTE:
+        case TYPE_CODE_UNICODE_SHORT_4BYTE:
+            return _Py_HashBytes(value.asChars, value.lengthMinusOne + 1);
+        case TYPE_CODE_UNICODE_LONG_1BYTE:
+        case TYPE_CODE_UNICODE_LONG_2BYTE:
+        case TYPE_CODE_UNICODE_LONG_4BYTE: {
+            const MDB_val data = immutable(m_ooc->stringsDb, value);
+            return _Py_HashBytes(data.mv_data, data.mv_size);
+        }
+        case TYPE_CODE_TUPLE: {
+            const MDB_val items = immutable(m_ooc->tuplesDb, value);
+            if(items.mv_size % sizeof(EncodedValue) != 0) throw OocError(OocError::UnexpectedData);
+            return tupleHash(static_cast<const EncodedValue*>(items.mv_data), items.mv_size / sizeof(EncodedValue));
+        }
+        default:
+            return decodedHash(value);
+        }
+    }
+};
+
+Py_hash_t OOCMap_encodedHash(OOCMapObject* const ooc, MDB_txn* const txn, const EncodedValue& value) {
+    EncodedHash hash(ooc, txn);
+    GilUnlocker gil;
+    return hash.hash(value);
+}
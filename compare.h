@@ -0,0 +1,52 @@
+#ifndef OOCMAP_COMPARE_H
+#define OOCMAP_COMPARE_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "oocmap.h"
+#include "lmdb.h"
+
+//
+// Comparing and hashing values by their encodings
+//
+// Two values from the same map can often be compared without decoding them. Identical encodings
+// are the same stored value. Strings, long ints and tuples are stored once for each content, so two
+// different encodings of them mean two different values. Numbers that fit into their EncodedValue
+// compare directly, and lists, tuples and dicts compare item by item. Only what the encodings can't
+// decide is decoded and handed to Python.
+//
+
+// A number that is stored inside its EncodedValue
+struct InlineNumber {
+    bool isFloat;
+    int64_t asInt;
+    double asFloat;
+};
+
+// Reads the number in an EncodedValue, if it holds one we can compare without the DB: bools, ints
+// that fit into the EncodedValue, and floats other than NaN.
+bool OOCMap_inlineNumber(const EncodedValue& value, InlineNumber* dest);
+
+// Whether a < b. Like Python, this is exact even for ints that don't fit into a double.
+bool OOCMap_inlineNumberLess(const InlineNumber& a, const InlineNumber& b);
+
+// Whether a == b, for two values from the same map. A stored list, tuple or dict is equal to
+// itself even if it holds NaN, the same way Python's containers consider an object equal to itself.
+bool OOCMap_encodedEqual(OOCMapObject* ooc, MDB_txn* txn, const EncodedValue& a, const EncodedValue& b);
+
+// Compares two values from the same map like PyObject_RichCompare(). Lists and tuples are compared
+// the way Python does, so at most the first pair of items that differ is decoded.
+PyObject* OOCMap_encodedRichcompare(
+    OOCMapObject* ooc,
+    MDB_txn* txn,
+    const EncodedValue& a,
+    const EncodedValue& b,
+    int op);
+
+// Computes hash() of a value from the same map, the same as Python computes it for the decoded value.
+// Ints, floats, strings and tuples are hashed straight from their encodings. Raises TypeError for
+// values that aren't hashable.
+Py_hash_t OOCMap_encodedHash(OOCMapObject* ooc, MDB_txn* txn, const EncodedValue& value);
+
+#endif //OOCMAP_COMPARE_H
@@ -0,0 +1,212 @@
+#include "contenthash.h"
+
+#include <cmath>
+#include <cstring>
+
+#include "db.h"
+#include "errors.h"
+#include "spooky.h"
+
+//
+// Hashing items
+//
+
+#pragma pack(push, 1)
+
+struct ListItem {
+    uint32_t index;
+    EncodedValue item;
+};
+
+struct DictItem {
+    EncodedValue key;
+    EncodedValue value;
+};
+
+#pragma pack(pop)
+
+// Seeds, so a list item and a dict item don't hash the same by accident
+static const uint64_t listItemSeed = 0x6c697374;
+static const uint64_t dictItemSeed = 0x64696374;
+
+static bool isNan(const EncodedValue& value) {
+    return value.typeCode == TYPE_CODE_FLOAT && std::isnan(value.asFloat);
+}
+
+static uint64_t listItemHash(const uint32_t index, const EncodedValue& item) {
+    const ListItem listItem = { .index = index, .item = item };
+    return SpookyHash::hash64(&listItem, sizeof(listItem), listItemSeed);
+}
+
+static uint64_t dictItemHash(const EncodedValue& key, const EncodedValue& value) {
+    const DictItem dictItem = { .key = key, .value = value };
+    return SpookyHash::hash64(&dictItem, sizeof(dictItem), dictItemSeed);
+}
+
+void ContentHash::addListItem(const uint32_t index, const EncodedValue& item) {
+    sum += listItemHash(index, item);
+    nanCount += isNan(item);
+}
+
+void ContentHash::removeListItem(const uint32_t index, const EncodedValue& item) {
+    sum -= listItemHash(index, item);
+    nanCount -= isNan(item);
+}
+
+void ContentHash::addDictItem(const EncodedValue& key, const EncodedValue& value) {
+    sum += dictItemHash(key, value);
+    nanCount += isNan(key) + isNan(value);
+}
+
+void ContentHash::removeDictItem(const EncodedValue& key, const EncodedValue& value) {
+    sum -= dictItemHash(key, value);
+    nanCount -= isNan(key) + isNan(value);
+}
+
+//
+// Headers
+//
+
+Py_ssize_t OOCMap_getListHeader(
+    OOCMapObject* const ooc,
+    MDB_txn* const txn,
+    const uint32_t listId,
+    ContentHash* const hash
+) {
+    ListKey listKey = { .listIndex = ListKey::listIndexLength, .listId = listId };
+    MDB_val mdbKey = { .mv_size = sizeof(listKey), .mv_data = &listKey };
+    MDB_val mdbValue;
+    if(!get(txn, ooc->listsDb, &mdbKey, &mdbValue)) throw OocError(OocError::UnexpectedData);
+    if(mdbValue.mv_size == sizeof(uint32_t)) {
+        if(hash != nullptr) *hash = ContentHash { .sum = 0, .nanCount = 0 };
+        return *static_cast<const uint32_t*>(mdbValue.mv_data);
+    }
+    // Lists that lend their items to copies have more after the header, see loans.h.
+    if(mdbValue.mv_size < sizeof(ListHeader)) throw OocError(OocError::UnexpectedData);
+    ListHeader header;
+    memcpy(&header, mdbValue.mv_data, sizeof(header));
+    if(hash != nullptr) *hash = header.hash;
+    return header.length;
+}
+
+void OOCMap_putListHeader(
+    OOCMapObject* const ooc,
+    MDB_txn* const txn,
+    const uint32_t listId,
+    const Py_ssize_t length,
+    const ContentHash& hash,
+    const unsigned int flags
+) {
+    ListKey listKey = { .listIndex = ListKey::listIndexLength, .listId = listId };
+    MDB_val mdbKey = { .mv_size = sizeof(listKey), .mv_data = &listKey };
+    ListHeader header = { .length = static_cast<uint32_t>(length), .reserved = 0, .hash = hash };
+    MDB_val mdbValue = {
+        .mv_size = ooc->contentHashes ? sizeof(header) : sizeof(header.length),
+        .mv_data = &header
+    };
+    put(txn, ooc->listsDb, &mdbKey, &mdbValue, flags);
+}
+
+Py_ssize_t OOCMap_getDictHeader(
+    OOCMapObject* const ooc,
+    MDB_txn* const txn,
+    uint32_t dictId,
+    ContentHash* const hash
+) {
+    MDB_val mdbKey = { .mv_size = sizeof(dictId), .mv_data = &dictId };
+    MDB_val mdbValue;
+    if(!get(txn, ooc->dictsDb, &mdbKey, &mdbValue)) throw OocError(OocError::UnexpectedData);
+    DictHeader header = { .length = 0, .hash = { .sum = 0, .nanCount = 0 } };
+    if(mdbValue.mv_size == sizeof(header.length)) {
+        memcpy(&header.length, mdbValue.mv_data, sizeof(header.length));
+    } else if(mdbValue.mv_size >= sizeof(header)) {
+        // Dicts that lend their items to copies have more after the header, see loans.h.
+        memcpy(&header, mdbValue.mv_data, sizeof(header));
+    } else {
+        throw OocError(OocError::UnexpectedData);
+    }
+    if(hash != nullptr) *hash = header.hash;
+    return header.length;
+}
+
+void OOCMap_putDictHeader(
+    OOCMapObject* const ooc,
+    MDB_txn* const txn,
+    uint32_t dictId,
+    const Py_ssize_t length,
+    const ContentHash& hash,
+    const unsigned int flags
+) {
+    MDB_val mdbKey = { .mv_size = sizeof(dictId), .mv_data = &dictId };
+    DictHeader header = { .length = length, .hash = hash };
+    MDB_val mdbValue = {
+        .mv_size = ooc->contentHashes ? sizeof(header) : sizeof(header.length),
+        .mv_data = &header
+    };
+    put(txn, ooc->dictsDb, &mdbKey, &mdbValue, flags);
+}
+
+//
+// Computing content hashes from scratch
+//
+
+ContentHash OOCMap_listContentHash(OOCMapObject* const ooc, MDB_txn* const txn, const uint32_t listId) {
+    ContentHash hash;
+    const Py_ssize_t length = OOCMap_getListHeader(ooc, txn, listId, &hash);
+    if(ooc->contentHashes) return hash;
+
+    hash = ContentHash { .sum = 0, .nanCount = 0 };
+    ListKey listKey = { .listIndex = 0, .listId = listId };
+    MDB_val mdbKey = { .mv_size = sizeof(listKey), .mv_data = &listKey };
+    MDB_val mdbValue;
+    MDB_cursor* const cursor = cursor_open(txn, ooc->listsDb);
+    try {
+        GilUnlocker gil;
+        bool found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET_RANGE);
+        for(Py_ssize_t i = 0; i < length; ++i) {
+            if(i > 0) found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT);
+            if(!found || mdbKey.mv_size != sizeof(ListKey)) throw OocError(OocError::UnexpectedData);
+            const ListKey* const itemKey = static_cast<const ListKey*>(mdbKey.mv_data);
+            if(itemKey->listId != listId || itemKey->listIndex != i) throw OocError(OocError::UnexpectedData);
+            if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+            EncodedValue item;
+            memcpy(&item, mdbValue.mv_data, sizeof(item));
+            hash.addListItem(itemKey->listIndex, item);
+        }
+    } catch(...) {
+        cursor_close(cursor);
+        throw;
+    }
+    cursor_close(cursor);
+    return hash;
+}
+
+ContentHash OOCMap_dictContentHash(OOCMapObject* const ooc, MDB_txn* const txn, uint32_t dictId) {
+    ContentHash hash;
+    OOCMap_getDictHeader(ooc, txn, dictId, &hash);
+    if(ooc->contentHashes) return hash;
+
+    hash = ContentHash { .sum = 0, .nanCount = 0 };
+    MDB_val mdbKey = { .mv_size = sizeof(dictId), .mv_data = &dictId };
+    MDB_val mdbValue;
+    MDB_cursor* const cursor = cursor_open(txn, ooc->dictsDb);
+    try {
+        GilUnlocker gil;
+        if(!cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET)) throw OocError(OocError::UnexpectedData);
+        while(cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT)) {
+            // The next dict's header ends our items.
+            if(mdbKey.mv_size != sizeof(DictItemKey)) break;
+            const DictItemKey* const itemKey = static_cast<const DictItemKey*>(mdbKey.mv_data);
+            if(itemKey->dictId != dictId) break;
+            if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+            EncodedValue value;
+            memcpy(&value, mdbValue.mv_data, sizeof(value));
+            hash.addDictItem(itemKey->key, value);
+        }
+    } catch(...) {
+        cursor_close(cursor);
+        throw;
+    }
+    cursor_close(cursor);
+    return hash;
+}
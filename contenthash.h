@@ -0,0 +1,81 @@
+#ifndef OOCMAP_CONTENTHASH_H
+#define OOCMAP_CONTENTHASH_H
+
+#include <cstdint>
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "oocmap.h"
+#include "lmdb.h"
+
+//
+// Content hashes of lists and dicts
+//
+// In maps created with content_hashes=True, a list's length record and a dict's header also hold a
+// hash of the container's items, which every change to the container keeps up to date. The hash
+// covers the encodings of the items. Strings, long ints and tuples are encoded by their content, so
+// it covers their content too, and two maps agree on it. Lists and dicts inside the container only
+// count by identity, because they can change without the containers that hold them knowing.
+//
+
+#pragma pack(push, 1)
+
+struct ContentHash {
+    uint64_t sum;       // of the hashes of the items
+    uint64_t nanCount;  // NaN floats among the items. They are not equal to anything, not even themselves.
+
+    void addListItem(uint32_t index, const EncodedValue& item);
+    void removeListItem(uint32_t index, const EncodedValue& item);
+    void addDictItem(const EncodedValue& key, const EncodedValue& value);
+    void removeDictItem(const EncodedValue& key, const EncodedValue& value);
+
+    // Whether two containers of the same length with these hashes hold equal items
+    bool provesEqual(const ContentHash& other) const {
+        return sum == other.sum && nanCount == 0 && other.nanCount == 0;
+    }
+};
+
+// The value of a list's length record in maps with content hashes, and in lists that lend their
+// items to copies, see loans.h. Otherwise, it's only the length.
+struct ListHeader {
+    uint32_t length;
+    uint32_t reserved;
+    ContentHash hash;
+};
+
+// The value of a dict's header in the same cases. Otherwise, it's only the length.
+struct DictHeader {
+    Py_ssize_t length;
+    ContentHash hash;
+};
+
+#pragma pack(pop)
+
+// Reads the length record of a list. If hash isn't null, this also reads the content hash, which is
+// empty in maps without content hashes.
+Py_ssize_t OOCMap_getListHeader(OOCMapObject* ooc, MDB_txn* txn, uint32_t listId, ContentHash* hash = nullptr);
+void OOCMap_putListHeader(
+    OOCMapObject* ooc,
+    MDB_txn* txn,
+    uint32_t listId,
+    Py_ssize_t length,
+    const ContentHash& hash,
+    unsigned int flags = 0);
+
+// Same as above, for the header of a dict
+Py_ssize_t OOCMap_getDictHeader(OOCMapObject* ooc, MDB_txn* txn, uint32_t dictId, ContentHash* hash = nullptr);
+void OOCMap_putDictHeader(
+    OOCMapObject* ooc,
+    MDB_txn* txn,
+    uint32_t dictId,
+    Py_ssize_t length,
+    const ContentHash& hash,
+    unsigned int flags = 0);
+
+// Returns the content hash of a list or dict. In maps without content hashes, this reads all items
+// to compute it.
+ContentHash OOCMap_listContentHash(OOCMapObject* ooc, MDB_txn* txn, uint32_t listId);
+ContentHash OOCMap_dictContentHash(OOCMapObject* ooc, MDB_txn* txn, uint32_t dictId);
+
+#endif //OOCMAP_CONTENTHASH_H
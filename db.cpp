@@ -3,36 +3,109 @@
 #include "spooky.h"
 #include "errors.h"
 
-class GilUnlocker {
-    PyThreadState* const m_threadState;
-
-public:
-    GilUnlocker() : m_threadState(PyGILState_Check() ? PyEval_SaveThread() : nullptr) { }
-    ~GilUnlocker() {
-        if(m_threadState != nullptr)
-            PyEval_RestoreThread(m_threadState);
+void EnvContext::enter() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    const auto found = m_threads.find(std::this_thread::get_id());
+    if(found != m_threads.end()) {
+        found->second += 1;
+        return;
     }
-};
+    m_changed.wait(lock, [this] { return !m_remapping; });
+    m_threads[std::this_thread::get_id()] = 1;
+}
+
+void EnvContext::leave() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto found = m_threads.find(std::this_thread::get_id());
+    if(found == m_threads.end()) return;
+    if(--found->second == 0) {
+        m_threads.erase(found);
+        m_changed.notify_all();
+    }
+}
+
+void EnvContext::keep(MDB_txn* const txn) {
+    leave();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_kept.insert(txn);
+}
+
+void EnvContext::end(MDB_txn* const txn) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_kept.erase(txn) > 0) return;
+    }
+    leave();
+}
+
+bool EnvContext::reading() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_threads.count(std::this_thread::get_id()) > 0;
+}
+
+bool EnvContext::remap(const std::function<bool()>& remap) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if(!m_kept.empty() || m_threads.count(std::this_thread::get_id()) > 0) return false;
+    if(m_remapping) {
+        m_changed.wait(lock, [this] { return !m_remapping; });
+        return true;
+    }
+
+    m_remapping = true;
+    m_changed.wait(lock, [this] { return m_threads.empty() || !m_kept.empty(); });
+    bool result = false;
+    try {
+        if(m_kept.empty())
+            result = remap();
+    } catch(...) {
+        m_remapping = false;
+        m_changed.notify_all();
+        throw;
+    }
+    m_remapping = false;
+    m_changed.notify_all();
+    return result;
+}
+
+static EnvContext* envContext(MDB_env* const mdb) {
+    return static_cast<EnvContext*>(mdb_env_get_userctx(mdb));
+}
 
 MDB_txn* txn_begin(MDB_env* const mdb, const bool write) {
     GilUnlocker gil;
 
+    EnvContext* const context = envContext(mdb);
     const unsigned int flags = write ? 0 : MDB_RDONLY;
     MDB_txn* txn = nullptr;
     int mapsizePatience = 10;
     while(true) {
+        if(context != nullptr)
+            context->enter();
         int error = mdb_txn_begin(mdb, nullptr, flags, &txn);
-        switch(error) {
-        case 0:
+        if(error == 0)
             return txn;
+        if(context != nullptr)
+            context->leave();
+        switch(error) {
         case MDB_MAP_RESIZED:
             if (mapsizePatience > 0) {
                 mapsizePatience -= 1;
-                error = mdb_env_set_mapsize(mdb, 0);
+                if(context == nullptr) {
+                    error = mdb_env_set_mapsize(mdb, 0);
+                } else {
+                    // Other threads may still be reading the old mapping.
+                    error = 0;
+                    const bool remapped = context->remap([&] {
+                        error = mdb_env_set_mapsize(mdb, 0);
+                        if(error == 0 && context->remapped != nullptr)
+                            context->remapped(mdb, context->arg);
+                        return true;
+                    });
+                    if(!remapped)
+                        error = MDB_MAP_RESIZED;
+                }
                 if(error != 0)
                     throw MdbError(error);
-                MDB_envinfo info;
-                mdb_env_info(mdb, &info);
                 continue;
             } else {
                 throw MdbError(error);
@@ -43,21 +116,50 @@ MDB_txn* txn_begin(MDB_env* const mdb, const bool write) {
     }
 }
 
-void txn_commit(MDB_txn* const txn) {
+void txn_commit(MDB_txn*& txn) {
     GilUnlocker gil;
+    EnvContext* const context = envContext(mdb_txn_env(txn));
     const int error = mdb_txn_commit(txn);
+    if(context != nullptr)
+        context->end(txn);
+    txn = nullptr;
     if(error != 0)
         throw MdbError(error);
 }
 
 void txn_abort(MDB_txn* const txn) {
     GilUnlocker gil;
+    EnvContext* const context = envContext(mdb_txn_env(txn));
     mdb_txn_abort(txn); // This doesn't return any errors.
+    if(context != nullptr)
+        context->end(txn);
+}
+
+void txn_keep(MDB_txn* const txn) {
+    EnvContext* const context = envContext(mdb_txn_env(txn));
+    if(context != nullptr)
+        context->keep(txn);
 }
 
 void open_db(MDB_txn* const txn, const char* const name, unsigned int flags, MDB_dbi* const dbi) {
     GilUnlocker gil;
-    const int error = mdb_dbi_open(txn, name, flags | MDB_CREATE, dbi);
+    const int error = mdb_dbi_open(txn, name, flags, dbi);
+    if(error != 0)
+        throw MdbError(error);
+}
+
+void env_copy(MDB_env* const mdb, const char* const path, const unsigned int flags) {
+    GilUnlocker gil;
+    EnvReader reader(mdb);
+    const int error = mdb_env_copy2(mdb, path, flags);
+    if(error != 0)
+        throw MdbError(error);
+}
+
+void env_sync(MDB_env* const mdb) {
+    GilUnlocker gil;
+    EnvReader reader(mdb);
+    const int error = mdb_env_sync(mdb, 1);
     if(error != 0)
         throw MdbError(error);
 }
@@ -107,7 +209,9 @@ uint64_t putImmutable(
         typeCode);
     MDB_val mdbKey = { .mv_size = sizeof(key), .mv_data = &key };
 
-    if(readonly) {
+    if(txn == nullptr) {
+        // Nothing to do
+    } else if(readonly) {
         // In a readonly transaction, we turn the put() into a get() to check whether
         // the value is there.
         const int error = mdb_get(txn, dbi, &mdbKey, mdbVal);
@@ -183,3 +287,45 @@ void cursor_del(MDB_cursor* const cursor, const unsigned int flags) {
     if(error != MDB_SUCCESS)
         throw MdbError(error);
 }
+
+size_t cursor_get_batch(
+    MDB_cursor* const cursor,
+    MDB_val* const keys,
+    MDB_val* const values,
+    const size_t count,
+    const MDB_cursor_op op
+) {
+    GilUnlocker gil;
+    for(size_t i = 0; i < count; ++i) {
+        const int error = mdb_cursor_get(cursor, &keys[i], &values[i], i == 0 ? op : MDB_NEXT);
+        switch(error) {
+        case MDB_SUCCESS:
+            break;
+        case MDB_NOTFOUND:
+            return i;
+        default:
+            throw MdbError(error);
+        }
+    }
+    return count;
+}
+
+bool cursor_del_batch(MDB_cursor* const cursor, const size_t count, MDB_val* const key, MDB_val* const value) {
+    GilUnlocker gil;
+    for(size_t i = 0; i < count; ++i) {
+        int error = mdb_cursor_del(cursor, 0);
+        if(error != MDB_SUCCESS)
+            throw MdbError(error);
+        // After a delete, MDB_NEXT finds the record that followed the deleted one.
+        error = mdb_cursor_get(cursor, key, value, MDB_NEXT);
+        switch(error) {
+        case MDB_SUCCESS:
+            break;
+        case MDB_NOTFOUND:
+            return false;
+        default:
+            throw MdbError(error);
+        }
+    }
+    return true;
+}
@@ -1,14 +1,103 @@
 #ifndef OOCMAP_DB_H
 #define OOCMAP_DB_H
 
+#include <cstddef>
 #include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
 #include "lmdb.h"
+#include "errors.h"
+
+// Releases the GIL for as long as it lives, if we hold it.
+class GilUnlocker {
+    PyThreadState* const m_threadState;
+
+public:
+    GilUnlocker() : m_threadState(PyGILState_Check() ? PyEval_SaveThread() : nullptr) { }
+    ~GilUnlocker() {
+        if(m_threadState != nullptr)
+            PyEval_RestoreThread(m_threadState);
+    }
+};
+
+// Takes the GIL for as long as it lives, for example to call into Python inside a GilUnlocker.
+class GilLocker {
+    const PyGILState_STATE m_state;
+
+public:
+    GilLocker() : m_state(PyGILState_Ensure()) { }
+    ~GilLocker() {
+        PyGILState_Release(m_state);
+    }
+};
+
+// Transactions point into the map, so the map must not be mapped again while any are alive, in any
+// thread. Environments that get mapped again while in use set one of these as their user context with
+// mdb_env_set_userctx(), and then txn_begin(), txn_commit() and txn_abort() keep track of their
+// transactions in it.
+class EnvContext {
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::unordered_map<std::thread::id, unsigned int> m_threads;   // open transactions, except kept ones
+    std::unordered_set<MDB_txn*> m_kept;
+    bool m_remapping = false;
+
+public:
+    // Runs without the GIL after txn_begin() mapped the file again because another process grew it.
+    void (*remapped)(MDB_env* mdb, void* arg) = nullptr;
+    void* arg = nullptr;
+
+    // Counts the calling thread as reading the map until it calls leave(). While the map is being
+    // mapped again, this waits, unless the thread is reading it already.
+    void enter();
+    void leave();
+    // Iterators keep their transaction open between calls, so nobody could wait for it to end. This
+    // stops counting txn as the calling thread's, and refuses to map the file again until it ends.
+    void keep(MDB_txn* txn);
+    void end(MDB_txn* txn);
+    // Whether the calling thread has a transaction open, not counting kept ones
+    bool reading();
+
+    // Waits until no other thread reads the map, and then runs remap(), holding off new readers while
+    // it runs. Returns what remap() returns. Returns false right away if the calling thread is reading
+    // the map itself, or if kept transactions are alive. If another thread was already mapping the
+    // file again, this waits for that instead, and returns true so the caller can try again.
+    bool remap(const std::function<bool()>& remap);
+};
+
+// Reads the map outside of a transaction for as long as it lives, for example to flush it to disk.
+class EnvReader {
+    EnvContext* const m_context;
+
+public:
+    explicit EnvReader(MDB_env* const mdb) : m_context(static_cast<EnvContext*>(mdb_env_get_userctx(mdb))) {
+        if(m_context != nullptr)
+            m_context->enter();
+    }
+    ~EnvReader() {
+        if(m_context != nullptr)
+            m_context->leave();
+    }
+};
 
 MDB_txn* txn_begin(MDB_env* mdb, bool write = false);
-void txn_commit(MDB_txn* txn);
+// LMDB frees the transaction even when the commit fails, so this clears txn either way.
+void txn_commit(MDB_txn*& txn);
 void txn_abort(MDB_txn* txn);
+// Marks a read transaction that stays open between calls, see EnvContext::keep().
+void txn_keep(MDB_txn* txn);
 void open_db(MDB_txn* txn, const char* name, unsigned int flags, MDB_dbi* dbi);
 
+void env_copy(MDB_env* mdb, const char* path, unsigned int flags = 0);
+void env_sync(MDB_env* mdb);
+
 void put(
     MDB_txn* txn,
     MDB_dbi dbi,
@@ -24,6 +113,7 @@ bool get(
     MDB_val* value
 );
 
+// Returns the key the value is stored under. Without a transaction, this only computes the key.
 uint64_t putImmutable(
     MDB_txn* txn,
     MDB_dbi dbi,
@@ -40,4 +130,32 @@ bool cursor_get(MDB_cursor* cursor, MDB_val* key, MDB_val* data, MDB_cursor_op o
 void cursor_put(MDB_cursor* cursor, MDB_val* key, MDB_val* data, unsigned int flags = 0);
 void cursor_del(MDB_cursor* cursor, unsigned int flags = 0);
 
+// Scans read this many records with each release of the GIL.
+const size_t cursorBatchSize = 64;
+
+// Reads up to count records with one release of the GIL. The first is the one op finds, with
+// keys[0] as its key if op needs one, and the others follow it. Returns how many it read, which is
+// fewer than count only at the end of the database. The records stay valid until the transaction
+// writes.
+size_t cursor_get_batch(MDB_cursor* cursor, MDB_val* keys, MDB_val* values, size_t count, MDB_cursor_op op);
+// Deletes the record at the cursor and the count - 1 after it with one release of the GIL. key and
+// value get the record after them. Returns false if there is none.
+bool cursor_del_batch(MDB_cursor* cursor, size_t count, MDB_val* key, MDB_val* value);
+
+// Walks up to count records like cursor_get_batch(), but hands each one to visit(key, value)
+// instead of keeping it. Returning false from visit stops the walk. Returns how many records it
+// visited. visit runs without the GIL, so it must not touch Python objects.
+template<typename Visit>
+size_t cursor_scan(MDB_cursor* const cursor, MDB_val* const key, const size_t count, const MDB_cursor_op op, Visit&& visit) {
+    GilUnlocker gil;
+    MDB_val value;
+    for(size_t i = 0; i < count; ++i) {
+        const int error = mdb_cursor_get(cursor, key, &value, i == 0 ? op : MDB_NEXT);
+        if(error == MDB_NOTFOUND) return i;
+        if(error != MDB_SUCCESS) throw MdbError(error);
+        if(!visit(*key, value)) return i + 1;
+    }
+    return count;
+}
+
 #endif //OOCMAP_DB_H
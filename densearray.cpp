@@ -0,0 +1,211 @@
+#include "densearray.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "errors.h"
+
+static const uint64_t denseMagic = 0x31534e4544434f4full;    // "OOCDENS1"
+static const uint64_t slotsPerBlock = 64;
+static const uint64_t initialCapacity = 16 * slotsPerBlock;
+
+#pragma pack(push, 1)
+
+struct DenseHeader {
+    uint64_t magic;
+    uint64_t capacity;  // in slots, always a multiple of slotsPerBlock
+    uint64_t count;
+    uint64_t reserved;
+};
+
+struct DenseBlock {
+    uint64_t present;
+    EncodedValue slots[slotsPerBlock];
+};
+
+#pragma pack(pop)
+
+static size_t sizeForCapacity(const uint64_t capacity) {
+    return sizeof(DenseHeader) + (capacity / slotsPerBlock) * sizeof(DenseBlock);
+}
+
+DenseArray::DenseArray(const char* const filename, const bool readonly) :
+    m_fd(-1),
+    m_readonly(readonly),
+    m_map(nullptr),
+    m_mapSize(0),
+    m_capacity(0)
+{
+    m_fd = open(filename, readonly ? O_RDONLY : O_RDWR | O_CREAT, 0644);
+    if(m_fd < 0) throw MdbError(errno);
+
+    try {
+        struct stat st;
+        if(fstat(m_fd, &st) != 0) throw MdbError(errno);
+        if(st.st_size == 0 && !readonly) {
+            if(ftruncate(m_fd, sizeForCapacity(initialCapacity)) != 0) throw MdbError(errno);
+            map(initialCapacity);
+            header()->magic = denseMagic;
+            header()->capacity = initialCapacity;
+            header()->count = 0;
+            header()->reserved = 0;
+            return;
+        }
+        if(st.st_size < static_cast<off_t>(sizeof(DenseHeader))) throw OocError(OocError::UnexpectedData);
+
+        DenseHeader fileHeader;
+        if(pread(m_fd, &fileHeader, sizeof(fileHeader), 0) != sizeof(fileHeader)) throw MdbError(errno);
+        if(
+            fileHeader.magic != denseMagic ||
+            fileHeader.capacity % slotsPerBlock != 0 ||
+            st.st_size < static_cast<off_t>(sizeForCapacity(fileHeader.capacity))
+        ) throw OocError(OocError::UnexpectedData);
+        map(fileHeader.capacity);
+    } catch(...) {
+        if(m_map != nullptr)
+            munmap(m_map, m_mapSize);
+        close(m_fd);
+        throw;
+    }
+}
+
+DenseArray::~DenseArray() {
+    if(m_map != nullptr)
+        munmap(m_map, m_mapSize);
+    close(m_fd);
+}
+
+void DenseArray::map(const uint64_t capacity) {
+    const size_t size = sizeForCapacity(capacity);
+    void* const newMap = mmap(
+        nullptr,
+        size,
+        m_readonly ? PROT_READ : PROT_READ | PROT_WRITE,
+        MAP_SHARED,
+        m_fd,
+        0);
+    if(newMap == MAP_FAILED) throw MdbError(errno);
+    if(m_map != nullptr)
+        munmap(m_map, m_mapSize);
+    m_map = static_cast<uint8_t*>(newMap);
+    m_mapSize = size;
+    m_capacity = capacity;
+}
+
+bool DenseArray::refresh(const uint64_t key) {
+    const uint64_t fileCapacity = header()->capacity;
+    if(fileCapacity > m_capacity)
+        map(fileCapacity);
+    return key < m_capacity;
+}
+
+DenseHeader* DenseArray::header() const {
+    return reinterpret_cast<DenseHeader*>(m_map);
+}
+
+DenseBlock* DenseArray::block(const uint64_t key) const {
+    return reinterpret_cast<DenseBlock*>(m_map + sizeof(DenseHeader)) + key / slotsPerBlock;
+}
+
+bool DenseArray::get(const uint64_t key, EncodedValue* const dest) {
+    if(key >= m_capacity && !refresh(key)) return false;
+    const DenseBlock* const b = block(key);
+    const uint64_t bit = 1ull << (key % slotsPerBlock);
+    if(!(b->present & bit)) return false;
+    *dest = b->slots[key % slotsPerBlock];
+    return true;
+}
+
+void DenseArray::reserve(const uint64_t key) {
+    if(key < m_capacity || refresh(key)) return;
+    uint64_t capacity = m_capacity * 2;
+    while(capacity <= key) capacity *= 2;
+    if(ftruncate(m_fd, sizeForCapacity(capacity)) != 0) throw MdbError(errno);
+    map(capacity);
+    header()->capacity = capacity;
+}
+
+void DenseArray::set(const uint64_t key, const EncodedValue& value) {
+    reserve(key);
+    DenseBlock* const b = block(key);
+    const uint64_t bit = 1ull << (key % slotsPerBlock);
+    b->slots[key % slotsPerBlock] = value;
+    // Writers of other keys in this block may be doing the same from another process.
+    if(!(__atomic_fetch_or(&b->present, bit, __ATOMIC_RELEASE) & bit))
+        __atomic_fetch_add(&header()->count, 1, __ATOMIC_RELAXED);
+}
+
+bool DenseArray::remove(const uint64_t key) {
+    if(key >= m_capacity && !refresh(key)) return false;
+    DenseBlock* const b = block(key);
+    const uint64_t bit = 1ull << (key % slotsPerBlock);
+    if(!(__atomic_fetch_and(&b->present, ~bit, __ATOMIC_RELEASE) & bit)) return false;
+    __atomic_fetch_sub(&header()->count, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+uint64_t DenseArray::count() const {
+    return header()->count;
+}
+
+bool DenseArray::next(uint64_t* const key) {
+    refresh(*key);
+    uint64_t k = *key;
+    while(k < m_capacity) {
+        // Skip straight to the next bit that is set in this block.
+        const uint64_t present = block(k)->present >> (k % slotsPerBlock);
+        if(present != 0) {
+            *key = k + __builtin_ctzll(present);
+            return true;
+        }
+        k = (k / slotsPerBlock + 1) * slotsPerBlock;
+    }
+    return false;
+}
+
+std::vector<uint64_t> DenseArray::split(const unsigned int parts) {
+    refresh(0);
+    std::vector<uint64_t> result;
+    const uint64_t total = count();
+    if(parts < 2 || total == 0) return result;
+
+    // Splitting between blocks is good enough, and only needs the bitmaps.
+    uint64_t seen = 0;
+    for(uint64_t k = 0; k < m_capacity && result.size() < parts - 1; k += slotsPerBlock) {
+        if(seen > 0 && seen >= total * (result.size() + 1) / parts)
+            result.push_back(k);
+        seen += __builtin_popcountll(block(k)->present);
+    }
+    return result;
+}
+
+void DenseArray::sync() {
+    if(m_readonly) return;
+    if(fdatasync(m_fd) != 0) throw MdbError(errno);
+}
+
+void DenseArray::copyTo(const char* const filename) {
+    const int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) throw MdbError(errno);
+    size_t written = 0;
+    while(written < m_mapSize) {
+        const ssize_t result = write(fd, m_map + written, m_mapSize - written);
+        if(result < 0) {
+            if(errno == EINTR) continue;
+            const int error = errno;
+            close(fd);
+            throw MdbError(error);
+        }
+        written += result;
+    }
+    if(fdatasync(fd) != 0) {
+        const int error = errno;
+        close(fd);
+        throw MdbError(error);
+    }
+    if(close(fd) != 0) throw MdbError(errno);
+}
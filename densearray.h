@@ -0,0 +1,67 @@
+#ifndef OOCMAP_DENSEARRAY_H
+#define OOCMAP_DENSEARRAY_H
+
+#include <cstdint>
+#include <vector>
+
+#include "oocmap.h"
+
+//
+// The root values of a map whose keys are small non-negative ints, stored in a file next to the
+// map at the position of their key. Finding a value takes a bounds check and one load, instead of
+// encoding the key and descending the root table.
+//
+// The file is a header followed by blocks of 64 slots, each with a bitmap of the slots in use. It
+// grows by doubling, so filling it in key order is cheap.
+//
+// The array is not part of LMDB's transactions. Writers grow it while they hold a write transaction,
+// so they don't race each other, and fill in the slot once that transaction has committed, so a slot
+// only ever points at committed data. Two writers of the same key can finish in either order, and
+// after a crash the array can be out of step with the map.
+//
+
+struct DenseHeader;
+struct DenseBlock;
+
+class DenseArray {
+    int m_fd;
+    bool m_readonly;
+    uint8_t* m_map;
+    size_t m_mapSize;
+    uint64_t m_capacity;    // the number of slots we have mapped
+
+    DenseHeader* header() const;
+    DenseBlock* block(uint64_t key) const;
+    void map(uint64_t capacity);
+    // Maps more of the file if another process has grown it. Returns whether key is in range now.
+    bool refresh(uint64_t key);
+
+public:
+    static const uint64_t maxKeys = 1ull << 32;
+
+    // Opens the array, or creates it unless readonly. Throws MdbError with errno if that fails.
+    DenseArray(const char* filename, bool readonly);
+    ~DenseArray();
+
+    bool get(uint64_t key, EncodedValue* dest);
+    // Grows the file so it has a slot for key. Only call this while holding a write transaction.
+    void reserve(uint64_t key);
+    // Stores value for key, reserving a slot first if there is none.
+    void set(uint64_t key, const EncodedValue& value);
+    // Returns whether the key was there.
+    bool remove(uint64_t key);
+    uint64_t count() const;
+
+    // Advances key to the next key that is in use, starting at key itself. Returns false if there
+    // is none.
+    bool next(uint64_t* key);
+
+    // Returns up to parts - 1 keys that split the keys in use into parts of about the same size.
+    // Key i is the first key of part i + 1.
+    std::vector<uint64_t> split(unsigned int parts);
+
+    void sync();
+    void copyTo(const char* filename);
+};
+
+#endif //OOCMAP_DENSEARRAY_H
@@ -0,0 +1,279 @@
+#include "frozen.h"
+
+#include <cstring>
+
+#include "contenthash.h"
+#include "db.h"
+#include "errors.h"
+
+//
+// Reading items
+//
+
+static void readListItems(
+    OOCMapObject* const ooc,
+    MDB_txn* const txn,
+    const uint32_t listId,
+    std::vector<EncodedValue>& dest
+) {
+    const Py_ssize_t length = OOCMap_getListHeader(ooc, txn, listId);
+    dest.resize(length);
+    if(length <= 0) return;
+
+    ListKey listKey = { .listIndex = 0, .listId = listId };
+    MDB_val mdbKey = { .mv_size = sizeof(listKey), .mv_data = &listKey };
+    MDB_val mdbValue;
+    MDB_cursor* const cursor = cursor_open(txn, ooc->listsDb);
+    try {
+        bool found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET_RANGE);
+        for(Py_ssize_t i = 0; i < length; ++i) {
+            if(i > 0) found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT);
+            if(!found || mdbKey.mv_size != sizeof(ListKey)) throw OocError(OocError::UnexpectedData);
+            const ListKey* const itemKey = static_cast<const ListKey*>(mdbKey.mv_data);
+            if(itemKey->listId != listId || itemKey->listIndex != i) throw OocError(OocError::UnexpectedData);
+            if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+            memcpy(&dest[i], mdbValue.mv_data, sizeof(EncodedValue));
+        }
+    } catch(...) {
+        cursor_close(cursor);
+        throw;
+    }
+    cursor_close(cursor);
+}
+
+static void readDictItems(OOCMapObject* const ooc, MDB_txn* const txn, uint32_t dictId, EncodedDictItems& dest) {
+    const Py_ssize_t length = OOCMap_getDictHeader(ooc, txn, dictId);
+    dest.clear();
+    dest.reserve(length);
+
+    MDB_val mdbKey = { .mv_size = sizeof(dictId), .mv_data = &dictId };
+    MDB_val mdbValue;
+    MDB_cursor* const cursor = cursor_open(txn, ooc->dictsDb);
+    try {
+        if(!cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET)) throw OocError(OocError::UnexpectedData);
+        while(cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT)) {
+            // The next dict's header ends our items.
+            if(mdbKey.mv_size != sizeof(DictItemKey)) break;
+            const DictItemKey* const itemKey = static_cast<const DictItemKey*>(mdbKey.mv_data);
+            if(itemKey->dictId != dictId) break;
+            if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+            EncodedValue value;
+            memcpy(&value, mdbValue.mv_data, sizeof(value));
+            dest.emplace_back(itemKey->key, value);
+        }
+    } catch(...) {
+        cursor_close(cursor);
+        throw;
+    }
+    cursor_close(cursor);
+    if(static_cast<Py_ssize_t>(dest.size()) != length) throw OocError(OocError::UnexpectedData);
+}
+
+//
+// Finding frozen lists and dicts by their content
+//
+
+// Where we start looking for the frozen ID of a content hash. Other contents can get there first,
+// so we probe the IDs after it until we find ours or an empty one.
+static uint32_t frozenId(const ContentHash& hash, const uint32_t probe) {
+    const uint32_t start = static_cast<uint32_t>(hash.sum ^ (hash.sum >> 32));
+    return frozenIdBit | ((start + probe) & ~frozenIdBit);
+}
+
+static bool listExists(OOCMapObject* const ooc, MDB_txn* const txn, const uint32_t listId) {
+    ListKey listKey = { .listIndex = ListKey::listIndexLength, .listId = listId };
+    MDB_val mdbKey = { .mv_size = sizeof(listKey), .mv_data = &listKey };
+    MDB_val mdbValue;
+    return get(txn, ooc->listsDb, &mdbKey, &mdbValue);
+}
+
+static bool dictExists(OOCMapObject* const ooc, MDB_txn* const txn, uint32_t dictId) {
+    MDB_val mdbKey = { .mv_size = sizeof(dictId), .mv_data = &dictId };
+    MDB_val mdbValue;
+    return get(txn, ooc->dictsDb, &mdbKey, &mdbValue);
+}
+
+static bool listHolds(
+    OOCMapObject* const ooc,
+    MDB_txn* const txn,
+    const uint32_t listId,
+    const std::vector<EncodedValue>& items,
+    const ContentHash& hash
+) {
+    ContentHash storedHash;
+    const Py_ssize_t length = OOCMap_getListHeader(ooc, txn, listId, &storedHash);
+    if(length != static_cast<Py_ssize_t>(items.size())) return false;
+    if(ooc->contentHashes && storedHash.sum != hash.sum) return false;
+
+    ListKey listKey = { .listIndex = 0, .listId = listId };
+    MDB_val mdbKey = { .mv_size = sizeof(listKey), .mv_data = &listKey };
+    MDB_val mdbValue;
+    MDB_cursor* const cursor = cursor_open(txn, ooc->listsDb);
+    try {
+        bool found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET_RANGE);
+        for(size_t i = 0; i < items.size(); ++i) {
+            if(i > 0) found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT);
+            if(!found || mdbKey.mv_size != sizeof(ListKey)) throw OocError(OocError::UnexpectedData);
+            if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+            EncodedValue item;
+            memcpy(&item, mdbValue.mv_data, sizeof(item));
+            if(item != items[i]) {
+                cursor_close(cursor);
+                return false;
+            }
+        }
+    } catch(...) {
+        cursor_close(cursor);
+        throw;
+    }
+    cursor_close(cursor);
+    return true;
+}
+
+static bool dictHolds(
+    OOCMapObject* const ooc,
+    MDB_txn* const txn,
+    const uint32_t dictId,
+    const EncodedDictItems& items,
+    const ContentHash& hash
+) {
+    ContentHash storedHash;
+    const Py_ssize_t length = OOCMap_getDictHeader(ooc, txn, dictId, &storedHash);
+    if(length != static_cast<Py_ssize_t>(items.size())) return false;
+    if(ooc->contentHashes && storedHash.sum != hash.sum) return false;
+
+    for(const auto& item : items) {
+        DictItemKey itemKey = { .dictId = dictId, .key = item.first };
+        MDB_val mdbKey = { .mv_size = sizeof(itemKey), .mv_data = &itemKey };
+        MDB_val mdbValue;
+        if(!get(txn, ooc->dictsDb, &mdbKey, &mdbValue)) return false;
+        if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+        EncodedValue value;
+        memcpy(&value, mdbValue.mv_data, sizeof(value));
+        if(value != item.second) return false;
+    }
+    return true;
+}
+
+static void writeList(
+    OOCMapObject* const ooc,
+    MDB_txn* const txn,
+    const uint32_t listId,
+    const std::vector<EncodedValue>& items,
+    const ContentHash& hash
+) {
+    ListKey listKey = { .listIndex = 0, .listId = listId };
+    MDB_val mdbKey = { .mv_size = sizeof(listKey), .mv_data = &listKey };
+    for(const EncodedValue& item : items) {
+        MDB_val mdbValue = { .mv_size = sizeof(item), .mv_data = const_cast<EncodedValue*>(&item) };
+        put(txn, ooc->listsDb, &mdbKey, &mdbValue);
+        listKey.listIndex += 1;
+    }
+    OOCMap_putListHeader(ooc, txn, listId, items.size(), hash);
+}
+
+static void writeDict(
+    OOCMapObject* const ooc,
+    MDB_txn* const txn,
+    const uint32_t dictId,
+    const EncodedDictItems& items,
+    const ContentHash& hash
+) {
+    OOCMap_putDictHeader(ooc, txn, dictId, items.size(), hash);
+    for(const auto& item : items) {
+        DictItemKey itemKey = { .dictId = dictId, .key = item.first };
+        MDB_val mdbKey = { .mv_size = sizeof(itemKey), .mv_data = &itemKey };
+        MDB_val mdbValue = { .mv_size = sizeof(item.second), .mv_data = const_cast<EncodedValue*>(&item.second) };
+        put(txn, ooc->dictsDb, &mdbKey, &mdbValue);
+    }
+}
+
+uint32_t OOCMap_putFrozenList(
+    OOCMapObject* const ooc,
+    MDB_txn* const txn,
+    const std::vector<EncodedValue>& items,
+    const bool readonly
+) {
+    GilUnlocker gil;
+    ContentHash hash = { .sum = 0, .nanCount = 0 };
+    for(size_t i = 0; i < items.size(); ++i)
+        hash.addListItem(i, items[i]);
+
+    for(uint32_t probe = 0; ; ++probe) {
+        const uint32_t listId = frozenId(hash, probe);
+        if(!listExists(ooc, txn, listId)) {
+            if(readonly) throw OocError(OocError::ImmutableValueNotFound);
+            writeList(ooc, txn, listId, items, hash);
+            return listId;
+        }
+        if(listHolds(ooc, txn, listId, items, hash)) return listId;
+    }
+}
+
+uint32_t OOCMap_putFrozenDict(
+    OOCMapObject* const ooc,
+    MDB_txn* const txn,
+    const EncodedDictItems& items,
+    const bool readonly
+) {
+    GilUnlocker gil;
+    ContentHash hash = { .sum = 0, .nanCount = 0 };
+    for(const auto& item : items)
+        hash.addDictItem(item.first, item.second);
+
+    for(uint32_t probe = 0; ; ++probe) {
+        const uint32_t dictId = frozenId(hash, probe);
+        if(!dictExists(ooc, txn, dictId)) {
+            if(readonly) throw OocError(OocError::ImmutableValueNotFound);
+            writeDict(ooc, txn, dictId, items, hash);
+            return dictId;
+        }
+        if(dictHolds(ooc, txn, dictId, items, hash)) return dictId;
+    }
+}
+
+uint32_t OOCMap_freezeList(OOCMapObject* const ooc, MDB_txn* const txn, const uint32_t listId, const bool readonly) {
+    if(OOCMap_isFrozenId(ooc, listId)) return listId;
+    std::vector<EncodedValue> items;
+    {
+        GilUnlocker gil;
+        readListItems(ooc, txn, listId, items);
+    }
+    return OOCMap_putFrozenList(ooc, txn, items, readonly);
+}
+
+uint32_t OOCMap_freezeDict(OOCMapObject* const ooc, MDB_txn* const txn, const uint32_t dictId, const bool readonly) {
+    if(OOCMap_isFrozenId(ooc, dictId)) return dictId;
+    EncodedDictItems items;
+    {
+        GilUnlocker gil;
+        readDictItems(ooc, txn, dictId, items);
+    }
+    return OOCMap_putFrozenDict(ooc, txn, items, readonly);
+}
+
+//
+// Copying them into lists and dicts that can change
+//
+
+uint32_t OOCMap_thawList(OOCMapObject* const ooc, MDB_txn* const txn, const uint32_t listId) {
+    GilUnlocker gil;
+    std::vector<EncodedValue> items;
+    readListItems(ooc, txn, listId, items);
+    ContentHash hash;
+    OOCMap_getListHeader(ooc, txn, listId, &hash);
+    const uint32_t copyId = OOCMap_newListId(ooc, txn, 0);
+    writeList(ooc, txn, copyId, items, hash);
+    return copyId;
+}
+
+uint32_t OOCMap_thawDict(OOCMapObject* const ooc, MDB_txn* const txn, const uint32_t dictId) {
+    GilUnlocker gil;
+    EncodedDictItems items;
+    readDictItems(ooc, txn, dictId, items);
+    ContentHash hash;
+    OOCMap_getDictHeader(ooc, txn, dictId, &hash);
+    const uint32_t copyId = OOCMap_newDictId(ooc, txn, 0);
+    writeDict(ooc, txn, copyId, items, hash);
+    return copyId;
+}
@@ -0,0 +1,59 @@
+#ifndef OOCMAP_FROZEN_H
+#define OOCMAP_FROZEN_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "oocmap.h"
+#include "lmdb.h"
+
+//
+// Frozen lists and dicts
+//
+// In maps created with frozen=True, lists and dicts are stored once for each content, the same way
+// as tuples. A list's ID is found from a hash of its items, so storing the same document many times
+// stores its lists and dicts only once, and equal ones have the same encoding. Frozen IDs have the
+// top bit set. Lists and dicts that aren't frozen get IDs without it, so the two never collide.
+//
+// Frozen lists and dicts never change, because anything might share them. Changing one through a
+// LazyList or LazyDict first copies it into a list or dict of that LazyList's own, and changes the
+// copy. Whatever held the frozen one still holds it, so
+//
+//     l = m["key"]
+//     l.append(1)
+//     m["key"] = l
+//
+// is how to change a value in place. Storing the copy stores a frozen snapshot of it, and the copy
+// stays with the LazyList.
+//
+
+const uint32_t frozenIdBit = 0x80000000;
+
+inline bool OOCMap_isFrozenId(const OOCMapObject* const ooc, const uint32_t id) {
+    return ooc->frozen > 0 && (id & frozenIdBit) != 0;
+}
+
+typedef std::vector<std::pair<EncodedValue, EncodedValue>> EncodedDictItems;
+
+// Returns the ID of the frozen list with these items, storing it if it isn't stored yet. With
+// readonly, this throws ImmutableValueNotFound instead.
+uint32_t OOCMap_putFrozenList(
+    OOCMapObject* ooc,
+    MDB_txn* txn,
+    const std::vector<EncodedValue>& items,
+    bool readonly = false);
+uint32_t OOCMap_putFrozenDict(OOCMapObject* ooc, MDB_txn* txn, const EncodedDictItems& items, bool readonly = false);
+
+// Returns the ID of a frozen list or dict with the same items as the given one.
+uint32_t OOCMap_freezeList(OOCMapObject* ooc, MDB_txn* txn, uint32_t listId, bool readonly = false);
+uint32_t OOCMap_freezeDict(OOCMapObject* ooc, MDB_txn* txn, uint32_t dictId, bool readonly = false);
+
+// Copies a frozen list or dict into a new one that can change, and returns its ID.
+uint32_t OOCMap_thawList(OOCMapObject* ooc, MDB_txn* txn, uint32_t listId);
+uint32_t OOCMap_thawDict(OOCMapObject* ooc, MDB_txn* txn, uint32_t dictId);
+
+#endif //OOCMAP_FROZEN_H
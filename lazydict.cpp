@@ -1,6 +1,13 @@
 #include "lazydict.h"
 
+#include <algorithm>
+#include <cstring>
+
 #include "oocmap.h"
+#include "compare.h"
+#include "contenthash.h"
+#include "frozen.h"
+#include "loans.h"
 #include "db.h"
 #include "errors.h"
 
@@ -16,6 +23,8 @@ OOCLazyDictObject* OOCLazyDict_fastnew(OOCMapObject* const ooc, const uint32_t d
     self->ooc = ooc;
     Py_INCREF(ooc);
     self->dictId = dictId;
+    self->borrowing = false;
+    self->copyId = 0;
     return self;
 }
 
@@ -34,6 +43,9 @@ OOCLazyDictItemsIterObject* OOCLazyDictItemsIter_fastnew(OOCLazyDictObject* cons
     OOCLazyDictItemsIterObject* self = reinterpret_cast<OOCLazyDictItemsIterObject*>(pySelf);
     self->dict = dict;
     self->cursor = nullptr;
+    self->remaining = 0;
+    self->batchLength = 0;
+    self->batchPosition = 0;
     Py_INCREF(dict);
     return self;
 }
@@ -53,6 +65,8 @@ static PyObject* OOCLazyDict_new(PyTypeObject* const type, PyObject* const args,
     }
     self->ooc = nullptr;
     self->dictId = 0;
+    self->borrowing = false;
+    self->copyId = 0;
     return (PyObject*)self;
 }
 
@@ -76,6 +90,9 @@ static PyObject* OOCLazyDictItemsIter_new(PyTypeObject* const type, PyObject* co
     }
     self->dict = nullptr;
     self->cursor = nullptr;
+    self->remaining = 0;
+    self->batchLength = 0;
+    self->batchPosition = 0;
     return (PyObject*)self;
 }
 
@@ -95,6 +112,8 @@ static int OOCLazyDict_init(OOCLazyDictObject* const self, PyObject* const args,
     // TODO: consider that __init__ might be called on an already initialized object
     self->ooc = reinterpret_cast<OOCMapObject*>(oocmapObject);
     Py_INCREF(oocmapObject);
+    self->borrowing = false;
+    self->copyId = 0;
 
     return 0;
 }
@@ -140,7 +159,38 @@ static int OOCLazyDictItemsIter_init(OOCLazyDictItemsIterObject* const self, PyO
     return 0;
 }
 
+// A copy that goes away while it still borrows ends its loan, see loans.h. Failing to only leaves
+// an empty dict behind, so this gives up quietly.
+static void OOCLazyDict_releaseLoan(OOCLazyDictObject* const self) {
+    PyObject* type;
+    PyObject* value;
+    PyObject* traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    MDB_txn* txn = nullptr;
+    while(true) {
+        try {
+            MDB_env* const mdb = OOCMap_env(self->ooc);
+            // We might be going away in the middle of one of our own writes.
+            if(self->ooc->envContext->reading())
+                break;
+            txn = txn_begin(mdb, true);
+            OOCMap_releaseDictLoan(self->ooc, txn, self->dictId, self->copyId);
+            txn_commit(txn);
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+        }
+        break;
+    }
+    PyErr_Restore(type, value, traceback);
+}
+
 static void OOCLazyDict_dealloc(OOCLazyDictObject* const self) {
+    if(self->borrowing)
+        OOCLazyDict_releaseLoan(self);
     Py_DECREF(self->ooc);
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
@@ -150,16 +200,22 @@ static void OOCLazyDictItems_dealloc(OOCLazyDictItemsObject* const self) {
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
+static void OOCLazyDictItemsIter_closeCursor(OOCLazyDictItemsIterObject* self, bool commit);
+
 static void OOCLazyDictItemsIter_dealloc(OOCLazyDictItemsIterObject* const self) {
+    if(self->cursor != nullptr)
+        OOCLazyDictItemsIter_closeCursor(self, false);
     Py_XDECREF(self->dict);
-    if(self->cursor != nullptr) {
-        MDB_txn* const txn = mdb_cursor_txn(self->cursor);
-        mdb_cursor_close(self->cursor);
-        txn_abort(txn);
-    }
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
+void OOCLazyDictObject_followLoan(OOCLazyDictObject* const self, MDB_txn* const txn) {
+    if(!self->borrowing) return;
+    if(OOCMap_dictLoanActive(self->ooc, txn, self->dictId, self->copyId)) return;
+    self->dictId = self->copyId;
+    self->borrowing = false;
+}
+
 static Py_ssize_t OOCLazyDict_length(PyObject* const pySelf) {
     if(pySelf->ob_type != &OOCLazyDictType) {
         PyErr_BadArgument();
@@ -169,7 +225,8 @@ static Py_ssize_t OOCLazyDict_length(PyObject* const pySelf) {
 
     MDB_txn* txn = nullptr;
     try {
-        txn = txn_begin(self->ooc->mdb, false);
+        txn = txn_begin(OOCMap_env(self->ooc), false);
+        OOCLazyDictObject_followLoan(self, txn);
         Py_ssize_t const result = OOCLazyDictObject_length(self, txn);
         txn_commit(txn);
         return result;
@@ -182,12 +239,7 @@ static Py_ssize_t OOCLazyDict_length(PyObject* const pySelf) {
 }
 
 Py_ssize_t OOCLazyDictObject_length(OOCLazyDictObject* const self, MDB_txn* const txn) {
-    MDB_val mdbKey = { .mv_size = sizeof(self->dictId), .mv_data = &self->dictId };
-    MDB_val mdbValue;
-    const bool found = get(txn, self->ooc->dictsDb, &mdbKey, &mdbValue);
-    if(!found) throw OocError(OocError::UnexpectedData);
-    if(mdbValue.mv_size != sizeof(Py_ssize_t)) throw OocError(OocError::UnexpectedData);
-    return *reinterpret_cast<Py_ssize_t*>(mdbValue.mv_data);
+    return OOCMap_getDictHeader(self->ooc, txn, self->dictId);
 }
 
 static Py_ssize_t OOCLazyDictItems_length(PyObject* const pySelf) {
@@ -199,6 +251,67 @@ static Py_ssize_t OOCLazyDictItems_length(PyObject* const pySelf) {
     return OOCLazyDict_length(reinterpret_cast<PyObject*>(self->dict));
 }
 
+// Frozen dicts never change, see frozen.h, and copies read the items of the dict they were copied
+// from, see loans.h. Before we change either, we copy the items into a dict of our own.
+static bool OOCLazyDict_thaw(OOCLazyDictObject* const self) {
+    if(!self->borrowing && !OOCMap_isFrozenId(self->ooc, self->dictId)) return true;
+
+    MDB_txn* txn = nullptr;
+    while(true) {
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), true);
+            uint32_t dictId;
+            if(self->borrowing) {
+                if(OOCMap_dictLoanActive(self->ooc, txn, self->dictId, self->copyId))
+                    OOCMap_repayDictLoan(self->ooc, txn, self->dictId, self->copyId);
+                dictId = self->copyId;
+            } else {
+                dictId = OOCMap_thawDict(self->ooc, txn, self->dictId);
+            }
+            txn_commit(txn);
+            self->dictId = dictId;
+            self->borrowing = false;
+            return true;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+            error.pythonize();
+            return false;
+        }
+    }
+}
+
+// Stores value under encodedKey, and updates *hash. Returns true if the key was already in the dict,
+// in which case the old value's item comes out of the hash and the length stays the same.
+static bool OOCLazyDict_putItem(
+    OOCLazyDictObject* const self,
+    MDB_txn* const txn,
+    DictItemKey& encodedKey,
+    PyObject* const value,
+    Id2EncodedMap& insertedItemsInThisTransaction,
+    ContentHash* const hash
+) {
+    MDB_val mdbKey = { .mv_size = sizeof(encodedKey), .mv_data = &encodedKey };
+    MDB_val mdbValue;
+    const bool found = get(txn, self->ooc->dictsDb, &mdbKey, &mdbValue);
+    if(found) {
+        if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+        EncodedValue oldValue;
+        memcpy(&oldValue, mdbValue.mv_data, sizeof(oldValue));
+        hash->removeDictItem(encodedKey.key, oldValue);
+    }
+
+    EncodedValue encodedValue;
+    OOCMap_encode(self->ooc, value, &encodedValue, txn, insertedItemsInThisTransaction);
+    mdbValue = (MDB_val) { .mv_size = sizeof(encodedValue), .mv_data = &encodedValue };
+    put(txn, self->ooc->dictsDb, &mdbKey, &mdbValue);
+    hash->addDictItem(encodedKey.key, encodedValue);
+    return found;
+}
+
 static int OOCLazyDict_insert(PyObject* pySelf, PyObject* key, PyObject* value) {
     if(pySelf->ob_type != &OOCLazyDictType) {
         PyErr_BadArgument();
@@ -206,29 +319,59 @@ static int OOCLazyDict_insert(PyObject* pySelf, PyObject* key, PyObject* value)
     }
     OOCLazyDictObject* const self = reinterpret_cast<OOCLazyDictObject*>(pySelf);
 
-    MDB_txn* txn = nullptr;
-    try {
-        Id2EncodedMap insertedItemsInThisTransaction;
-        txn = txn_begin(self->ooc->mdb, true);
+    // Like dict, we only take hashable keys.
+    if(PyObject_Hash(key) == -1) return -1;
 
-        DictItemKey encodedKey = { .dictId = self->dictId };
-        OOCMap_encode(self->ooc, key, &encodedKey.key, txn, insertedItemsInThisTransaction);
-        EncodedValue encodedValue;
-        OOCMap_encode(self->ooc, key, &encodedValue, txn, insertedItemsInThisTransaction);
+    if(!OOCLazyDict_thaw(self)) return -1;
 
-        MDB_val mdbKey = { .mv_size = sizeof(encodedKey), .mv_data = &encodedKey };
-        MDB_val mdbValue = { .mv_size = sizeof(encodedValue), .mv_data = &encodedValue };
-        put(txn, self->ooc->dictsDb, &mdbKey, &mdbValue);
+    MDB_txn* txn = nullptr;
+    while(true) {
+        try {
+            Id2EncodedMap insertedItemsInThisTransaction;
+            txn = txn_begin(OOCMap_env(self->ooc), true);
+            OOCMap_settleDictLoans(self->ooc, txn, self->dictId);
+
+            ContentHash hash;
+            const Py_ssize_t length = OOCMap_getDictHeader(self->ooc, txn, self->dictId, &hash);
+
+            // Deleting a key that was never stored doesn't have to store it first.
+            DictItemKey encodedKey = { .dictId = self->dictId };
+            OOCMap_encodeDictKey(self->ooc, key, &encodedKey.key, txn, insertedItemsInThisTransaction, value == nullptr);
+
+            if(value == nullptr) {
+                MDB_val mdbKey = { .mv_size = sizeof(encodedKey), .mv_data = &encodedKey };
+                MDB_val mdbValue;
+                if(!get(txn, self->ooc->dictsDb, &mdbKey, &mdbValue))
+                    throw OocError(OocError::ImmutableValueNotFound);
+                if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+                EncodedValue oldValue;
+                memcpy(&oldValue, mdbValue.mv_data, sizeof(oldValue));
+                hash.removeDictItem(encodedKey.key, oldValue);
+                del(txn, self->ooc->dictsDb, &mdbKey);
+                OOCMap_putDictHeader(self->ooc, txn, self->dictId, length - 1, hash);
+            } else {
+                const bool replaced =
+                    OOCLazyDict_putItem(self, txn, encodedKey, value, insertedItemsInThisTransaction, &hash);
+                // Without content hashes, the header only changes with the length.
+                if(!replaced || self->ooc->contentHashes)
+                    OOCMap_putDictHeader(self->ooc, txn, self->dictId, replaced ? length : length + 1, hash);
+            }
 
-        txn_commit(txn);
-    } catch(const OocError& error) {
-        if(txn != nullptr)
-            txn_abort(txn);
-        error.pythonize();
-        return -1;
+            txn_commit(txn);
+            return 0;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+            if(error.errorCode == OocError::ImmutableValueNotFound)
+                PyErr_SetObject(PyExc_KeyError, key);
+            else
+                error.pythonize();
+            return -1;
+        }
     }
-
-    return 0;
 }
 
 static PyObject* OOCLazyDict_get(PyObject* const pySelf, PyObject* const key) {
@@ -238,13 +381,16 @@ static PyObject* OOCLazyDict_get(PyObject* const pySelf, PyObject* const key) {
     }
     OOCLazyDictObject* const self = reinterpret_cast<OOCLazyDictObject*>(pySelf);
 
+    if(PyObject_Hash(key) == -1) return nullptr;
+
     MDB_txn* txn = nullptr;
     try {
         Id2EncodedMap insertedItemsInThisTransaction;
-        txn = txn_begin(self->ooc->mdb, false);
+        txn = txn_begin(OOCMap_env(self->ooc), false);
+        OOCLazyDictObject_followLoan(self, txn);
 
         DictItemKey encodedItemKey = { .dictId = self->dictId };
-        OOCMap_encode(self->ooc, key, &encodedItemKey.key, txn, insertedItemsInThisTransaction, true);
+        OOCMap_encodeDictKey(self->ooc, key, &encodedItemKey.key, txn, insertedItemsInThisTransaction, true);
 
         MDB_val mdbKey = { .mv_size = sizeof(encodedItemKey), .mv_data = &encodedItemKey };
         MDB_val mdbValue;
@@ -277,8 +423,11 @@ PyObject* OOCLazyDict_eager(PyObject* const pySelf) {
 
     MDB_txn* txn = nullptr;
     try {
-        txn = txn_begin(self->ooc->mdb, false);
-        return OOCLazyDictObject_eager(self, txn);
+        txn = txn_begin(OOCMap_env(self->ooc), false);
+        OOCLazyDictObject_followLoan(self, txn);
+        PyObject* const result = OOCLazyDictObject_eager(self, txn);
+        txn_commit(txn);
+        return result;
     } catch(const OocError& error) {
         if(txn != nullptr)
             txn_abort(txn);
@@ -287,12 +436,35 @@ PyObject* OOCLazyDict_eager(PyObject* const pySelf) {
     }
 }
 
+// Reads the next count items of a dict from a cursor on the one before them.
+static void OOCLazyDict_readItems(
+    MDB_cursor* const cursor,
+    const uint32_t dictId,
+    const size_t count,
+    EncodedValue* const keys,
+    EncodedValue* const values
+) {
+    MDB_val mdbKeys[cursorBatchSize];
+    MDB_val mdbValues[cursorBatchSize];
+    if(cursor_get_batch(cursor, mdbKeys, mdbValues, count, MDB_NEXT) != count)
+        throw OocError(OocError::UnexpectedData);
+    for(size_t i = 0; i < count; ++i) {
+        if(mdbKeys[i].mv_size != sizeof(DictItemKey)) throw OocError(OocError::UnexpectedData);
+        const DictItemKey* const itemKey = static_cast<const DictItemKey*>(mdbKeys[i].mv_data);
+        if(itemKey->dictId != dictId) throw OocError(OocError::UnexpectedData);
+        if(mdbValues[i].mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+        keys[i] = itemKey->key;
+        memcpy(&values[i], mdbValues[i].mv_data, sizeof(EncodedValue));
+    }
+}
+
 PyObject* OOCLazyDictObject_eager(OOCLazyDictObject* const self, MDB_txn* const txn) {
     PyObject* result = nullptr;
     MDB_cursor* cursor = nullptr;
     try {
         result = PyDict_New();
         if(result == nullptr) throw OocError(OocError::OutOfMemory);
+        Py_ssize_t remaining = OOCLazyDictObject_length(self, txn);
         cursor = cursor_open(txn, self->ooc->dictsDb);
 
         MDB_val mdbKey = { .mv_size = sizeof(self->dictId), .mv_data = &self->dictId };
@@ -300,22 +472,20 @@ PyObject* OOCLazyDictObject_eager(OOCLazyDictObject* const self, MDB_txn* const
         bool found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET);
         if(!found) throw OocError(OocError::UnexpectedData);
 
-        while(true) {
-            found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT);
-            if(!found)
-                break;
-            if(mdbKey.mv_size != sizeof(DictItemKey)) throw OocError(OocError::UnexpectedData);
-            DictItemKey* const encodedItemKey = static_cast<DictItemKey* const>(mdbKey.mv_data);
-            if(encodedItemKey->dictId != self->dictId)
-                break;
-            PyObject* const itemKey = OOCMap_decode(self->ooc, &encodedItemKey->key, txn);
-
-            if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
-            EncodedValue* const encodedItemValue = static_cast<EncodedValue* const>(mdbValue.mv_data);
-            PyObject* const itemValue = OOCMap_decode(self->ooc, encodedItemValue, txn);
-
-            const int failure = PyDict_SetItem(result, itemKey, itemValue);
-            if(failure) throw OocError(OocError::AlreadyPythonizedError);
+        EncodedValue keys[cursorBatchSize];
+        EncodedValue values[cursorBatchSize];
+        while(remaining > 0) {
+            const size_t count = std::min(static_cast<size_t>(remaining), cursorBatchSize);
+            OOCLazyDict_readItems(cursor, self->dictId, count, keys, values);
+            remaining -= count;
+            for(size_t i = 0; i < count; ++i) {
+                PyObject* const itemKey = OOCMap_decode(self->ooc, &keys[i], txn);
+                PyObject* const itemValue = OOCMap_decode(self->ooc, &values[i], txn);
+                const int failure = PyDict_SetItem(result, itemKey, itemValue);
+                Py_DECREF(itemKey);
+                Py_DECREF(itemValue);
+                if(failure) throw OocError(OocError::AlreadyPythonizedError);
+            }
         }
 
         cursor_close(cursor);
@@ -328,6 +498,62 @@ PyObject* OOCLazyDictObject_eager(OOCLazyDictObject* const self, MDB_txn* const
     return result;
 }
 
+static PyObject* OOCLazyDict_richcompare(PyObject* const pySelf, PyObject* const other, const int op) {
+    if(pySelf->ob_type != &OOCLazyDictType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCLazyDictObject* const self = reinterpret_cast<OOCLazyDictObject*>(pySelf);
+
+    // Like Python's dicts, we only know about equality.
+    if((op != Py_EQ && op != Py_NE) || !(PyDict_Check(other) || other->ob_type == &OOCLazyDictType))
+        Py_RETURN_NOTIMPLEMENTED;
+
+    if(other->ob_type == &OOCLazyDictType && reinterpret_cast<OOCLazyDictObject*>(other)->ooc == self->ooc) {
+        // Both dicts are in the same map, so we can compare them without decoding most items.
+        EncodedValue selfValue;
+        selfValue.asUInt = 0;
+        selfValue.typeCodeWithLength = 0;
+        selfValue.typeCode = TYPE_CODE_DICT;
+        EncodedValue otherValue = selfValue;
+        OOCLazyDictObject* const otherDict = reinterpret_cast<OOCLazyDictObject*>(other);
+
+        MDB_txn* txn = nullptr;
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), false);
+            OOCLazyDictObject_followLoan(self, txn);
+            OOCLazyDictObject_followLoan(otherDict, txn);
+            selfValue.asDictKey.dictId = self->dictId;
+            otherValue.asDictKey.dictId = otherDict->dictId;
+            PyObject* const result = OOCMap_encodedRichcompare(self->ooc, txn, selfValue, otherValue, op);
+            txn_commit(txn);
+            return result;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            error.pythonize();
+            return nullptr;
+        }
+    }
+
+    PyObject* const eager = OOCLazyDict_eager(pySelf);
+    if(eager == nullptr) return nullptr;
+    PyObject* otherEager = other;
+    Py_INCREF(otherEager);
+    if(other->ob_type == &OOCLazyDictType) {
+        Py_DECREF(otherEager);
+        otherEager = OOCLazyDict_eager(other);
+        if(otherEager == nullptr) {
+            Py_DECREF(eager);
+            return nullptr;
+        }
+    }
+    PyObject* const result = PyObject_RichCompare(eager, otherEager, op);
+    Py_DECREF(eager);
+    Py_DECREF(otherEager);
+    return result;
+}
+
 static PyObject* OOCLazyDict_items(PyObject* const pySelf) {
     if(pySelf->ob_type != &OOCLazyDictType) {
         PyErr_BadArgument();
@@ -351,6 +577,18 @@ static PyObject* OOCLazyDictItemsIter_iter(PyObject* const pySelf) {
     return pySelf;
 }
 
+// Ends the read transaction the iterator keeps open between calls.
+static void OOCLazyDictItemsIter_closeCursor(OOCLazyDictItemsIterObject* const self, const bool commit) {
+    MDB_txn* txn = mdb_cursor_txn(self->cursor);
+    cursor_close(self->cursor);
+    self->cursor = nullptr;
+    self->dict->ooc->liveReadTxns -= 1;
+    if(commit)
+        txn_commit(txn);
+    else
+        txn_abort(txn);
+}
+
 static PyObject* OOCLazyDictItemsIter_iternext(PyObject* const pySelf) {
     if(pySelf->ob_type != &OOCLazyDictItemsIterType) {
         PyErr_BadArgument();
@@ -361,64 +599,48 @@ static PyObject* OOCLazyDictItemsIter_iternext(PyObject* const pySelf) {
     OOCMapObject* const ooc = self->dict->ooc;
 
     MDB_txn* txn = nullptr;
-    if(self->cursor == nullptr) {
-        try {
-            txn = txn_begin(ooc->mdb, false);
+    PyObject* pyKey = nullptr;
+    PyObject* pyValue = nullptr;
+    try {
+        if(self->cursor == nullptr) {
+            txn = txn_begin(OOCMap_env(ooc), false);
+            OOCLazyDictObject_followLoan(self->dict, txn);
+            self->remaining = OOCLazyDictObject_length(self->dict, txn);
             self->cursor = cursor_open(txn, ooc->dictsDb);
+            txn_keep(txn);
+            ooc->liveReadTxns += 1;
 
             MDB_val mdbKey = { .mv_size = sizeof(self->dict->dictId), .mv_data = &self->dict->dictId };
             MDB_val mdbValue;
             const bool found = cursor_get(self->cursor, &mdbKey, &mdbValue, MDB_SET);
             if(!found) throw OocError(OocError::UnexpectedData);
-        } catch(const OocError& error) {
-            if(self->cursor != nullptr) {
-                cursor_close(self->cursor);
-                self->cursor = nullptr;
-            }
-            if(txn != nullptr)
-                txn_abort(txn);
-            error.pythonize();
-            return nullptr;
+        } else {
+            txn = mdb_cursor_txn(self->cursor);
         }
-    } else {
-        txn = mdb_cursor_txn(self->cursor);
-    }
-    assert(txn != nullptr);
 
-    PyObject* pyKey = nullptr;
-    PyObject* pyValue = nullptr;
-    try {
-        MDB_val mdbKey;
-        MDB_val mdbValue;
-        const bool found = cursor_get(self->cursor, &mdbKey, &mdbValue, MDB_NEXT);
-        if(!found) throw OocError(OocError::IndexError);
-
-        switch(mdbKey.mv_size) {
-        case sizeof(DictItemKey):
-            break;
-        case sizeof(self->dict->dictId):
-            throw OocError(OocError::IndexError);
-        default:
-            throw OocError(OocError::UnexpectedData);
+        if(self->batchPosition == self->batchLength) {
+            if(self->remaining <= 0) {
+                OOCLazyDictItemsIter_closeCursor(self, true);
+                Py_CLEAR(self->dict);
+                return nullptr;
+            }
+            const size_t count = std::min(static_cast<size_t>(self->remaining), cursorBatchSize);
+            OOCLazyDict_readItems(self->cursor, self->dict->dictId, count, self->batchKeys, self->batchValues);
+            self->remaining -= count;
+            self->batchLength = static_cast<uint32_t>(count);
+            self->batchPosition = 0;
         }
-        DictItemKey* const dictItemKey = static_cast<DictItemKey* const>(mdbKey.mv_data);
 
-        if(mdbValue.mv_size != sizeof(EncodedValue))
-            throw OocError(OocError::UnexpectedData);
-        EncodedValue* const dictItemValue = static_cast<EncodedValue* const>(mdbValue.mv_data);
-
-        pyKey = OOCMap_decode(ooc, &dictItemKey->key, txn);
-        pyValue = OOCMap_decode(ooc, dictItemValue, txn);
+        pyKey = OOCMap_decode(ooc, &self->batchKeys[self->batchPosition], txn);
+        pyValue = OOCMap_decode(ooc, &self->batchValues[self->batchPosition], txn);
+        self->batchPosition += 1;
     } catch(const OocError& error) {
-        cursor_close(self->cursor);
-        self->cursor = nullptr;
-        if(error.errorCode == OocError::IndexError) {
-            txn_commit(txn);
-            Py_CLEAR(self->dict);
-        } else {
+        Py_XDECREF(pyKey);
+        if(self->cursor != nullptr)
+            OOCLazyDictItemsIter_closeCursor(self, false);
+        else if(txn != nullptr)
             txn_abort(txn);
-            error.pythonize();
-        }
+        error.pythonize();
         return nullptr;
     }
 
@@ -426,6 +648,7 @@ static PyObject* OOCLazyDictItemsIter_iternext(PyObject* const pySelf) {
     if(result == nullptr) {
         Py_DECREF(pyKey);
         Py_DECREF(pyValue);
+        return nullptr;
     }
     PyTuple_SET_ITEM(result, 0, pyKey);
     PyTuple_SET_ITEM(result, 1, pyValue);
@@ -433,6 +656,99 @@ static PyObject* OOCLazyDictItemsIter_iternext(PyObject* const pySelf) {
 }
 
 
+static PyObject* OOCLazyDict_prefetch(PyObject* const pySelf) {
+    if(pySelf->ob_type != &OOCLazyDictType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCLazyDictObject* const self = reinterpret_cast<OOCLazyDictObject*>(pySelf);
+
+    EncodedValue value;
+    value.asUInt = 0;
+    value.typeCodeWithLength = 0;
+    value.typeCode = TYPE_CODE_DICT;
+
+    MDB_txn* txn = nullptr;
+    try {
+        txn = txn_begin(OOCMap_env(self->ooc), false);
+        OOCLazyDictObject_followLoan(self, txn);
+        value.asDictKey.dictId = self->dictId;
+        OOCMap_prefetch(self->ooc, txn, &value);
+        txn_commit(txn);
+    } catch(const OocError& error) {
+        if(txn != nullptr)
+            txn_abort(txn);
+        error.pythonize();
+        return nullptr;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* OOCLazyDict_contentHash(PyObject* const pySelf) {
+    if(pySelf->ob_type != &OOCLazyDictType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCLazyDictObject* const self = reinterpret_cast<OOCLazyDictObject*>(pySelf);
+
+    MDB_txn* txn = nullptr;
+    try {
+        txn = txn_begin(OOCMap_env(self->ooc), false);
+        OOCLazyDictObject_followLoan(self, txn);
+        const ContentHash hash = OOCMap_dictContentHash(self->ooc, txn, self->dictId);
+        txn_commit(txn);
+        return PyLong_FromUnsignedLongLong(hash.sum);
+    } catch(const OocError& error) {
+        if(txn != nullptr)
+            txn_abort(txn);
+        error.pythonize();
+        return nullptr;
+    }
+}
+
+// Doesn't copy any items until either dict changes, see loans.h.
+static PyObject* OOCLazyDict_copy(PyObject* const pySelf) {
+    if(pySelf->ob_type != &OOCLazyDictType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCLazyDictObject* const self = reinterpret_cast<OOCLazyDictObject*>(pySelf);
+
+    OOCLazyDictObject* result;
+    try {
+        result = OOCLazyDict_fastnew(self->ooc, self->dictId);
+    } catch(const OocError& error) {
+        error.pythonize();
+        return nullptr;
+    }
+    // Frozen dicts never change, so the copy can have the same one. Read-only maps can't lend.
+    if(OOCMap_isFrozenId(self->ooc, self->dictId) || (self->ooc->envFlags & MDB_RDONLY) != 0)
+        return reinterpret_cast<PyObject*>(result);
+
+    MDB_txn* txn = nullptr;
+    while(true) {
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), true);
+            OOCLazyDictObject_followLoan(self, txn);
+            const uint32_t copyId = OOCMap_lendDict(self->ooc, txn, self->dictId);
+            txn_commit(txn);
+            result->dictId = self->dictId;
+            result->borrowing = true;
+            result->copyId = copyId;
+            return reinterpret_cast<PyObject*>(result);
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+            Py_DECREF(result);
+            error.pythonize();
+            return nullptr;
+        }
+    }
+}
+
 static PyMethodDef OOCLazyDict_methods[] = {
     {
         "eager",
@@ -444,6 +760,21 @@ static PyMethodDef OOCLazyDict_methods[] = {
         (PyCFunction)OOCLazyDict_items,
         METH_NOARGS,
         PyDoc_STR("returns a view over the items in the dictionary")
+    }, {
+        "prefetch",
+        (PyCFunction)OOCLazyDict_prefetch,
+        METH_NOARGS,
+        PyDoc_STR("starts reading the dict from disk in the background")
+    }, {
+        "content_hash",
+        (PyCFunction)OOCLazyDict_contentHash,
+        METH_NOARGS,
+        PyDoc_STR("returns a hash of the items in the dict, which is the same for dicts with the same items")
+    }, {
+        "copy",
+        (PyCFunction)OOCLazyDict_copy,
+        METH_NOARGS,
+        PyDoc_STR("returns a copy of the dict, which only copies the items when either dict changes")
     },
     {nullptr}, // sentinel
 };
@@ -463,6 +794,7 @@ PyTypeObject OOCLazyDictType = {
     .tp_as_mapping = &OOCLazyDict_mapping_methods,
     .tp_flags = Py_TPFLAGS_DEFAULT,
     .tp_doc = "A dict-like class that's backed by an OOCMap",
+    .tp_richcompare = OOCLazyDict_richcompare,
     .tp_iter = nullptr,  // TODO?
     .tp_methods = OOCLazyDict_methods,
     .tp_init = (initproc)OOCLazyDict_init,
@@ -5,6 +5,7 @@
 #include <Python.h>
 
 #include "oocmap.h"
+#include "db.h"
 #include "lmdb.h"
 
 //
@@ -15,12 +16,19 @@ typedef struct {
     PyObject_HEAD
     OOCMapObject* ooc;
     uint32_t dictId;
+    // Whether this is a copy that still reads the items of dictId, see loans.h. Its own dict is
+    // copyId.
+    bool borrowing;
+    uint32_t copyId;
 } OOCLazyDictObject;
 
 extern PyTypeObject OOCLazyDictType;
 
 OOCLazyDictObject* OOCLazyDict_fastnew(OOCMapObject* ooc, uint32_t dictId);
 
+// Same as for LazyList, see lazylist.h
+void OOCLazyDictObject_followLoan(OOCLazyDictObject* self, MDB_txn* txn);
+
 Py_ssize_t OOCLazyDictObject_length(OOCLazyDictObject* self, MDB_txn* txn);
 
 PyObject* OOCLazyDictObject_eager(OOCLazyDictObject* self, MDB_txn* txn);
@@ -49,6 +57,12 @@ typedef struct {
     PyObject_HEAD
     OOCLazyDictObject* dict;
     MDB_cursor* cursor;
+    // The iterator reads the items in batches, see cursor_get_batch() in db.h.
+    Py_ssize_t remaining;    // items not read from the cursor yet
+    uint32_t batchLength;
+    uint32_t batchPosition;
+    EncodedValue batchKeys[cursorBatchSize];
+    EncodedValue batchValues[cursorBatchSize];
 } OOCLazyDictItemsIterObject;
 
 extern PyTypeObject OOCLazyDictItemsIterType;
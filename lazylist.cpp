@@ -1,8 +1,17 @@
 #include "lazylist.h"
 
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
 #include "oocmap.h"
 #include "db.h"
 #include "errors.h"
+#include "listsort.h"
+#include "compare.h"
+#include "contenthash.h"
+#include "frozen.h"
+#include "loans.h"
 
 
 //
@@ -17,6 +26,8 @@ OOCLazyListObject* OOCLazyList_fastnew(OOCMapObject* const ooc, const uint32_t l
     self->ooc = ooc;
     Py_INCREF(ooc);
     self->listId = listId;
+    self->borrowing = false;
+    self->copyId = 0;
     return self;
 }
 
@@ -27,6 +38,11 @@ OOCLazyListIterObject* OOCLazyListIter_fastnew(OOCLazyListObject* const list) {
     self->list = list;
     Py_INCREF(list);
     self->cursor = nullptr;
+    self->listId = 0;
+    self->nextIndex = 0;
+    self->length = 0;
+    self->batchLength = 0;
+    self->batchPosition = 0;
     return self;
 }
 
@@ -44,6 +60,8 @@ static PyObject* OOCLazyList_new(PyTypeObject* const type, PyObject* const args,
     }
     self->ooc = nullptr;
     self->listId = 0;
+    self->borrowing = false;
+    self->copyId = 0;
     return (PyObject*)self;
 }
 
@@ -56,6 +74,11 @@ static PyObject* OOCLazyListIter_new(PyTypeObject* const type, PyObject* const a
     }
     self->list = nullptr;
     self->cursor = nullptr;
+    self->listId = 0;
+    self->nextIndex = 0;
+    self->length = 0;
+    self->batchLength = 0;
+    self->batchPosition = 0;
     return (PyObject*)self;
 }
 
@@ -75,6 +98,8 @@ static int OOCLazyList_init(OOCLazyListObject* const self, PyObject* const args,
     // TODO: consider that __init__ might be called on an already initialized object
     self->ooc = reinterpret_cast<OOCMapObject*>(oocmapObject);
     Py_INCREF(oocmapObject);
+    self->borrowing = false;
+    self->copyId = 0;
 
     return 0;
 }
@@ -100,18 +125,48 @@ static int OOCLazyListIter_init(OOCLazyListIterObject* const self, PyObject* con
     return 0;
 }
 
+// A copy that goes away while it still borrows ends its loan, see loans.h. Failing to only leaves
+// an empty list behind, so this gives up quietly.
+static void OOCLazyList_releaseLoan(OOCLazyListObject* const self) {
+    PyObject* type;
+    PyObject* value;
+    PyObject* traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    MDB_txn* txn = nullptr;
+    while(true) {
+        try {
+            MDB_env* const mdb = OOCMap_env(self->ooc);
+            // We might be going away in the middle of one of our own writes.
+            if(self->ooc->envContext->reading())
+                break;
+            txn = txn_begin(mdb, true);
+            OOCMap_releaseListLoan(self->ooc, txn, self->listId, self->copyId);
+            txn_commit(txn);
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+        }
+        break;
+    }
+    PyErr_Restore(type, value, traceback);
+}
+
 static void OOCLazyList_dealloc(OOCLazyListObject* const self) {
+    if(self->borrowing)
+        OOCLazyList_releaseLoan(self);
     Py_DECREF(self->ooc);
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
+static void OOCLazyListIter_closeCursor(OOCLazyListIterObject* self, bool commit);
+
 static void OOCLazyListIter_dealloc(OOCLazyListIterObject* const self) {
+    if(self->cursor != nullptr)
+        OOCLazyListIter_closeCursor(self, false);
     Py_XDECREF(self->list);
-    if(self->cursor != nullptr) {
-        MDB_txn* const txn = mdb_cursor_txn(self->cursor);
-        mdb_cursor_close(self->cursor);
-        txn_abort(txn);
-    }
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
@@ -124,7 +179,8 @@ static Py_ssize_t OOCLazyList_length(PyObject* const pySelf) {
 
     MDB_txn* txn = nullptr;
     try {
-        txn = txn_begin(self->ooc->mdb, false);
+        txn = txn_begin(OOCMap_env(self->ooc), false);
+        OOCLazyListObject_followLoan(self, txn);
         const Py_ssize_t result = OOCLazyListObject_length(self, txn);
         txn_commit(txn);
         return result;
@@ -137,17 +193,47 @@ static Py_ssize_t OOCLazyList_length(PyObject* const pySelf) {
 }
 
 Py_ssize_t OOCLazyListObject_length(OOCLazyListObject* const self, MDB_txn* const txn) {
-    ListKey encodedListKey = {
-        .listIndex = ListKey::listIndexLength,
-        .listId = self->listId,
-    };
+    return OOCMap_getListHeader(self->ooc, txn, self->listId);
+}
 
-    MDB_val mdbKey = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
-    MDB_val mdbValue;
-    const bool found = get(txn, self->ooc->listsDb, &mdbKey, &mdbValue);
-    if(!found) throw OocError(OocError::UnexpectedData);
-    if(mdbValue.mv_size != sizeof(uint32_t)) throw OocError(OocError::UnexpectedData);
-    return *reinterpret_cast<uint32_t*>(mdbValue.mv_data);
+void OOCLazyListObject_followLoan(OOCLazyListObject* const self, MDB_txn* const txn) {
+    if(!self->borrowing) return;
+    if(OOCMap_listLoanActive(self->ooc, txn, self->listId, self->copyId)) return;
+    self->listId = self->copyId;
+    self->borrowing = false;
+}
+
+// Frozen lists never change, see frozen.h, and copies read the items of the list they were copied
+// from, see loans.h. Before we change either, we copy the items into a list of our own.
+static bool OOCLazyList_thaw(OOCLazyListObject* const self) {
+    if(!self->borrowing && !OOCMap_isFrozenId(self->ooc, self->listId)) return true;
+
+    MDB_txn* txn = nullptr;
+    while(true) {
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), true);
+            uint32_t listId;
+            if(self->borrowing) {
+                if(OOCMap_listLoanActive(self->ooc, txn, self->listId, self->copyId))
+                    OOCMap_repayListLoan(self->ooc, txn, self->listId, self->copyId);
+                listId = self->copyId;
+            } else {
+                listId = OOCMap_thawList(self->ooc, txn, self->listId);
+            }
+            txn_commit(txn);
+            self->listId = listId;
+            self->borrowing = false;
+            return true;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+            error.pythonize();
+            return false;
+        }
+    }
 }
 
 static PyObject* OOCLazyList_item(PyObject* const pySelf, Py_ssize_t const index) {
@@ -164,14 +250,14 @@ static PyObject* OOCLazyList_item(PyObject* const pySelf, Py_ssize_t const index
     }
     OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
 
-    ListKey encodedListKey = {
-        .listIndex = index,
-        .listId = self->listId,
-    };
-
     MDB_txn* txn = nullptr;
     try {
-        txn = txn_begin(self->ooc->mdb, false);
+        txn = txn_begin(OOCMap_env(self->ooc), false);
+        OOCLazyListObject_followLoan(self, txn);
+        ListKey encodedListKey = {
+            .listIndex = static_cast<uint32_t>(index),
+            .listId = self->listId,
+        };
         MDB_val mdbKey = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
         MDB_val mdbValue;
         const bool found = get(txn, self->ooc->listsDb, &mdbKey, &mdbValue);
@@ -207,22 +293,54 @@ static int OOCLazyList_setItem(
     }
     OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
 
+    if(!OOCLazyList_thaw(self)) return -1;
+    MDB_txn* txn = nullptr;
+    while(true) {
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), true);
+            OOCMap_settleListLoans(self->ooc, txn, self->listId);
+            OOCLazyListObject_setItem(self, txn, index, item);
+            txn_commit(txn);
+            return 0;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+            error.pythonize();
+            return -1;
+        }
+    }
+}
+
+void OOCLazyListObject_setItem(
+    OOCLazyListObject* const self,
+    MDB_txn* const txn,
+    const Py_ssize_t index,
+    PyObject* const item
+) {
     ListKey encodedListKey = {
-        .listIndex = index,
+        .listIndex = static_cast<uint32_t>(index),
         .listId = self->listId,
     };
-    MDB_txn* txn = nullptr;
-    MDB_cursor* sourceCursor = nullptr;
-    MDB_cursor* destCursor = nullptr;
-    try {
-        txn = txn_begin(self->ooc->mdb, true);
-        if(item == nullptr) {
-            // We're deleting the item by moving all items after it forwards by one.
+    const bool hashing = self->ooc->contentHashes;
+    if(item == nullptr) {
+        // We're deleting the item by moving all items after it forwards by one.
+        ContentHash hash = { .sum = 0, .nanCount = 0 };
+        if(hashing) OOCMap_getListHeader(self->ooc, txn, self->listId, &hash);
+        MDB_cursor* sourceCursor = nullptr;
+        MDB_cursor* destCursor = nullptr;
+        try {
             MDB_val mdbValue;
             destCursor = cursor_open(txn, self->ooc->listsDb);
             MDB_val mdbDestKey = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
             bool destFound = cursor_get(destCursor, &mdbDestKey, &mdbValue, MDB_SET_KEY);
             if(!destFound) throw OocError(OocError::IndexError);
+            if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+            EncodedValue value;
+            memcpy(&value, mdbValue.mv_data, sizeof(value));
+            if(hashing) hash.removeListItem(index, value);
 
             sourceCursor = cursor_open(txn, self->ooc->listsDb);
             encodedListKey.listIndex += 1;
@@ -239,6 +357,12 @@ static int OOCLazyList_setItem(
                     sourceFound = false;
                     break;
                 }
+                if(hashing) {
+                    if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+                    memcpy(&value, mdbValue.mv_data, sizeof(value));
+                    hash.removeListItem(sourceListKey->listIndex, value);
+                    hash.addListItem(sourceListKey->listIndex - 1, value);
+                }
 
                 cursor_put(destCursor, &mdbDestKey, &mdbValue, MDB_CURRENT);
 
@@ -247,339 +371,879 @@ static int OOCLazyList_setItem(
                 sourceFound = cursor_get(sourceCursor, &mdbSourceKey, &mdbValue, MDB_NEXT);
             }
 
-            // sourceCursor now points to the length item, which must be updated
             // destCursor now points to the last item, the one we're about to delete. The index of that
             // item is the new length.
             if(mdbDestKey.mv_size != sizeof(ListKey)) throw OocError(OocError::UnexpectedData);
-            ListKey* const destListKey = reinterpret_cast<ListKey*>(mdbDestKey.mv_data);
-            mdbValue = (MDB_val) { .mv_size = sizeof(destListKey->listIndex), .mv_data = &destListKey->listIndex };
-            cursor_put(sourceCursor, &mdbDestKey, &mdbValue, MDB_CURRENT);
-            cursor_close(sourceCursor);
-
-            // destCursor now points to the last item and must be deleted
+            const uint32_t newLength = reinterpret_cast<ListKey*>(mdbDestKey.mv_data)->listIndex;
             cursor_del(destCursor);
-            cursor_close(destCursor);
-        } else {
-            // We're setting the item.
-            const Py_ssize_t length = OOCLazyListObject_length(self, txn);
-            if(index >= length) throw OocError(OocError::IndexError);
-
-            Id2EncodedMap insertedItems;
-            EncodedValue encodedItem;
-            OOCMap_encode(self->ooc, item, &encodedItem, txn, insertedItems);
-            MDB_val mdbKey = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
-            MDB_val mdbValue = { .mv_size = sizeof(encodedItem), .mv_data = &encodedItem };
-            put(txn, self->ooc->listsDb, &mdbKey, &mdbValue);
+            OOCMap_putListHeader(self->ooc, txn, self->listId, newLength, hash);
+        } catch(...) {
+            if(sourceCursor != nullptr) cursor_close(sourceCursor);
+            if(destCursor != nullptr) cursor_close(destCursor);
+            throw;
         }
-        txn_commit(txn);
-        return 0;
-    } catch(const OocError& error) {
-        if(sourceCursor != nullptr) cursor_close(sourceCursor);
-        if(destCursor != nullptr) cursor_close(destCursor);
-        if(txn != nullptr) txn_abort(txn);
-        error.pythonize();
-        return -1;
+        cursor_close(sourceCursor);
+        cursor_close(destCursor);
+    } else {
+        // We're setting the item.
+        ContentHash hash;
+        const Py_ssize_t length = OOCMap_getListHeader(self->ooc, txn, self->listId, &hash);
+        if(index >= length) throw OocError(OocError::IndexError);
+
+        Id2EncodedMap insertedItems;
+        EncodedValue encodedItem;
+        OOCMap_encode(self->ooc, item, &encodedItem, txn, insertedItems);
+        MDB_val mdbKey = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
+        MDB_val mdbValue;
+        if(hashing) {
+            if(!get(txn, self->ooc->listsDb, &mdbKey, &mdbValue)) throw OocError(OocError::UnexpectedData);
+            if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+            EncodedValue oldItem;
+            memcpy(&oldItem, mdbValue.mv_data, sizeof(oldItem));
+            hash.removeListItem(index, oldItem);
+            hash.addListItem(index, encodedItem);
+            OOCMap_putListHeader(self->ooc, txn, self->listId, length, hash);
+        }
+        mdbValue = (MDB_val) { .mv_size = sizeof(encodedItem), .mv_data = &encodedItem };
+        put(txn, self->ooc->listsDb, &mdbKey, &mdbValue);
     }
 }
 
-PyObject* OOCLazyList_eager(PyObject* const pySelf) {
-    if(pySelf->ob_type != &OOCLazyListType) {
-        PyErr_BadArgument();
-        return nullptr;
-    }
-    OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
-
-    MDB_txn* txn = nullptr;
-    try {
-        txn = txn_begin(self->ooc->mdb, false);
-        PyObject* const result = OOCLazyListObject_eager(self, txn);
-        txn_commit(txn);
-        return result;
-    } catch(const OocError& error) {
-        if(txn != nullptr)
-            txn_abort(txn);
-        error.pythonize();
+// Returns the key the cursor is on, or nullptr if the cursor has gone past the items of the list.
+static const ListKey* OOCLazyListObject_itemKey(const OOCLazyListObject* const self, const MDB_val* const mdbKey) {
+    if(mdbKey->mv_size != sizeof(ListKey)) throw OocError(OocError::UnexpectedData);
+    const ListKey* const listKey = static_cast<const ListKey*>(mdbKey->mv_data);
+    if(listKey->listId != self->listId || listKey->listIndex == ListKey::listIndexLength)
         return nullptr;
-    }
+    return listKey;
 }
 
-PyObject* OOCLazyListObject_eager(OOCLazyListObject* const self, MDB_txn* const txn) {
-    const Py_ssize_t length = OOCLazyListObject_length(self, txn);
-    PyObject* result = nullptr;
+// Up to this step, walking the cursor from one item of a slice to the next is cheaper than seeking.
+static const Py_ssize_t sliceWalkDistance = 8;
+
+PyObject* OOCLazyListObject_slice(
+    OOCLazyListObject* const self,
+    MDB_txn* const txn,
+    const Py_ssize_t start,
+    const Py_ssize_t step,
+    const Py_ssize_t slicelength
+) {
+    PyObject* const result = PyList_New(slicelength);
+    if(result == nullptr) throw OocError(OocError::AlreadyPythonizedError);
+    if(slicelength <= 0) return result;
+
+    // We always walk forward, so with a negative step, we start at the other end.
+    const Py_ssize_t stride = step > 0 ? step : -step;
+    const Py_ssize_t first = step > 0 ? start : start + (slicelength - 1) * step;
+
     MDB_cursor* cursor = nullptr;
     try {
-        result = PyList_New(length);
-        if(result == nullptr) throw OocError(OocError::OutOfMemory);
-        if(length <= 0) return result;
+        std::vector<EncodedValue> values(slicelength);
         cursor = cursor_open(txn, self->ooc->listsDb);
 
         ListKey encodedListKey = {
-            .listIndex = 0,
+            .listIndex = static_cast<uint32_t>(first),
             .listId = self->listId,
         };
         MDB_val mdbKey = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
         MDB_val mdbValue;
         bool found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET_RANGE);
-
-        while(found) {
-            if(mdbKey.mv_size != sizeof(ListKey)) throw OocError(OocError::UnexpectedData);
-            ListKey* const listItemKey = static_cast<ListKey*>(mdbKey.mv_data);
-            if(
-                listItemKey->listId != self->listId ||
-                listItemKey->listIndex == ListKey::listIndexLength
-            ) {
-                found = false;
-                break;
+        for(Py_ssize_t i = 0; i < slicelength; ++i) {
+            const Py_ssize_t index = first + i * stride;
+            if(i > 0) {
+                if(stride <= sliceWalkDistance) {
+                    for(Py_ssize_t skipped = 0; found && skipped < stride; ++skipped)
+                        found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT);
+                } else {
+                    encodedListKey.listIndex = static_cast<uint32_t>(index);
+                    mdbKey = (MDB_val) { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
+                    found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET_KEY);
+                }
             }
-            if(listItemKey->listIndex != encodedListKey.listIndex) throw OocError(OocError::UnexpectedData);
-            encodedListKey.listIndex += 1;  // We just do this to check that we're setting all the elements in the list.
-
+            if(!found) throw OocError(OocError::UnexpectedData);
+            const ListKey* const listItemKey = OOCLazyListObject_itemKey(self, &mdbKey);
+            if(listItemKey == nullptr || listItemKey->listIndex != index) throw OocError(OocError::UnexpectedData);
             if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
-            EncodedValue* const encodedResult = static_cast<EncodedValue* const>(mdbValue.mv_data);
-            PyObject* const item = OOCMap_decode(self->ooc, encodedResult, txn);
-            PyList_SET_ITEM(result, listItemKey->listIndex, item);
-
-            found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT);
+            memcpy(&values[step > 0 ? i : slicelength - 1 - i], mdbValue.mv_data, sizeof(EncodedValue));
         }
-        if(encodedListKey.listIndex != length) throw OocError(OocError::UnexpectedData);  // We didn't set all the values in the list.
-
         cursor_close(cursor);
+        cursor = nullptr;
+
+        OOCMap_prefetch(self->ooc, txn, values.data(), values.size(), true);
+        for(Py_ssize_t i = 0; i < slicelength; ++i)
+            PyList_SET_ITEM(result, i, OOCMap_decode(self->ooc, &values[i], txn));
     } catch(...) {
-        if(result != nullptr) Py_DECREF(result);
         if(cursor != nullptr) cursor_close(cursor);
+        Py_DECREF(result);
         throw;
     }
 
     return result;
 }
 
-static PyObject* OOCLazyList_index(
-    PyObject* const pySelf,
-    PyObject *const *const args,
-    const Py_ssize_t nargs
+// Compares the list to a Python list like PyObject_RichCompare(), in one transaction.
+static PyObject* OOCLazyListObject_compareList(
+    OOCLazyListObject* const self,
+    MDB_txn* const txn,
+    PyObject* const other,
+    const int op
 ) {
-    if(pySelf->ob_type != &OOCLazyListType) {
-        PyErr_BadArgument();
-        return nullptr;
-    }
-    OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
-
-    // parse parameters
-    if(nargs < 1) {
-        PyErr_Format(PyExc_TypeError, "index expected at least 1 argument, got 0");
-        return nullptr;
-    }
-    PyObject* const value = args[0];
-
-    Py_ssize_t start = 0;
-    if(nargs > 1) {
-        start = PyLong_AsSsize_t(args[1]);
-        if(PyErr_Occurred()) return nullptr;
-    }
-
-    Py_ssize_t stop = 9223372036854775807;
-    if(nargs > 2) {
-        stop = PyLong_AsSsize_t(args[2]);
-        if(PyErr_Occurred()) return nullptr;
-    }
+    const Py_ssize_t length = OOCLazyListObject_length(self, txn);
+    if((op == Py_EQ || op == Py_NE) && length != PyList_GET_SIZE(other))
+        return PyBool_FromLong(op == Py_NE);
 
-    Py_ssize_t index;
-    MDB_txn* txn = nullptr;
+    MDB_cursor* const cursor = cursor_open(txn, self->ooc->listsDb);
     try {
-        txn = txn_begin(self->ooc->mdb, false);
-        index = OOCLazyListObject_index(self, txn, value, start, stop);
-        txn_commit(txn);
-    } catch(const OocError& error) {
-        if(txn != nullptr)
-            txn_abort(txn);
-        error.pythonize();
-        return nullptr;
+        ListKey encodedListKey = { .listIndex = 0, .listId = self->listId };
+        MDB_val mdbKey = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
+        MDB_val mdbValue;
+        bool found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET_RANGE);
+        // Comparing items can run any code, including code that changes other, so we check its
+        // length every time.
+        for(Py_ssize_t i = 0; i < length && i < PyList_GET_SIZE(other); ++i) {
+            if(i > 0)
+                found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT);
+            if(!found) throw OocError(OocError::UnexpectedData);
+            const ListKey* const listItemKey = OOCLazyListObject_itemKey(self, &mdbKey);
+            if(listItemKey == nullptr || listItemKey->listIndex != i) throw OocError(OocError::UnexpectedData);
+            if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+            EncodedValue value;
+            memcpy(&value, mdbValue.mv_data, sizeof(value));
+
+            PyObject* const item = OOCMap_decode(self->ooc, &value, txn);
+            PyObject* const otherItem = PyList_GET_ITEM(other, i);
+            Py_INCREF(otherItem);
+            // Like Python's lists, we compare only the first items that aren't equal with op.
+            const int equal = PyObject_RichCompareBool(item, otherItem, Py_EQ);
+            PyObject* result = nullptr;
+            if(equal == 0) {
+                if(op == Py_EQ || op == Py_NE)
+                    result = PyBool_FromLong(op == Py_NE);
+                else
+                    result = PyObject_RichCompare(item, otherItem, op);
+            }
+            Py_DECREF(item);
+            Py_DECREF(otherItem);
+            if(equal < 0 || (equal == 0 && result == nullptr))
+                throw OocError(OocError::AlreadyPythonizedError);
+            if(equal == 0) {
+                cursor_close(cursor);
+                return result;
+            }
+        }
+    } catch(...) {
+        cursor_close(cursor);
+        throw;
     }
+    cursor_close(cursor);
 
-    if(index < 0) {
-        PyErr_Format(PyExc_ValueError, "%R is not in list", value);
-        return nullptr;
-    } else {
-        return PyLong_FromSsize_t(index);
-    }
+    // One is a prefix of the other.
+    const Py_ssize_t otherLength = PyList_GET_SIZE(other);
+    Py_RETURN_RICHCOMPARE(length, otherLength, op);
 }
 
-Py_ssize_t OOCLazyListObject_index(
-    OOCLazyListObject* self,
-    MDB_txn* txn,
-    PyObject* value,
-    Py_ssize_t start,
-    Py_ssize_t stop
+// Moves the items from index from to the end of the list so they start at index to. This leaves
+// the items in between, or the ones at the end, for the caller to overwrite or delete. If hash isn't
+// null, this moves the items in the content hash as well.
+static void OOCLazyListObject_moveItems(
+    OOCLazyListObject* const self,
+    MDB_txn* const txn,
+    const Py_ssize_t from,
+    const Py_ssize_t to,
+    const Py_ssize_t length,
+    ContentHash* const hash = nullptr
 ) {
-    // unfuck start and stop
-    // That behavior in Python is seriously weird and we have to copy it here.
-    Py_ssize_t length = -1;
-    if(start < 0) {
-        length = OOCLazyListObject_length(self, txn);
-        start += length;
-        if(start < 0)
-            start = 0;
-    }
-    if(stop < 0) {
-        if(length < 0)
-            length = OOCLazyListObject_length(self, txn);
-        stop += length;
-    }
+    if(from == to || from >= length) return;
 
-    Id2EncodedMap insertedItemsInThisTransaction;
-    EncodedValue encodedValue;
+    // Moving items up, we walk backwards so we don't overwrite items we haven't moved yet.
+    const bool up = to > from;
+    const MDB_cursor_op direction = up ? MDB_PREV : MDB_NEXT;
+    const Py_ssize_t count = length - from;
+
+    // Destinations past the end of the list have to be inserted. The others already exist, so a
+    // second cursor walks along and overwrites them, which saves descending the tree for each item.
+    MDB_cursor* sourceCursor = nullptr;
+    MDB_cursor* destCursor = nullptr;
     try {
-        OOCMap_encode(self->ooc, value, &encodedValue, txn, insertedItemsInThisTransaction, true);
-    } catch(const MdbError& e) {
-        if(e.mdbErrorCode != EACCES) throw;
-        // We tried to write the value in a readonly transaction, so we got the EACCES error. This must
-        // mean the value is a mutable value. The only thing we can do is search linearly through the list.
-        encodedValue.typeCodeWithLength = 0xff;  // Mark the encoded value as unusable
-    } catch(const OocError& e) {
-        if(e.errorCode != OocError::ImmutableValueNotFound) throw;
-        // Needle is immutable but not inserted into the map, so we know for sure we won't find it.
-        return -1;
+        sourceCursor = cursor_open(txn, self->ooc->listsDb);
+        destCursor = cursor_open(txn, self->ooc->listsDb);
+        ListKey sourceListKey = {
+            .listIndex = static_cast<uint32_t>(up ? length - 1 : from),
+            .listId = self->listId,
+        };
+        MDB_val mdbSourceKey = { .mv_size = sizeof(sourceListKey), .mv_data = &sourceListKey };
+        MDB_val mdbSourceValue;
+        bool found = cursor_get(sourceCursor, &mdbSourceKey, &mdbSourceValue, MDB_SET_KEY);
+        bool destPositioned = false;
+        for(Py_ssize_t i = 0; i < count; ++i) {
+            const Py_ssize_t sourceIndex = up ? length - 1 - i : from + i;
+            const Py_ssize_t destIndex = sourceIndex + (to - from);
+            if(!found) throw OocError(OocError::UnexpectedData);
+            const ListKey* const sourceItemKey = OOCLazyListObject_itemKey(self, &mdbSourceKey);
+            if(sourceItemKey == nullptr || sourceItemKey->listIndex != sourceIndex) throw OocError(OocError::UnexpectedData);
+            if(mdbSourceValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+
+            // Writing might move the page the value is on, so we copy it first.
+            EncodedValue value;
+            memcpy(&value, mdbSourceValue.mv_data, sizeof(value));
+            if(hash != nullptr) {
+                hash->removeListItem(sourceIndex, value);
+                hash->addListItem(destIndex, value);
+            }
+            MDB_val mdbValue = { .mv_size = sizeof(value), .mv_data = &value };
+            ListKey destListKey = {
+                .listIndex = static_cast<uint32_t>(destIndex),
+                .listId = self->listId,
+            };
+            MDB_val mdbDestKey = { .mv_size = sizeof(destListKey), .mv_data = &destListKey };
+            if(destIndex >= length) {
+                put(txn, self->ooc->listsDb, &mdbDestKey, &mdbValue);
+            } else {
+                MDB_val mdbOldValue;
+                const bool destFound = cursor_get(
+                    destCursor,
+                    &mdbDestKey,
+                    &mdbOldValue,
+                    destPositioned ? direction : MDB_SET_KEY);
+                destPositioned = true;
+                if(!destFound) throw OocError(OocError::UnexpectedData);
+                const ListKey* const destItemKey = OOCLazyListObject_itemKey(self, &mdbDestKey);
+                if(destItemKey == nullptr || destItemKey->listIndex != destIndex) throw OocError(OocError::UnexpectedData);
+                cursor_put(destCursor, &mdbDestKey, &mdbValue, MDB_CURRENT);
+            }
+
+            if(i + 1 < count)
+                found = cursor_get(sourceCursor, &mdbSourceKey, &mdbSourceValue, direction);
+        }
+    } catch(...) {
+        if(sourceCursor != nullptr) cursor_close(sourceCursor);
+        if(destCursor != nullptr) cursor_close(destCursor);
+        throw;
     }
+    cursor_close(sourceCursor);
+    cursor_close(destCursor);
+}
 
+// Removes the items from index from up to index to from the content hash
+static void OOCLazyListObject_unhashItems(
+    OOCLazyListObject* const self,
+    MDB_txn* const txn,
+    const Py_ssize_t from,
+    const Py_ssize_t to,
+    ContentHash* const hash
+) {
+    if(from >= to) return;
     ListKey encodedListKey = {
-        .listIndex = start,
+        .listIndex = static_cast<uint32_t>(from),
         .listId = self->listId,
     };
-    MDB_val mdbKey = {.mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey};
-    MDB_val mdbValue;
+    MDB_val mdbKey = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
     MDB_cursor* const cursor = cursor_open(txn, self->ooc->listsDb);
-    bool found;
     try {
-        found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET_RANGE);
-        while(found) {
-            if(mdbKey.mv_size != sizeof(ListKey)) throw OocError(OocError::UnexpectedData);
-            ListKey* const listItemKey = static_cast<ListKey*>(mdbKey.mv_data);
-            if(
-                listItemKey->listIndex >= stop ||
-                listItemKey->listId != self->listId ||
-                listItemKey->listIndex == ListKey::listIndexLength
-            ) {
-                found = false;
-                break;
-            }
-
+        MDB_val mdbValue;
+        bool found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET_KEY);
+        for(Py_ssize_t index = from; index < to; ++index) {
+            if(index > from) found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT);
+            if(!found) throw OocError(OocError::UnexpectedData);
+            const ListKey* const listItemKey = OOCLazyListObject_itemKey(self, &mdbKey);
+            if(listItemKey == nullptr || listItemKey->listIndex != index) throw OocError(OocError::UnexpectedData);
             if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
-            EncodedValue* const encodedItem = static_cast<EncodedValue* const>(mdbValue.mv_data);
-            if(encodedValue.typeCodeWithLength == 0xff) {
-                PyObject* const item = OOCMap_decode(self->ooc, encodedItem, txn);
-                if(PyObject_RichCompareBool(value, item, Py_EQ))
-                    break;
-            } else {
-                if(encodedValue == *encodedItem)
-                    break;
-            }
-
-            found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT);
+            EncodedValue value;
+            memcpy(&value, mdbValue.mv_data, sizeof(value));
+            hash->removeListItem(index, value);
         }
-
-        cursor_close(cursor);
     } catch(...) {
         cursor_close(cursor);
         throw;
     }
-
-    if(!found)
-        return -1;
-
-    ListKey* const listKey = static_cast<ListKey* const>(mdbKey.mv_data);
-    return listKey->listIndex;
+    cursor_close(cursor);
 }
 
-static PyObject* OOCLazyList_count(
-    PyObject* const pySelf,
-    PyObject* const value
+// Writes the new length and content hash, and deletes the items beyond the new length.
+static void OOCLazyListObject_setLength(
+    OOCLazyListObject* const self,
+    MDB_txn* const txn,
+    const Py_ssize_t newLength,
+    const ContentHash& hash
 ) {
-    if(pySelf->ob_type != &OOCLazyListType) {
-        PyErr_BadArgument();
+    ListKey encodedListKey = {
+        .listIndex = static_cast<uint32_t>(newLength),
+        .listId = self->listId,
+    };
+    MDB_val mdbKey = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
+    MDB_cursor* const cursor = cursor_open(txn, self->ooc->listsDb);
+    try {
+        MDB_val mdbValue;
+        bool found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET_RANGE);
+        while(found && OOCLazyListObject_itemKey(self, &mdbKey) != nullptr) {
+            cursor_del(cursor);
+            found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT);
+        }
+    } catch(...) {
+        cursor_close(cursor);
+        throw;
+    }
+    cursor_close(cursor);
+
+    OOCMap_putListHeader(self->ooc, txn, self->listId, newLength, hash);
+}
+
+void OOCLazyListObject_setSlice(
+    OOCLazyListObject* const self,
+    MDB_txn* const txn,
+    const Py_ssize_t start,
+    Py_ssize_t stop,
+    Py_ssize_t step,
+    const Py_ssize_t slicelength,
+    PyObject* const items
+) {
+    const bool hashing = self->ooc->contentHashes;
+    ContentHash hash;
+    const Py_ssize_t length = OOCMap_getListHeader(self->ooc, txn, self->listId, &hash);
+
+    // Encoding can fail, so we do it before we change anything.
+    const Py_ssize_t itemCount = items == nullptr ? 0 : PySequence_Fast_GET_SIZE(items);
+    std::vector<EncodedValue> encodedItems(itemCount);
+    Id2EncodedMap insertedItems;
+    for(Py_ssize_t i = 0; i < itemCount; ++i)
+        OOCMap_encode(self->ooc, PySequence_Fast_GET_ITEM(items, i), &encodedItems[i], txn, insertedItems);
+
+    ListKey encodedListKey = {
+        .listIndex = 0,
+        .listId = self->listId,
+    };
+    MDB_val mdbKey = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
+    MDB_val mdbValue = { .mv_size = sizeof(EncodedValue), .mv_data = nullptr };
+
+    if(step == 1) {
+        // Python lets you assign to l[5:2], and inserts the items at 5.
+        if(stop < start) stop = start;
+        const Py_ssize_t newLength = length - (stop - start) + itemCount;
+        if(newLength >= ListKey::listIndexLength) throw OocError(OocError::IndexError);
+
+        if(hashing) OOCLazyListObject_unhashItems(self, txn, start, stop, &hash);
+        OOCLazyListObject_moveItems(self, txn, stop, start + itemCount, length, hashing ? &hash : nullptr);
+        for(Py_ssize_t i = 0; i < itemCount; ++i) {
+            encodedListKey.listIndex = static_cast<uint32_t>(start + i);
+            mdbValue.mv_data = &encodedItems[i];
+            put(txn, self->ooc->listsDb, &mdbKey, &mdbValue);
+            if(hashing) hash.addListItem(encodedListKey.listIndex, encodedItems[i]);
+        }
+        if(newLength != length || hashing)
+            OOCLazyListObject_setLength(self, txn, newLength, hash);
+        return;
+    }
+
+    if(items != nullptr) {
+        if(itemCount != slicelength) {
+            PyErr_Format(
+                PyExc_ValueError,
+                "attempt to assign sequence of size %zd to extended slice of size %zd",
+                itemCount,
+                slicelength);
+            throw OocError(OocError::AlreadyPythonizedError);
+        }
+        for(Py_ssize_t i = 0; i < itemCount; ++i) {
+            encodedListKey.listIndex = static_cast<uint32_t>(start + i * step);
+            if(hashing) {
+                OOCLazyListObject_unhashItems(self, txn, encodedListKey.listIndex, encodedListKey.listIndex + 1, &hash);
+                hash.addListItem(encodedListKey.listIndex, encodedItems[i]);
+            }
+            mdbValue.mv_data = &encodedItems[i];
+            put(txn, self->ooc->listsDb, &mdbKey, &mdbValue);
+        }
+        if(hashing) OOCMap_putListHeader(self->ooc, txn, self->listId, length, hash);
+        return;
+    }
+
+    // Deleting an extended slice means closing the gaps between the survivors, in one walk from
+    // the first deleted item to the end.
+    if(slicelength <= 0) return;
+    const Py_ssize_t first = step > 0 ? start : start + (slicelength - 1) * step;
+    if(step < 0) step = -step;
+    ListKey sourceListKey = {
+        .listIndex = static_cast<uint32_t>(first),
+        .listId = self->listId,
+    };
+    MDB_val mdbSourceKey = { .mv_size = sizeof(sourceListKey), .mv_data = &sourceListKey };
+    Py_ssize_t destIndex = first;
+    MDB_cursor* const cursor = cursor_open(txn, self->ooc->listsDb);
+    try {
+        MDB_val mdbSourceValue;
+        bool found = cursor_get(cursor, &mdbSourceKey, &mdbSourceValue, MDB_SET_KEY);
+        while(found) {
+            const ListKey* const listItemKey = OOCLazyListObject_itemKey(self, &mdbSourceKey);
+            if(listItemKey == nullptr) break;
+            const Py_ssize_t offset = listItemKey->listIndex - first;
+            if(mdbSourceValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+            EncodedValue value;
+            memcpy(&value, mdbSourceValue.mv_data, sizeof(value));
+            if(hashing) hash.removeListItem(listItemKey->listIndex, value);
+            if(offset % step != 0 || offset / step >= slicelength) {
+                if(hashing) hash.addListItem(destIndex, value);
+                encodedListKey.listIndex = static_cast<uint32_t>(destIndex);
+                mdbValue.mv_data = &value;
+                put(txn, self->ooc->listsDb, &mdbKey, &mdbValue);
+                destIndex += 1;
+            }
+            found = cursor_get(cursor, &mdbSourceKey, &mdbSourceValue, MDB_NEXT);
+        }
+    } catch(...) {
+        cursor_close(cursor);
+        throw;
+    }
+    cursor_close(cursor);
+    OOCLazyListObject_setLength(self, txn, destIndex, hash);
+}
+
+static PyObject* OOCLazyList_subscript(PyObject* const pySelf, PyObject* const key) {
+    if(pySelf->ob_type != &OOCLazyListType) {
+        PyErr_BadArgument();
         return nullptr;
     }
     OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
 
-    Py_ssize_t count;
+    if(PyIndex_Check(key)) {
+        Py_ssize_t index = PyNumber_AsSsize_t(key, PyExc_IndexError);
+        if(index == -1 && PyErr_Occurred()) return nullptr;
+        if(index < 0) {
+            const Py_ssize_t length = OOCLazyList_length(pySelf);
+            if(length < 0) return nullptr;
+            index += length;
+        }
+        return OOCLazyList_item(pySelf, index);
+    }
+    if(!PySlice_Check(key)) {
+        PyErr_Format(PyExc_TypeError, "list indices must be integers or slices, not %.200s", Py_TYPE(key)->tp_name);
+        return nullptr;
+    }
+
+    Py_ssize_t start, stop, step;
+    if(PySlice_Unpack(key, &start, &stop, &step) < 0) return nullptr;
+
     MDB_txn* txn = nullptr;
     try {
-        txn = txn_begin(self->ooc->mdb, false);
-        count = OOCLazyListObject_count(self, txn, value);
+        txn = txn_begin(OOCMap_env(self->ooc), false);
+        OOCLazyListObject_followLoan(self, txn);
+        const Py_ssize_t length = OOCLazyListObject_length(self, txn);
+        const Py_ssize_t slicelength = PySlice_AdjustIndices(length, &start, &stop, step);
+        PyObject* const result = OOCLazyListObject_slice(self, txn, start, step, slicelength);
         txn_commit(txn);
+        return result;
     } catch(const OocError& error) {
         if(txn != nullptr)
             txn_abort(txn);
         error.pythonize();
         return nullptr;
     }
+}
 
-    return PyLong_FromSsize_t(count);
+static int OOCLazyList_assSubscript(PyObject* const pySelf, PyObject* const key, PyObject* const value) {
+    if(pySelf->ob_type != &OOCLazyListType) {
+        PyErr_BadArgument();
+        return -1;
+    }
+    OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
+
+    if(PyIndex_Check(key)) {
+        Py_ssize_t index = PyNumber_AsSsize_t(key, PyExc_IndexError);
+        if(index == -1 && PyErr_Occurred()) return -1;
+        if(index < 0) {
+            const Py_ssize_t length = OOCLazyList_length(pySelf);
+            if(length < 0) return -1;
+            index += length;
+        }
+        return OOCLazyList_setItem(pySelf, index, value);
+    }
+    if(!PySlice_Check(key)) {
+        PyErr_Format(PyExc_TypeError, "list indices must be integers or slices, not %.200s", Py_TYPE(key)->tp_name);
+        return -1;
+    }
+
+    Py_ssize_t start, stop, step;
+    if(PySlice_Unpack(key, &start, &stop, &step) < 0) return -1;
+
+    // If we have to retry the transaction, we need to see the same items again. This also takes a
+    // copy when the items come from this list.
+    PyObject* items = nullptr;
+    if(value != nullptr) {
+        items = PySequence_Fast(value, "can only assign an iterable");
+        if(items == nullptr) return -1;
+    }
+
+    if(!OOCLazyList_thaw(self)) {
+        Py_XDECREF(items);
+        return -1;
+    }
+    MDB_txn* txn = nullptr;
+    while(true) {
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), true);
+            OOCMap_settleListLoans(self->ooc, txn, self->listId);
+            const Py_ssize_t length = OOCLazyListObject_length(self, txn);
+            Py_ssize_t sliceStart = start, sliceStop = stop;
+            const Py_ssize_t slicelength = PySlice_AdjustIndices(length, &sliceStart, &sliceStop, step);
+            OOCLazyListObject_setSlice(self, txn, sliceStart, sliceStop, step, slicelength, items);
+            txn_commit(txn);
+            break;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+            Py_XDECREF(items);
+            error.pythonize();
+            return -1;
+        }
+    }
+    Py_XDECREF(items);
+    return 0;
 }
 
-Py_ssize_t OOCLazyListObject_count(OOCLazyListObject* self, MDB_txn* txn, PyObject* value) {
+PyObject* OOCLazyList_eager(PyObject* const pySelf) {
+    if(pySelf->ob_type != &OOCLazyListType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
+
+    MDB_txn* txn = nullptr;
+    try {
+        txn = txn_begin(OOCMap_env(self->ooc), false);
+        OOCLazyListObject_followLoan(self, txn);
+        PyObject* const result = OOCLazyListObject_eager(self, txn);
+        txn_commit(txn);
+        return result;
+    } catch(const OocError& error) {
+        if(txn != nullptr)
+            txn_abort(txn);
+        error.pythonize();
+        return nullptr;
+    }
+}
+
+PyObject* OOCLazyListObject_eager(OOCLazyListObject* const self, MDB_txn* const txn) {
+    const Py_ssize_t length = OOCLazyListObject_length(self, txn);
+    PyObject* result = nullptr;
+    MDB_cursor* cursor = nullptr;
+    try {
+        result = PyList_New(length);
+        if(result == nullptr) throw OocError(OocError::OutOfMemory);
+        if(length <= 0) return result;
+        cursor = cursor_open(txn, self->ooc->listsDb);
+
+        ListKey encodedListKey = {
+            .listIndex = 0,
+            .listId = self->listId,
+        };
+        MDB_val mdbKeys[cursorBatchSize];
+        MDB_val mdbValues[cursorBatchSize];
+        mdbKeys[0] = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
+        MDB_cursor_op op = MDB_SET_KEY;
+        for(Py_ssize_t index = 0; index < length; op = MDB_NEXT) {
+            const size_t wanted = std::min(static_cast<size_t>(length - index), cursorBatchSize);
+            // We didn't find all the items in the list.
+            if(cursor_get_batch(cursor, mdbKeys, mdbValues, wanted, op) != wanted)
+                throw OocError(OocError::UnexpectedData);
+            for(size_t i = 0; i < wanted; ++i, ++index) {
+                const ListKey* const listItemKey = OOCLazyListObject_itemKey(self, &mdbKeys[i]);
+                if(listItemKey == nullptr || listItemKey->listIndex != index) throw OocError(OocError::UnexpectedData);
+                if(mdbValues[i].mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+                EncodedValue* const encodedResult = static_cast<EncodedValue*>(mdbValues[i].mv_data);
+                PyList_SET_ITEM(result, index, OOCMap_decode(self->ooc, encodedResult, txn));
+            }
+        }
+
+        cursor_close(cursor);
+    } catch(...) {
+        if(result != nullptr) Py_DECREF(result);
+        if(cursor != nullptr) cursor_close(cursor);
+        throw;
+    }
+
+    return result;
+}
+
+static PyObject* OOCLazyList_index(
+    PyObject* const pySelf,
+    PyObject *const *const args,
+    const Py_ssize_t nargs
+) {
+    if(pySelf->ob_type != &OOCLazyListType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
+
+    // parse parameters
+    if(nargs < 1) {
+        PyErr_Format(PyExc_TypeError, "index expected at least 1 argument, got 0");
+        return nullptr;
+    }
+    PyObject* const value = args[0];
+
+    Py_ssize_t start = 0;
+    if(nargs > 1) {
+        start = PyLong_AsSsize_t(args[1]);
+        if(PyErr_Occurred()) return nullptr;
+    }
+
+    Py_ssize_t stop = 9223372036854775807;
+    if(nargs > 2) {
+        stop = PyLong_AsSsize_t(args[2]);
+        if(PyErr_Occurred()) return nullptr;
+    }
+
+    Py_ssize_t index;
+    MDB_txn* txn = nullptr;
+    try {
+        txn = txn_begin(OOCMap_env(self->ooc), false);
+        OOCLazyListObject_followLoan(self, txn);
+        index = OOCLazyListObject_index(self, txn, value, start, stop);
+        txn_commit(txn);
+    } catch(const OocError& error) {
+        if(txn != nullptr)
+            txn_abort(txn);
+        error.pythonize();
+        return nullptr;
+    }
+
+    if(index < 0) {
+        PyErr_Format(PyExc_ValueError, "%R is not in list", value);
+        return nullptr;
+    } else {
+        return PyLong_FromSsize_t(index);
+    }
+}
+
+// Whether two values with different encodings are always different, if one of them is this one.
+// That's true for None, strings and tuples of those, but numbers are equal to numbers of other types.
+static bool OOCLazyList_encodingDecidesEquality(PyObject* const value) {
+    if(value == Py_None || PyUnicode_CheckExact(value)) return true;
+    if(!PyTuple_CheckExact(value)) return false;
+    const Py_ssize_t size = PyTuple_GET_SIZE(value);
+    for(Py_ssize_t i = 0; i < size; ++i) {
+        if(!OOCLazyList_encodingDecidesEquality(PyTuple_GET_ITEM(value, i)))
+            return false;
+    }
+    return true;
+}
+
+// What the encoding of an item tells us about whether it equals the needle
+enum ScanMatch {
+    SCAN_DIFFERENT,
+    SCAN_EQUAL,
+    SCAN_UNDECIDED  // we have to decode the item and ask Python
+};
+
+// Compares the items from start to stop with a needle, in place and without the GIL. match() looks at
+// the encoding of each item. The items it can't decide are decoded and compared afterwards, with the
+// GIL. Returns the index of the first match, or -1. With countAll, it returns the number of matches.
+template<typename Match>
+static Py_ssize_t OOCLazyListObject_scanEncoded(
+    OOCLazyListObject* const self,
+    MDB_txn* const txn,
+    PyObject* const needle,
+    const Py_ssize_t start,
+    const Py_ssize_t stop,
+    const bool countAll,
+    Match&& match
+) {
+    Py_ssize_t index = start;
+    Py_ssize_t count = 0;
+    bool matched = false;
+    std::vector<std::pair<Py_ssize_t, EncodedValue>> undecided;
+    if(start < stop) {
+        ListKey encodedListKey = {
+            .listIndex = static_cast<uint32_t>(start),
+            .listId = self->listId,
+        };
+        MDB_val mdbKey = {.mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey};
+        MDB_cursor* const cursor = cursor_open(txn, self->ooc->listsDb);
+        try {
+            const size_t wanted = stop - start;
+            const size_t visited = cursor_scan(cursor, &mdbKey, wanted, MDB_SET_KEY,
+                [&](const MDB_val& key, const MDB_val& value) -> bool {
+                    if(key.mv_size != sizeof(ListKey)) throw OocError(OocError::UnexpectedData);
+                    const ListKey* const listItemKey = static_cast<const ListKey*>(key.mv_data);
+                    if(listItemKey->listId != self->listId || listItemKey->listIndex != index)
+                        throw OocError(OocError::UnexpectedData);
+                    if(value.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+                    const EncodedValue& item = *static_cast<const EncodedValue*>(value.mv_data);
+                    switch(match(item)) {
+                    case SCAN_EQUAL:
+                        if(!countAll) {
+                            matched = true;
+                            return false;
+                        }
+                        count += 1;
+                        break;
+                    case SCAN_UNDECIDED:
+                        undecided.emplace_back(index, item);
+                        break;
+                    case SCAN_DIFFERENT:
+                        break;
+                    }
+                    index += 1;
+                    return true;
+                });
+            if(visited != wanted && !matched) throw OocError(OocError::UnexpectedData);
+        } catch(...) {
+            cursor_close(cursor);
+            throw;
+        }
+        cursor_close(cursor);
+    }
+
+    // All of these come before the first match we found, so in order, they decide index().
+    for(auto& candidate : undecided) {
+        PyObject* const item = OOCMap_decode(self->ooc, &candidate.second, txn);
+        const int comparison = PyObject_RichCompareBool(needle, item, Py_EQ);
+        Py_DECREF(item);
+        if(comparison < 0) throw OocError(OocError::AlreadyPythonizedError);
+        if(!comparison) continue;
+        if(!countAll) return candidate.first;
+        count += 1;
+    }
+
+    if(countAll) return count;
+    return matched ? index : -1;
+}
+
+// Looks for value among the items from start to stop by their encodings, the way
+// OOCLazyListObject_scanEncoded() does. Returns false if the encodings can't tell, and the caller
+// has to decode every item.
+static bool OOCLazyListObject_scan(
+    OOCLazyListObject* const self,
+    MDB_txn* const txn,
+    PyObject* const value,
+    const Py_ssize_t start,
+    const Py_ssize_t stop,
+    const bool countAll,
+    Py_ssize_t* const result
+) {
     Id2EncodedMap insertedItemsInThisTransaction;
-    EncodedValue encodedValue;
+    EncodedValue needle;
     try {
-        OOCMap_encode(self->ooc, value, &encodedValue, txn, insertedItemsInThisTransaction, true);
+        OOCMap_encode(self->ooc, value, &needle, txn, insertedItemsInThisTransaction, true);
     } catch(const MdbError& e) {
         if(e.mdbErrorCode != EACCES) throw;
         // We tried to write the value in a readonly transaction, so we got the EACCES error. This must
         // mean the value is a mutable value. The only thing we can do is search linearly through the list.
-        encodedValue.typeCodeWithLength = 0xff;  // Mark the encoded value as unusable
+        return false;
     } catch(const OocError& e) {
         if(e.errorCode != OocError::ImmutableValueNotFound) throw;
-        // Needle is immutable but not inserted into the map, so we know for sure we won't find it.
-        return 0;
+        // Needle is immutable but not inserted into the map. Unless it could equal a value of another
+        // type, we know for sure we won't find it.
+        if(!OOCLazyList_encodingDecidesEquality(value)) return false;
+        *result = countAll ? 0 : -1;
+        return true;
+    }
+
+    if(OOCLazyList_encodingDecidesEquality(value)) {
+        *result = OOCLazyListObject_scanEncoded(self, txn, value, start, stop, countAll,
+            [&needle](const EncodedValue& item) {
+                return item == needle ? SCAN_EQUAL : SCAN_DIFFERENT;
+            });
+        return true;
+    }
+
+    InlineNumber number;
+    if(OOCMap_inlineNumber(needle, &number)) {
+        *result = OOCLazyListObject_scanEncoded(self, txn, value, start, stop, countAll,
+            [&number](const EncodedValue& item) {
+                InlineNumber itemNumber;
+                if(OOCMap_inlineNumber(item, &itemNumber)) {
+                    const bool equal =
+                        !OOCMap_inlineNumberLess(number, itemNumber) &&
+                        !OOCMap_inlineNumberLess(itemNumber, number);
+                    return equal ? SCAN_EQUAL : SCAN_DIFFERENT;
+                }
+                switch(item.typeCode) {
+                case TYPE_CODE_LONG_POSITIVE_INT:
+                case TYPE_CODE_LONG_NEGATIVE_INT:
+                    // Inline ints are too small to equal a long int, but a float can.
+                    return number.isFloat ? SCAN_UNDECIDED : SCAN_DIFFERENT;
+                case TYPE_CODE_COMPLEX:
+                    return SCAN_UNDECIDED;
+                default:
+                    return SCAN_DIFFERENT;
+                }
+            });
+        return true;
+    }
+
+    return false;
+}
+
+Py_ssize_t OOCLazyListObject_index(
+    OOCLazyListObject* self,
+    MDB_txn* txn,
+    PyObject* value,
+    Py_ssize_t start,
+    Py_ssize_t stop
+) {
+    // unfuck start and stop
+    // That behavior in Python is seriously weird and we have to copy it here.
+    const Py_ssize_t length = OOCLazyListObject_length(self, txn);
+    if(start < 0) {
+        start += length;
+        if(start < 0)
+            start = 0;
     }
+    if(stop < 0)
+        stop += length;
+    if(stop > length)
+        stop = length;
+    if(start >= stop)
+        return -1;
+
+    Py_ssize_t result;
+    if(OOCLazyListObject_scan(self, txn, value, start, stop, false, &result))
+        return result;
 
     ListKey encodedListKey = {
-        .listIndex = 0,
+        .listIndex = static_cast<uint32_t>(start),
         .listId = self->listId,
     };
-    Py_ssize_t count = 0;
+    MDB_val mdbKeys[cursorBatchSize];
+    MDB_val mdbValues[cursorBatchSize];
+    mdbKeys[0] = {.mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey};
     MDB_cursor* const cursor = cursor_open(txn, self->ooc->listsDb);
     try {
-        MDB_val mdbKey = {.mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey};
-        MDB_val mdbValue;
-        bool found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET_RANGE);
-
-        while(found) {
-            if(mdbKey.mv_size != sizeof(ListKey)) throw OocError(OocError::UnexpectedData);
-            ListKey* const listItemKey = static_cast<ListKey*>(mdbKey.mv_data);
-            if(
-                listItemKey->listId != self->listId ||
-                listItemKey->listIndex == ListKey::listIndexLength
-            ) {
-                found = false;
-                break;
-            }
-
-            if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
-            EncodedValue* const encodedItem = static_cast<EncodedValue* const>(mdbValue.mv_data);
-            if(encodedValue.typeCodeWithLength == 0xff) {
+        MDB_cursor_op op = MDB_SET_KEY;
+        for(Py_ssize_t index = start; index < stop; op = MDB_NEXT) {
+            const size_t wanted = std::min(static_cast<size_t>(stop - index), cursorBatchSize);
+            if(cursor_get_batch(cursor, mdbKeys, mdbValues, wanted, op) != wanted)
+                throw OocError(OocError::UnexpectedData);
+            for(size_t i = 0; i < wanted; ++i, ++index) {
+                const ListKey* const listItemKey = OOCLazyListObject_itemKey(self, &mdbKeys[i]);
+                if(listItemKey == nullptr || listItemKey->listIndex != index) throw OocError(OocError::UnexpectedData);
+                if(mdbValues[i].mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+                EncodedValue* const encodedItem = static_cast<EncodedValue*>(mdbValues[i].mv_data);
                 PyObject* const item = OOCMap_decode(self->ooc, encodedItem, txn);
-                if(PyObject_RichCompareBool(value, item, Py_EQ))
-                    count += 1;
-            } else {
-                if(encodedValue == *encodedItem)
-                    count += 1;
+                const int comparison = PyObject_RichCompareBool(value, item, Py_EQ);
+                Py_DECREF(item);
+                if(comparison < 0) throw OocError(OocError::AlreadyPythonizedError);
+                if(comparison) {
+                    cursor_close(cursor);
+                    return index;
+                }
             }
-
-            found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT);
         }
-
-        cursor_close(cursor);
     } catch(...) {
         cursor_close(cursor);
         throw;
     }
+    cursor_close(cursor);
 
-    return count;
+    return -1;
 }
 
-static PyObject* OOCLazyList_extend(
+static PyObject* OOCLazyList_count(
     PyObject* const pySelf,
-    PyObject* const other
+    PyObject* const value
 ) {
     if(pySelf->ob_type != &OOCLazyListType) {
         PyErr_BadArgument();
@@ -587,10 +1251,12 @@ static PyObject* OOCLazyList_extend(
     }
     OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
 
+    Py_ssize_t count;
     MDB_txn* txn = nullptr;
     try {
-        txn = txn_begin(self->ooc->mdb, true);
-        OOCLazyListObject_extend(self, txn, other);
+        txn = txn_begin(OOCMap_env(self->ooc), false);
+        OOCLazyListObject_followLoan(self, txn);
+        count = OOCLazyListObject_count(self, txn, value);
         txn_commit(txn);
     } catch(const OocError& error) {
         if(txn != nullptr)
@@ -599,6 +1265,99 @@ static PyObject* OOCLazyList_extend(
         return nullptr;
     }
 
+    return PyLong_FromSsize_t(count);
+}
+
+Py_ssize_t OOCLazyListObject_count(OOCLazyListObject* self, MDB_txn* txn, PyObject* value) {
+    const Py_ssize_t length = OOCLazyListObject_length(self, txn);
+    Py_ssize_t result;
+    if(OOCLazyListObject_scan(self, txn, value, 0, length, true, &result))
+        return result;
+
+    ListKey encodedListKey = {
+        .listIndex = 0,
+        .listId = self->listId,
+    };
+    Py_ssize_t count = 0;
+    MDB_val mdbKeys[cursorBatchSize];
+    MDB_val mdbValues[cursorBatchSize];
+    mdbKeys[0] = {.mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey};
+    MDB_cursor* const cursor = cursor_open(txn, self->ooc->listsDb);
+    try {
+        MDB_cursor_op op = MDB_SET_KEY;
+        for(Py_ssize_t index = 0; index < length; op = MDB_NEXT) {
+            const size_t wanted = std::min(static_cast<size_t>(length - index), cursorBatchSize);
+            if(cursor_get_batch(cursor, mdbKeys, mdbValues, wanted, op) != wanted)
+                throw OocError(OocError::UnexpectedData);
+            for(size_t i = 0; i < wanted; ++i, ++index) {
+                const ListKey* const listItemKey = OOCLazyListObject_itemKey(self, &mdbKeys[i]);
+                if(listItemKey == nullptr || listItemKey->listIndex != index) throw OocError(OocError::UnexpectedData);
+                if(mdbValues[i].mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+                EncodedValue* const encodedItem = static_cast<EncodedValue*>(mdbValues[i].mv_data);
+                PyObject* const item = OOCMap_decode(self->ooc, encodedItem, txn);
+                const int comparison = PyObject_RichCompareBool(value, item, Py_EQ);
+                Py_DECREF(item);
+                if(comparison < 0) throw OocError(OocError::AlreadyPythonizedError);
+                count += comparison;
+            }
+        }
+    } catch(...) {
+        cursor_close(cursor);
+        throw;
+    }
+    cursor_close(cursor);
+
+    return count;
+}
+
+static PyObject* OOCLazyList_extend(
+    PyObject* const pySelf,
+    PyObject* const other
+) {
+    if(pySelf->ob_type != &OOCLazyListType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
+
+    // If we have to retry the transaction, we need to see the same items again, so we can't
+    // consume an iterator directly.
+    PyObject* items;
+    if(other->ob_type == &OOCLazyListType) {
+        items = other;
+        Py_INCREF(items);
+    } else {
+        items = PySequence_Fast(other, "can only extend a list with an iterable");
+        if(items == nullptr) return nullptr;
+    }
+
+    if(!OOCLazyList_thaw(self)) {
+        Py_DECREF(items);
+        return nullptr;
+    }
+    MDB_txn* txn = nullptr;
+    while(true) {
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), true);
+            if(items->ob_type == &OOCLazyListType && reinterpret_cast<OOCLazyListObject*>(items)->ooc == self->ooc)
+                OOCLazyListObject_followLoan(reinterpret_cast<OOCLazyListObject*>(items), txn);
+            OOCMap_settleListLoans(self->ooc, txn, self->listId);
+            OOCLazyListObject_extend(self, txn, items);
+            txn_commit(txn);
+            break;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+            Py_DECREF(items);
+            error.pythonize();
+            return nullptr;
+        }
+    }
+    Py_DECREF(items);
+
     Py_RETURN_NONE;
 }
 
@@ -611,8 +1370,9 @@ void OOCLazyListObject_extend(OOCLazyListObject* self, MDB_txn* txn, PyObject* p
         PyObject* const iter = PyObject_GetIter(pyOther);
         if(iter == nullptr) throw OocError(OocError::AlreadyPythonizedError);
         try {
+            ContentHash hash;
             ListKey selfEncodedListKey = {
-                .listIndex = OOCLazyListObject_length(self, txn),
+                .listIndex = static_cast<uint32_t>(OOCMap_getListHeader(self->ooc, txn, self->listId, &hash)),
                 .listId = self->listId
             };
             MDB_val mdbSelfKey = {.mv_size = sizeof(selfEncodedListKey), .mv_data = &selfEncodedListKey};
@@ -623,20 +1383,19 @@ void OOCLazyListObject_extend(OOCLazyListObject* self, MDB_txn* txn, PyObject* p
             while((item = PyIter_Next(iter))) {
                 OOCMap_encode(self->ooc, item, &encodedItem, txn, insertedItems);
                 put(txn, self->ooc->listsDb, &mdbSelfKey, &mdbValue);
+                if(self->ooc->contentHashes) hash.addListItem(selfEncodedListKey.listIndex, encodedItem);
                 Py_CLEAR(item);
                 selfEncodedListKey.listIndex += 1;
             }
+            if(PyErr_Occurred()) throw OocError(OocError::AlreadyPythonizedError);
 
-            // write the new length
-            uint32_t newLength = selfEncodedListKey.listIndex;
-            MDB_val mdbLength = {.mv_size = sizeof(newLength), .mv_data = &newLength};
-            selfEncodedListKey.listIndex = ListKey::listIndexLength;
-            put(txn, self->ooc->listsDb, &mdbSelfKey, &mdbLength);
+            OOCMap_putListHeader(self->ooc, txn, self->listId, selfEncodedListKey.listIndex, hash);
         } catch(...) {
             Py_DECREF(iter);
             if(item != nullptr) Py_DECREF(item);
             throw;
         }
+        Py_DECREF(iter);
     }
 }
 
@@ -647,55 +1406,61 @@ void OOCLazyListObject_extend(OOCLazyListObject* self, MDB_txn* txn, OOCLazyList
             return;
         }
 
+        ContentHash hash;
         ListKey selfEncodedListKey = {
-            .listIndex = OOCLazyListObject_length(self, txn),
+            .listIndex = static_cast<uint32_t>(OOCMap_getListHeader(self->ooc, txn, self->listId, &hash)),
             .listId = self->listId
         };
         ListKey otherEncodedListKey = {
             .listIndex = 0,
             .listId = other->listId
         };
+        const Py_ssize_t otherLength = OOCLazyListObject_length(other, txn);
         MDB_val mdbSelfKey = {.mv_size = sizeof(selfEncodedListKey), .mv_data = &selfEncodedListKey};
-        MDB_val mdbOtherKey = {.mv_size = sizeof(otherEncodedListKey), .mv_data = &otherEncodedListKey};
+        MDB_val mdbOtherKeys[cursorBatchSize];
+        MDB_val mdbOtherValues[cursorBatchSize];
+        mdbOtherKeys[0] = {.mv_size = sizeof(otherEncodedListKey), .mv_data = &otherEncodedListKey};
+        // The puts can move the records we read, so we copy them out of the batch first.
+        EncodedValue values[cursorBatchSize];
         MDB_cursor* const cursor = cursor_open(txn, other->ooc->listsDb);
         try {
-            MDB_val mdbValue;
-            bool found = cursor_get(cursor, &mdbOtherKey, &mdbValue, MDB_SET_RANGE);
-            while(found) {
-                if(mdbOtherKey.mv_size != sizeof(ListKey)) throw OocError(OocError::UnexpectedData);
-                ListKey* const listItemKey = static_cast<ListKey*>(mdbOtherKey.mv_data);
-                if(
-                    listItemKey->listId != other->listId ||
-                    listItemKey->listIndex == ListKey::listIndexLength
-                ) {
-                    break;
+            MDB_cursor_op op = MDB_SET_KEY;
+            for(Py_ssize_t index = 0; index < otherLength; op = MDB_NEXT) {
+                const size_t wanted = std::min(static_cast<size_t>(otherLength - index), cursorBatchSize);
+                if(cursor_get_batch(cursor, mdbOtherKeys, mdbOtherValues, wanted, op) != wanted)
+                    throw OocError(OocError::UnexpectedData);
+                for(size_t i = 0; i < wanted; ++i, ++index) {
+                    const ListKey* const listItemKey = OOCLazyListObject_itemKey(other, &mdbOtherKeys[i]);
+                    if(listItemKey == nullptr || listItemKey->listIndex != index)
+                        throw OocError(OocError::UnexpectedData);
+                    if(mdbOtherValues[i].mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+                    memcpy(&values[i], mdbOtherValues[i].mv_data, sizeof(EncodedValue));
                 }
 
-                if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
-                put(txn, self->ooc->listsDb, &mdbSelfKey, &mdbValue);
-                selfEncodedListKey.listIndex += 1;
-
-                found = cursor_get(cursor, &mdbOtherKey, &mdbValue, MDB_NEXT);
+                for(size_t i = 0; i < wanted; ++i) {
+                    if(self->ooc->contentHashes) hash.addListItem(selfEncodedListKey.listIndex, values[i]);
+                    MDB_val mdbValue = {.mv_size = sizeof(values[i]), .mv_data = &values[i]};
+                    put(txn, self->ooc->listsDb, &mdbSelfKey, &mdbValue);
+                    selfEncodedListKey.listIndex += 1;
+                }
             }
-
-            cursor_close(cursor);
-        } catch(const MdbError& e) {
-            cursor_close(cursor);
-            if(e.mdbErrorCode != MDB_NOTFOUND)
-                throw;
         } catch(...) {
             cursor_close(cursor);
             throw;
         }
+        cursor_close(cursor);
 
-        // write the new length
-        uint32_t newLength = selfEncodedListKey.listIndex;
-        MDB_val mdbLength = {.mv_size = sizeof(newLength), .mv_data = &newLength};
-        selfEncodedListKey.listIndex = ListKey::listIndexLength;
-        put(txn, self->ooc->listsDb, &mdbSelfKey, &mdbLength);
+        OOCMap_putListHeader(self->ooc, txn, self->listId, selfEncodedListKey.listIndex, hash);
     } else {
         PyObject* const eager = OOCLazyList_eager(reinterpret_cast<PyObject* const>(other));
-        OOCLazyListObject_extend(self, txn, eager);
+        if(eager == nullptr) throw OocError(OocError::AlreadyPythonizedError);
+        try {
+            OOCLazyListObject_extend(self, txn, eager);
+        } catch(...) {
+            Py_DECREF(eager);
+            throw;
+        }
+        Py_DECREF(eager);
     }
 }
 
@@ -706,17 +1471,43 @@ static PyObject* OOCLazyList_inplaceConcat(PyObject* const pySelf, PyObject* con
     }
     OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
 
-    MDB_txn* txn = nullptr;
-    try {
-        txn = txn_begin(self->ooc->mdb, true);
-        OOCLazyListObject_extend(self, txn, other);
-        txn_commit(txn);
-    } catch(const OocError& error) {
-        if(txn != nullptr)
-            txn_abort(txn);
-        error.pythonize();
+    // If we have to retry the transaction, we need to see the same items again, so we can't
+    // consume an iterator directly.
+    PyObject* items;
+    if(other->ob_type == &OOCLazyListType) {
+        items = other;
+        Py_INCREF(items);
+    } else {
+        items = PySequence_Fast(other, "can only extend a list with an iterable");
+        if(items == nullptr) return nullptr;
+    }
+
+    if(!OOCLazyList_thaw(self)) {
+        Py_DECREF(items);
         return nullptr;
     }
+    MDB_txn* txn = nullptr;
+    while(true) {
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), true);
+            if(items->ob_type == &OOCLazyListType && reinterpret_cast<OOCLazyListObject*>(items)->ooc == self->ooc)
+                OOCLazyListObject_followLoan(reinterpret_cast<OOCLazyListObject*>(items), txn);
+            OOCMap_settleListLoans(self->ooc, txn, self->listId);
+            OOCLazyListObject_extend(self, txn, items);
+            txn_commit(txn);
+            break;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+            Py_DECREF(items);
+            error.pythonize();
+            return nullptr;
+        }
+    }
+    Py_DECREF(items);
 
     Py_INCREF(pySelf);
     return pySelf;
@@ -729,16 +1520,24 @@ static PyObject* OOCLazyList_inplaceRepeat(PyObject* const pySelf, const Py_ssiz
     }
     OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
 
+    if(!OOCLazyList_thaw(self)) return nullptr;
     MDB_txn* txn = nullptr;
-    try {
-        txn = txn_begin(self->ooc->mdb, true);
-        OOCLazyListObject_inplaceRepeat(self, txn, count);
-        txn_commit(txn);
-    } catch(const OocError& error) {
-        if(txn != nullptr)
-            txn_abort(txn);
-        error.pythonize();
-        return nullptr;
+    while(true) {
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), true);
+            OOCMap_settleListLoans(self->ooc, txn, self->listId);
+            OOCLazyListObject_inplaceRepeat(self, txn, count);
+            txn_commit(txn);
+            break;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+            error.pythonize();
+            return nullptr;
+        }
     }
 
     Py_INCREF(pySelf);
@@ -751,7 +1550,8 @@ void OOCLazyListObject_inplaceRepeat(OOCLazyListObject* self, MDB_txn* txn, unsi
         return;
     }
 
-    const Py_ssize_t length = OOCLazyListObject_length(self, txn);
+    ContentHash hash;
+    const Py_ssize_t length = OOCMap_getListHeader(self->ooc, txn, self->listId, &hash);
     if(length <= 0) return;
 
     /*
@@ -787,6 +1587,11 @@ void OOCLazyListObject_inplaceRepeat(OOCLazyListObject* self, MDB_txn* txn, unsi
             }
 
             if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+            if(self->ooc->contentHashes) {
+                EncodedValue value;
+                memcpy(&value, mdbValue.mv_data, sizeof(value));
+                hash.addListItem(destEncodedListKey.listIndex, value);
+            }
             put(txn, self->ooc->listsDb, &mdbDestKey, &mdbValue);
             destEncodedListKey.listIndex += 1;
 
@@ -804,11 +1609,7 @@ void OOCLazyListObject_inplaceRepeat(OOCLazyListObject* self, MDB_txn* txn, unsi
         throw;
     }
 
-    // write the new length
-    uint32_t newLength = destEncodedListKey.listIndex;
-    MDB_val mdbLength = {.mv_size = sizeof(newLength), .mv_data = &newLength};
-    destEncodedListKey.listIndex = ListKey::listIndexLength;
-    put(txn, self->ooc->listsDb, &mdbDestKey, &mdbLength);
+    OOCMap_putListHeader(self->ooc, txn, self->listId, destEncodedListKey.listIndex, hash);
 }
 
 static PyObject* OOCLazyList_append(
@@ -821,16 +1622,24 @@ static PyObject* OOCLazyList_append(
     }
     OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
 
+    if(!OOCLazyList_thaw(self)) return nullptr;
     MDB_txn* txn = nullptr;
-    try {
-        txn = txn_begin(self->ooc->mdb, true);
-        OOCLazyListObject_append(self, txn, other);
-        txn_commit(txn);
-    } catch(const OocError& error) {
-        if(txn != nullptr)
-            txn_abort(txn);
-        error.pythonize();
-        return nullptr;
+    while(true) {
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), true);
+            OOCMap_settleListLoans(self->ooc, txn, self->listId);
+            OOCLazyListObject_append(self, txn, other);
+            txn_commit(txn);
+            break;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+            error.pythonize();
+            return nullptr;
+        }
     }
 
     Py_RETURN_NONE;
@@ -841,80 +1650,397 @@ void OOCLazyListObject_append(OOCLazyListObject* self, MDB_txn* txn, PyObject* i
     Id2EncodedMap insertedItems;
     OOCMap_encode(self->ooc, item, &encodedItem, txn, insertedItems);
 
+    ContentHash hash;
     ListKey selfEncodedListKey = {
-        .listIndex = OOCLazyListObject_length(self, txn),
+        .listIndex = static_cast<uint32_t>(OOCMap_getListHeader(self->ooc, txn, self->listId, &hash)),
         .listId = self->listId
     };
     MDB_val mdbSelfKey = {.mv_size = sizeof(selfEncodedListKey), .mv_data = &selfEncodedListKey};
     MDB_val mdbValue = {.mv_size = sizeof(encodedItem), .mv_data = &encodedItem};
     put(txn, self->ooc->listsDb, &mdbSelfKey, &mdbValue);
+    if(self->ooc->contentHashes) hash.addListItem(selfEncodedListKey.listIndex, encodedItem);
+
+    OOCMap_putListHeader(self->ooc, txn, self->listId, selfEncodedListKey.listIndex + 1, hash);
+}
+
+PyObject* OOCLazyList_clear(PyObject* const pySelf) {
+    if(pySelf->ob_type != &OOCLazyListType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
+
+    if(!OOCLazyList_thaw(self)) return nullptr;
+    MDB_txn* txn = nullptr;
+    while(true) {
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), true);
+            OOCMap_settleListLoans(self->ooc, txn, self->listId);
+            OOCLazyListObject_clear(self, txn);
+            txn_commit(txn);
+            Py_RETURN_NONE;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+            error.pythonize();
+            return nullptr;
+        }
+    }
+}
+
+void OOCLazyListObject_clear(OOCLazyListObject* const self, MDB_txn* const txn) {
+    MDB_cursor* cursor = nullptr;
+    try {
+        cursor = cursor_open(txn, self->ooc->listsDb);
+
+        // The items are the records right before the header, so we delete that many from the
+        // first one on, and check that we end up at the header. If we don't, the transaction fails.
+        const Py_ssize_t length = OOCLazyListObject_length(self, txn);
+        ListKey encodedListKey = {
+            .listIndex = 0,
+            .listId = self->listId,
+        };
+        MDB_val mdbKey = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
+        MDB_val mdbValue;
+        if(length > 0) {
+            if(!cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET_KEY)) throw OocError(OocError::UnexpectedData);
+            if(!cursor_del_batch(cursor, length, &mdbKey, &mdbValue)) throw OocError(OocError::UnexpectedData);
+            if(mdbKey.mv_size != sizeof(ListKey)) throw OocError(OocError::UnexpectedData);
+            const ListKey* const listKey = static_cast<const ListKey*>(mdbKey.mv_data);
+            if(listKey->listId != self->listId || listKey->listIndex != ListKey::listIndexLength)
+                throw OocError(OocError::UnexpectedData);
+        }
+
+        cursor_close(cursor);
+        cursor = nullptr;
+        OOCMap_putListHeader(self->ooc, txn, self->listId, 0, ContentHash { .sum = 0, .nanCount = 0 });
+    } catch(...) {
+        if(cursor != nullptr) cursor_close(cursor);
+        throw;
+    }
+}
+
+static PyObject* OOCLazyList_insert(
+    PyObject* const pySelf,
+    PyObject *const *const args,
+    const Py_ssize_t nargs
+) {
+    if(pySelf->ob_type != &OOCLazyListType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
+
+    if(nargs != 2) {
+        PyErr_Format(PyExc_TypeError, "insert expected 2 arguments, got %zd", nargs);
+        return nullptr;
+    }
+    const Py_ssize_t index = PyNumber_AsSsize_t(args[0], PyExc_OverflowError);
+    if(index == -1 && PyErr_Occurred()) return nullptr;
+
+    if(!OOCLazyList_thaw(self)) return nullptr;
+    MDB_txn* txn = nullptr;
+    while(true) {
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), true);
+            OOCMap_settleListLoans(self->ooc, txn, self->listId);
+            OOCLazyListObject_insert(self, txn, index, args[1]);
+            txn_commit(txn);
+            Py_RETURN_NONE;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+            error.pythonize();
+            return nullptr;
+        }
+    }
+}
+
+void OOCLazyListObject_insert(OOCLazyListObject* const self, MDB_txn* const txn, Py_ssize_t index, PyObject* const item) {
+    ContentHash hash;
+    const Py_ssize_t length = OOCMap_getListHeader(self->ooc, txn, self->listId, &hash);
+    if(length + 1 >= ListKey::listIndexLength) throw OocError(OocError::IndexError);
+
+    // Like list.insert(), indices that are out of range insert at the ends.
+    if(index < 0) {
+        index += length;
+        if(index < 0) index = 0;
+    }
+    if(index > length) index = length;
+
+    EncodedValue encodedItem;
+    Id2EncodedMap insertedItems;
+    OOCMap_encode(self->ooc, item, &encodedItem, txn, insertedItems);
+
+    const bool hashing = self->ooc->contentHashes;
+    OOCLazyListObject_moveItems(self, txn, index, index + 1, length, hashing ? &hash : nullptr);
+    ListKey encodedListKey = {
+        .listIndex = static_cast<uint32_t>(index),
+        .listId = self->listId,
+    };
+    MDB_val mdbKey = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
+    MDB_val mdbValue = { .mv_size = sizeof(encodedItem), .mv_data = &encodedItem };
+    put(txn, self->ooc->listsDb, &mdbKey, &mdbValue);
+    if(hashing) hash.addListItem(index, encodedItem);
+    OOCLazyListObject_setLength(self, txn, length + 1, hash);
+}
+
+static PyObject* OOCLazyList_pop(
+    PyObject* const pySelf,
+    PyObject *const *const args,
+    const Py_ssize_t nargs
+) {
+    if(pySelf->ob_type != &OOCLazyListType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
+
+    if(nargs > 1) {
+        PyErr_Format(PyExc_TypeError, "pop expected at most 1 argument, got %zd", nargs);
+        return nullptr;
+    }
+    Py_ssize_t index = -1;
+    if(nargs > 0) {
+        index = PyNumber_AsSsize_t(args[0], PyExc_IndexError);
+        if(index == -1 && PyErr_Occurred()) return nullptr;
+    }
+
+    if(!OOCLazyList_thaw(self)) return nullptr;
+    MDB_txn* txn = nullptr;
+    while(true) {
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), true);
+            OOCMap_settleListLoans(self->ooc, txn, self->listId);
+            PyObject* const result = OOCLazyListObject_pop(self, txn, index);
+            try {
+                txn_commit(txn);
+            } catch(...) {
+                Py_DECREF(result);
+                throw;
+            }
+            return result;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+            error.pythonize();
+            return nullptr;
+        }
+    }
+}
+
+PyObject* OOCLazyListObject_pop(OOCLazyListObject* const self, MDB_txn* const txn, Py_ssize_t index) {
+    const Py_ssize_t length = OOCLazyListObject_length(self, txn);
+    if(length <= 0) {
+        PyErr_SetString(PyExc_IndexError, "pop from empty list");
+        throw OocError(OocError::AlreadyPythonizedError);
+    }
+    if(index < 0) index += length;
+    if(index < 0 || index >= length) {
+        PyErr_SetString(PyExc_IndexError, "pop index out of range");
+        throw OocError(OocError::AlreadyPythonizedError);
+    }
+
+    ListKey encodedListKey = {
+        .listIndex = static_cast<uint32_t>(index),
+        .listId = self->listId,
+    };
+    MDB_val mdbKey = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
+    MDB_val mdbValue;
+    if(!get(txn, self->ooc->listsDb, &mdbKey, &mdbValue)) throw OocError(OocError::UnexpectedData);
+    if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+    PyObject* const result = OOCMap_decode(self->ooc, static_cast<EncodedValue*>(mdbValue.mv_data), txn);
+    try {
+        OOCLazyListObject_setItem(self, txn, index, nullptr);
+    } catch(...) {
+        Py_DECREF(result);
+        throw;
+    }
+    return result;
+}
+
+static PyObject* OOCLazyList_remove(PyObject* const pySelf, PyObject* const item) {
+    if(pySelf->ob_type != &OOCLazyListType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
+
+    if(!OOCLazyList_thaw(self)) return nullptr;
+    MDB_txn* txn = nullptr;
+    while(true) {
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), true);
+            OOCMap_settleListLoans(self->ooc, txn, self->listId);
+            OOCLazyListObject_remove(self, txn, item);
+            txn_commit(txn);
+            Py_RETURN_NONE;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+            error.pythonize();
+            return nullptr;
+        }
+    }
+}
+
+void OOCLazyListObject_remove(OOCLazyListObject* const self, MDB_txn* const txn, PyObject* const item) {
+    const Py_ssize_t index = OOCLazyListObject_index(self, txn, item);
+    if(index < 0) {
+        if(!PyErr_Occurred())
+            PyErr_SetString(PyExc_ValueError, "list.remove(x): x not in list");
+        throw OocError(OocError::AlreadyPythonizedError);
+    }
+    OOCLazyListObject_setItem(self, txn, index, nullptr);
+}
+
+// Reads the encoded items of the list, without decoding them.
+static void OOCLazyListObject_encodedItems(
+    OOCLazyListObject* const self,
+    MDB_txn* const txn,
+    std::vector<EncodedValue>& dest
+) {
+    const Py_ssize_t length = OOCLazyListObject_length(self, txn);
+    dest.clear();
+    dest.reserve(length);
+    ListKey encodedListKey = {
+        .listIndex = 0,
+        .listId = self->listId,
+    };
+    MDB_val mdbKey = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
+    MDB_val mdbValue;
+    MDB_cursor* const cursor = cursor_open(txn, self->ooc->listsDb);
+    try {
+        bool found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET_RANGE);
+        while(found) {
+            const ListKey* const listItemKey = OOCLazyListObject_itemKey(self, &mdbKey);
+            if(listItemKey == nullptr) break;
+            if(listItemKey->listIndex != dest.size()) throw OocError(OocError::UnexpectedData);
+            if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+            dest.push_back(*static_cast<const EncodedValue*>(mdbValue.mv_data));
+            found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT);
+        }
+    } catch(...) {
+        cursor_close(cursor);
+        throw;
+    }
+    cursor_close(cursor);
+    if(static_cast<Py_ssize_t>(dest.size()) != length) throw OocError(OocError::UnexpectedData);
+}
+
+// Overwrites the items of the list in place with encoded items, in one walk of the cursor. The list
+// must have as many items as there are values. The content hash is computed again from the values.
+static void OOCLazyListObject_setEncodedItems(
+    OOCLazyListObject* const self,
+    MDB_txn* const txn,
+    const std::vector<EncodedValue>& values
+) {
+    if(values.empty()) return;
+    ListKey encodedListKey = {
+        .listIndex = 0,
+        .listId = self->listId,
+    };
+    MDB_val mdbKey = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
+    MDB_val mdbValue;
+    MDB_cursor* const cursor = cursor_open(txn, self->ooc->listsDb);
+    try {
+        bool found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET_RANGE);
+        for(size_t i = 0; i < values.size(); ++i) {
+            if(!found) throw OocError(OocError::UnexpectedData);
+            const ListKey* const listItemKey = OOCLazyListObject_itemKey(self, &mdbKey);
+            if(listItemKey == nullptr || listItemKey->listIndex != i) throw OocError(OocError::UnexpectedData);
+            mdbValue = (MDB_val) { .mv_size = sizeof(EncodedValue), .mv_data = const_cast<EncodedValue*>(&values[i]) };
+            cursor_put(cursor, &mdbKey, &mdbValue, MDB_CURRENT);
+            found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT);
+        }
+    } catch(...) {
+        cursor_close(cursor);
+        throw;
+    }
+    cursor_close(cursor);
+
+    if(self->ooc->contentHashes) {
+        ContentHash hash = { .sum = 0, .nanCount = 0 };
+        for(size_t i = 0; i < values.size(); ++i)
+            hash.addListItem(i, values[i]);
+        OOCMap_putListHeader(self->ooc, txn, self->listId, values.size(), hash);
+    }
+}
+
+static PyObject* OOCLazyList_reverse(PyObject* const pySelf) {
+    if(pySelf->ob_type != &OOCLazyListType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
+
+    if(!OOCLazyList_thaw(self)) return nullptr;
+    MDB_txn* txn = nullptr;
+    while(true) {
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), true);
+            OOCMap_settleListLoans(self->ooc, txn, self->listId);
+            OOCLazyListObject_reverse(self, txn);
+            txn_commit(txn);
+            Py_RETURN_NONE;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+            error.pythonize();
+            return nullptr;
+        }
+    }
+}
 
-    // write the new length
-    uint32_t newLength = selfEncodedListKey.listIndex + 1;
-    MDB_val mdbLength = {.mv_size = sizeof(newLength), .mv_data = &newLength};
-    selfEncodedListKey.listIndex = ListKey::listIndexLength;
-    put(txn, self->ooc->listsDb, &mdbSelfKey, &mdbLength);
+void OOCLazyListObject_reverse(OOCLazyListObject* const self, MDB_txn* const txn) {
+    // The items only move around, so there is no need to decode them.
+    std::vector<EncodedValue> values;
+    OOCLazyListObject_encodedItems(self, txn, values);
+    std::reverse(values.begin(), values.end());
+    OOCLazyListObject_setEncodedItems(self, txn, values);
 }
 
-PyObject* OOCLazyList_clear(PyObject* const pySelf) {
+static PyObject* OOCLazyList_sort(PyObject* const pySelf, PyObject* const args, PyObject* const kwds) {
     if(pySelf->ob_type != &OOCLazyListType) {
         PyErr_BadArgument();
         return nullptr;
     }
     OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
 
-    MDB_txn* txn = nullptr;
-    try {
-        txn = txn_begin(self->ooc->mdb, true);
-        OOCLazyListObject_clear(self, txn);
-        txn_commit(txn);
-        Py_RETURN_NONE;
-    } catch(const OocError& error) {
-        if(txn != nullptr)
-            txn_abort(txn);
-        error.pythonize();
+    static const char* kwlist[] = {"key", "reverse", "run_length", nullptr};
+    PyObject* key = Py_None;
+    int reverse = 0;
+    Py_ssize_t runLength = OOCLAZYLIST_SORT_RUN_LENGTH;
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|$Opn", const_cast<char**>(kwlist), &key, &reverse, &runLength))
+        return nullptr;
+    if(runLength < 1) {
+        PyErr_Format(PyExc_ValueError, "run_length must be at least 1");
         return nullptr;
     }
-}
 
-void OOCLazyListObject_clear(OOCLazyListObject* const self, MDB_txn* const txn) {
-    MDB_cursor* cursor = nullptr;
+    if(!OOCLazyList_thaw(self)) return nullptr;
     try {
-        cursor = cursor_open(txn, self->ooc->listsDb);
-
-        ListKey encodedListKey = {
-            .listIndex = 0,
-            .listId = self->listId,
-        };
-        MDB_val mdbKey = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
-        MDB_val mdbValue;
-        bool found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET_RANGE);
-
-        while(found) {
-            if(mdbKey.mv_size != sizeof(ListKey)) throw OocError(OocError::UnexpectedData);
-            ListKey* const listItemKey = static_cast<ListKey*>(mdbKey.mv_data);
-            if(
-                listItemKey->listId != self->listId ||
-                listItemKey->listIndex == ListKey::listIndexLength
-            ) {
-                found = false;
-                break;
-            }
-
-            cursor_del(cursor);
-            found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT);
-        }
-
-        // cursor is now positioned at the length item, which we overwrite with 0
-        static uint32_t zeroLength = 0;
-        mdbValue = (MDB_val) { .mv_size = sizeof(zeroLength), .mv_data = &zeroLength };
-        cursor_put(cursor, &mdbKey, &mdbValue, MDB_CURRENT);
-
-        cursor_close(cursor);
-    } catch(...) {
-        if(cursor != nullptr) cursor_close(cursor);
-        throw;
+        OOCLazyListObject_sort(self, key, reverse, runLength);
+    } catch(const OocError& error) {
+        error.pythonize();
+        return nullptr;
     }
+    Py_RETURN_NONE;
 }
 
 static int OOCLazyList_contains(PyObject* const pySelf, PyObject* const item) {
@@ -926,7 +2052,8 @@ static int OOCLazyList_contains(PyObject* const pySelf, PyObject* const item) {
 
     MDB_txn* txn = nullptr;
     try {
-        txn = txn_begin(self->ooc->mdb, false);
+        txn = txn_begin(OOCMap_env(self->ooc), false);
+        OOCLazyListObject_followLoan(self, txn);
         const Py_ssize_t index = OOCLazyListObject_index(self, txn, item);
         txn_commit(txn);
         if(index < 0) return 0; else return 1;
@@ -938,6 +2065,7 @@ static int OOCLazyList_contains(PyObject* const pySelf, PyObject* const item) {
     }
 }
 
+// Like list, these return new Python lists. stored_concat() and stored_repeat() keep theirs in the map.
 PyObject* OOCLazyList_concat(PyObject* const pySelf, PyObject* const pyOther) {
     PyObject* const eager = OOCLazyList_eager(pySelf);
     if(eager == nullptr) return nullptr;
@@ -968,6 +2096,43 @@ static PyObject* OOCLazyListIter_iter(PyObject* const pySelf) {
     return pySelf;
 }
 
+// Ends the read transaction the iterator keeps open between calls.
+static void OOCLazyListIter_closeCursor(OOCLazyListIterObject* const self, const bool commit) {
+    MDB_txn* txn = mdb_cursor_txn(self->cursor);
+    cursor_close(self->cursor);
+    self->cursor = nullptr;
+    self->list->ooc->liveReadTxns -= 1;
+    if(commit)
+        txn_commit(txn);
+    else
+        txn_abort(txn);
+}
+
+// Reads the next batch of items from the cursor.
+static void OOCLazyListIter_fill(OOCLazyListIterObject* const self, const MDB_cursor_op op) {
+    ListKey encodedListKey = {
+        .listIndex = static_cast<uint32_t>(self->nextIndex),
+        .listId = self->listId
+    };
+    MDB_val mdbKeys[cursorBatchSize];
+    MDB_val mdbValues[cursorBatchSize];
+    mdbKeys[0] = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
+    const size_t wanted = std::min(static_cast<size_t>(self->length - self->nextIndex), cursorBatchSize);
+    if(cursor_get_batch(self->cursor, mdbKeys, mdbValues, wanted, op) != wanted)
+        throw OocError(OocError::UnexpectedData);
+    for(size_t i = 0; i < wanted; ++i) {
+        if(mdbKeys[i].mv_size != sizeof(ListKey)) throw OocError(OocError::UnexpectedData);
+        const ListKey* const listKey = static_cast<const ListKey*>(mdbKeys[i].mv_data);
+        if(listKey->listId != self->listId || listKey->listIndex != self->nextIndex + i)
+            throw OocError(OocError::UnexpectedData);
+        if(mdbValues[i].mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+        memcpy(&self->batch[i], mdbValues[i].mv_data, sizeof(EncodedValue));
+    }
+    self->nextIndex += wanted;
+    self->batchLength = static_cast<uint32_t>(wanted);
+    self->batchPosition = 0;
+}
+
 static PyObject* OOCLazyListIter_iternext(PyObject* const pySelf) {
     if(pySelf->ob_type != &OOCLazyListIterType) {
         PyErr_BadArgument();
@@ -977,75 +2142,39 @@ static PyObject* OOCLazyListIter_iternext(PyObject* const pySelf) {
     if(self->list == nullptr) return nullptr;
     OOCMapObject* const ooc = self->list->ooc;
 
-    if(self->cursor == nullptr) {
-        MDB_txn* txn = nullptr;
-        try {
-            txn = txn_begin(ooc->mdb, false);
+    MDB_txn* txn = nullptr;
+    try {
+        if(self->cursor == nullptr) {
+            txn = txn_begin(OOCMap_env(ooc), false);
+            OOCLazyListObject_followLoan(self->list, txn);
+            self->listId = self->list->listId;
+            self->length = OOCMap_getListHeader(ooc, txn, self->listId);
             self->cursor = cursor_open(txn, ooc->listsDb);
+            txn_keep(txn);
+            ooc->liveReadTxns += 1;
+            self->nextIndex = 0;
+            if(self->length > 0) OOCLazyListIter_fill(self, MDB_SET_KEY);
+        } else {
+            txn = mdb_cursor_txn(self->cursor);
+            if(self->batchPosition == self->batchLength && self->nextIndex < self->length)
+                OOCLazyListIter_fill(self, MDB_NEXT);
+        }
 
-            ListKey encodedListKey = {
-                .listIndex = 0,
-                .listId = self->list->listId
-            };
-            MDB_val mdbKey = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
-            MDB_val mdbValue;
-            const bool found = cursor_get(self->cursor, &mdbKey, &mdbValue, MDB_SET_KEY);
-            if(!found) {
-                cursor_close(self->cursor);
-                self->cursor = nullptr;
-                txn_commit(txn);
-                Py_CLEAR(self->list);
-                return nullptr;
-            } else {
-                if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
-                EncodedValue* const encodedResult = static_cast<EncodedValue* const>(mdbValue.mv_data);
-                return OOCMap_decode(ooc, encodedResult, txn);
-            }
-        } catch(const OocError& error) {
-            if(self->cursor != nullptr) {
-                cursor_close(self->cursor);
-                self->cursor = nullptr;
-            }
-            if(txn != nullptr)
-                txn_abort(txn);
-            error.pythonize();
+        if(self->batchPosition == self->batchLength) {
+            OOCLazyListIter_closeCursor(self, true);
+            Py_CLEAR(self->list);
             return nullptr;
         }
-    } else {
-        MDB_txn* txn = mdb_cursor_txn(self->cursor);
-        try {
-            MDB_val mdbKey;
-            MDB_val mdbValue;
-            const bool found = cursor_get(self->cursor, &mdbKey, &mdbValue, MDB_NEXT);
-            if(!found) {
-                cursor_close(self->cursor);
-                self->cursor = nullptr;
-                txn_commit(txn);
-                Py_CLEAR(self->list);
-                return nullptr;
-            }
-            if(mdbKey.mv_size != sizeof(ListKey)) throw OocError(OocError::UnexpectedData);
-            ListKey* const listKey = static_cast<ListKey* const>(mdbKey.mv_data);
-            if(
-                listKey->listIndex == ListKey::listIndexLength ||
-                listKey->listId != self->list->listId
-            ) {
-                cursor_close(self->cursor);
-                self->cursor = nullptr;
-                txn_commit(txn);
-                Py_CLEAR(self->list);
-                return nullptr;
-            }
-            if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
-            EncodedValue* const encodedResult = static_cast<EncodedValue* const>(mdbValue.mv_data);
-            return OOCMap_decode(ooc, encodedResult, txn);
-        } catch(const OocError& error) {
-            cursor_close(self->cursor);
-            self->cursor = nullptr;
+        EncodedValue* const encodedResult = &self->batch[self->batchPosition];
+        self->batchPosition += 1;
+        return OOCMap_decode(ooc, encodedResult, txn);
+    } catch(const OocError& error) {
+        if(self->cursor != nullptr)
+            OOCLazyListIter_closeCursor(self, false);
+        else if(txn != nullptr)
             txn_abort(txn);
-            error.pythonize();
-            return nullptr;
-        }
+        error.pythonize();
+        return nullptr;
     }
 }
 
@@ -1103,40 +2232,105 @@ PyObject* OOCLazyList_richcompare(PyObject* const pySelf, PyObject* const other,
         PyErr_BadArgument();
         return nullptr;
     }
+    OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
+
+    if(other->ob_type == &OOCLazyListType && reinterpret_cast<OOCLazyListObject*>(other)->ooc == self->ooc) {
+        // Both lists are in the same map, so we can compare them without decoding most items.
+        EncodedValue selfValue;
+        selfValue.asUInt = 0;
+        selfValue.typeCodeWithLength = 0;
+        selfValue.typeCode = TYPE_CODE_LIST;
+        selfValue.asListKey.listIndex = ListKey::listIndexLength;
+        EncodedValue otherValue = selfValue;
+        OOCLazyListObject* const otherList = reinterpret_cast<OOCLazyListObject*>(other);
+
+        MDB_txn* txn = nullptr;
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), false);
+            OOCLazyListObject_followLoan(self, txn);
+            OOCLazyListObject_followLoan(otherList, txn);
+            selfValue.asListKey.listId = self->listId;
+            otherValue.asListKey.listId = otherList->listId;
+            PyObject* const result = OOCMap_encodedRichcompare(self->ooc, txn, selfValue, otherValue, op);
+            txn_commit(txn);
+            return result;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            error.pythonize();
+            return nullptr;
+        }
+    }
+
+    if(PyList_Check(other)) {
+        MDB_txn* txn = nullptr;
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), false);
+            OOCLazyListObject_followLoan(self, txn);
+            PyObject* const result = OOCLazyListObject_compareList(self, txn, other, op);
+            txn_commit(txn);
+            return result;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            error.pythonize();
+            return nullptr;
+        }
+    }
+
+    if(other->ob_type == &OOCLazyListType) {
+        // other is in a different map, so all we can do is decode both.
+        if(op == Py_EQ || op == Py_NE) {
+            const Py_ssize_t selfLength = PyObject_Length(pySelf);
+            if(selfLength < 0) return nullptr;
+            const Py_ssize_t otherLength = PyObject_Length(other);
+            if(otherLength < 0) return nullptr;
+            if(selfLength != otherLength)
+                return PyBool_FromLong(op == Py_NE);
+        }
 
-    if(PyList_Check(other) || other->ob_type == &OOCLazyListType) {
         PyObject* const selfIter = PyObject_GetIter(pySelf);
         if(selfIter == nullptr) return nullptr;
         PyObject* const otherIter = PyObject_GetIter(other);
-        if(otherIter == nullptr) return nullptr;
+        if(otherIter == nullptr) {
+            Py_DECREF(selfIter);
+            return nullptr;
+        }
 
+        PyObject* result = nullptr;
         while(true) {
             PyObject* const selfItem = PyIter_Next(selfIter);
-            if(PyErr_Occurred()) return nullptr;
+            if(selfItem == nullptr && PyErr_Occurred()) break;
             PyObject* const otherItem = PyIter_Next(otherIter);
-            if(PyErr_Occurred()) return nullptr;
-
-            if(selfItem == nullptr && otherItem == nullptr) {
-                // Both iterators are at the end, and they compared the same all the way though.
-                return _computeRichcompareResult(0, op);
-            }
-            if(selfItem == nullptr) {
-                // self is exhausted, but other still has items. Self is a prefix of other.
-                return _computeRichcompareResult(-1, op);
-            }
-            if(otherItem == nullptr) {
-                // other is exhausted, but self still has items. Other is a prefix of self.
-                return _computeRichcompareResult(1, op);
+            if(otherItem == nullptr && PyErr_Occurred()) {
+                Py_XDECREF(selfItem);
+                break;
             }
 
-            const int lessThan = PyObject_RichCompareBool(selfItem, otherItem, Py_LT);
-            if(lessThan < 0) return nullptr;
-            if(lessThan) return _computeRichcompareResult(-1, op);
+            if(selfItem == nullptr || otherItem == nullptr) {
+                // At least one of them is exhausted, so the shorter one is a prefix of the other.
+                const int comparison = selfItem != nullptr ? 1 : otherItem != nullptr ? -1 : 0;
+                Py_XDECREF(selfItem);
+                Py_XDECREF(otherItem);
+                result = _computeRichcompareResult(comparison, op);
+                break;
+            }
 
-            const int greaterThan = PyObject_RichCompareBool(selfItem, otherItem, Py_GT);
-            if(greaterThan < 0) return nullptr;
-            if(greaterThan) return _computeRichcompareResult(1, op);
+            // Like Python's lists, we compare only the first items that aren't equal with op.
+            const int equal = PyObject_RichCompareBool(selfItem, otherItem, Py_EQ);
+            if(equal == 0) {
+                if(op == Py_EQ || op == Py_NE)
+                    result = PyBool_FromLong(op == Py_NE);
+                else
+                    result = PyObject_RichCompare(selfItem, otherItem, op);
+            }
+            Py_DECREF(selfItem);
+            Py_DECREF(otherItem);
+            if(equal != 1) break;
         }
+        Py_DECREF(selfIter);
+        Py_DECREF(otherIter);
+        return result;
     } else {
         switch(op) {
         case Py_EQ:
@@ -1152,6 +2346,185 @@ PyObject* OOCLazyList_richcompare(PyObject* const pySelf, PyObject* const other,
     }
 }
 
+static PyObject* OOCLazyList_prefetch(PyObject* const pySelf) {
+    if(pySelf->ob_type != &OOCLazyListType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
+
+    EncodedValue value;
+    value.asUInt = 0;
+    value.typeCodeWithLength = 0;
+    value.typeCode = TYPE_CODE_LIST;
+    value.asListKey.listIndex = ListKey::listIndexLength;
+
+    MDB_txn* txn = nullptr;
+    try {
+        txn = txn_begin(OOCMap_env(self->ooc), false);
+        OOCLazyListObject_followLoan(self, txn);
+        value.asListKey.listId = self->listId;
+        OOCMap_prefetch(self->ooc, txn, &value);
+        txn_commit(txn);
+    } catch(const OocError& error) {
+        if(txn != nullptr)
+            txn_abort(txn);
+        error.pythonize();
+        return nullptr;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* OOCLazyList_contentHash(PyObject* const pySelf) {
+    if(pySelf->ob_type != &OOCLazyListType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
+
+    MDB_txn* txn = nullptr;
+    try {
+        txn = txn_begin(OOCMap_env(self->ooc), false);
+        OOCLazyListObject_followLoan(self, txn);
+        const ContentHash hash = OOCMap_listContentHash(self->ooc, txn, self->listId);
+        txn_commit(txn);
+        return PyLong_FromUnsignedLongLong(hash.sum);
+    } catch(const OocError& error) {
+        if(txn != nullptr)
+            txn_abort(txn);
+        error.pythonize();
+        return nullptr;
+    }
+}
+
+// Doesn't copy any items until either list changes, see loans.h.
+static PyObject* OOCLazyList_copy(PyObject* const pySelf) {
+    if(pySelf->ob_type != &OOCLazyListType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
+
+    OOCLazyListObject* result;
+    try {
+        result = OOCLazyList_fastnew(self->ooc, self->listId);
+    } catch(const OocError& error) {
+        error.pythonize();
+        return nullptr;
+    }
+    // Frozen lists never change, so the copy can have the same one. Read-only maps can't lend.
+    if(OOCMap_isFrozenId(self->ooc, self->listId) || (self->ooc->envFlags & MDB_RDONLY) != 0)
+        return reinterpret_cast<PyObject*>(result);
+
+    MDB_txn* txn = nullptr;
+    while(true) {
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), true);
+            OOCLazyListObject_followLoan(self, txn);
+            const uint32_t copyId = OOCMap_lendList(self->ooc, txn, self->listId);
+            txn_commit(txn);
+            result->listId = self->listId;
+            result->borrowing = true;
+            result->copyId = copyId;
+            return reinterpret_cast<PyObject*>(result);
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+            Py_DECREF(result);
+            error.pythonize();
+            return nullptr;
+        }
+    }
+}
+
+// Builds the new list from the encoded items, so nothing is read into memory.
+static PyObject* OOCLazyList_storedConcat(PyObject* const pySelf, PyObject* const other) {
+    if(pySelf->ob_type != &OOCLazyListType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
+
+    // If we have to retry the transaction, we need to see the same items again, so we can't
+    // consume an iterator directly.
+    PyObject* items;
+    if(other->ob_type == &OOCLazyListType) {
+        items = other;
+        Py_INCREF(items);
+    } else {
+        items = PySequence_Fast(other, "can only concatenate an iterable to a list");
+        if(items == nullptr) return nullptr;
+    }
+
+    MDB_txn* txn = nullptr;
+    while(true) {
+        OOCLazyListObject* result = nullptr;
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), true);
+            OOCLazyListObject_followLoan(self, txn);
+            if(items->ob_type == &OOCLazyListType && reinterpret_cast<OOCLazyListObject*>(items)->ooc == self->ooc)
+                OOCLazyListObject_followLoan(reinterpret_cast<OOCLazyListObject*>(items), txn);
+            result = OOCLazyList_fastnew(self->ooc, OOCMap_newListId(self->ooc, txn, 0));
+            OOCLazyListObject_extend(result, txn, self);
+            OOCLazyListObject_extend(result, txn, items);
+            txn_commit(txn);
+            Py_DECREF(items);
+            return reinterpret_cast<PyObject*>(result);
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            Py_XDECREF(result);
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+            Py_DECREF(items);
+            error.pythonize();
+            return nullptr;
+        }
+    }
+}
+
+static PyObject* OOCLazyList_storedRepeat(PyObject* const pySelf, PyObject* const pyCount) {
+    if(pySelf->ob_type != &OOCLazyListType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCLazyListObject* const self = reinterpret_cast<OOCLazyListObject*>(pySelf);
+
+    const Py_ssize_t count = PyNumber_AsSsize_t(pyCount, PyExc_OverflowError);
+    if(count == -1 && PyErr_Occurred()) return nullptr;
+    // One repetition is a copy, and copies borrow their items, see loans.h.
+    if(count == 1) return OOCLazyList_copy(pySelf);
+
+    MDB_txn* txn = nullptr;
+    while(true) {
+        OOCLazyListObject* result = nullptr;
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), true);
+            OOCLazyListObject_followLoan(self, txn);
+            result = OOCLazyList_fastnew(self->ooc, OOCMap_newListId(self->ooc, txn, 0));
+            if(count > 0) {
+                OOCLazyListObject_extend(result, txn, self);
+                OOCLazyListObject_inplaceRepeat(result, txn, count);
+            }
+            txn_commit(txn);
+            return reinterpret_cast<PyObject*>(result);
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            Py_XDECREF(result);
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+            error.pythonize();
+            return nullptr;
+        }
+    }
+}
+
 static PyMethodDef OOCLazyList_methods[] = {
     {
         "eager",
@@ -1185,6 +2558,62 @@ static PyMethodDef OOCLazyList_methods[] = {
         METH_NOARGS,
         PyDoc_STR("wipes the list")
     },
+    {
+        "insert",
+        (PyCFunction)OOCLazyList_insert,
+        METH_FASTCALL,
+        PyDoc_STR("inserts an item before the given index")
+    },
+    {
+        "pop",
+        (PyCFunction)OOCLazyList_pop,
+        METH_FASTCALL,
+        PyDoc_STR("removes and returns the item at the given index, or the last one")
+    },
+    {
+        "remove",
+        (PyCFunction)OOCLazyList_remove,
+        METH_O,
+        PyDoc_STR("removes the first occurrence of an item")
+    },
+    {
+        "reverse",
+        (PyCFunction)OOCLazyList_reverse,
+        METH_NOARGS,
+        PyDoc_STR("reverses the list in place")
+    },
+    {
+        "sort",
+        (PyCFunction)OOCLazyList_sort,
+        METH_VARARGS | METH_KEYWORDS,
+        PyDoc_STR("sorts the list in place, in runs of run_length items if it is longer than that")
+    },
+    {
+        "prefetch",
+        (PyCFunction)OOCLazyList_prefetch,
+        METH_NOARGS,
+        PyDoc_STR("starts reading the list from disk in the background")
+    }, {
+        "content_hash",
+        (PyCFunction)OOCLazyList_contentHash,
+        METH_NOARGS,
+        PyDoc_STR("returns a hash of the items in the list, which is the same for lists with the same items")
+    }, {
+        "copy",
+        (PyCFunction)OOCLazyList_copy,
+        METH_NOARGS,
+        PyDoc_STR("returns a copy of the list, which only copies the items when either list changes")
+    }, {
+        "stored_concat",
+        (PyCFunction)OOCLazyList_storedConcat,
+        METH_O,
+        PyDoc_STR("returns a new LazyList with the items of this list followed by those of the given iterable")
+    }, {
+        "stored_repeat",
+        (PyCFunction)OOCLazyList_storedRepeat,
+        METH_O,
+        PyDoc_STR("returns a new LazyList with the items of this list repeated the given number of times")
+    },
     {nullptr}, // sentinel
 };
 
@@ -1199,6 +2628,12 @@ static PySequenceMethods OOCLazyList_sequence_methods = {
     .sq_inplace_repeat = OOCLazyList_inplaceRepeat
 };
 
+static PyMappingMethods OOCLazyList_mapping_methods = {
+    .mp_length = OOCLazyList_length,
+    .mp_subscript = OOCLazyList_subscript,
+    .mp_ass_subscript = OOCLazyList_assSubscript
+};
+
 PyTypeObject OOCLazyListType = {
     PyVarObject_HEAD_INIT(nullptr, 0)
     .tp_name = "oocmap.LazyList",
@@ -1206,6 +2641,7 @@ PyTypeObject OOCLazyListType = {
     .tp_itemsize = 0,
     .tp_dealloc = (destructor)OOCLazyList_dealloc,
     .tp_as_sequence = &OOCLazyList_sequence_methods,
+    .tp_as_mapping = &OOCLazyList_mapping_methods,
     .tp_flags = Py_TPFLAGS_DEFAULT,
     .tp_doc = "A list-like class that's backed by an OOCMap",
     .tp_richcompare = OOCLazyList_richcompare,
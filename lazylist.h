@@ -5,6 +5,7 @@
 #include <Python.h>
 
 #include "oocmap.h"
+#include "db.h"
 #include "lmdb.h"
 
 //
@@ -15,12 +16,21 @@ typedef struct {
     PyObject_HEAD
     OOCMapObject* ooc;
     uint32_t listId;
+    // Whether this is a copy that still reads the items of listId, see loans.h. Its own list is
+    // copyId.
+    bool borrowing;
+    uint32_t copyId;
 } OOCLazyListObject;
 
 extern PyTypeObject OOCLazyListType;
 
 OOCLazyListObject* OOCLazyList_fastnew(OOCMapObject* ooc, uint32_t listId);
 
+// A copy stops borrowing once either side changes, see loans.h. This points it at its own list
+// when that has happened. It must come before anything else in the transaction, so we never follow
+// a loan that ends in a transaction we throw away.
+void OOCLazyListObject_followLoan(OOCLazyListObject* self, MDB_txn* txn);
+
 Py_ssize_t OOCLazyListObject_length(OOCLazyListObject* self, MDB_txn* txn);
 
 PyObject* OOCLazyListObject_eager(OOCLazyListObject* self, MDB_txn* txn);
@@ -34,12 +44,30 @@ Py_ssize_t OOCLazyListObject_index(
     Py_ssize_t stop = 9223372036854775807
 );
 
+void OOCLazyListObject_setItem(OOCLazyListObject* self, MDB_txn* txn, Py_ssize_t index, PyObject* item);
+// Returns the items of a slice as a list. The arguments are what PySlice_AdjustIndices() returns.
+PyObject* OOCLazyListObject_slice(OOCLazyListObject* self, MDB_txn* txn, Py_ssize_t start, Py_ssize_t step, Py_ssize_t slicelength);
+// Replaces the items of a slice with items, which must come from PySequence_Fast(), or deletes them
+// if items is nullptr.
+void OOCLazyListObject_setSlice(
+    OOCLazyListObject* self,
+    MDB_txn* txn,
+    Py_ssize_t start,
+    Py_ssize_t stop,
+    Py_ssize_t step,
+    Py_ssize_t slicelength,
+    PyObject* items
+);
 Py_ssize_t OOCLazyListObject_count(OOCLazyListObject* self, MDB_txn* txn, PyObject* value);
 void OOCLazyListObject_extend(OOCLazyListObject* self, MDB_txn* txn, PyObject* pyOther);
 void OOCLazyListObject_extend(OOCLazyListObject* self, MDB_txn* txn, OOCLazyListObject* other);
 void OOCLazyListObject_append(OOCLazyListObject* self, MDB_txn* txn, PyObject* item);
 void OOCLazyListObject_clear(OOCLazyListObject* self, MDB_txn* txn);
 void OOCLazyListObject_inplaceRepeat(OOCLazyListObject* self, MDB_txn* txn, unsigned int count);
+void OOCLazyListObject_insert(OOCLazyListObject* self, MDB_txn* txn, Py_ssize_t index, PyObject* item);
+PyObject* OOCLazyListObject_pop(OOCLazyListObject* self, MDB_txn* txn, Py_ssize_t index);
+void OOCLazyListObject_remove(OOCLazyListObject* self, MDB_txn* txn, PyObject* item);
+void OOCLazyListObject_reverse(OOCLazyListObject* self, MDB_txn* txn);
 
 //
 // OOCLazyListIter
@@ -49,6 +77,13 @@ typedef struct {
     PyObject_HEAD
     OOCLazyListObject* list;
     MDB_cursor* cursor;
+    uint32_t listId;    // of the items we go through, which stays the same if list stops borrowing
+    // The iterator reads the items in batches, see cursor_get_batch() in db.h.
+    Py_ssize_t nextIndex;    // of the next item to read from the cursor
+    Py_ssize_t length;
+    uint32_t batchLength;
+    uint32_t batchPosition;
+    EncodedValue batch[cursorBatchSize];
 } OOCLazyListIterObject;
 
 extern PyTypeObject OOCLazyListIterType;
@@ -1,6 +1,7 @@
 #include "lazytuple.h"
 
 #include "oocmap.h"
+#include "compare.h"
 #include "db.h"
 #include "errors.h"
 
@@ -17,6 +18,7 @@ OOCLazyTupleObject* OOCLazyTuple_fastnew(OOCMapObject* const ooc, const uint64_t
     Py_INCREF(ooc);
     self->tupleId = tupleId;
     self->eager = nullptr;
+    self->hash = -1;
     return self;
 }
 
@@ -36,7 +38,6 @@ PyObject* OOCLazyTupleObject_eager(OOCLazyTupleObject* const self, MDB_txn* cons
     EncodedValue* const encodedResults = static_cast<EncodedValue* const>(mdbValue.mv_data);
     for(Py_ssize_t i = 0; i < size; ++i)
         PyTuple_SET_ITEM(result, i, OOCMap_decode(self->ooc, encodedResults + i, txn));
-    txn_commit(txn);
     self->eager = result;
     Py_INCREF(result);
     return result;
@@ -57,6 +58,7 @@ static PyObject* OOCLazyTuple_new(PyTypeObject* const type, PyObject* const args
     self->ooc = nullptr;
     self->tupleId = 0;
     self->eager = nullptr;
+    self->hash = -1;
     return (PyObject*)self;
 }
 
@@ -77,6 +79,7 @@ static int OOCLazyTuple_init(OOCLazyTupleObject* const self, PyObject* const arg
     self->ooc = reinterpret_cast<OOCMapObject*>(oocmapObject);
     Py_INCREF(oocmapObject);
     self->eager = nullptr;
+    self->hash = -1;
 
     return 0;
 }
@@ -99,7 +102,7 @@ static Py_ssize_t OOCLazyTuple_length(PyObject* const pySelf) {
 
     MDB_txn* txn = nullptr;
     try {
-        txn = txn_begin(self->ooc->mdb, false);
+        txn = txn_begin(OOCMap_env(self->ooc), false);
         MDB_val mdbKey = { .mv_size = sizeof(self->tupleId), .mv_data = &self->tupleId };
         MDB_val mdbValue;
         const bool found = get(txn, self->ooc->tuplesDb, &mdbKey, &mdbValue);
@@ -127,7 +130,7 @@ static PyObject* OOCLazyTuple_item(PyObject* const pySelf, Py_ssize_t const inde
 
     MDB_txn* txn = nullptr;
     try {
-        txn = txn_begin(self->ooc->mdb, false);
+        txn = txn_begin(OOCMap_env(self->ooc), false);
         MDB_val mdbKey = { .mv_size = sizeof(self->tupleId), .mv_data = &self->tupleId };
         MDB_val mdbValue;
         const bool found = get(txn, self->ooc->tuplesDb, &mdbKey, &mdbValue);
@@ -160,8 +163,10 @@ PyObject* OOCLazyTuple_eager(PyObject* const pySelf) {
 
     MDB_txn* txn = nullptr;
     try {
-        txn = txn_begin(self->ooc->mdb, false);
-        return OOCLazyTupleObject_eager(self, txn);
+        txn = txn_begin(OOCMap_env(self->ooc), false);
+        PyObject* const result = OOCLazyTupleObject_eager(self, txn);
+        txn_commit(txn);
+        return result;
     } catch(const OocError& error) {
         if(txn != nullptr)
             txn_abort(txn);
@@ -171,17 +176,70 @@ PyObject* OOCLazyTuple_eager(PyObject* const pySelf) {
 }
 
 Py_hash_t OOCLazyTuple_hash(PyObject* const pySelf) {
+    if(pySelf->ob_type != &OOCLazyTupleType) {
+        PyErr_BadArgument();
+        return -1;
+    }
+    OOCLazyTupleObject* const self = reinterpret_cast<OOCLazyTupleObject*>(pySelf);
+
     // If we want LazyTuple to work as a key in a dict the same way as a normal tuple would, they have to hash
-    // to the same thing. The only way to achieve that is to call eager().
-    PyObject* const eager = OOCLazyTuple_eager(pySelf);
-    if(eager == nullptr) return -1;
-    const Py_hash_t result = PyObject_Hash(eager);
-    Py_DECREF(eager);
-    return result;
+    // to the same thing. We compute the hash the same way Python does, but from the stored items.
+    if(self->hash != -1)
+        return self->hash;
+
+    EncodedValue value;
+    value.asUInt = self->tupleId;
+    value.typeCodeWithLength = 0;
+    value.typeCode = TYPE_CODE_TUPLE;
+
+    MDB_txn* txn = nullptr;
+    try {
+        MDB_env* const env = OOCMap_env(self->ooc);
+        // Usually none of this needs Python, so we release the GIL only once.
+        GilUnlocker gil;
+        txn = txn_begin(env, false);
+        const Py_hash_t result = OOCMap_encodedHash(self->ooc, txn, value);
+        txn_commit(txn);
+        self->hash = result;
+        return result;
+    } catch(const OocError& error) {
+        if(txn != nullptr)
+            txn_abort(txn);
+        error.pythonize();
+        return -1;
+    }
 }
 
 PyObject* OOCLazyTuple_richcompare(PyObject* const pySelf, PyObject* const other, int op) {
-    // TODO: optimize this (but only if it shows up on a profiler)
+    if(pySelf->ob_type != &OOCLazyTupleType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCLazyTupleObject* const self = reinterpret_cast<OOCLazyTupleObject*>(pySelf);
+
+    if(other->ob_type == &OOCLazyTupleType && reinterpret_cast<OOCLazyTupleObject*>(other)->ooc == self->ooc) {
+        // Both tuples are in the same map, so we can compare them without decoding most items.
+        EncodedValue selfValue;
+        selfValue.asUInt = self->tupleId;
+        selfValue.typeCodeWithLength = 0;
+        selfValue.typeCode = TYPE_CODE_TUPLE;
+        EncodedValue otherValue = selfValue;
+        otherValue.asUInt = reinterpret_cast<OOCLazyTupleObject*>(other)->tupleId;
+
+        MDB_txn* txn = nullptr;
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), false);
+            PyObject* const result = OOCMap_encodedRichcompare(self->ooc, txn, selfValue, otherValue, op);
+            txn_commit(txn);
+            return result;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            error.pythonize();
+            return nullptr;
+        }
+    }
+
     PyObject* const eager = OOCLazyTuple_eager(pySelf);
     if(eager == nullptr) return nullptr;
     PyObject* const result = PyObject_RichCompare(eager, other, op);
@@ -189,6 +247,33 @@ PyObject* OOCLazyTuple_richcompare(PyObject* const pySelf, PyObject* const other
     return result;
 }
 
+static PyObject* OOCLazyTuple_prefetch(PyObject* const pySelf) {
+    if(pySelf->ob_type != &OOCLazyTupleType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCLazyTupleObject* const self = reinterpret_cast<OOCLazyTupleObject*>(pySelf);
+
+    EncodedValue value;
+    value.asUInt = 0;
+    value.typeCodeWithLength = 0;
+    value.typeCode = TYPE_CODE_TUPLE;
+    value.asUInt = self->tupleId;
+
+    MDB_txn* txn = nullptr;
+    try {
+        txn = txn_begin(OOCMap_env(self->ooc), false);
+        OOCMap_prefetch(self->ooc, txn, &value);
+        txn_commit(txn);
+    } catch(const OocError& error) {
+        if(txn != nullptr)
+            txn_abort(txn);
+        error.pythonize();
+        return nullptr;
+    }
+    Py_RETURN_NONE;
+}
+
 static PyMethodDef OOCLazyTuple_methods[] = {
     {
         "eager",
@@ -196,6 +281,12 @@ static PyMethodDef OOCLazyTuple_methods[] = {
         METH_NOARGS,
         PyDoc_STR("returns the original tuple")
     },
+    {
+        "prefetch",
+        (PyCFunction)OOCLazyTuple_prefetch,
+        METH_NOARGS,
+        PyDoc_STR("starts reading the tuple from disk in the background")
+    },
     {nullptr}, // sentinel
 };
 
@@ -12,6 +12,7 @@ typedef struct {
     OOCMapObject* ooc;
     uint64_t tupleId;
     PyObject* eager;
+    Py_hash_t hash;     // -1 until we computed it
 } OOCLazyTupleObject;
 
 extern PyTypeObject OOCLazyTupleType;
@@ -0,0 +1,595 @@
+#include "listsort.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "compare.h"
+#include "contenthash.h"
+#include "db.h"
+#include "errors.h"
+#include "loans.h"
+
+//
+// Comparing numbers without decoding them
+//
+
+// Only for values that OOCMap_inlineNumber() reads. NaN doesn't compare consistently, so only
+// list.sort()'s own algorithm gets the same answer for it.
+static bool encodedNumberLess(const EncodedValue& a, const EncodedValue& b) {
+    InlineNumber aNumber;
+    InlineNumber bNumber;
+    OOCMap_inlineNumber(a, &aNumber);
+    OOCMap_inlineNumber(b, &bNumber);
+    return OOCMap_inlineNumberLess(aNumber, bNumber);
+}
+
+// Remembers what the list looked like when we read it, so that we can tell whether somebody
+// changed it before we write it back.
+class SortDigest {
+    uint64_t m_hash = 14695981039346656037ull;
+
+public:
+    void add(const EncodedValue& value) {
+        m_hash = (m_hash ^ std::hash<EncodedValue>()(value)) * 1099511628211ull;
+    }
+
+    bool operator==(const SortDigest& other) const {
+        return m_hash == other.m_hash;
+    }
+};
+
+static void throwModified() {
+    PyErr_SetString(PyExc_ValueError, "list modified during sort");
+    throw OocError(OocError::AlreadyPythonizedError);
+}
+
+//
+// Reading and writing lists by their ID
+//
+
+// Reads count items of a list, starting at start, without decoding them.
+static void readItems(
+    OOCMapObject* const ooc,
+    MDB_txn* const txn,
+    const uint32_t listId,
+    const Py_ssize_t start,
+    const Py_ssize_t count,
+    std::vector<EncodedValue>& dest
+) {
+    dest.resize(count);
+    if(count <= 0) return;
+
+    ListKey encodedListKey = {
+        .listIndex = static_cast<uint32_t>(start),
+        .listId = listId,
+    };
+    MDB_val mdbKey = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
+    MDB_val mdbValue;
+    MDB_cursor* const cursor = cursor_open(txn, ooc->listsDb);
+    try {
+        // Nothing in here needs Python, so we release the GIL once instead of for every item.
+        GilUnlocker gil;
+        bool found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET_RANGE);
+        for(Py_ssize_t i = 0; i < count; ++i) {
+            if(!found) throw OocError(OocError::UnexpectedData);
+            if(mdbKey.mv_size != sizeof(ListKey)) throw OocError(OocError::UnexpectedData);
+            const ListKey* const listItemKey = static_cast<const ListKey*>(mdbKey.mv_data);
+            if(listItemKey->listId != listId || listItemKey->listIndex != start + i)
+                throw OocError(OocError::UnexpectedData);
+            if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+            memcpy(&dest[i], mdbValue.mv_data, sizeof(EncodedValue));
+            if(i + 1 < count)
+                found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT);
+        }
+    } catch(...) {
+        cursor_close(cursor);
+        throw;
+    }
+    cursor_close(cursor);
+}
+
+// Writes values to a list from start on, and sets its length to the end of them.
+static void putItems(
+    OOCMapObject* const ooc,
+    MDB_txn* const txn,
+    const uint32_t listId,
+    const Py_ssize_t start,
+    const std::vector<EncodedValue>& values
+) {
+    ListKey encodedListKey = {
+        .listIndex = static_cast<uint32_t>(start),
+        .listId = listId,
+    };
+    MDB_val mdbKey = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
+    GilUnlocker gil;
+    ContentHash hash;
+    OOCMap_getListHeader(ooc, txn, listId, &hash);
+    for(const EncodedValue& value : values) {
+        MDB_val mdbValue = { .mv_size = sizeof(value), .mv_data = const_cast<EncodedValue*>(&value) };
+        put(txn, ooc->listsDb, &mdbKey, &mdbValue);
+        if(ooc->contentHashes) hash.addListItem(encodedListKey.listIndex, value);
+        encodedListKey.listIndex += 1;
+    }
+
+    OOCMap_putListHeader(ooc, txn, listId, encodedListKey.listIndex, hash);
+}
+
+// Writes values to a new temporary list in a transaction of its own, and returns its ID.
+static uint32_t newTempList(OOCMapObject* const ooc, const std::vector<EncodedValue>& values) {
+    MDB_txn* txn = nullptr;
+    while(true) {
+        try {
+            txn = txn_begin(OOCMap_env(ooc), true);
+            const uint32_t listId = OOCMap_newListId(ooc, txn, 0);
+            putItems(ooc, txn, listId, 0, values);
+            txn_commit(txn);
+            return listId;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(ooc, error))
+                continue;
+            throw;
+        }
+    }
+}
+
+// Appends values to a temporary list in a transaction of its own.
+static void appendToTempList(
+    OOCMapObject* const ooc,
+    const uint32_t listId,
+    const Py_ssize_t start,
+    const std::vector<EncodedValue>& values
+) {
+    MDB_txn* txn = nullptr;
+    while(true) {
+        try {
+            txn = txn_begin(OOCMap_env(ooc), true);
+            putItems(ooc, txn, listId, start, values);
+            txn_commit(txn);
+            return;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(ooc, error))
+                continue;
+            throw;
+        }
+    }
+}
+
+static void deleteList(OOCMapObject* const ooc, MDB_txn* const txn, const uint32_t listId) {
+    ListKey encodedListKey = {
+        .listIndex = 0,
+        .listId = listId,
+    };
+    MDB_val mdbKey = { .mv_size = sizeof(encodedListKey), .mv_data = &encodedListKey };
+    MDB_val mdbValue;
+    MDB_cursor* const cursor = cursor_open(txn, ooc->listsDb);
+    try {
+        // The length record comes last, so this deletes it too.
+        bool found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET_RANGE);
+        while(found) {
+            if(mdbKey.mv_size != sizeof(ListKey)) throw OocError(OocError::UnexpectedData);
+            if(static_cast<const ListKey*>(mdbKey.mv_data)->listId != listId) break;
+            cursor_del(cursor);
+            found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT);
+        }
+    } catch(...) {
+        cursor_close(cursor);
+        throw;
+    }
+    cursor_close(cursor);
+}
+
+// Deletes the temporary lists after a failure. The failure is what the caller will report, so this
+// gives up quietly.
+static void deleteTempLists(OOCMapObject* const ooc, const std::vector<uint32_t>& listIds) {
+    if(listIds.empty()) return;
+    PyObject* type;
+    PyObject* value;
+    PyObject* traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    MDB_txn* txn = nullptr;
+    try {
+        txn = txn_begin(OOCMap_env(ooc), true);
+        for(const uint32_t listId : listIds)
+            deleteList(ooc, txn, listId);
+        txn_commit(txn);
+    } catch(const OocError& error) {
+        if(txn != nullptr)
+            txn_abort(txn);
+    }
+    PyErr_Restore(type, value, traceback);
+}
+
+//
+// Sorting in memory
+//
+
+// Decodes values into a new list. They must have been read in txn.
+static PyObject* decodeItems(OOCMapObject* const ooc, MDB_txn* const txn, std::vector<EncodedValue>& values) {
+    OOCMap_prefetch(ooc, txn, values.data(), values.size(), true);
+    PyObject* const result = PyList_New(values.size());
+    if(result == nullptr) throw OocError(OocError::AlreadyPythonizedError);
+    try {
+        for(size_t i = 0; i < values.size(); ++i)
+            PyList_SET_ITEM(result, i, OOCMap_decode(ooc, &values[i], txn));
+    } catch(...) {
+        Py_DECREF(result);
+        throw;
+    }
+    return result;
+}
+
+// Replaces the items with what key returns for them, unless key is None.
+static void applyKey(PyObject* const items, PyObject* const key) {
+    if(key == Py_None) return;
+    for(Py_ssize_t i = 0; i < PyList_GET_SIZE(items); ++i) {
+        PyObject* const itemKey = PyObject_CallFunctionObjArgs(key, PyList_GET_ITEM(items, i), nullptr);
+        if(itemKey == nullptr) throw OocError(OocError::AlreadyPythonizedError);
+        PyList_SetItem(items, i, itemKey);
+    }
+}
+
+// Returns the order that sorts keys, as list.sort() would sort them.
+static std::vector<Py_ssize_t> sortOrder(PyObject* const keys, const bool reverse) {
+    const Py_ssize_t length = PyList_GET_SIZE(keys);
+    PyObject* const order = PyList_New(length);
+    if(order == nullptr) throw OocError(OocError::AlreadyPythonizedError);
+    PyObject* getKey = nullptr;
+    PyObject* kwargs = nullptr;
+    PyObject* sortMethod = nullptr;
+    PyObject* emptyArgs = nullptr;
+    PyObject* sortResult = nullptr;
+    std::vector<Py_ssize_t> result;
+    for(Py_ssize_t i = 0; i < length; ++i) {
+        PyObject* const index = PyLong_FromSsize_t(i);
+        if(index == nullptr) goto done;
+        PyList_SET_ITEM(order, i, index);
+    }
+
+    // Sorting the indices by their keys keeps list.sort()'s stability, even in reverse.
+    getKey = PyObject_GetAttrString(keys, "__getitem__");
+    if(getKey == nullptr) goto done;
+    kwargs = Py_BuildValue("{s:O,s:O}", "key", getKey, "reverse", reverse ? Py_True : Py_False);
+    if(kwargs == nullptr) goto done;
+    sortMethod = PyObject_GetAttrString(order, "sort");
+    if(sortMethod == nullptr) goto done;
+    emptyArgs = PyTuple_New(0);
+    if(emptyArgs == nullptr) goto done;
+    sortResult = PyObject_Call(sortMethod, emptyArgs, kwargs);
+    if(sortResult == nullptr) goto done;
+
+    result.resize(length);
+    for(Py_ssize_t i = 0; i < length; ++i)
+        result[i] = PyLong_AsSsize_t(PyList_GET_ITEM(order, i));
+
+done:
+    Py_XDECREF(sortResult);
+    Py_XDECREF(emptyArgs);
+    Py_XDECREF(sortMethod);
+    Py_XDECREF(kwargs);
+    Py_XDECREF(getKey);
+    Py_DECREF(order);
+    if(PyErr_Occurred()) throw OocError(OocError::AlreadyPythonizedError);
+    return result;
+}
+
+// Reads count items of the list from start, and sorts their encodings. Returns whether it could
+// compare the encodings directly.
+static bool readSortedRun(
+    OOCLazyListObject* const self,
+    const Py_ssize_t start,
+    const Py_ssize_t count,
+    PyObject* const key,
+    const bool reverse,
+    std::vector<EncodedValue>& values,
+    SortDigest& digest
+) {
+    bool numeric = key == Py_None;
+    PyObject* keys = nullptr;
+    MDB_txn* txn = nullptr;
+    try {
+        txn = txn_begin(OOCMap_env(self->ooc), false);
+        readItems(self->ooc, txn, self->listId, start, count, values);
+        InlineNumber number;
+        for(const EncodedValue& value : values) {
+            digest.add(value);
+            numeric = numeric && OOCMap_inlineNumber(value, &number);
+        }
+        if(!numeric)
+            keys = decodeItems(self->ooc, txn, values);
+        txn_commit(txn);
+
+        if(numeric) {
+            GilUnlocker gil;
+            std::stable_sort(
+                values.begin(),
+                values.end(),
+                [reverse](const EncodedValue& a, const EncodedValue& b) {
+                    return reverse ? encodedNumberLess(b, a) : encodedNumberLess(a, b);
+                });
+            return true;
+        }
+
+        applyKey(keys, key);
+        const std::vector<Py_ssize_t> order = sortOrder(keys, reverse);
+        Py_CLEAR(keys);
+        std::vector<EncodedValue> sorted(values.size());
+        for(size_t i = 0; i < values.size(); ++i)
+            sorted[i] = values[order[i]];
+        values.swap(sorted);
+        return false;
+    } catch(...) {
+        if(txn != nullptr)
+            txn_abort(txn);
+        Py_XDECREF(keys);
+        throw;
+    }
+}
+
+//
+// Merging sorted runs
+//
+
+struct SortRun {
+    uint32_t listId;            // the temporary list that holds the run
+    Py_ssize_t length;
+    Py_ssize_t nextToRead;
+    std::vector<EncodedValue> values;   // read ahead from the temporary list
+    PyObject* keys;             // the keys of values, unless we compare the encodings directly
+    size_t pos;                 // the head of the run in values
+};
+
+static void refillRun(
+    OOCMapObject* const ooc,
+    SortRun& run,
+    const Py_ssize_t blockLength,
+    PyObject* const key,
+    const bool numeric
+) {
+    const Py_ssize_t count = std::min(blockLength, run.length - run.nextToRead);
+    Py_CLEAR(run.keys);
+    MDB_txn* txn = nullptr;
+    try {
+        txn = txn_begin(OOCMap_env(ooc), false);
+        readItems(ooc, txn, run.listId, run.nextToRead, count, run.values);
+        if(!numeric)
+            run.keys = decodeItems(ooc, txn, run.values);
+        txn_commit(txn);
+    } catch(...) {
+        if(txn != nullptr)
+            txn_abort(txn);
+        throw;
+    }
+    if(!numeric)
+        applyKey(run.keys, key);
+    run.nextToRead += count;
+    run.pos = 0;
+}
+
+// Merges the runs into the temporary list sortedListId, writing runLength items at a time.
+static void mergeRuns(
+    OOCMapObject* const ooc,
+    std::vector<SortRun>& runs,
+    const uint32_t sortedListId,
+    PyObject* const key,
+    const bool reverse,
+    const bool numeric,
+    const Py_ssize_t runLength
+) {
+    // Whether the head of run x sorts before the head of run y, ignoring stability
+    const auto before = [&](const size_t x, const size_t y) -> bool {
+        const SortRun& first = runs[reverse ? y : x];
+        const SortRun& second = runs[reverse ? x : y];
+        if(numeric)
+            return encodedNumberLess(first.values[first.pos], second.values[second.pos]);
+        const int result = PyObject_RichCompareBool(
+            PyList_GET_ITEM(first.keys, first.pos),
+            PyList_GET_ITEM(second.keys, second.pos),
+            Py_LT);
+        if(result < 0) throw OocError(OocError::AlreadyPythonizedError);
+        return result;
+    };
+    // The runs are in the order of the list, so on a tie, the earlier run goes first.
+    const auto precedes = [&](const size_t x, const size_t y) -> bool {
+        return x < y ? !before(y, x) : before(x, y);
+    };
+    const auto heapOrder = [&](const size_t x, const size_t y) -> bool {
+        return precedes(y, x);
+    };
+
+    // Altogether, the runs read about as many items ahead as there are in one run.
+    const Py_ssize_t blockLength = std::max<Py_ssize_t>(16, runLength / runs.size());
+    std::vector<size_t> heap;
+    for(size_t i = 0; i < runs.size(); ++i) {
+        refillRun(ooc, runs[i], blockLength, key, numeric);
+        heap.push_back(i);
+        std::push_heap(heap.begin(), heap.end(), heapOrder);
+    }
+
+    std::vector<EncodedValue> sorted;
+    Py_ssize_t written = 0;
+    while(!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), heapOrder);
+        SortRun& run = runs[heap.back()];
+        sorted.push_back(run.values[run.pos]);
+        run.pos += 1;
+        if(run.pos < run.values.size()) {
+            std::push_heap(heap.begin(), heap.end(), heapOrder);
+        } else if(run.nextToRead < run.length) {
+            refillRun(ooc, run, blockLength, key, numeric);
+            std::push_heap(heap.begin(), heap.end(), heapOrder);
+        } else {
+            Py_CLEAR(run.keys);
+            heap.pop_back();
+        }
+
+        if(static_cast<Py_ssize_t>(sorted.size()) >= runLength || heap.empty()) {
+            appendToTempList(ooc, sortedListId, written, sorted);
+            written += sorted.size();
+            sorted.clear();
+        }
+    }
+}
+
+// Writes the sorted items over the list, if the list still is what we read. They come either from
+// sorted or from the temporary list sortedListId. The temporary lists are deleted in the same
+// transaction.
+static void replaceItems(
+    OOCLazyListObject* const self,
+    const Py_ssize_t length,
+    const SortDigest& digest,
+    const std::vector<EncodedValue>* const sorted,
+    const uint32_t sortedListId,
+    const std::vector<uint32_t>& tempListIds
+) {
+    MDB_txn* txn = nullptr;
+    MDB_cursor* destCursor = nullptr;
+    MDB_cursor* sourceCursor = nullptr;
+    while(true) {
+        try {
+            txn = txn_begin(OOCMap_env(self->ooc), true);
+            if(OOCLazyListObject_length(self, txn) != length) throwModified();
+            OOCMap_settleListLoans(self->ooc, txn, self->listId);
+
+            if(length > 0) {
+                destCursor = cursor_open(txn, self->ooc->listsDb);
+                ListKey destListKey = { .listIndex = 0, .listId = self->listId };
+                MDB_val mdbDestKey = { .mv_size = sizeof(destListKey), .mv_data = &destListKey };
+                MDB_val mdbDestValue;
+                bool destFound = cursor_get(destCursor, &mdbDestKey, &mdbDestValue, MDB_SET_RANGE);
+
+                ListKey sourceListKey = { .listIndex = 0, .listId = sortedListId };
+                MDB_val mdbSourceKey = { .mv_size = sizeof(sourceListKey), .mv_data = &sourceListKey };
+                MDB_val mdbSourceValue;
+                bool sourceFound = false;
+                if(sorted == nullptr) {
+                    sourceCursor = cursor_open(txn, self->ooc->listsDb);
+                    sourceFound = cursor_get(sourceCursor, &mdbSourceKey, &mdbSourceValue, MDB_SET_RANGE);
+                }
+
+                SortDigest current;
+                // The sorted list holds the same items in another order, so its content hash is
+                // computed from scratch as we write them.
+                ContentHash hash = { .sum = 0, .nanCount = 0 };
+                {
+                    // Nothing in here needs Python, so we release the GIL once instead of for every item.
+                    GilUnlocker gil;
+                    for(Py_ssize_t i = 0; i < length; ++i) {
+                        if(!destFound || mdbDestKey.mv_size != sizeof(ListKey)) throw OocError(OocError::UnexpectedData);
+                        const ListKey* const destItemKey = static_cast<const ListKey*>(mdbDestKey.mv_data);
+                        if(destItemKey->listId != self->listId || destItemKey->listIndex != i)
+                            throw OocError(OocError::UnexpectedData);
+                        if(mdbDestValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+                        EncodedValue value;
+                        memcpy(&value, mdbDestValue.mv_data, sizeof(value));
+                        current.add(value);
+
+                        if(sorted != nullptr) {
+                            value = (*sorted)[i];
+                        } else {
+                            if(!sourceFound || mdbSourceKey.mv_size != sizeof(ListKey)) throw OocError(OocError::UnexpectedData);
+                            const ListKey* const sourceItemKey = static_cast<const ListKey*>(mdbSourceKey.mv_data);
+                            if(sourceItemKey->listId != sortedListId || sourceItemKey->listIndex != i)
+                                throw OocError(OocError::UnexpectedData);
+                            if(mdbSourceValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+                            memcpy(&value, mdbSourceValue.mv_data, sizeof(value));
+                            sourceFound = cursor_get(sourceCursor, &mdbSourceKey, &mdbSourceValue, MDB_NEXT);
+                        }
+                        if(self->ooc->contentHashes) hash.addListItem(i, value);
+                        mdbDestValue = (MDB_val) { .mv_size = sizeof(value), .mv_data = &value };
+                        cursor_put(destCursor, &mdbDestKey, &mdbDestValue, MDB_CURRENT);
+                        destFound = cursor_get(destCursor, &mdbDestKey, &mdbDestValue, MDB_NEXT);
+                    }
+                }
+                if(!(current == digest)) throwModified();
+
+                if(sourceCursor != nullptr) cursor_close(sourceCursor);
+                sourceCursor = nullptr;
+                cursor_close(destCursor);
+                destCursor = nullptr;
+                if(self->ooc->contentHashes) OOCMap_putListHeader(self->ooc, txn, self->listId, length, hash);
+            }
+
+            for(const uint32_t listId : tempListIds)
+                deleteList(self->ooc, txn, listId);
+            txn_commit(txn);
+            return;
+        } catch(const OocError& error) {
+            if(sourceCursor != nullptr) cursor_close(sourceCursor);
+            sourceCursor = nullptr;
+            if(destCursor != nullptr) cursor_close(destCursor);
+            destCursor = nullptr;
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self->ooc, error))
+                continue;
+            throw;
+        }
+    }
+}
+
+void OOCLazyListObject_sort(
+    OOCLazyListObject* const self,
+    PyObject* const key,
+    const bool reverse,
+    const Py_ssize_t runLength
+) {
+    Py_ssize_t length;
+    MDB_txn* txn = nullptr;
+    try {
+        txn = txn_begin(OOCMap_env(self->ooc), false);
+        length = OOCLazyListObject_length(self, txn);
+        txn_commit(txn);
+    } catch(...) {
+        if(txn != nullptr)
+            txn_abort(txn);
+        throw;
+    }
+
+    SortDigest digest;
+    if(length <= runLength) {
+        std::vector<EncodedValue> values;
+        readSortedRun(self, 0, length, key, reverse, values, digest);
+        replaceItems(self, length, digest, &values, 0, std::vector<uint32_t>());
+        return;
+    }
+
+    std::vector<uint32_t> tempListIds;
+    std::vector<SortRun> runs;
+    try {
+        bool numeric = true;
+        std::vector<EncodedValue> values;
+        for(Py_ssize_t start = 0; start < length; start += runLength) {
+            const Py_ssize_t count = std::min(runLength, length - start);
+            numeric = readSortedRun(self, start, count, key, reverse, values, digest) && numeric;
+            const uint32_t runListId = newTempList(self->ooc, values);
+            tempListIds.push_back(runListId);
+            runs.push_back(SortRun {
+                .listId = runListId,
+                .length = count,
+                .nextToRead = 0,
+                .values = std::vector<EncodedValue>(),
+                .keys = nullptr,
+                .pos = 0,
+            });
+        }
+        std::vector<EncodedValue>().swap(values);
+
+        const uint32_t sortedListId = newTempList(self->ooc, values);
+        tempListIds.push_back(sortedListId);
+        mergeRuns(self->ooc, runs, sortedListId, key, reverse, numeric, runLength);
+        replaceItems(self, length, digest, nullptr, sortedListId, tempListIds);
+    } catch(...) {
+        for(SortRun& run : runs)
+            Py_CLEAR(run.keys);
+        deleteTempLists(self->ooc, tempListIds);
+        throw;
+    }
+}
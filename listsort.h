@@ -0,0 +1,30 @@
+#ifndef OOCMAP_LISTSORT_H
+#define OOCMAP_LISTSORT_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "lazylist.h"
+
+//
+// Sorting LazyLists, including lists that don't fit into memory
+//
+// Lists of up to runLength items are sorted in memory. Longer lists are cut into runs of
+// runLength items. Each run is sorted in memory and written to a temporary list in the same map,
+// and then the runs are merged into one more temporary list, which is copied over the original in
+// a single write transaction. If the process dies before that, the temporary lists stay behind in
+// the map.
+//
+// When there is no key function and every item is a number that fits into its EncodedValue, the
+// encodings are compared directly, without creating any PyObjects.
+//
+
+// The default for how many items to sort in memory at once
+const Py_ssize_t OOCLAZYLIST_SORT_RUN_LENGTH = 1 << 20;
+
+// Sorts the list in place, like list.sort(). This runs its own transactions, and calls key and
+// compares items while none of them are open, so both may use the map. With more than runLength
+// items, key is called twice for each item.
+void OOCLazyListObject_sort(OOCLazyListObject* self, PyObject* key, bool reverse, Py_ssize_t runLength);
+
+#endif //OOCMAP_LISTSORT_H
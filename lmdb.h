@@ -303,6 +303,8 @@ typedef void (MDB_rel_func)(MDB_val *item, void *oldptr, void *newptr, void *rel
 #define MDB_NORDAHEAD	0x800000
 	/** don't initialize malloc'd memory before writing to datafile */
 #define MDB_NOMEMINIT	0x1000000
+	/** align the map and ask for transparent huge pages (Linux only) */
+#define MDB_HUGEPAGES	0x2000000
 /** @} */
 
 /**	@defgroup	mdb_dbi_open	Database Flags
@@ -810,6 +812,21 @@ int  mdb_env_get_path(MDB_env *env, const char **path);
 	 */
 int  mdb_env_get_fd(MDB_env *env, mdb_filehandle_t *fd);
 
+	/** @brief Return the address of the memory map.
+	 *
+	 * Unlike #MDB_envinfo.%me_mapaddr, this is where the map actually is,
+	 * even without #MDB_FIXEDMAP. The address changes when the map is resized.
+	 *
+	 * @param[in] env An environment handle returned by #mdb_env_create()
+	 * @param[out] addr Address of a pointer to contain the map address.
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>EINVAL - an invalid parameter was specified.
+	 * </ul>
+	 */
+int  mdb_env_get_map(MDB_env *env, void **addr);
+
 	/** @brief Set the size of the memory map to use for this environment.
 	 *
 	 * The size should be a multiple of the OS page size. The default is
@@ -1544,6 +1561,28 @@ int  mdb_cursor_del(MDB_cursor *cursor, unsigned int flags);
 	 */
 int  mdb_cursor_count(MDB_cursor *cursor, size_t *countp);
 
+	/** @brief Return keys that split a database into parts of about the same size.
+	 *
+	 * This walks down the B-tree from the root until one level of it has
+	 * several keys for every key wanted, and returns evenly spaced keys from
+	 * that level. It only reads leaf pages when the tree is too small to have
+	 * enough branch keys. Key  i is the first key of part  i+1. The keys
+	 * point into the map and stay valid until the end of the transaction.
+	 * This call is not valid on databases with #MDB_DUPSORT.
+	 * @param[in] txn A transaction handle returned by #mdb_txn_begin()
+	 * @param[in] dbi A database handle returned by #mdb_dbi_open()
+	 * @param[out] keys An array of at least  *count keys.
+	 * @param[in,out] count The number of keys wanted. On return, the number
+	 * of keys found, which can be smaller for small databases.
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>MDB_INCOMPATIBLE - the database uses #MDB_DUPSORT.
+	 *	<li>EINVAL - an invalid parameter was specified.
+	 * </ul>
+	 */
+int  mdb_dbi_split_keys(MDB_txn *txn, MDB_dbi dbi, MDB_val *keys, unsigned int *count);
+
 	/** @brief Compare two data items according to a particular database.
 	 *
 	 * This returns a comparison as if the two data items were keys in the
@@ -0,0 +1,301 @@
+#include "loans.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "contenthash.h"
+#include "db.h"
+#include "errors.h"
+
+static_assert(sizeof(ListHeader) == sizeof(DictHeader), "lists and dicts share the code for their headers");
+
+// Copying reads this many items at a time, so copying a long list doesn't need much memory.
+static const Py_ssize_t copyChunkSize = 4096;
+
+//
+// Headers with loans
+//
+
+// The header of a list or dict
+class HeaderRecord {
+    MDB_dbi m_dbi;
+    ListKey m_listKey;
+    uint32_t m_dictId;
+    MDB_val m_key;
+    size_t m_shortSize;     // without content hash or loans
+
+public:
+    HeaderRecord(OOCMapObject* const ooc, const uint8_t typeCode, const uint32_t id) {
+        if(typeCode == TYPE_CODE_LIST) {
+            m_dbi = ooc->listsDb;
+            m_listKey = { .listIndex = ListKey::listIndexLength, .listId = id };
+            m_key = { .mv_size = sizeof(m_listKey), .mv_data = &m_listKey };
+            m_shortSize = sizeof(ListHeader::length);
+        } else {
+            m_dbi = ooc->dictsDb;
+            m_dictId = id;
+            m_key = { .mv_size = sizeof(m_dictId), .mv_data = &m_dictId };
+            m_shortSize = sizeof(DictHeader::length);
+        }
+    }
+    HeaderRecord(const HeaderRecord&) = delete;
+
+    // Reads the header in its full form, and the IDs of the copies that follow it.
+    void read(MDB_txn* const txn, char (&header)[sizeof(ListHeader)], std::vector<uint32_t>& copyIds) {
+        MDB_val mdbValue;
+        if(!get(txn, m_dbi, &m_key, &mdbValue)) throw OocError(OocError::UnexpectedData);
+        memset(header, 0, sizeof(header));
+        copyIds.clear();
+        if(mdbValue.mv_size == m_shortSize) {
+            memcpy(header, mdbValue.mv_data, m_shortSize);
+            return;
+        }
+        if(mdbValue.mv_size < sizeof(header) || (mdbValue.mv_size - sizeof(header)) % sizeof(uint32_t) != 0)
+            throw OocError(OocError::UnexpectedData);
+        memcpy(header, mdbValue.mv_data, sizeof(header));
+        copyIds.resize((mdbValue.mv_size - sizeof(header)) / sizeof(uint32_t));
+        memcpy(
+            copyIds.data(),
+            static_cast<const char*>(mdbValue.mv_data) + sizeof(header),
+            copyIds.size() * sizeof(uint32_t));
+    }
+
+    void write(
+        OOCMapObject* const ooc,
+        MDB_txn* const txn,
+        const char (&header)[sizeof(ListHeader)],
+        const std::vector<uint32_t>& copyIds
+    ) {
+        std::vector<char> value(header, header + sizeof(header));
+        if(copyIds.empty() && !ooc->contentHashes) {
+            value.resize(m_shortSize);
+        } else {
+            const char* const ids = reinterpret_cast<const char*>(copyIds.data());
+            value.insert(value.end(), ids, ids + copyIds.size() * sizeof(uint32_t));
+        }
+        MDB_val mdbValue = { .mv_size = value.size(), .mv_data = value.data() };
+        put(txn, m_dbi, &m_key, &mdbValue);
+    }
+
+    void remove(MDB_txn* const txn) {
+        del(txn, m_dbi, &m_key);
+    }
+};
+
+//
+// Copying items
+//
+
+static void copyListItems(OOCMapObject* const ooc, MDB_txn* const txn, const uint32_t fromId, const uint32_t toId) {
+    const Py_ssize_t length = OOCMap_getListHeader(ooc, txn, fromId);
+    std::vector<EncodedValue> items;
+    for(Py_ssize_t start = 0; start < length; start += copyChunkSize) {
+        items.resize(std::min(copyChunkSize, length - start));
+
+        ListKey listKey = { .listIndex = static_cast<uint32_t>(start), .listId = fromId };
+        MDB_val mdbKey = { .mv_size = sizeof(listKey), .mv_data = &listKey };
+        MDB_val mdbValue;
+        MDB_cursor* const cursor = cursor_open(txn, ooc->listsDb);
+        try {
+            bool found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET_KEY);
+            for(size_t i = 0; i < items.size(); ++i) {
+                if(i > 0) found = cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT);
+                if(!found || mdbKey.mv_size != sizeof(ListKey)) throw OocError(OocError::UnexpectedData);
+                const ListKey* const itemKey = static_cast<const ListKey*>(mdbKey.mv_data);
+                if(itemKey->listId != fromId || itemKey->listIndex != start + i)
+                    throw OocError(OocError::UnexpectedData);
+                if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+                memcpy(&items[i], mdbValue.mv_data, sizeof(EncodedValue));
+            }
+        } catch(...) {
+            cursor_close(cursor);
+            throw;
+        }
+        cursor_close(cursor);
+
+        listKey = { .listIndex = static_cast<uint32_t>(start), .listId = toId };
+        mdbKey = { .mv_size = sizeof(listKey), .mv_data = &listKey };
+        for(EncodedValue& item : items) {
+            mdbValue = { .mv_size = sizeof(item), .mv_data = &item };
+            put(txn, ooc->listsDb, &mdbKey, &mdbValue);
+            listKey.listIndex += 1;
+        }
+    }
+}
+
+static void copyDictItems(OOCMapObject* const ooc, MDB_txn* const txn, uint32_t fromId, const uint32_t toId) {
+    // Each chunk starts after the last key of the one before it.
+    DictItemKey resumeKey = { .dictId = fromId };
+    bool resume = false;
+    std::vector<std::pair<EncodedValue, EncodedValue>> items;
+    bool done = false;
+    while(!done) {
+        items.clear();
+        MDB_val mdbKey = resume ?
+            MDB_val { .mv_size = sizeof(resumeKey), .mv_data = &resumeKey } :
+            MDB_val { .mv_size = sizeof(fromId), .mv_data = &fromId };
+        MDB_val mdbValue;
+        MDB_cursor* const cursor = cursor_open(txn, ooc->dictsDb);
+        try {
+            if(!cursor_get(cursor, &mdbKey, &mdbValue, MDB_SET)) throw OocError(OocError::UnexpectedData);
+            done = true;
+            while(cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT)) {
+                // The next dict's header ends our items.
+                if(mdbKey.mv_size != sizeof(DictItemKey)) break;
+                const DictItemKey* const itemKey = static_cast<const DictItemKey*>(mdbKey.mv_data);
+                if(itemKey->dictId != fromId) break;
+                if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+                EncodedValue value;
+                memcpy(&value, mdbValue.mv_data, sizeof(value));
+                items.emplace_back(itemKey->key, value);
+                if(static_cast<Py_ssize_t>(items.size()) == copyChunkSize) {
+                    done = false;
+                    break;
+                }
+            }
+        } catch(...) {
+            cursor_close(cursor);
+            throw;
+        }
+        cursor_close(cursor);
+
+        for(auto& item : items) {
+            DictItemKey itemKey = { .dictId = toId, .key = item.first };
+            MDB_val mdbItemKey = { .mv_size = sizeof(itemKey), .mv_data = &itemKey };
+            MDB_val mdbItemValue = { .mv_size = sizeof(item.second), .mv_data = &item.second };
+            put(txn, ooc->dictsDb, &mdbItemKey, &mdbItemValue);
+        }
+        if(!items.empty()) {
+            resumeKey.key = items.back().first;
+            resume = true;
+        }
+    }
+}
+
+//
+// Loans of either
+//
+
+static void copyItems(OOCMapObject* const ooc, MDB_txn* const txn, const uint8_t typeCode, const uint32_t fromId, const uint32_t toId) {
+    if(typeCode == TYPE_CODE_LIST)
+        copyListItems(ooc, txn, fromId, toId);
+    else
+        copyDictItems(ooc, txn, fromId, toId);
+}
+
+static void lend(OOCMapObject* const ooc, MDB_txn* const txn, const uint8_t typeCode, const uint32_t id, const uint32_t copyId) {
+    HeaderRecord record(ooc, typeCode, id);
+    char header[sizeof(ListHeader)];
+    std::vector<uint32_t> copyIds;
+    record.read(txn, header, copyIds);
+    copyIds.push_back(copyId);
+    record.write(ooc, txn, header, copyIds);
+}
+
+static bool loanActive(OOCMapObject* const ooc, MDB_txn* const txn, const uint8_t typeCode, const uint32_t id, const uint32_t copyId) {
+    HeaderRecord record(ooc, typeCode, id);
+    char header[sizeof(ListHeader)];
+    std::vector<uint32_t> copyIds;
+    record.read(txn, header, copyIds);
+    return std::find(copyIds.begin(), copyIds.end(), copyId) != copyIds.end();
+}
+
+static void repay(OOCMapObject* const ooc, MDB_txn* const txn, const uint8_t typeCode, const uint32_t id, const uint32_t copyId) {
+    GilUnlocker gil;
+    HeaderRecord record(ooc, typeCode, id);
+    char header[sizeof(ListHeader)];
+    std::vector<uint32_t> copyIds;
+    record.read(txn, header, copyIds);
+    const auto loan = std::find(copyIds.begin(), copyIds.end(), copyId);
+    if(loan == copyIds.end()) throw OocError(OocError::UnexpectedData);
+    copyIds.erase(loan);
+    record.write(ooc, txn, header, copyIds);
+
+    copyItems(ooc, txn, typeCode, id, copyId);
+    HeaderRecord(ooc, typeCode, copyId).write(ooc, txn, header, std::vector<uint32_t>());
+}
+
+static void settle(OOCMapObject* const ooc, MDB_txn* const txn, const uint8_t typeCode, const uint32_t id) {
+    GilUnlocker gil;
+    HeaderRecord record(ooc, typeCode, id);
+    char header[sizeof(ListHeader)];
+    std::vector<uint32_t> copyIds;
+    record.read(txn, header, copyIds);
+    // Almost nothing lends its items, so this is all most changes pay for.
+    if(copyIds.empty()) return;
+
+    const std::vector<uint32_t> noCopies;
+    record.write(ooc, txn, header, noCopies);
+    for(const uint32_t copyId : copyIds) {
+        copyItems(ooc, txn, typeCode, id, copyId);
+        HeaderRecord(ooc, typeCode, copyId).write(ooc, txn, header, noCopies);
+    }
+}
+
+static void release(OOCMapObject* const ooc, MDB_txn* const txn, const uint8_t typeCode, const uint32_t id, const uint32_t copyId) {
+    HeaderRecord record(ooc, typeCode, id);
+    char header[sizeof(ListHeader)];
+    std::vector<uint32_t> copyIds;
+    record.read(txn, header, copyIds);
+    const auto loan = std::find(copyIds.begin(), copyIds.end(), copyId);
+    if(loan == copyIds.end()) return;
+    copyIds.erase(loan);
+    record.write(ooc, txn, header, copyIds);
+
+    // Copies start out with nothing but a header.
+    HeaderRecord(ooc, typeCode, copyId).remove(txn);
+}
+
+//
+// Lists
+//
+
+uint32_t OOCMap_lendList(OOCMapObject* const ooc, MDB_txn* const txn, const uint32_t listId) {
+    const uint32_t copyId = OOCMap_newListId(ooc, txn, 0);
+    lend(ooc, txn, TYPE_CODE_LIST, listId, copyId);
+    return copyId;
+}
+
+bool OOCMap_listLoanActive(OOCMapObject* const ooc, MDB_txn* const txn, const uint32_t listId, const uint32_t copyId) {
+    return loanActive(ooc, txn, TYPE_CODE_LIST, listId, copyId);
+}
+
+void OOCMap_repayListLoan(OOCMapObject* const ooc, MDB_txn* const txn, const uint32_t listId, const uint32_t copyId) {
+    repay(ooc, txn, TYPE_CODE_LIST, listId, copyId);
+}
+
+void OOCMap_settleListLoans(OOCMapObject* const ooc, MDB_txn* const txn, const uint32_t listId) {
+    settle(ooc, txn, TYPE_CODE_LIST, listId);
+}
+
+void OOCMap_releaseListLoan(OOCMapObject* const ooc, MDB_txn* const txn, const uint32_t listId, const uint32_t copyId) {
+    release(ooc, txn, TYPE_CODE_LIST, listId, copyId);
+}
+
+//
+// Dicts
+//
+
+uint32_t OOCMap_lendDict(OOCMapObject* const ooc, MDB_txn* const txn, const uint32_t dictId) {
+    const uint32_t copyId = OOCMap_newDictId(ooc, txn, 0);
+    lend(ooc, txn, TYPE_CODE_DICT, dictId, copyId);
+    return copyId;
+}
+
+bool OOCMap_dictLoanActive(OOCMapObject* const ooc, MDB_txn* const txn, const uint32_t dictId, const uint32_t copyId) {
+    return loanActive(ooc, txn, TYPE_CODE_DICT, dictId, copyId);
+}
+
+void OOCMap_repayDictLoan(OOCMapObject* const ooc, MDB_txn* const txn, const uint32_t dictId, const uint32_t copyId) {
+    repay(ooc, txn, TYPE_CODE_DICT, dictId, copyId);
+}
+
+void OOCMap_settleDictLoans(OOCMapObject* const ooc, MDB_txn* const txn, const uint32_t dictId) {
+    settle(ooc, txn, TYPE_CODE_DICT, dictId);
+}
+
+void OOCMap_releaseDictLoan(OOCMapObject* const ooc, MDB_txn* const txn, const uint32_t dictId, const uint32_t copyId) {
+    release(ooc, txn, TYPE_CODE_DICT, dictId, copyId);
+}
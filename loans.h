@@ -0,0 +1,47 @@
+#ifndef OOCMAP_LOANS_H
+#define OOCMAP_LOANS_H
+
+#include <cstdint>
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "oocmap.h"
+#include "lmdb.h"
+
+//
+// Copies of lists and dicts
+//
+// LazyList.copy() and LazyDict.copy() don't copy any items. The copy gets an empty list or dict of
+// its own, but until either side changes, it reads the items of the one it was copied from. That
+// one's header remembers the copies that borrow its items: It's a full ListHeader or DictHeader
+// then, followed by their IDs. Before the original changes, it copies its items into every copy
+// that still borrows them. Before a copy changes, it copies the items into itself. Either way, the
+// loan is over, and the copy reads its own items from then on. A copy that goes away while it still
+// borrows ends its loan and deletes its empty list or dict.
+//
+// Only LazyList and LazyDict objects borrow. Storing one copies the items it borrows, so the lists
+// and dicts in a map never borrow from anything. Read-only maps can't lend, so their copies are
+// only other views of the same list or dict.
+//
+
+// Makes a new copy of a list that borrows its items, and returns the copy's ID.
+uint32_t OOCMap_lendList(OOCMapObject* ooc, MDB_txn* txn, uint32_t listId);
+// Whether copyId still borrows the items of listId
+bool OOCMap_listLoanActive(OOCMapObject* ooc, MDB_txn* txn, uint32_t listId, uint32_t copyId);
+// Copies the items of listId into copyId, and ends the loan.
+void OOCMap_repayListLoan(OOCMapObject* ooc, MDB_txn* txn, uint32_t listId, uint32_t copyId);
+// Ends all loans of a list. Everything that changes a list calls this first.
+void OOCMap_settleListLoans(OOCMapObject* ooc, MDB_txn* txn, uint32_t listId);
+// Ends the loan of a copy that goes away while it still borrows, and deletes the copy's empty list,
+// which nothing else can refer to then. Does nothing if the loan is over already.
+void OOCMap_releaseListLoan(OOCMapObject* ooc, MDB_txn* txn, uint32_t listId, uint32_t copyId);
+
+// Same as above, for dicts
+uint32_t OOCMap_lendDict(OOCMapObject* ooc, MDB_txn* txn, uint32_t dictId);
+bool OOCMap_dictLoanActive(OOCMapObject* ooc, MDB_txn* txn, uint32_t dictId, uint32_t copyId);
+void OOCMap_repayDictLoan(OOCMapObject* ooc, MDB_txn* txn, uint32_t dictId, uint32_t copyId);
+void OOCMap_settleDictLoans(OOCMapObject* ooc, MDB_txn* txn, uint32_t dictId);
+void OOCMap_releaseDictLoan(OOCMapObject* ooc, MDB_txn* txn, uint32_t dictId, uint32_t copyId);
+
+#endif //OOCMAP_LOANS_H
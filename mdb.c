@@ -527,6 +527,13 @@ static txnid_t mdb_debug_start;
 	 */
 #define MDB_MINKEYS	 2
 
+	/** The alignment #MDB_HUGEPAGES puts the map on. This is the size of
+	 *	a PMD-mapped transparent huge page on x86-64 and most arm64 kernels.
+	 */
+#ifndef MDB_HUGEPAGE_SIZE
+#define MDB_HUGEPAGE_SIZE	(2 * 1024 * 1024)
+#endif
+
 	/**	A stamp that identifies a file as an LMDB file.
 	 *	There's nothing special about this value other than that it is easily
 	 *	recognizable, and it will reflect any byte order mismatches.
@@ -4016,6 +4023,31 @@ mdb_env_map(MDB_env *env, void *addr)
 		if (ftruncate(env->me_fd, env->me_mapsize) < 0)
 			return ErrCode();
 	}
+	env->me_map = MAP_FAILED;
+#ifdef MADV_HUGEPAGE
+	if ((flags & MDB_HUGEPAGES) && !addr) {
+		/* Huge pages need a huge-page-aligned range, and mmap() only
+		 * promises normal page alignment. Reserve a little more address
+		 * space than we need, and put the map on the first boundary in it.
+		 */
+		size_t slop = MDB_HUGEPAGE_SIZE;
+		char *reserved = mmap(NULL, env->me_mapsize + slop, PROT_NONE,
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+		if (reserved != MAP_FAILED) {
+			char *aligned = (char *)(((size_t)reserved + slop - 1) & ~(slop - 1));
+			env->me_map = mmap(aligned, env->me_mapsize, prot,
+				MAP_SHARED|MAP_FIXED, env->me_fd, 0);
+			if (env->me_map == MAP_FAILED) {
+				munmap(reserved, env->me_mapsize + slop);
+			} else {
+				if (aligned != reserved)
+					munmap(reserved, aligned - reserved);
+				munmap(aligned + env->me_mapsize, reserved + slop - aligned);
+			}
+		}
+	}
+	if (env->me_map == MAP_FAILED)
+#endif
 	env->me_map = mmap(addr, env->me_mapsize, prot, MAP_SHARED,
 		env->me_fd, 0);
 	if (env->me_map == MAP_FAILED) {
@@ -4033,6 +4065,10 @@ mdb_env_map(MDB_env *env, void *addr)
 #endif /* POSIX_MADV_RANDOM */
 #endif /* MADV_RANDOM */
 	}
+#ifdef MADV_HUGEPAGE
+	if (flags & MDB_HUGEPAGES)
+		madvise(env->me_map, env->me_mapsize, MADV_HUGEPAGE);
+#endif
 #endif /* _WIN32 */
 
 	/* Can happen because the address argument to mmap() is just a
@@ -4943,7 +4979,7 @@ fail:
 	 */
 #define	CHANGEABLE	(MDB_NOSYNC|MDB_NOMETASYNC|MDB_MAPASYNC|MDB_NOMEMINIT)
 #define	CHANGELESS	(MDB_FIXEDMAP|MDB_NOSUBDIR|MDB_RDONLY| \
-	MDB_WRITEMAP|MDB_NOTLS|MDB_NOLOCK|MDB_NORDAHEAD)
+	MDB_WRITEMAP|MDB_NOTLS|MDB_NOLOCK|MDB_NORDAHEAD|MDB_HUGEPAGES)
 
 #if VALID_FLAGS & PERSISTENT_FLAGS & (CHANGEABLE|CHANGELESS)
 # error "Persistent DB flags & env flags overlap, but both go in mm_flags"
@@ -7728,6 +7764,112 @@ mdb_cursor_close(MDB_cursor *mc)
 	}
 }
 
+/** How many candidate keys #mdb_dbi_split_keys() wants for every key it returns */
+#define MDB_SPLIT_OVERSAMPLE	8
+
+int
+mdb_dbi_split_keys(MDB_txn *txn, MDB_dbi dbi, MDB_val *keys, unsigned int *count)
+{
+	MDB_cursor	mc;
+	MDB_page	*mp;
+	MDB_node	*node;
+	pgno_t		*level = NULL, *next = NULL;
+	MDB_val		*cands = NULL;
+	size_t		 nlevel, nnext, nkeys, nchildren, ncands = 0, i, j;
+	unsigned int wanted;
+	int			 leaf, rc = MDB_SUCCESS;
+
+	if (!txn || !count || (*count && !keys) || !TXN_DBI_EXIST(txn, dbi, DB_USRVALID))
+		return EINVAL;
+
+	if (txn->mt_flags & MDB_TXN_BLOCKED)
+		return MDB_BAD_TXN;
+
+	if (txn->mt_dbs[dbi].md_flags & MDB_DUPSORT)
+		return MDB_INCOMPATIBLE;
+
+	wanted = *count;
+	*count = 0;
+	mdb_cursor_init(&mc, txn, dbi, NULL);
+	if (!wanted || txn->mt_dbs[dbi].md_root == P_INVALID)
+		return MDB_SUCCESS;
+
+	/* Walk down one level at a time, until a level has enough keys to
+	 * choose from. The first key of a branch page is always empty, so we
+	 * want several candidates for every key we return.
+	 */
+	if ((level = malloc(sizeof(pgno_t))) == NULL)
+		return ENOMEM;
+	level[0] = txn->mt_dbs[dbi].md_root;
+	nlevel = 1;
+	for (;;) {
+		nkeys = nchildren = 0;
+		leaf = 0;
+		for (i = 0; i < nlevel; i++) {
+			if ((rc = mdb_page_get(&mc, level[i], &mp, NULL)) != 0)
+				goto done;
+			if (IS_LEAF(mp)) {
+				leaf = 1;
+				nkeys += NUMKEYS(mp);
+			} else {
+				nkeys += NUMKEYS(mp) - 1;
+				nchildren += NUMKEYS(mp);
+			}
+		}
+		if (leaf || nkeys >= (size_t)wanted * MDB_SPLIT_OVERSAMPLE)
+			break;
+		if ((next = malloc(nchildren * sizeof(pgno_t))) == NULL) {
+			rc = ENOMEM;
+			goto done;
+		}
+		nnext = 0;
+		for (i = 0; i < nlevel; i++) {
+			if ((rc = mdb_page_get(&mc, level[i], &mp, NULL)) != 0)
+				goto done;
+			for (j = 0; j < NUMKEYS(mp); j++)
+				next[nnext++] = NODEPGNO(NODEPTR(mp, j));
+		}
+		free(level);
+		level = next;
+		next = NULL;
+		nlevel = nnext;
+	}
+
+	if (!nkeys)
+		goto done;
+	if ((cands = malloc(nkeys * sizeof(MDB_val))) == NULL) {
+		rc = ENOMEM;
+		goto done;
+	}
+	for (i = 0; i < nlevel; i++) {
+		if ((rc = mdb_page_get(&mc, level[i], &mp, NULL)) != 0)
+			goto done;
+		for (j = IS_LEAF(mp) ? 0 : 1; j < NUMKEYS(mp); j++) {
+			node = NODEPTR(mp, j);
+			cands[ncands].mv_size = NODEKSZ(node);
+			cands[ncands].mv_data = NODEKEY(node);
+			ncands++;
+		}
+	}
+
+	/* Splitting at the very first key would make an empty part. */
+	if (ncands <= wanted) {
+		for (i = 1; i < ncands; i++)
+			keys[i - 1] = cands[i];
+		*count = ncands - 1;
+	} else {
+		for (i = 0; i < wanted; i++)
+			keys[i] = cands[(i + 1) * ncands / (wanted + 1)];
+		*count = wanted;
+	}
+
+done:
+	free(level);
+	free(next);
+	free(cands);
+	return rc;
+}
+
 MDB_txn *
 mdb_cursor_txn(MDB_cursor *mc)
 {
@@ -9647,6 +9789,16 @@ mdb_env_get_fd(MDB_env *env, mdb_filehandle_t *arg)
 	return MDB_SUCCESS;
 }
 
+int ESECT
+mdb_env_get_map(MDB_env *env, void **arg)
+{
+	if (!env || !arg)
+		return EINVAL;
+
+	*arg = env->me_map;
+	return MDB_SUCCESS;
+}
+
 /** Common code for #mdb_stat() and #mdb_env_stat().
  * @param[in] env the environment to operate in.
  * @param[in] db the #MDB_db record containing the stats to return.
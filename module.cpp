@@ -4,6 +4,8 @@
 #include "lazytuple.h"
 #include "lazylist.h"
 #include "lazydict.h"
+#include "sharded.h"
+#include "partition.h"
 
 static PyMethodDef OocmapMethods[] = {
     {nullptr, nullptr, 0, nullptr}        /* Sentinel */
@@ -20,6 +22,12 @@ static struct PyModuleDef oocmap_module = {
 PyMODINIT_FUNC PyInit_oocmap() {
     if(PyType_Ready(&OOCMapType) < 0)
         return nullptr;
+    if(PyType_Ready(&OOCMapIterType) < 0)
+        return nullptr;
+    if(PyType_Ready(&OOCMapViewType) < 0)
+        return nullptr;
+    if(PyType_Ready(&OOCMapPartitionType) < 0)
+        return nullptr;
     if(PyType_Ready(&OOCLazyTupleType) < 0)
         return nullptr;
     if(PyType_Ready(&OOCLazyListType) < 0)
@@ -32,34 +40,48 @@ PyMODINIT_FUNC PyInit_oocmap() {
         return nullptr;
     if(PyType_Ready(&OOCLazyDictItemsIterType) < 0)
         return nullptr;
+    if(PyType_Ready(&ShardedOOCMapType) < 0)
+        return nullptr;
 
     PyObject* const m = PyModule_Create(&oocmap_module);
     if(m == nullptr)
         return nullptr;
 
     Py_INCREF(&OOCMapType);
+    Py_INCREF(&OOCMapIterType);
+    Py_INCREF(&OOCMapViewType);
+    Py_INCREF(&OOCMapPartitionType);
     Py_INCREF(&OOCLazyTupleType);
     Py_INCREF(&OOCLazyListType);
     Py_INCREF(&OOCLazyListIterType);
     Py_INCREF(&OOCLazyDictType);
     Py_INCREF(&OOCLazyDictItemsType);
     Py_INCREF(&OOCLazyDictItemsIterType);
+    Py_INCREF(&ShardedOOCMapType);
     if(
         PyModule_AddObject(m, "OOCMap", (PyObject*)&OOCMapType) < 0 ||
+        PyModule_AddObject(m, "OOCMapIter", (PyObject*)&OOCMapIterType) < 0 ||
+        PyModule_AddObject(m, "OOCMapView", (PyObject*)&OOCMapViewType) < 0 ||
+        PyModule_AddObject(m, "Partition", (PyObject*)&OOCMapPartitionType) < 0 ||
         PyModule_AddObject(m, "LazyTuple", (PyObject*)&OOCLazyTupleType) < 0 ||
         PyModule_AddObject(m, "LazyList", (PyObject*)&OOCLazyListType) < 0 ||
         PyModule_AddObject(m, "LazyListIter", (PyObject*)&OOCLazyListIterType) < 0 ||
         PyModule_AddObject(m, "LazyDict", (PyObject*)&OOCLazyDictType) < 0 ||
         PyModule_AddObject(m, "LazyDictItems", (PyObject*)&OOCLazyDictItemsType) < 0 ||
-        PyModule_AddObject(m, "LazyDictItemsIter", (PyObject*)&OOCLazyDictItemsIterType) < 0
+        PyModule_AddObject(m, "LazyDictItemsIter", (PyObject*)&OOCLazyDictItemsIterType) < 0 ||
+        PyModule_AddObject(m, "ShardedOOCMap", (PyObject*)&ShardedOOCMapType) < 0
     ) {
         Py_DECREF(&OOCMapType);
+        Py_DECREF(&OOCMapIterType);
+        Py_DECREF(&OOCMapViewType);
+        Py_DECREF(&OOCMapPartitionType);
         Py_DECREF(&OOCLazyTupleType);
         Py_DECREF(&OOCLazyListType);
         Py_DECREF(&OOCLazyListIterType);
         Py_DECREF(&OOCLazyDictType);
         Py_DECREF(&OOCLazyDictItemsType);
         Py_DECREF(&OOCLazyDictItemsIterType);
+        Py_DECREF(&ShardedOOCMapType);
         Py_DECREF(m);
         return nullptr;
     }
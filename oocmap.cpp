@@ -2,13 +2,31 @@
 
 #include <memory>
 #include <random>
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <condition_variable>
+#include <unordered_set>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "spooky.h"
+#include "orderedkeys.h"
+#include "densearray.h"
+#include "partition.h"
 
 #include "errors.h"
 #include "db.h"
 #include "lazytuple.h"
 #include "lazylist.h"
 #include "lazydict.h"
+#include "contenthash.h"
+#include "frozen.h"
+#include "loans.h"
 
 static std::mt19937 random_engine(std::chrono::system_clock::now().time_since_epoch().count());
 
@@ -28,6 +46,44 @@ static const EncodedValue ENCODED_FALSE = {.asInt = 4, .typeCode = TYPE_CODE_HAR
 static const EncodedValue ENCODED_EMPTY_TUPLE = {.asInt = 5, .typeCode = TYPE_CODE_HARDCODED, .lengthMinusOne = 0};
 static const EncodedValue ENCODED_EMPTY_STRING = {.asInt = 6, .typeCode = TYPE_CODE_HARDCODED, .lengthMinusOne = 0};
 
+// IDs of frozen lists and dicts come from their content, and the others must not collide with them.
+static uint32_t OOCMap_randomId(OOCMapObject* const self) {
+    const uint32_t id = random_engine();
+    return self->frozen ? id & ~frozenIdBit : id;
+}
+
+uint32_t OOCMap_newListId(OOCMapObject* const self, MDB_txn* const txn, const uint32_t length) {
+    const ContentHash hash = { .sum = 0, .nanCount = 0 };
+    while(true) {
+        const uint32_t listId = OOCMap_randomId(self);
+        try {
+            OOCMap_putListHeader(self, txn, listId, length, hash, MDB_NOOVERWRITE);
+        } catch(const MdbError& e) {
+            if(e.mdbErrorCode == MDB_KEYEXIST)
+                continue;
+            else
+                throw;
+        }
+        return listId;
+    }
+}
+
+uint32_t OOCMap_newDictId(OOCMapObject* const self, MDB_txn* const txn, const Py_ssize_t length) {
+    const ContentHash hash = { .sum = 0, .nanCount = 0 };
+    while(true) {
+        const uint32_t dictId = OOCMap_randomId(self);
+        try {
+            OOCMap_putDictHeader(self, txn, dictId, length, hash, MDB_NOOVERWRITE);
+        } catch(const MdbError& e) {
+            if(e.mdbErrorCode == MDB_KEYEXIST)
+                continue;
+            else
+                throw;
+        }
+        return dictId;
+    }
+}
+
 void OOCMap_encode(
     OOCMapObject* const self,
     PyObject* const value,
@@ -44,16 +100,16 @@ void OOCMap_encode(
     }
 
     // did we already write this object?
-    const EncodedValue*& destInTheMap = insertedItemsInThisTransaction[value];
-    if(destInTheMap != nullptr) {
-        *dest = *destInTheMap;
+    const auto alreadyInserted = insertedItemsInThisTransaction.find(value);
+    if(alreadyInserted != insertedItemsInThisTransaction.end()) {
+        *dest = alreadyInserted->second;
         return;
     }
 
     // Python's None
     if(value == Py_None) {
         *dest = ENCODED_NONE;
-        destInTheMap = dest;
+        insertedItemsInThisTransaction[value] = *dest;
         return;
     }
 
@@ -66,7 +122,7 @@ void OOCMap_encode(
         if(longObject->ob_base.ob_size == 0) {
             // Integer is 0
             *dest = ENCODED_INT_ZERO;
-            destInTheMap = dest;
+            insertedItemsInThisTransaction[value] = *dest;
             return;
         } else {
             const size_t longBufferSize = sizeof(digit) * abs(longObject->ob_base.ob_size);
@@ -79,7 +135,7 @@ void OOCMap_encode(
                     TYPE_CODE_SHORT_POSITIVE_INT :
                     TYPE_CODE_SHORT_NEGATIVE_INT;
                 dest->lengthMinusOne = longBufferSize - 1;
-                destInTheMap = dest;
+                insertedItemsInThisTransaction[value] = *dest;
                 return;
             } else {
                 // Integer doesn't fit into EncodedValue, has to be written to the DB
@@ -97,7 +153,7 @@ void OOCMap_encode(
                     &mdbValue,
                     dest->typeCode,
                     readonly);
-                destInTheMap = dest;
+                insertedItemsInThisTransaction[value] = *dest;
                 return;
             }
         }
@@ -107,11 +163,11 @@ void OOCMap_encode(
     if(PyBool_Check(value)) {
         if(value == Py_False) {
             *dest = ENCODED_FALSE;
-            destInTheMap = dest;
+            insertedItemsInThisTransaction[value] = *dest;
             return;
         } else if(value == Py_True) {
             *dest = ENCODED_TRUE;
-            destInTheMap = dest;
+            insertedItemsInThisTransaction[value] = *dest;
             return;
         } else {
             throw OocError(OocError::InvalidBool);
@@ -124,7 +180,7 @@ void OOCMap_encode(
         dest->asFloat = PyFloat_AS_DOUBLE(value);
         dest->typeCode = TYPE_CODE_FLOAT;
         dest->lengthMinusOne = 0;
-        destInTheMap = dest;
+        insertedItemsInThisTransaction[value] = *dest;
         return;
     }
 
@@ -145,7 +201,7 @@ void OOCMap_encode(
         size_t dataSize = PyUnicode_GET_LENGTH(value);
         if(dataSize == 0) {
             *dest = ENCODED_EMPTY_STRING;
-            destInTheMap = dest;
+            insertedItemsInThisTransaction[value] = *dest;
             return;
         } else {
             const int kind = PyUnicode_KIND(value);
@@ -175,7 +231,7 @@ void OOCMap_encode(
                 dest->lengthMinusOne = dataSize - 1;
                 dest->asUInt = 0;
                 memcpy(dest->asChars, PyUnicode_DATA(value), dataSize);
-                destInTheMap = dest;
+                insertedItemsInThisTransaction[value] = *dest;
                 return;
             } else {
                 // String does not fit into one EncodedValue, has to be written to DB
@@ -183,7 +239,7 @@ void OOCMap_encode(
                 dest->typeCode += TYPE_CODE_UNICODE_LONG_SHORT_OFFSET;
                 MDB_val mdbValue = {.mv_size = dataSize, .mv_data = PyUnicode_DATA(value)};
                 dest->asUInt = putImmutable(txn, self->stringsDb, &mdbValue, dest->typeCode, readonly);
-                destInTheMap = dest;
+                insertedItemsInThisTransaction[value] = *dest;
                 return;
             }
         }
@@ -194,7 +250,7 @@ void OOCMap_encode(
     if(PyTuple_CheckExact(value)) {
         if(PyTuple_GET_SIZE(value) == 0) {
             *dest = ENCODED_EMPTY_TUPLE;
-            destInTheMap = dest;
+            insertedItemsInThisTransaction[value] = *dest;
             return;
         } else {
             std::vector<EncodedValue> encodedValues(PyTuple_GET_SIZE(value));
@@ -220,36 +276,60 @@ void OOCMap_encode(
             };
             dest->asUInt = putImmutable(txn, self->tuplesDb, &mdbValue, dest->typeCode, readonly);
 
-            destInTheMap = dest;
+            insertedItemsInThisTransaction[value] = *dest;
             return;
         }
     }
 
+    // Without a transaction, we can only encode values whose encoding follows from their content.
+    if(txn == nullptr && (
+        PyList_CheckExact(value) || PyDict_CheckExact(value) ||
+        value->ob_type == &OOCLazyListType || value->ob_type == &OOCLazyDictType
+    )) {
+        PyErr_Format(PyExc_TypeError, "unhashable type: '%s'", Py_TYPE(value)->tp_name);
+        throw OocError(OocError::AlreadyPythonizedError);
+    }
+
+    // Python's list objects, in maps that store them once for each content
+    if(PyList_CheckExact(value) && self->frozen) {
+        // A list that contains itself has no content we could find it by. It runs into the recursion
+        // limit instead.
+        if(Py_EnterRecursiveCall(" while storing a frozen list")) throw OocError(OocError::AlreadyPythonizedError);
+        std::vector<EncodedValue> encodedItems(PyList_GET_SIZE(value));
+        try {
+            for(Py_ssize_t i = 0; i < PyList_GET_SIZE(value); ++i) {
+                OOCMap_encode(
+                    self,
+                    PyList_GET_ITEM(value, i),
+                    &encodedItems[i],
+                    txn,
+                    insertedItemsInThisTransaction,
+                    readonly);
+            }
+        } catch(...) {
+            Py_LeaveRecursiveCall();
+            throw;
+        }
+        Py_LeaveRecursiveCall();
+
+        dest->typeCode = TYPE_CODE_LIST;
+        dest->lengthMinusOne = 0;
+        dest->asListKey.listIndex = ListKey::listIndexLength;
+        dest->asListKey.listId = OOCMap_putFrozenList(self, txn, encodedItems, readonly);
+        insertedItemsInThisTransaction[value] = *dest;
+        return;
+    }
+
     // Python's list objects
     if(PyList_CheckExact(value)) {
         dest->typeCode = TYPE_CODE_LIST;
+        dest->lengthMinusOne = 0;
         dest->asListKey.listIndex = ListKey::listIndexLength;
-        MDB_val mdbKey = { .mv_size = sizeof(dest->asListKey), .mv_data = &dest->asListKey };
-        uint32_t length = Py_SIZE(value);
-
-        // find a key
-        while(true) {
-            dest->asListKey.listId = random_engine();
-            MDB_val mdbValue = { .mv_size = sizeof(uint32_t), .mv_data = &length};
-            try {
-                put(txn, self->listsDb, &mdbKey, &mdbValue, MDB_NODUPDATA);
-            } catch(const MdbError& e) {
-                if(e.mdbErrorCode == MDB_KEYEXIST)
-                    continue;
-                else
-                    throw;
-            }
-            break;
-        }
+        dest->asListKey.listId = OOCMap_newListId(self, txn, Py_SIZE(value));
 
         // We put this into the map now, because the recursive call to _encode() might need it.
         // Lists can contain themselves after all.
-        destInTheMap = dest;
+        insertedItemsInThisTransaction[value] = *dest;
         try {
             // add the list elements
             EncodedValue encodedListElement = *dest;
@@ -258,19 +338,27 @@ void OOCMap_encode(
                 .mv_data = &encodedListElement.asListKey
             };
 
+            ContentHash hash = { .sum = 0, .nanCount = 0 };
             for(Py_ssize_t i = 0; i < PyList_GET_SIZE(value); ++i) {
-                encodedListElement.asListKey.listIndex = i;
-                MDB_val mdbElementValue = {.mv_size = sizeof(EncodedValue), .mv_data = nullptr};
-                put(txn, self->listsDb, &mdbElementKey, &mdbElementValue, MDB_RESERVE);
-
+                // We can't encode straight into a reserved spot in the list, because encoding
+                // containers writes to the lists table too, and that moves the spot when its page
+                // splits.
+                EncodedValue encodedItem;
                 OOCMap_encode(
                     self,
                     PyList_GET_ITEM(value, i),
-                    reinterpret_cast<EncodedValue*>(mdbElementValue.mv_data),
+                    &encodedItem,
                     txn,
                     insertedItemsInThisTransaction,
                     readonly);
+
+                encodedListElement.asListKey.listIndex = i;
+                MDB_val mdbElementValue = {.mv_size = sizeof(encodedItem), .mv_data = &encodedItem};
+                put(txn, self->listsDb, &mdbElementKey, &mdbElementValue);
+                if(self->contentHashes) hash.addListItem(i, encodedItem);
             }
+            if(self->contentHashes)
+                OOCMap_putListHeader(self, txn, dest->asListKey.listId, PyList_GET_SIZE(value), hash);
         } catch(...) {
             insertedItemsInThisTransaction.erase(value);
             throw;
@@ -279,38 +367,51 @@ void OOCMap_encode(
         return;
     }
 
+    // Python's dict objects, in maps that store them once for each content
+    if(PyDict_CheckExact(value) && self->frozen) {
+        if(Py_EnterRecursiveCall(" while storing a frozen dict")) throw OocError(OocError::AlreadyPythonizedError);
+        EncodedDictItems encodedItems;
+        encodedItems.reserve(PyDict_Size(value));
+        try {
+            PyObject* pyKey;
+            PyObject* pyValue;
+            Py_ssize_t pos = 0;
+            while(PyDict_Next(value, &pos, &pyKey, &pyValue)) {
+                encodedItems.emplace_back();
+                OOCMap_encodeDictKey(self, pyKey, &encodedItems.back().first, txn, insertedItemsInThisTransaction, readonly);
+                OOCMap_encode(self, pyValue, &encodedItems.back().second, txn, insertedItemsInThisTransaction, readonly);
+            }
+        } catch(...) {
+            Py_LeaveRecursiveCall();
+            throw;
+        }
+        Py_LeaveRecursiveCall();
+
+        dest->asDictKey.dictId = OOCMap_putFrozenDict(self, txn, encodedItems, readonly);
+        dest->asDictKey.reserved = 0;
+        dest->typeCode = TYPE_CODE_DICT;
+        dest->lengthMinusOne = 0;
+        insertedItemsInThisTransaction[value] = *dest;
+        return;
+    }
+
     // Python's dict objects
     if(PyDict_CheckExact(value)) {
         // This gets super confusing because we have two key/value stores going at the same
         // time, the PyDict that's stored in *value, and the mdb store. Both of these take
         // keys and values, so the names are all over the place.
 
-        uint32_t dictId;
-        MDB_val mdbKey = { .mv_size = sizeof(dictId), .mv_data = &dictId };
-
-        Py_ssize_t dictSize = PyDict_Size(value);
-        MDB_val mdbValue = { .mv_size = sizeof(dictSize), .mv_data = &dictSize };
-
-        // find a key
-        while(true) {
-            dictId = random_engine();
-            try {
-                put(txn, self->dictsDb, &mdbKey, &mdbValue, MDB_NODUPDATA);
-            } catch(const MdbError& e) {
-                if(e.mdbErrorCode == MDB_KEYEXIST)
-                    continue;
-                else
-                    throw;
-            }
-            break;
-        }
+        const Py_ssize_t dictSize = PyDict_Size(value);
+        ContentHash hash = { .sum = 0, .nanCount = 0 };
+        const uint32_t dictId = OOCMap_newDictId(self, txn, dictSize);
 
         // We put this into the map now, because the recursive call to _encode() might need it.
         // Dicts can contain themselves after all.
         dest->asDictKey.dictId = dictId;
         dest->asDictKey.reserved = 0;
         dest->typeCode = TYPE_CODE_DICT;
-        destInTheMap = dest;
+        dest->lengthMinusOne = 0;
+        insertedItemsInThisTransaction[value] = *dest;
         try {
             // insert the items
             PyObject* pyKey;
@@ -319,7 +420,7 @@ void OOCMap_encode(
             DictItemKey dictItemKey = { .dictId = dictId };
             while(PyDict_Next(value, &pos, &pyKey, &pyValue)) {
                 // write the PyDict key, filling in the value we need for the mdb key
-                OOCMap_encode(
+                OOCMap_encodeDictKey(
                     self,
                     pyKey,
                     &dictItemKey.key,
@@ -341,7 +442,10 @@ void OOCMap_encode(
                 MDB_val mdbDictItemKey = {.mv_size = sizeof(dictItemKey), .mv_data = &dictItemKey};
                 MDB_val mdbDictItemValue = {.mv_size = sizeof(encodedValue), .mv_data = &encodedValue};
                 put(txn, self->dictsDb, &mdbDictItemKey, &mdbDictItemValue);
+                if(self->contentHashes) hash.addDictItem(dictItemKey.key, encodedValue);
             }
+            if(self->contentHashes)
+                OOCMap_putDictHeader(self, txn, dictId, dictSize, hash);
         } catch(...) {
             insertedItemsInThisTransaction.erase(value);
             throw;
@@ -360,10 +464,10 @@ void OOCMap_encode(
             dest->asUInt = tupleValue->tupleId;
             dest->typeCode = TYPE_CODE_TUPLE;
             dest->lengthMinusOne = 0;
-            destInTheMap = dest;
+            insertedItemsInThisTransaction[value] = *dest;
             return;
         } else {
-            MDB_txn* otherTxn = txn_begin(tupleValue->ooc->mdb);
+            MDB_txn* otherTxn = txn_begin(OOCMap_env(tupleValue->ooc));
             PyObject* eager;
             try {
                 eager = OOCLazyTupleObject_eager(tupleValue, otherTxn);
@@ -372,8 +476,16 @@ void OOCMap_encode(
                 txn_abort(otherTxn);
                 throw;
             }
-            OOCMap_encode(self, eager, dest, txn, insertedItemsInThisTransaction, readonly);
-            destInTheMap = dest;
+            // eager and everything in it goes away when we're done, and another object might
+            // reuse their addresses, so they must not end up in insertedItemsInThisTransaction.
+            Id2EncodedMap insertedEagerItems;
+            try {
+                OOCMap_encode(self, eager, dest, txn, insertedEagerItems, readonly);
+            } catch(...) {
+                Py_DECREF(eager);
+                throw;
+            }
+            insertedItemsInThisTransaction[value] = *dest;
             Py_DECREF(eager);
             return;
         }
@@ -383,24 +495,46 @@ void OOCMap_encode(
     if(value->ob_type == &OOCLazyListType) {
         OOCLazyListObject* const listValue = reinterpret_cast<OOCLazyListObject*>(value);
         if(listValue->ooc == self) {
-            dest->asListKey.listId = listValue->listId;
+            // Copies borrow the items of another list, but the lists in the map never do, see
+            // loans.h. Frozen maps store a frozen list instead, which they can make from the
+            // borrowed items.
+            uint32_t listId = listValue->listId;
+            if(listValue->borrowing) {
+                if(!OOCMap_listLoanActive(self, txn, listId, listValue->copyId)) {
+                    listId = listValue->copyId;
+                } else if(!readonly && !self->frozen) {
+                    OOCMap_repayListLoan(self, txn, listId, listValue->copyId);
+                    listId = listValue->copyId;
+                }
+            }
+            // In frozen maps, this stores a snapshot of lists that can change.
+            dest->asListKey.listId = self->frozen ? OOCMap_freezeList(self, txn, listId, readonly) : listId;
             dest->asListKey.listIndex = std::numeric_limits<uint32_t>::max();
             dest->typeCode = TYPE_CODE_LIST;
             dest->lengthMinusOne = 0;
-            destInTheMap = dest;
+            insertedItemsInThisTransaction[value] = *dest;
             return;
         } else {
-            MDB_txn* otherTxn = txn_begin(listValue->ooc->mdb);
+            MDB_txn* otherTxn = txn_begin(OOCMap_env(listValue->ooc));
             PyObject* eager;
             try {
+                OOCLazyListObject_followLoan(listValue, otherTxn);
                 eager = OOCLazyListObject_eager(listValue, otherTxn);
                 txn_commit(otherTxn);
             } catch(...) {
                 txn_abort(otherTxn);
                 throw;
             }
-            OOCMap_encode(self, eager, dest, txn, insertedItemsInThisTransaction, readonly);
-            destInTheMap = dest;
+            // eager and everything in it goes away when we're done, and another object might
+            // reuse their addresses, so they must not end up in insertedItemsInThisTransaction.
+            Id2EncodedMap insertedEagerItems;
+            try {
+                OOCMap_encode(self, eager, dest, txn, insertedEagerItems, readonly);
+            } catch(...) {
+                Py_DECREF(eager);
+                throw;
+            }
+            insertedItemsInThisTransaction[value] = *dest;
             Py_DECREF(eager);
             return;
         }
@@ -410,24 +544,43 @@ void OOCMap_encode(
     if(value->ob_type == &OOCLazyDictType) {
         OOCLazyDictObject* const dictValue = reinterpret_cast<OOCLazyDictObject*>(value);
         if(dictValue->ooc == self) {
-            dest->asDictKey.dictId = dictValue->dictId;
+            // Same as for lists above
+            uint32_t dictId = dictValue->dictId;
+            if(dictValue->borrowing) {
+                if(!OOCMap_dictLoanActive(self, txn, dictId, dictValue->copyId)) {
+                    dictId = dictValue->copyId;
+                } else if(!readonly && !self->frozen) {
+                    OOCMap_repayDictLoan(self, txn, dictId, dictValue->copyId);
+                    dictId = dictValue->copyId;
+                }
+            }
+            dest->asDictKey.dictId = self->frozen ? OOCMap_freezeDict(self, txn, dictId, readonly) : dictId;
             dest->asDictKey.reserved = 0;
             dest->typeCode = TYPE_CODE_DICT;
             dest->lengthMinusOne = 0;
-            destInTheMap = dest;
+            insertedItemsInThisTransaction[value] = *dest;
             return;
         } else {
-            MDB_txn* otherTxn = txn_begin(dictValue->ooc->mdb);
+            MDB_txn* otherTxn = txn_begin(OOCMap_env(dictValue->ooc));
             PyObject* eager;
             try {
+                OOCLazyDictObject_followLoan(dictValue, otherTxn);
                 eager = OOCLazyDictObject_eager(dictValue, otherTxn);
                 txn_commit(otherTxn);
             } catch(...) {
                 txn_abort(otherTxn);
                 throw;
             }
-            OOCMap_encode(self, eager, dest, txn, insertedItemsInThisTransaction, readonly);
-            destInTheMap = dest;
+            // eager and everything in it goes away when we're done, and another object might
+            // reuse their addresses, so they must not end up in insertedItemsInThisTransaction.
+            Id2EncodedMap insertedEagerItems;
+            try {
+                OOCMap_encode(self, eager, dest, txn, insertedEagerItems, readonly);
+            } catch(...) {
+                Py_DECREF(eager);
+                throw;
+            }
+            insertedItemsInThisTransaction[value] = *dest;
             Py_DECREF(eager);
             return;
         }
@@ -578,197 +731,2112 @@ PyObject* OOCMap_decode(
     }
 }
 
-static bool isOOCMap(PyObject* self);
-
-//
-// Methods that are directly exposed to Python
-// These are not allowed to throw exceptions.
-//
+void OOCMap_encodeDictKey(
+    OOCMapObject* const self,
+    PyObject* const key,
+    EncodedValue* const dest,
+    MDB_txn* const txn,
+    Id2EncodedMap& insertedItemsInThisTransaction,
+    const bool readonly
+) {
+    PyObject* normalized = nullptr;
+    if(PyBool_Check(key)) {
+        normalized = PyLong_FromLong(key == Py_True);
+    } else if(PyFloat_CheckExact(key)) {
+        const double number = PyFloat_AS_DOUBLE(key);
+        if(std::isfinite(number) && number == std::floor(number))
+            normalized = PyLong_FromDouble(number);
+    }
+    if(normalized == nullptr) {
+        if(PyErr_Occurred()) throw OocError(OocError::AlreadyPythonizedError);
+        OOCMap_encode(self, key, dest, txn, insertedItemsInThisTransaction, readonly);
+        return;
+    }
 
-static void OOCMap_dealloc(OOCMapObject* self) {
-    mdb_env_close(self->mdb);
-    Py_TYPE(self)->tp_free((PyObject*)self);
+    // The int goes away again, so its address must not end up in insertedItemsInThisTransaction.
+    Id2EncodedMap insertedNormalizedItems;
+    try {
+        OOCMap_encode(self, normalized, dest, txn, insertedNormalizedItems, readonly);
+    } catch(...) {
+        Py_DECREF(normalized);
+        throw;
+    }
+    Py_DECREF(normalized);
 }
 
-static PyObject* OOCMap_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
-    PyObject* pySelf = type->tp_alloc(type, 0);
-    OOCMapObject* self = reinterpret_cast<OOCMapObject*>(pySelf);
-    if(self == nullptr) {
-        PyErr_NoMemory();
-    } else {
-        const int error = mdb_env_create(&self->mdb);
-        if(error != 0) {
-            type->tp_dealloc(pySelf);
-            MdbError(error).pythonize();
-            return nullptr;
+void OOCMap_encodeRootKey(
+    OOCMapObject* const self,
+    PyObject* const key,
+    RootKey* const dest,
+    MDB_txn* const txn,
+    Id2EncodedMap& insertedItemsInThisTransaction,
+    const bool readonly
+) {
+    if(self->keyEncoding == KEY_ENCODING_ORDERED) {
+        dest->ordered.clear();
+        OrderedKey_encode(key, dest->ordered);
+        if(dest->ordered.size() > static_cast<size_t>(mdb_env_get_maxkeysize(self->mdb))) {
+            PyErr_Format(PyExc_ValueError, "key is too long for an ordered map");
+            throw OocError(OocError::AlreadyPythonizedError);
         }
-        mdb_env_set_maxdbs(self->mdb, 6);
+        dest->mdbKey = { .mv_size = dest->ordered.size(), .mv_data = &dest->ordered[0] };
+    } else {
+        OOCMap_encode(self, key, &dest->encoded, txn, insertedItemsInThisTransaction, readonly);
+        dest->mdbKey = { .mv_size = sizeof(dest->encoded), .mv_data = &dest->encoded };
     }
-    return (PyObject*)self;
 }
 
-static int OOCMap_init(OOCMapObject* self, PyObject* args, PyObject* kwds) {
-    // parse parameters
-    static const char *kwlist[] = {"filename", "max_size", nullptr};
-    PyObject* filenameObject = nullptr;
-    unsigned long long mapsize = 0;
-    const int parseSuccess = PyArg_ParseTupleAndKeywords(
-            args,
-            kwds,
-            "O&|$K",
-            const_cast<char**>(kwlist),
-            PyUnicode_FSConverter, &filenameObject, &mapsize);
-    if(!parseSuccess)
-        return -1;
-    const char* filename = PyBytes_AS_STRING(filenameObject);
+PyObject* OOCMap_decodeRootKey(OOCMapObject* const self, MDB_val* const key, MDB_txn* const txn) {
+    if(self->keyEncoding == KEY_ENCODING_ORDERED)
+        return OrderedKey_decode(key);
+    if(key->mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+    return OOCMap_decode(self, static_cast<EncodedValue*>(key->mv_data), txn);
+}
 
-    // set mapsize
-    if(mapsize == 0) mapsize = 1024ull * 1024ull * 1024ull;
-    const int setMapsizeError = mdb_env_set_mapsize(self->mdb, mapsize);
-    if(setMapsizeError != 0) {
-        Py_XDECREF(filenameObject);
-        MdbError(setMapsizeError).pythonize();
-        return -1;
-    }
+uint64_t OOCMap_hashKey(OOCMapObject* const self, PyObject* const key) {
+    Id2EncodedMap insertedItemsInThisTransaction;
+    EncodedValue encodedKey;
+    OOCMap_encode(self, key, &encodedKey, nullptr, insertedItemsInThisTransaction);
+    return SpookyHash::hash64(&encodedKey, sizeof(encodedKey), 0);
+}
 
-    // open lmdb
-    // These are some aggressive flags that don't guarantee data integrity.
-    const int mdbOpenError = mdb_env_open(
-            self->mdb,
-            filename,
-            MDB_NOSUBDIR | MDB_NOSYNC | MDB_WRITEMAP | MDB_NOMETASYNC| MDB_MAPASYNC | MDB_NOMEMINIT | MDB_NOTLS,
-            0644);
-    Py_CLEAR(filenameObject);
-    if(mdbOpenError != 0) {
-        MdbError(mdbOpenError).pythonize();
-        return -1;
+// Asks the kernel to start reading the pages under the given range.
+static void adviseWillNeed(const void* const data, const size_t size) {
+    static const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    const uintptr_t start = reinterpret_cast<uintptr_t>(data) & ~(pageSize - 1);
+    const uintptr_t end = reinterpret_cast<uintptr_t>(data) + size;
+    madvise(reinterpret_cast<void*>(start), end - start, MADV_WILLNEED);
+}
+
+// A value prefetch() still has to walk. For a list or dict it has walked partly, from is the key of
+// the item to continue with.
+struct PrefetchStep {
+    EncodedValue value;
+    std::string from;
+};
+
+// Walks the steps on todo until it has read budget records, and leaves the rest on todo. Finding the
+// values means walking the b-trees, which faults in the pages along the way. Large values live in
+// overflow pages the walk doesn't touch, so those are the ones we madvise(). This is only advice, so
+// errors just end the walk early.
+static void OOCMap_prefetchSteps(
+    OOCMapObject* const self,
+    MDB_txn* const txn,
+    std::vector<PrefetchStep>& todo,
+    std::unordered_set<EncodedValue>& seenContainers,
+    const bool shallow,
+    const size_t budget
+) {
+    size_t records = 0;
+    MDB_cursor* cursor;
+    while(!todo.empty() && records < budget) {
+        const PrefetchStep step = std::move(todo.back());
+        todo.pop_back();
+        const EncodedValue value = step.value;
+
+        switch(value.typeCode) {
+        case TYPE_CODE_LONG_POSITIVE_INT:
+        case TYPE_CODE_LONG_NEGATIVE_INT:
+        case TYPE_CODE_UNICODE_LONG_WCHAR:
+        case TYPE_CODE_UNICODE_LONG_1BYTE:
+        case TYPE_CODE_UNICODE_LONG_2BYTE:
+        case TYPE_CODE_UNICODE_LONG_4BYTE:
+        case TYPE_CODE_TUPLE: {
+            const MDB_dbi dbi =
+                value.typeCode == TYPE_CODE_TUPLE ? self->tuplesDb :
+                value.typeCode <= TYPE_CODE_LONG_NEGATIVE_INT ? self->intsDb :
+                self->stringsDb;
+            MDB_val mdbKey = { .mv_size = sizeof(value.asUInt), .mv_data = const_cast<uint64_t*>(&value.asUInt) };
+            MDB_val mdbValue;
+            records += 1;
+            if(mdb_get(txn, dbi, &mdbKey, &mdbValue) != 0)
+                break;
+            adviseWillNeed(mdbValue.mv_data, mdbValue.mv_size);
+            if(value.typeCode == TYPE_CODE_TUPLE && !shallow) {
+                const EncodedValue* const items = static_cast<const EncodedValue*>(mdbValue.mv_data);
+                for(size_t i = 0; i < mdbValue.mv_size / sizeof(EncodedValue); ++i)
+                    todo.push_back({ items[i], std::string() });
+            }
+            break;
+        }
+        case TYPE_CODE_LIST:
+        case TYPE_CODE_DICT: {
+            if(shallow)
+                break;
+            if(step.from.empty() && !seenContainers.insert(value).second)
+                break;
+            const bool isList = value.typeCode == TYPE_CODE_LIST;
+            if(mdb_cursor_open(txn, isList ? self->listsDb : self->dictsDb, &cursor) != 0)
+                break;
+            // A dict's header comes first, followed by its items.
+            ListKey listKey = { .listIndex = 0, .listId = value.asListKey.listId };
+            uint32_t dictId = value.asDictKey.dictId;
+            MDB_val mdbKey;
+            if(!step.from.empty())
+                mdbKey = { .mv_size = step.from.size(), .mv_data = const_cast<char*>(step.from.data()) };
+            else if(isList)
+                mdbKey = { .mv_size = sizeof(listKey), .mv_data = &listKey };
+            else
+                mdbKey = { .mv_size = sizeof(dictId), .mv_data = &dictId };
+            MDB_val mdbValue;
+            int error = mdb_cursor_get(cursor, &mdbKey, &mdbValue, step.from.empty() && !isList ? MDB_SET : MDB_SET_RANGE);
+            if(error == 0 && step.from.empty() && !isList)
+                error = mdb_cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT);
+            // The items go on top of where we continue, so we finish those first.
+            const size_t continuation = todo.size();
+            while(error == 0) {
+                if(isList) {
+                    const ListKey* const itemKey = static_cast<const ListKey*>(mdbKey.mv_data);
+                    if(itemKey->listId != listKey.listId || itemKey->listIndex == ListKey::listIndexLength)
+                        break;
+                } else {
+                    const DictItemKey* const itemKey = static_cast<const DictItemKey*>(mdbKey.mv_data);
+                    if(mdbKey.mv_size != sizeof(DictItemKey) || itemKey->dictId != dictId)
+                        break;
+                }
+                if(records >= budget) {
+                    todo.insert(
+                        todo.begin() + continuation,
+                        { value, std::string(static_cast<const char*>(mdbKey.mv_data), mdbKey.mv_size) });
+                    break;
+                }
+                records += 1;
+                if(!isList)
+                    todo.push_back({ static_cast<const DictItemKey*>(mdbKey.mv_data)->key, std::string() });
+                todo.push_back({ *static_cast<const EncodedValue*>(mdbValue.mv_data), std::string() });
+                error = mdb_cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT);
+            }
+            mdb_cursor_close(cursor);
+            break;
+        }
+        default:
+            // Everything else is stored inline.
+            break;
+        }
     }
-    MDB_envinfo info;
-    mdb_env_info(self->mdb, &info);
-    // TODO: We should check for and handle the case where self->mdb has already been opened.
+}
 
-    // open all the DBs
-    MDB_txn* txn = nullptr;
-    try {
-        txn = txn_begin(self->mdb, true);
-        open_db(txn, "root", MDB_CREATE, &self->rootDb);
-        open_db(txn, "ints", MDB_CREATE | MDB_INTEGERKEY, &self->intsDb);
-        open_db(txn, "strings", MDB_CREATE | MDB_INTEGERKEY, &self->stringsDb);
-        open_db(txn, "lists", MDB_CREATE | MDB_INTEGERKEY, &self->listsDb);
-        open_db(txn, "tuples", MDB_CREATE | MDB_INTEGERKEY, &self->tuplesDb);
-        open_db(txn, "dicts", MDB_CREATE, &self->dictsDb);
-        txn_commit(txn);
-    } catch (const OocError& error) {
-        if(txn != nullptr)
-            txn_abort(txn);
-        error.pythonize();
-        return -1;
+// Walks what prefetch() asks for in the background, so the caller doesn't wait for the pages the
+// walk faults in. It reads in short transactions, so it doesn't hold up growing the map for long.
+class Prefetcher {
+    OOCMapObject* const m_self;
+    bool m_stopping;
+    std::vector<EncodedValue> m_values;
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::thread m_thread;
+
+    static const size_t recordsPerTxn = 1024;
+
+    void run() {
+        std::vector<PrefetchStep> todo;
+        std::unordered_set<EncodedValue> seenContainers;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while(true) {
+            if(todo.empty()) {
+                seenContainers.clear();
+                m_wakeup.wait(lock, [this] { return m_stopping || !m_values.empty(); });
+            }
+            if(m_stopping) break;
+            for(const EncodedValue& value : m_values)
+                todo.push_back({ value, std::string() });
+            m_values.clear();
+
+            lock.unlock();
+            {
+                EnvReader reader(m_self->mdb);
+                MDB_txn* txn;
+                if(mdb_txn_begin(m_self->mdb, nullptr, MDB_RDONLY, &txn) == 0) {
+                    OOCMap_prefetchSteps(m_self, txn, todo, seenContainers, false, recordsPerTxn);
+                    mdb_txn_abort(txn);
+                } else {
+                    todo.clear();
+                }
+            }
+            lock.lock();
+        }
     }
 
-    return 0;
-}
+public:
+    explicit Prefetcher(OOCMapObject* const self) :
+        m_self(self),
+        m_stopping(false),
+        m_thread(&Prefetcher::run, this)
+    { }
+
+    // Stops the walk, even if it isn't done.
+    ~Prefetcher() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wakeup.notify_all();
+        m_thread.join();
+    }
 
-static Py_ssize_t OOCMap_length(PyObject* pySelf) {
-    if(!isOOCMap(pySelf)) {
-        PyErr_BadArgument();
-        return -1;
+    void add(const EncodedValue* const values, const size_t count) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_values.insert(m_values.end(), values, values + count);
+        }
+        m_wakeup.notify_all();
     }
-    OOCMapObject* const self = reinterpret_cast<OOCMapObject*>(pySelf);
+};
 
-    MDB_txn* txn = nullptr;
-    try {
-        txn = txn_begin(self->mdb, false);
-        MDB_stat stat;
-        mdb_stat(txn, self->rootDb, &stat);
-        txn_commit(txn);
-        return stat.ms_entries;
-    } catch(const OocError& error) {
-        if(txn != nullptr)
-            txn_abort(txn);
-        error.pythonize();
-        return -1;
+void OOCMap_prefetch(
+    OOCMapObject* const self,
+    MDB_txn* const txn,
+    const EncodedValue* const values,
+    const size_t count,
+    const bool shallow
+) {
+    if(!shallow) {
+        // Walking whole lists and dicts could take as long as reading them, so that happens in the
+        // background.
+        if(self->prefetcher == nullptr)
+            self->prefetcher = new Prefetcher(self);
+        self->prefetcher->add(values, count);
+        return;
     }
+
+    GilUnlocker gil;
+    std::vector<PrefetchStep> todo;
+    for(size_t i = 0; i < count; ++i)
+        todo.push_back({ values[i], std::string() });
+    std::unordered_set<EncodedValue> seenContainers;
+    OOCMap_prefetchSteps(self, txn, todo, seenContainers, true, SIZE_MAX);
 }
 
-static int OOCMap_insert(PyObject* pySelf, PyObject* key, PyObject* value) {
-    // cast the input
-    if(!isOOCMap(pySelf)) {
-        PyErr_BadArgument();
-        return -1;
+// Flushes the map to disk every so often, so that the fast, non-syncing flags lose at most that
+// much data in a crash.
+class PeriodicSyncer {
+    MDB_env* const m_mdb;
+    DenseArray* const m_dense;
+    const std::chrono::duration<double> m_interval;
+    bool m_stopping;
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::thread m_thread;
+
+    void run() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while(!m_stopping) {
+            m_wakeup.wait_for(lock, m_interval);
+            if(m_stopping) break;
+            {
+                EnvReader reader(m_mdb);
+                mdb_env_sync(m_mdb, 1);
+            }
+            if(m_dense != nullptr) {
+                try {
+                    m_dense->sync();
+                } catch(const OocError&) {
+                    // Like a failed mdb_env_sync(), this leaves it to the next round.
+                }
+            }
+        }
     }
-    OOCMapObject* self = reinterpret_cast<OOCMapObject*>(pySelf);
 
-    // start transaction
-    MDB_txn* txn = nullptr;
-    try {
-        txn = txn_begin(self->mdb, true);
-        Id2EncodedMap insertedItemsInThisTransaction;
+public:
+    PeriodicSyncer(MDB_env* const mdb, DenseArray* const dense, const double seconds) :
+        m_mdb(mdb),
+        m_dense(dense),
+        m_interval(seconds),
+        m_stopping(false),
+        m_thread(&PeriodicSyncer::run, this)
+    { }
+
+    ~PeriodicSyncer() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wakeup.notify_all();
+        m_thread.join();
+    }
+};
 
-        EncodedValue encodedKey;
-        OOCMap_encode(self, key, &encodedKey, txn, insertedItemsInThisTransaction);
-        MDB_val mdbKey = { .mv_size=sizeof(encodedKey), .mv_data=&encodedKey };
+static const char* const tableNames[] = {"root", "ints", "strings", "lists", "tuples", "dicts"};
+static const unsigned int allTables = (1 << 6) - 1;
 
-        if(value == nullptr) {
-            // Deleting the value
-            del(txn, self->rootDb, &mdbKey);
-        } else {
-            // Inserting a new value
-            EncodedValue encodedValue;
-            OOCMap_encode(self, value, &encodedValue, txn, insertedItemsInThisTransaction);
-            MDB_val mdbValue = { .mv_size=sizeof(encodedValue), .mv_data=&encodedValue };
+// Locks the pages of the resident tables into memory. If we're not allowed to lock that much, we
+// at least read them all once.
+static void OOCMap_makeResident(OOCMapObject* const self) {
+    GilUnlocker gil;
 
-            put(txn, self->rootDb, &mdbKey, &mdbValue);
+    MDB_envinfo info;
+    mdb_env_info(self->mdb, &info);
+    MDB_stat stat;
+    mdb_env_stat(self->mdb, &stat);
+    const uintptr_t pageSize = stat.ms_psize;
+    void* mapAddress;
+    mdb_env_get_map(self->mdb, &mapAddress);
+    const uintptr_t map = reinterpret_cast<uintptr_t>(mapAddress);
+
+    std::vector<std::pair<uintptr_t, uintptr_t>> ranges;
+    if(self->residentTables == allTables) {
+        ranges.emplace_back(map, map + (info.me_last_pgno + 1) * pageSize);
+    } else {
+        // The tables share one file, so we have to find their pages. Leaf pages are wherever the
+        // values are, and large values continue into overflow pages after that.
+        MDB_txn* txn;
+        if(mdb_txn_begin(self->mdb, nullptr, MDB_RDONLY, &txn) != 0)
+            return;
+        const MDB_dbi dbis[] = {
+            self->rootDb, self->intsDb, self->stringsDb, self->listsDb, self->tuplesDb, self->dictsDb
+        };
+        for(unsigned int i = 0; i < sizeof(dbis) / sizeof(dbis[0]); ++i) {
+            if(!(self->residentTables & (1 << i)))
+                continue;
+            MDB_cursor* cursor;
+            if(mdb_cursor_open(txn, dbis[i], &cursor) != 0)
+                continue;
+            MDB_val mdbKey;
+            MDB_val mdbValue;
+            while(mdb_cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT) == 0) {
+                const uintptr_t start = reinterpret_cast<uintptr_t>(mdbValue.mv_data) & ~(pageSize - 1);
+                const uintptr_t end = reinterpret_cast<uintptr_t>(mdbValue.mv_data) + mdbValue.mv_size;
+                if(ranges.empty() || ranges.back().second < start || ranges.back().first > start)
+                    ranges.emplace_back(start, end);
+                else
+                    ranges.back().second = std::max(ranges.back().second, end);
+            }
+            mdb_cursor_close(cursor);
         }
-        txn_commit(txn);
-    } catch(const OocError& error) {
-        if(txn != nullptr)
-            txn_abort(txn);
-        error.pythonize();
-        return -1;
+        mdb_txn_abort(txn);
+
+        std::sort(ranges.begin(), ranges.end());
+        size_t merged = 0;
+        for(size_t i = 1; i < ranges.size(); ++i) {
+            if(ranges[i].first <= ranges[merged].second)
+                ranges[merged].second = std::max(ranges[merged].second, ranges[i].second);
+            else
+                ranges[++merged] = ranges[i];
+        }
+        if(!ranges.empty())
+            ranges.resize(merged + 1);
     }
 
-    return 0;
+    for(const auto& range : ranges) {
+        void* const start = reinterpret_cast<void*>(range.first);
+        const size_t size = range.second - range.first;
+        if(mlock(start, size) == 0)
+            continue;
+        madvise(start, size, MADV_WILLNEED);
+        for(uintptr_t page = range.first; page < range.second; page += pageSize)
+            (void)*reinterpret_cast<volatile const char*>(page);
+    }
 }
 
-static PyObject* OOCMap_get(PyObject* pySelf, PyObject* key) {
-    // cast the input
-    if(!isOOCMap(pySelf)) {
-        PyErr_BadArgument();
-        return nullptr;
+// Mappings forget their advice when they are replaced, so this runs whenever we map the file.
+static void OOCMap_applyAccessPattern(OOCMapObject* const self) {
+    switch(self->accessPattern) {
+    case ACCESS_PATTERN_SEQUENTIAL: {
+        MDB_envinfo info;
+        mdb_env_info(self->mdb, &info);
+        void* mapAddress;
+        mdb_env_get_map(self->mdb, &mapAddress);
+        madvise(mapAddress, info.me_mapsize, MADV_SEQUENTIAL);
+        break;
     }
-    OOCMapObject* self = reinterpret_cast<OOCMapObject*>(pySelf);
+    case ACCESS_PATTERN_RESIDENT:
+        OOCMap_makeResident(self);
+        break;
+    default:
+        // MDB_NORDAHEAD takes care of ACCESS_PATTERN_RANDOM.
+        break;
+    }
+}
 
-    MDB_txn* txn = nullptr;
-    try {
-        txn = txn_begin(self->mdb, false);
-        Id2EncodedMap insertedItemsInThisTransaction;
+// When another process grows the map, txn_begin() maps it again to catch up.
+static void OOCMap_remapped(MDB_env* const mdb, void* const arg) {
+    OOCMapObject* const self = static_cast<OOCMapObject*>(arg);
+    // Iterators from before a fork can still use the old environment after we opened a new one.
+    if(mdb == self->mdb)
+        OOCMap_applyAccessPattern(self);
+}
 
-        EncodedValue encodedKey;
-        OOCMap_encode(self, key, &encodedKey, txn, insertedItemsInThisTransaction, true);
-        MDB_val mdbKey = {.mv_size=sizeof(encodedKey), .mv_data=&encodedKey};
+bool OOCMap_growIfFull(OOCMapObject* const self, const OocError& error) {
+    if(error.errorCode != OocError::MdbError) return false;
+    if(static_cast<const MdbError&>(error).mdbErrorCode != MDB_MAP_FULL) return false;
+    // Growing the map remaps it, which would pull the rug out from under open iterators.
+    if(!self->autogrow || self->liveReadTxns > 0) return false;
+
+    // We grow geometrically, so that a map that keeps growing only has to be remapped a few times.
+    // If another process grew the map even further in the meantime, txn_begin() will pick that
+    // up as MDB_MAP_RESIZED. Other threads may be reading the map, and they need the GIL to finish.
+    GilUnlocker gil;
+    return self->envContext->remap([self] {
+        MDB_envinfo info;
+        mdb_env_info(self->mdb, &info);
+        if(mdb_env_set_mapsize(self->mdb, info.me_mapsize * 2) != 0)
+            return false;
+        OOCMap_applyAccessPattern(self);
+        return true;
+    });
+}
 
-        MDB_val mdbValue;
-        const bool found = get(txn, self->rootDb, &mdbKey, &mdbValue);
-        if(found) {
-            if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
-            EncodedValue* encodedValue = static_cast<EncodedValue*>(mdbValue.mv_data);
+static bool isOOCMap(PyObject* self);
+
+// Counts the forks this process is removed from the one that loaded the module.
+static unsigned int forkGeneration = 0;
+
+static void OOCMap_afterFork() {
+    ++forkGeneration;
+}
+
+// Reconciles a boolean setting that changes how lists and dicts are stored, so only maps without any
+// can turn it on. requested is -1 if the caller didn't ask for either. Returns the map's setting.
+static bool OOCMap_loadListAndDictSetting(
+    OOCMapObject* const self,
+    MDB_txn* const txn,
+    const bool hasMetaDb,
+    const bool readonly,
+    const char* const name,
+    const int requested
+) {
+    MDB_val mdbKey = { .mv_size = strlen(name), .mv_data = const_cast<char*>(name) };
+    MDB_val mdbValue;
+    int stored = -1;
+    if(hasMetaDb && get(txn, self->metaDb, &mdbKey, &mdbValue)) {
+        if(mdbValue.mv_size != sizeof(uint8_t)) throw OocError(OocError::UnexpectedData);
+        stored = *static_cast<uint8_t*>(mdbValue.mv_data);
+        if(stored > 1) throw OocError(OocError::UnexpectedData);
+    }
+    if(stored < 0) {
+        MDB_stat listsStat;
+        mdb_stat(txn, self->listsDb, &listsStat);
+        MDB_stat dictsStat;
+        mdb_stat(txn, self->dictsDb, &dictsStat);
+        const bool empty = listsStat.ms_entries == 0 && dictsStat.ms_entries == 0;
+        stored = empty && requested > 0;
+        if(!readonly) {
+            uint8_t storedByte = stored;
+            mdbValue = { .mv_size = sizeof(storedByte), .mv_data = &storedByte };
+            put(txn, self->metaDb, &mdbKey, &mdbValue);
+        }
+    }
+    if(requested >= 0 && requested != stored) {
+        PyErr_Format(PyExc_ValueError, "This map was created with %s=%s", name, stored ? "True" : "False");
+        throw OocError(OocError::AlreadyPythonizedError);
+    }
+    return stored;
+}
+
+// Reconciles the settings we were asked for with the ones the map was created with.
+static void OOCMap_loadSettings(OOCMapObject* const self, MDB_txn* const txn, const bool hasMetaDb, const bool readonly) {
+    static const char keyEncodingName[] = "key_encoding";
+    MDB_val mdbKey = { .mv_size = sizeof(keyEncodingName) - 1, .mv_data = const_cast<char*>(keyEncodingName) };
+
+    KeyEncoding stored = KEY_ENCODING_UNSPECIFIED;
+    MDB_val mdbValue;
+    if(hasMetaDb && get(txn, self->metaDb, &mdbKey, &mdbValue)) {
+        if(mdbValue.mv_size != sizeof(uint8_t)) throw OocError(OocError::UnexpectedData);
+        stored = static_cast<KeyEncoding>(*static_cast<uint8_t*>(mdbValue.mv_data));
+        if(stored > KEY_ENCODING_DENSE) throw OocError(OocError::UnexpectedData);
+    }
+    if(stored == KEY_ENCODING_UNSPECIFIED) {
+        // Maps from before we had settings use EncodedValues. So do new maps, unless told otherwise.
+        MDB_stat stat;
+        mdb_stat(txn, self->rootDb, &stat);
+        if(stat.ms_entries == 0 && self->keyEncoding != KEY_ENCODING_UNSPECIFIED)
+            stored = self->keyEncoding;
+        else
+            stored = KEY_ENCODING_VALUES;
+        if(!readonly) {
+            uint8_t storedByte = stored;
+            mdbValue = { .mv_size = sizeof(storedByte), .mv_data = &storedByte };
+            put(txn, self->metaDb, &mdbKey, &mdbValue);
+        }
+    }
+    if(self->keyEncoding != KEY_ENCODING_UNSPECIFIED && self->keyEncoding != stored) {
+        static const char* const createdWith[] = {
+            nullptr, "neither ordered_keys=True nor dense=True", "ordered_keys=True", "dense=True"
+        };
+        PyErr_Format(PyExc_ValueError, "This map was created with %s", createdWith[stored]);
+        throw OocError(OocError::AlreadyPythonizedError);
+    }
+    self->keyEncoding = stored;
+
+    // Content hashes have to cover every list and dict.
+    self->contentHashes = OOCMap_loadListAndDictSetting(self, txn, hasMetaDb, readonly, "content_hashes", self->contentHashes);
+    // Frozen lists and dicts only take IDs that random ones can't have.
+    self->frozen = OOCMap_loadListAndDictSetting(self, txn, hasMetaDb, readonly, "frozen", self->frozen);
+}
+
+// Creates the LMDB environment for self->filename, and opens all the DBs in it.
+static void OOCMap_open(OOCMapObject* const self, const size_t mapsize) {
+    static pthread_once_t atforkOnce = PTHREAD_ONCE_INIT;
+    pthread_once(&atforkOnce, [] { pthread_atfork(nullptr, nullptr, OOCMap_afterFork); });
+
+    int error = mdb_env_create(&self->mdb);
+    if(error != 0) {
+        self->mdb = nullptr;
+        throw MdbError(error);
+    }
+    self->forkGeneration = forkGeneration;
+    self->envContext = new EnvContext;
+    self->envContext->remapped = OOCMap_remapped;
+    self->envContext->arg = self;
+    mdb_env_set_userctx(self->mdb, self->envContext);
+
+    MDB_txn* txn = nullptr;
+    try {
+        mdb_env_set_maxdbs(self->mdb, 7);
+        error = mdb_env_set_mapsize(self->mdb, mapsize);
+        if(error != 0)
+            throw MdbError(error);
+        if(self->maxReaders > 0) {
+            // This only has an effect for the first process that opens the map. Everyone else
+            // gets the size of the existing lock file.
+            error = mdb_env_set_maxreaders(self->mdb, self->maxReaders);
+            if(error != 0)
+                throw MdbError(error);
+        }
+        error = mdb_env_open(self->mdb, PyBytes_AS_STRING(self->filename), self->envFlags, 0644);
+        if(error != 0)
+            throw MdbError(error);
+
+        // Processes that died while reading leave their reader slots behind. Free them up, so
+        // workers that come and go don't eventually run out.
+        int deadReaders;
+        error = mdb_reader_check(self->mdb, &deadReaders);
+        if(error != 0)
+            throw MdbError(error);
+
+        // Open all the DBs. Read-only maps do this in a read transaction, so they don't need the
+        // writer lock, but then the DBs have to exist already.
+        const bool readonly = (self->envFlags & MDB_RDONLY) != 0;
+        const unsigned int create = readonly ? 0 : MDB_CREATE;
+        txn = txn_begin(self->mdb, !readonly);
+        open_db(txn, "root", create, &self->rootDb);
+        open_db(txn, "ints", create | MDB_INTEGERKEY, &self->intsDb);
+        open_db(txn, "strings", create | MDB_INTEGERKEY, &self->stringsDb);
+        open_db(txn, "lists", create | MDB_INTEGERKEY, &self->listsDb);
+        open_db(txn, "tuples", create | MDB_INTEGERKEY, &self->tuplesDb);
+        open_db(txn, "dicts", create, &self->dictsDb);
+        bool hasMetaDb = true;
+        try {
+            open_db(txn, "meta", create, &self->metaDb);
+        } catch(const MdbError& error) {
+            // Maps from before we had settings don't have this, and read-only maps can't add it.
+            if(error.mdbErrorCode != MDB_NOTFOUND) throw;
+            hasMetaDb = false;
+        }
+        OOCMap_loadSettings(self, txn, hasMetaDb, readonly);
+        txn_commit(txn);
+
+        if(self->keyEncoding == KEY_ENCODING_DENSE) {
+            std::string denseFilename(PyBytes_AS_STRING(self->filename));
+            denseFilename += "-dense";
+            self->dense = new DenseArray(denseFilename.c_str(), readonly);
+        }
+    } catch(...) {
+        if(txn != nullptr)
+            txn_abort(txn);
+        mdb_env_close(self->mdb);
+        self->mdb = nullptr;
+        delete self->envContext;
+        self->envContext = nullptr;
+        throw;
+    }
+
+    OOCMap_applyAccessPattern(self);
+
+    if(self->syncInterval > 0)
+        self->syncer = new PeriodicSyncer(self->mdb, self->dense, self->syncInterval);
+}
+
+// Counterpart to OOCMap_open()
+static void OOCMap_close(OOCMapObject* const self) {
+    if(self->lockFd >= 0) {
+        close(self->lockFd);
+        self->lockFd = -1;
+    }
+    if(self->forkGeneration != forkGeneration) {
+        // The syncer's and the prefetcher's threads did not make it across the fork, so there is
+        // nothing to stop. If iterators from before the fork are still around, they hold on to the
+        // old environment, so we can't close it either. Closing it is otherwise safe, because LMDB
+        // only releases the reader slots of the calling process.
+        self->syncer = nullptr;
+        self->prefetcher = nullptr;
+        if(self->liveReadTxns > 0) {
+            delete self->dense;
+            self->dense = nullptr;
+            self->mdb = nullptr;
+            self->envContext = nullptr;
+            return;
+        }
+    }
+    delete self->prefetcher;
+    self->prefetcher = nullptr;
+    delete self->syncer;
+    self->syncer = nullptr;
+    delete self->dense;
+    self->dense = nullptr;
+    mdb_env_close(self->mdb);
+    self->mdb = nullptr;
+    delete self->envContext;
+    self->envContext = nullptr;
+}
+
+MDB_env* OOCMap_env(OOCMapObject* const self) {
+    if(self->forkGeneration != forkGeneration) {
+        MDB_envinfo info;
+        mdb_env_info(self->mdb, &info);
+        OOCMap_close(self);
+        OOCMap_open(self, info.me_mapsize);
+    }
+    return self->mdb;
+}
+
+struct PageStats {
+    size_t pageSize;
+    size_t pages;       // pages in use by the data file, including free ones
+    size_t freePages;   // pages on LMDB's freelist
+    size_t diskBytes;   // bytes the data file actually occupies on disk
+};
+
+static void OOCMap_pageStats(MDB_env* const mdb, PageStats* const stats) {
+    MDB_stat stat;
+    mdb_env_stat(mdb, &stat);
+    MDB_envinfo info;
+    mdb_env_info(mdb, &info);
+    stats->pageSize = stat.ms_psize;
+    stats->pages = info.me_last_pgno + 1;
+
+    // The freelist lives in DB 0. Every record in it is a list of page numbers, prefixed with
+    // the length of the list.
+    stats->freePages = 0;
+    MDB_txn* txn = txn_begin(mdb, false);
+    MDB_cursor* cursor = nullptr;
+    try {
+        cursor = cursor_open(txn, 0);
+        MDB_val mdbKey;
+        MDB_val mdbValue;
+        while(cursor_get(cursor, &mdbKey, &mdbValue, MDB_NEXT))
+            stats->freePages += *static_cast<const size_t*>(mdbValue.mv_data);
+        cursor_close(cursor);
+        txn_commit(txn);
+    } catch(...) {
+        if(cursor != nullptr) cursor_close(cursor);
+        txn_abort(txn);
+        throw;
+    }
+
+    mdb_filehandle_t fd;
+    mdb_env_get_fd(mdb, &fd);
+    struct stat fileStat;
+    if(fstat(fd, &fileStat) != 0)
+        throw MdbError(errno);
+    stats->diskBytes = fileStat.st_blocks * 512;
+}
+
+static void OOCMap_pageStatsForFile(const char* const filename, PageStats* const stats) {
+    MDB_env* mdb;
+    int error = mdb_env_create(&mdb);
+    if(error != 0)
+        throw MdbError(error);
+    try {
+        error = mdb_env_open(mdb, filename, MDB_NOSUBDIR | MDB_RDONLY | MDB_NOLOCK, 0644);
+        if(error != 0)
+            throw MdbError(error);
+        OOCMap_pageStats(mdb, stats);
+    } catch(...) {
+        mdb_env_close(mdb);
+        throw;
+    }
+    mdb_env_close(mdb);
+}
+
+static PyObject* PageStats_toDict(const PageStats& stats) {
+    return Py_BuildValue(
+        "{s:n,s:n,s:n,s:n}",
+        "page_size", static_cast<Py_ssize_t>(stats.pageSize),
+        "pages", static_cast<Py_ssize_t>(stats.pages),
+        "free_pages", static_cast<Py_ssize_t>(stats.freePages),
+        "disk_bytes", static_cast<Py_ssize_t>(stats.diskBytes));
+}
+
+// A residency snapshot is this header, followed by runs of resident pages in file order.
+struct ResidencyHeader {
+    char magic[8];
+    uint64_t pageSize;
+    uint64_t runCount;
+};
+struct ResidencyRun {
+    uint64_t firstPage;
+    uint64_t pageCount;
+};
+static const char residencyMagic[8] = {'O', 'O', 'C', 'R', 'E', 'S', '1', '\0'};
+
+// Writes down which pages of the data file are in the page cache right now. Returns the number
+// of bytes that are.
+static size_t OOCMap_saveResidency(MDB_env* const mdb, const char* const path) {
+    GilUnlocker gil;
+    EnvReader reader(mdb);
+    MDB_stat stat;
+    mdb_env_stat(mdb, &stat);
+    MDB_envinfo info;
+    mdb_env_info(mdb, &info);
+    void* map;
+    mdb_env_get_map(mdb, &map);
+
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    const size_t usedBytes = (info.me_last_pgno + 1) * stat.ms_psize;
+    std::vector<unsigned char> resident((usedBytes + pageSize - 1) / pageSize);
+    if(mincore(map, usedBytes, resident.data()) != 0)
+        throw MdbError(errno);
+
+    std::vector<ResidencyRun> runs;
+    size_t residentPages = 0;
+    for(size_t page = 0; page < resident.size(); ++page) {
+        if(!(resident[page] & 1))
+            continue;
+        ++residentPages;
+        if(!runs.empty() && runs.back().firstPage + runs.back().pageCount == page)
+            runs.back().pageCount += 1;
+        else
+            runs.push_back({ .firstPage = page, .pageCount = 1 });
+    }
+
+    ResidencyHeader header = { .pageSize = pageSize, .runCount = runs.size() };
+    memcpy(header.magic, residencyMagic, sizeof(header.magic));
+    FILE* const file = fopen(path, "wb");
+    if(file == nullptr)
+        throw MdbError(errno);
+    const bool written =
+        fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(runs.data(), sizeof(ResidencyRun), runs.size(), file) == runs.size();
+    const int error = errno;
+    if(fclose(file) != 0 || !written)
+        throw MdbError(written ? errno : error);
+
+    return residentPages * pageSize;
+}
+
+// Reads the byte ranges of the data file that a residency snapshot lists, merging ranges that are
+// close together so we can read them in large, sequential chunks.
+static std::vector<std::pair<off_t, off_t>> OOCMap_loadResidency(const char* const path) {
+    FILE* const file = fopen(path, "rb");
+    if(file == nullptr)
+        throw MdbError(errno);
+    ResidencyHeader header;
+    std::vector<ResidencyRun> runs;
+    struct stat fileStat;
+    bool valid =
+        fstat(fileno(file), &fileStat) == 0 &&
+        fread(&header, sizeof(header), 1, file) == 1 &&
+        memcmp(header.magic, residencyMagic, sizeof(header.magic)) == 0;
+    // The run count comes from the file, so we check it against the file's size before we trust it
+    // with an allocation.
+    if(valid) {
+        const uint64_t runBytes = static_cast<uint64_t>(fileStat.st_size) - sizeof(header);
+        valid =
+            header.runCount <= runBytes / sizeof(ResidencyRun) &&
+            sizeof(header) + header.runCount * sizeof(ResidencyRun) == static_cast<uint64_t>(fileStat.st_size);
+    }
+    if(valid) {
+        runs.resize(header.runCount);
+        valid = fread(runs.data(), sizeof(ResidencyRun), runs.size(), file) == runs.size();
+    }
+    fclose(file);
+    if(!valid)
+        throw OocError(OocError::UnexpectedData);
+
+    static const off_t maxGap = 1024 * 1024;
+    std::vector<std::pair<off_t, off_t>> ranges;
+    for(const ResidencyRun& run : runs) {
+        const off_t start = run.firstPage * header.pageSize;
+        const off_t end = start + run.pageCount * header.pageSize;
+        if(!ranges.empty() && start - ranges.back().second <= maxGap)
+            ranges.back().second = end;
+        else
+            ranges.emplace_back(start, end);
+    }
+    return ranges;
+}
+
+// Pulls the given ranges of the file into the page cache, and closes the file when it's done.
+static void OOCMap_warmRanges(const int fd, const std::vector<std::pair<off_t, off_t>>& ranges) {
+    static const size_t chunkSize = 4 * 1024 * 1024;
+    std::unique_ptr<char[]> buffer(new char[chunkSize]);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    for(const auto& range : ranges) {
+        for(off_t offset = range.first; offset < range.second; ) {
+            const size_t size = std::min(static_cast<size_t>(range.second - offset), chunkSize);
+            const ssize_t bytesRead = pread(fd, buffer.get(), size, offset);
+            if(bytesRead <= 0)
+                break;  // The file shrank, for example because it was compacted in the meantime.
+            offset += bytesRead;
+        }
+    }
+    close(fd);
+}
+
+// Every process that has the environment open holds a shared lock on the first byte of its lock
+// file, and LMDB takes it before it opens the data file for writing. Taking that byte exclusively
+// tells us that nobody else has the map open, and keeps others from opening it until we let go.
+static bool OOCMap_lockOutOthers(OOCMapObject* const self) {
+    if(self->lockFd < 0) {
+        const std::string lockFilename = std::string(PyBytes_AS_STRING(self->filename)) + "-lock";
+        self->lockFd = open(lockFilename.c_str(), O_RDWR | O_CLOEXEC);
+        if(self->lockFd < 0)
+            throw MdbError(errno);
+    }
+    struct flock lock = {};
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = 0;
+    lock.l_len = 1;
+    int error;
+    while((error = fcntl(self->lockFd, F_SETLK, &lock)) != 0 && errno == EINTR) ;
+    if(error == 0)
+        return true;
+    if(errno == EAGAIN || errno == EACCES)
+        return false;
+    throw MdbError(errno);
+}
+
+// Goes back to the shared lock that every process holds.
+static void OOCMap_letOthersIn(OOCMapObject* const self) {
+    struct flock lock = {};
+    lock.l_type = F_RDLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = 0;
+    lock.l_len = 1;
+    int error;
+    while((error = fcntl(self->lockFd, F_SETLK, &lock)) != 0 && errno == EINTR) ;
+    if(error != 0)
+        throw MdbError(errno);
+}
+
+static int countForeignReaders(const char* const msg, void* const ctx) {
+    // mdb_reader_list() gives us one line per reader, starting with the pid.
+    int pid;
+    if(sscanf(msg, "%d", &pid) == 1 && pid != getpid())
+        *static_cast<int*>(ctx) += 1;
+    return 0;
+}
+
+//
+// Methods that are directly exposed to Python
+// These are not allowed to throw exceptions.
+//
+
+static void OOCMap_dealloc(OOCMapObject* self) {
+    if(self->mdb != nullptr)
+        OOCMap_close(self);
+    Py_XDECREF(self->filename);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* OOCMap_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
+    PyObject* pySelf = type->tp_alloc(type, 0);
+    OOCMapObject* self = reinterpret_cast<OOCMapObject*>(pySelf);
+    if(self == nullptr) {
+        PyErr_NoMemory();
+    } else {
+        self->mdb = nullptr;
+        self->filename = nullptr;
+        self->envFlags = 0;
+        self->maxReaders = 0;
+        self->forkGeneration = 0;
+        self->keyEncoding = KEY_ENCODING_UNSPECIFIED;
+        self->dense = nullptr;
+        self->contentHashes = -1;
+        self->frozen = -1;
+        self->accessPattern = ACCESS_PATTERN_DEFAULT;
+        self->residentTables = 0;
+        self->autogrow = true;
+        self->syncer = nullptr;
+        self->prefetcher = nullptr;
+        self->syncInterval = 0;
+        self->liveReadTxns = 0;
+        self->envContext = nullptr;
+        self->lockFd = -1;
+    }
+    return (PyObject*)self;
+}
+
+static int OOCMap_init(OOCMapObject* self, PyObject* args, PyObject* kwds) {
+    // parse parameters
+    static const char *kwlist[] = {
+        "filename", "max_size", "autogrow", "durability", "sync_interval", "readonly", "lock", "max_readers",
+        "access_pattern", "resident_tables", "huge_pages", "ordered_keys", "dense", "content_hashes", "frozen",
+        nullptr
+    };
+    PyObject* filenameObject = nullptr;
+    unsigned long long mapsize = 0;
+    int autogrow = 1;
+    const char* durability = "fast";
+    double syncInterval = 1.0;
+    int readonly = 0;
+    int lock = 1;
+    unsigned int maxReaders = 0;
+    const char* accessPattern = "default";
+    PyObject* residentTables = nullptr;
+    int hugePages = 0;
+    PyObject* orderedKeys = Py_None;
+    int dense = 0;
+    PyObject* contentHashes = Py_None;
+    PyObject* frozen = Py_None;
+    const int parseSuccess = PyArg_ParseTupleAndKeywords(
+            args,
+            kwds,
+            "O&|$KpsdppIsOpOpOO",
+            const_cast<char**>(kwlist),
+            PyUnicode_FSConverter, &filenameObject, &mapsize, &autogrow, &durability, &syncInterval,
+            &readonly, &lock, &maxReaders, &accessPattern, &residentTables, &hugePages, &orderedKeys, &dense,
+            &contentHashes, &frozen);
+    if(!parseSuccess)
+        return -1;
+    // TODO: We should check for and handle the case where self->mdb has already been opened.
+    Py_XSETREF(self->filename, filenameObject);
+    self->autogrow = autogrow;
+    self->maxReaders = maxReaders;
+
+    if(mapsize == 0) mapsize = 1024ull * 1024ull * 1024ull;
+
+    self->envFlags = MDB_NOSUBDIR | MDB_WRITEMAP | MDB_NOMEMINIT | MDB_NOTLS;
+    self->syncInterval = 0;
+    if(strcmp(durability, "fast") == 0) {
+        // These are some aggressive flags that don't guarantee data integrity.
+        self->envFlags |= MDB_NOSYNC | MDB_NOMETASYNC | MDB_MAPASYNC;
+    } else if(strcmp(durability, "full") == 0) {
+        // Every commit waits for the data and the meta page to hit the disk.
+    } else if(strcmp(durability, "nometasync") == 0) {
+        // Every commit waits for the data, but not for the meta page. A crash can lose the last
+        // transaction, but never corrupts the map.
+        self->envFlags |= MDB_NOMETASYNC;
+    } else if(strcmp(durability, "periodic") == 0) {
+        // Fast commits, with a background thread bounding how much a crash can lose.
+        if(syncInterval <= 0) {
+            PyErr_Format(PyExc_ValueError, "sync_interval must be positive");
+            return -1;
+        }
+        self->envFlags |= MDB_NOSYNC | MDB_NOMETASYNC | MDB_MAPASYNC;
+        self->syncInterval = syncInterval;
+    } else {
+        PyErr_Format(
+            PyExc_ValueError,
+            "durability must be one of \"fast\", \"full\", \"nometasync\", or \"periodic\", not \"%s\"",
+            durability);
+        return -1;
+    }
+
+    if(readonly) {
+        // None of the write-related flags matter here, and a writable map can't be made from a
+        // file we opened read-only.
+        self->envFlags = MDB_NOSUBDIR | MDB_NOTLS | MDB_RDONLY;
+        self->syncInterval = 0;
+        self->autogrow = false;
+    }
+    if(!lock) {
+        // Without the lock file, LMDB can't coordinate readers with a writer. That is only safe
+        // when nobody writes, i.e., for immutable snapshots.
+        if(!readonly) {
+            PyErr_Format(PyExc_ValueError, "lock=False requires readonly=True");
+            return -1;
+        }
+        self->envFlags |= MDB_NOLOCK;
+    }
+
+    if(orderedKeys == Py_None) {
+        self->keyEncoding = KEY_ENCODING_UNSPECIFIED;
+    } else {
+        const int ordered = PyObject_IsTrue(orderedKeys);
+        if(ordered < 0)
+            return -1;
+        self->keyEncoding = ordered ? KEY_ENCODING_ORDERED : KEY_ENCODING_VALUES;
+    }
+    if(dense) {
+        if(self->keyEncoding == KEY_ENCODING_ORDERED) {
+            PyErr_Format(PyExc_ValueError, "dense=True and ordered_keys=True don't go together");
+            return -1;
+        }
+        self->keyEncoding = KEY_ENCODING_DENSE;
+    }
+
+    if(contentHashes == Py_None) {
+        self->contentHashes = -1;
+    } else {
+        self->contentHashes = PyObject_IsTrue(contentHashes);
+        if(self->contentHashes < 0)
+            return -1;
+    }
+    if(frozen == Py_None) {
+        self->frozen = -1;
+    } else {
+        self->frozen = PyObject_IsTrue(frozen);
+        if(self->frozen < 0)
+            return -1;
+    }
+
+    if(hugePages) {
+        // Fewer TLB misses for random lookups, if the kernel plays along. huge_page_bytes() tells
+        // whether it does.
+        self->envFlags |= MDB_HUGEPAGES;
+    }
+
+    self->residentTables = 0;
+    if(strcmp(accessPattern, "default") == 0) {
+        self->accessPattern = ACCESS_PATTERN_DEFAULT;
+    } else if(strcmp(accessPattern, "random") == 0) {
+        // For maps much larger than memory, readahead mostly evicts pages we still need.
+        self->accessPattern = ACCESS_PATTERN_RANDOM;
+        self->envFlags |= MDB_NORDAHEAD;
+    } else if(strcmp(accessPattern, "sequential") == 0) {
+        self->accessPattern = ACCESS_PATTERN_SEQUENTIAL;
+    } else if(strcmp(accessPattern, "resident") == 0) {
+        self->accessPattern = ACCESS_PATTERN_RESIDENT;
+        self->residentTables = allTables;
+    } else {
+        PyErr_Format(
+            PyExc_ValueError,
+            "access_pattern must be one of \"default\", \"random\", \"sequential\", or \"resident\", not \"%s\"",
+            accessPattern);
+        return -1;
+    }
+    if(residentTables != nullptr && residentTables != Py_None) {
+        if(self->accessPattern != ACCESS_PATTERN_RESIDENT) {
+            PyErr_Format(PyExc_ValueError, "resident_tables requires access_pattern=\"resident\"");
+            return -1;
+        }
+        PyObject* const iterator = PyObject_GetIter(residentTables);
+        if(iterator == nullptr)
+            return -1;
+        self->residentTables = 0;
+        PyObject* tableName;
+        while((tableName = PyIter_Next(iterator)) != nullptr) {
+            const char* const name = PyUnicode_Check(tableName) ? PyUnicode_AsUTF8(tableName) : nullptr;
+            unsigned int i = 0;
+            while(name != nullptr && i < sizeof(tableNames) / sizeof(tableNames[0]) && strcmp(name, tableNames[i]) != 0)
+                ++i;
+            if(name == nullptr || i >= sizeof(tableNames) / sizeof(tableNames[0])) {
+                PyErr_Format(PyExc_ValueError, "Unknown table %R", tableName);
+                Py_DECREF(tableName);
+                Py_DECREF(iterator);
+                return -1;
+            }
+            self->residentTables |= 1 << i;
+            Py_DECREF(tableName);
+        }
+        Py_DECREF(iterator);
+        if(PyErr_Occurred())
+            return -1;
+    }
+
+    try {
+        OOCMap_open(self, mapsize);
+    } catch (const OocError& error) {
+        error.pythonize();
+        return -1;
+    }
+
+    return 0;
+}
+
+static Py_ssize_t OOCMap_length(PyObject* pySelf) {
+    if(!isOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return -1;
+    }
+    OOCMapObject* const self = reinterpret_cast<OOCMapObject*>(pySelf);
+    if(self->keyEncoding == KEY_ENCODING_DENSE)
+        return self->dense->count();
+
+    MDB_txn* txn = nullptr;
+    try {
+        txn = txn_begin(OOCMap_env(self), false);
+        MDB_stat stat;
+        mdb_stat(txn, self->rootDb, &stat);
+        txn_commit(txn);
+        return stat.ms_entries;
+    } catch(const OocError& error) {
+        if(txn != nullptr)
+            txn_abort(txn);
+        error.pythonize();
+        return -1;
+    }
+}
+
+// Returns false for keys that can't be in a dense map.
+static bool OOCMap_denseKey(PyObject* const key, uint64_t* const dest) {
+    if(!PyLong_CheckExact(key)) return false;
+    int overflow;
+    const long long value = PyLong_AsLongLongAndOverflow(key, &overflow);
+    if(overflow != 0 || value < 0 || static_cast<uint64_t>(value) >= DenseArray::maxKeys) return false;
+    *dest = value;
+    return true;
+}
+
+// Whether OOCMap_decode() has to look at the DB to decode this value.
+static bool OOCMap_decodeNeedsTxn(const EncodedValue* const encodedValue) {
+    switch(encodedValue->typeCode) {
+    case TYPE_CODE_LONG_POSITIVE_INT:
+    case TYPE_CODE_LONG_NEGATIVE_INT:
+    case TYPE_CODE_UNICODE_LONG_WCHAR:
+    case TYPE_CODE_UNICODE_LONG_1BYTE:
+    case TYPE_CODE_UNICODE_LONG_2BYTE:
+    case TYPE_CODE_UNICODE_LONG_4BYTE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static int OOCMap_insertDense(OOCMapObject* const self, PyObject* const key, PyObject* const value) {
+    uint64_t denseKey;
+    if(!OOCMap_denseKey(key, &denseKey)) {
+        if(value == nullptr)
+            PyErr_SetObject(PyExc_KeyError, key);
+        else if(!PyLong_CheckExact(key))
+            PyErr_Format(PyExc_TypeError, "dense maps need int keys, not %s", Py_TYPE(key)->tp_name);
+        else
+            PyErr_Format(PyExc_ValueError, "dense maps need keys from 0 to %llu", DenseArray::maxKeys - 1);
+        return -1;
+    }
+
+    // The array is not part of the transaction, so we only fill in the slot once the transaction has
+    // committed. Otherwise a failed commit would leave it pointing at data that isn't there. Growing
+    // the array still happens in the transaction, which keeps other writers out.
+    MDB_txn* txn = nullptr;
+    while(true) {
+        try {
+            txn = txn_begin(OOCMap_env(self), true);
+            EncodedValue encodedValue;
+            if(value == nullptr) {
+                if(!self->dense->get(denseKey, &encodedValue)) {
+                    txn_abort(txn);
+                    PyErr_SetObject(PyExc_KeyError, key);
+                    return -1;
+                }
+            } else {
+                Id2EncodedMap insertedItemsInThisTransaction;
+                OOCMap_encode(self, value, &encodedValue, txn, insertedItemsInThisTransaction);
+                self->dense->reserve(denseKey);
+            }
+            txn_commit(txn);
+            if(value == nullptr)
+                self->dense->remove(denseKey);
+            else
+                self->dense->set(denseKey, encodedValue);
+            if(!(self->envFlags & MDB_NOSYNC))
+                self->dense->sync();
+            return 0;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self, error))
+                continue;
+            error.pythonize();
+            return -1;
+        }
+    }
+}
+
+static int OOCMap_insert(PyObject* pySelf, PyObject* key, PyObject* value) {
+    // cast the input
+    if(!isOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return -1;
+    }
+    OOCMapObject* self = reinterpret_cast<OOCMapObject*>(pySelf);
+    if(self->keyEncoding == KEY_ENCODING_DENSE)
+        return OOCMap_insertDense(self, key, value);
+
+    // start transaction
+    MDB_txn* txn = nullptr;
+    while(true) {
+        try {
+            txn = txn_begin(OOCMap_env(self), true);
+            Id2EncodedMap insertedItemsInThisTransaction;
+
+            RootKey rootKey;
+            OOCMap_encodeRootKey(self, key, &rootKey, txn, insertedItemsInThisTransaction);
+
+            if(value == nullptr) {
+                // Deleting the value
+                del(txn, self->rootDb, &rootKey.mdbKey);
+            } else {
+                // Inserting a new value
+                EncodedValue encodedValue;
+                OOCMap_encode(self, value, &encodedValue, txn, insertedItemsInThisTransaction);
+                MDB_val mdbValue = { .mv_size=sizeof(encodedValue), .mv_data=&encodedValue };
+
+                put(txn, self->rootDb, &rootKey.mdbKey, &mdbValue);
+            }
+            txn_commit(txn);
+            return 0;
+        } catch(const OocError& error) {
+            if(txn != nullptr)
+                txn_abort(txn);
+            txn = nullptr;
+            if(OOCMap_growIfFull(self, error))
+                continue;
+            error.pythonize();
+            return -1;
+        }
+    }
+}
+
+static PyObject* OOCMap_getDense(OOCMapObject* const self, PyObject* const key) {
+    uint64_t denseKey;
+    EncodedValue encodedValue;
+    if(!OOCMap_denseKey(key, &denseKey) || !self->dense->get(denseKey, &encodedValue)) {
+        PyErr_SetObject(PyExc_KeyError, key);
+        return nullptr;
+    }
+
+    MDB_txn* txn = nullptr;
+    try {
+        // Most values decode without the DB, and then we don't need a transaction either.
+        if(!OOCMap_decodeNeedsTxn(&encodedValue))
+            return OOCMap_decode(self, &encodedValue, nullptr);
+        txn = txn_begin(OOCMap_env(self), false);
+        PyObject* const result = OOCMap_decode(self, &encodedValue, txn);
+        txn_commit(txn);
+        return result;
+    } catch(const OocError& error) {
+        if(txn != nullptr) txn_abort(txn);
+        error.pythonize();
+        return nullptr;
+    }
+}
+
+static PyObject* OOCMap_get(PyObject* pySelf, PyObject* key) {
+    // cast the input
+    if(!isOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCMapObject* self = reinterpret_cast<OOCMapObject*>(pySelf);
+    if(self->keyEncoding == KEY_ENCODING_DENSE)
+        return OOCMap_getDense(self, key);
+
+    MDB_txn* txn = nullptr;
+    try {
+        txn = txn_begin(OOCMap_env(self), false);
+        Id2EncodedMap insertedItemsInThisTransaction;
+
+        RootKey rootKey;
+        OOCMap_encodeRootKey(self, key, &rootKey, txn, insertedItemsInThisTransaction, true);
+
+        MDB_val mdbValue;
+        const bool found = get(txn, self->rootDb, &rootKey.mdbKey, &mdbValue);
+        if(found) {
+            if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+            EncodedValue* encodedValue = static_cast<EncodedValue*>(mdbValue.mv_data);
 
             PyObject* const result = OOCMap_decode(self, encodedValue, txn);
             txn_commit(txn);
             return result;
         } else {
             txn_abort(txn);
-            PyErr_SetObject(PyExc_KeyError, key);
-            return nullptr;
+            PyErr_SetObject(PyExc_KeyError, key);
+            return nullptr;
+        }
+    } catch(const OocError& error) {
+        if(txn != nullptr) txn_abort(txn);
+        if(error.errorCode == OocError::ImmutableValueNotFound)
+            PyErr_SetObject(PyExc_KeyError, key);
+        else
+            error.pythonize();
+        return nullptr;
+    }
+}
+
+static int OOCMap_contains(PyObject* const pySelf, PyObject* const key) {
+    if(!isOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return -1;
+    }
+    OOCMapObject* const self = reinterpret_cast<OOCMapObject*>(pySelf);
+    if(self->keyEncoding == KEY_ENCODING_DENSE) {
+        uint64_t denseKey;
+        EncodedValue encodedValue;
+        return OOCMap_denseKey(key, &denseKey) && self->dense->get(denseKey, &encodedValue);
+    }
+
+    MDB_txn* txn = nullptr;
+    try {
+        txn = txn_begin(OOCMap_env(self), false);
+        Id2EncodedMap insertedItemsInThisTransaction;
+        RootKey rootKey;
+        OOCMap_encodeRootKey(self, key, &rootKey, txn, insertedItemsInThisTransaction, true);
+        MDB_val mdbValue;
+        const bool found = get(txn, self->rootDb, &rootKey.mdbKey, &mdbValue);
+        txn_commit(txn);
+        return found;
+    } catch(const OocError& error) {
+        if(txn != nullptr) txn_abort(txn);
+        // Values that were never stored can't be keys either.
+        if(error.errorCode == OocError::ImmutableValueNotFound)
+            return 0;
+        error.pythonize();
+        return -1;
+    }
+}
+
+static PyObject* OOCMap_prefetchKeys(PyObject* const pySelf, PyObject* const keys) {
+    if(!isOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCMapObject* const self = reinterpret_cast<OOCMapObject*>(pySelf);
+
+    PyObject* const iterator = PyObject_GetIter(keys);
+    if(iterator == nullptr)
+        return nullptr;
+
+    MDB_txn* txn = nullptr;
+    try {
+        txn = txn_begin(OOCMap_env(self), false);
+
+        // Find the values first, so the walk can run without the GIL.
+        std::vector<EncodedValue> values;
+        PyObject* key;
+        while((key = PyIter_Next(iterator)) != nullptr) {
+            if(self->keyEncoding == KEY_ENCODING_DENSE) {
+                uint64_t denseKey;
+                EncodedValue value;
+                if(OOCMap_denseKey(key, &denseKey) && self->dense->get(denseKey, &value))
+                    values.push_back(value);
+                Py_DECREF(key);
+                continue;
+            }
+
+            Id2EncodedMap insertedItemsInThisTransaction;
+            RootKey rootKey;
+            try {
+                OOCMap_encodeRootKey(self, key, &rootKey, txn, insertedItemsInThisTransaction, true);
+            } catch(const OocError& error) {
+                Py_DECREF(key);
+                // Keys that can't be in the map have nothing to prefetch.
+                if(error.errorCode == OocError::ImmutableValueNotFound) continue;
+                throw;
+            }
+            Py_DECREF(key);
+
+            MDB_val mdbValue;
+            if(get(txn, self->rootDb, &rootKey.mdbKey, &mdbValue)) {
+                if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+                values.push_back(*static_cast<EncodedValue*>(mdbValue.mv_data));
+            }
+        }
+        if(PyErr_Occurred())
+            throw OocError(OocError::AlreadyPythonizedError);
+
+        OOCMap_prefetch(self, txn, values.data(), values.size());
+        txn_commit(txn);
+    } catch(const OocError& error) {
+        if(txn != nullptr)
+            txn_abort(txn);
+        Py_DECREF(iterator);
+        error.pythonize();
+        return nullptr;
+    }
+    Py_DECREF(iterator);
+    Py_RETURN_NONE;
+}
+
+static PyObject* OOCMap_saveResidencyPy(PyObject* const pySelf, PyObject* const pathObject) {
+    if(!isOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCMapObject* const self = reinterpret_cast<OOCMapObject*>(pySelf);
+
+    PyObject* path = nullptr;
+    if(!PyUnicode_FSConverter(pathObject, &path))
+        return nullptr;
+
+    size_t residentBytes;
+    try {
+        residentBytes = OOCMap_saveResidency(OOCMap_env(self), PyBytes_AS_STRING(path));
+    } catch(const OocError& error) {
+        Py_DECREF(path);
+        error.pythonize();
+        return nullptr;
+    }
+    Py_DECREF(path);
+    return PyLong_FromSize_t(residentBytes);
+}
+
+static PyObject* OOCMap_warm(PyObject* const pySelf, PyObject* const args, PyObject* const kwds) {
+    if(!isOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCMapObject* const self = reinterpret_cast<OOCMapObject*>(pySelf);
+
+    static const char *kwlist[] = {"path", "background", nullptr};
+    PyObject* path = nullptr;
+    int background = 0;
+    const int parseSuccess = PyArg_ParseTupleAndKeywords(
+        args,
+        kwds,
+        "O&|$p",
+        const_cast<char**>(kwlist),
+        PyUnicode_FSConverter, &path, &background);
+    if(!parseSuccess)
+        return nullptr;
+
+    size_t bytes = 0;
+    try {
+        GilUnlocker gil;
+        const std::vector<std::pair<off_t, off_t>> ranges = OOCMap_loadResidency(PyBytes_AS_STRING(path));
+        for(const auto& range : ranges)
+            bytes += range.second - range.first;
+
+        // We read through our own file descriptor, so this doesn't care what happens to the
+        // environment in the meantime.
+        const int fd = open(PyBytes_AS_STRING(self->filename), O_RDONLY | O_CLOEXEC);
+        if(fd < 0)
+            throw MdbError(errno);
+        if(background)
+            std::thread(OOCMap_warmRanges, fd, ranges).detach();
+        else
+            OOCMap_warmRanges(fd, ranges);
+    } catch(const OocError& error) {
+        Py_DECREF(path);
+        error.pythonize();
+        return nullptr;
+    }
+    Py_DECREF(path);
+    return PyLong_FromSize_t(bytes);
+}
+
+static PyObject* OOCMap_hugePageBytes(PyObject* const pySelf) {
+    if(!isOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCMapObject* const self = reinterpret_cast<OOCMapObject*>(pySelf);
+
+    void* map;
+    try {
+        mdb_env_get_map(OOCMap_env(self), &map);
+    } catch(const OocError& error) {
+        error.pythonize();
+        return nullptr;
+    }
+
+    // Only the kernel knows which parts of the map it backed with huge pages. We find our mapping
+    // in smaps, and add up its huge page counters.
+    size_t bytes = 0;
+    FILE* const smaps = fopen("/proc/self/smaps", "r");
+    if(smaps != nullptr) {
+        char line[256];
+        bool inMap = false;
+        while(fgets(line, sizeof(line), smaps) != nullptr) {
+            unsigned long start;
+            unsigned long end;
+            size_t kilobytes;
+            char field[64];
+            if(sscanf(line, "%lx-%lx ", &start, &end) == 2)
+                inMap = start == reinterpret_cast<uintptr_t>(map);
+            else if(inMap && sscanf(line, "%63[^:]: %zu kB", field, &kilobytes) == 2 && (
+                strcmp(field, "AnonHugePages") == 0 ||
+                strcmp(field, "ShmemPmdMapped") == 0 ||
+                strcmp(field, "FilePmdMapped") == 0
+            ))
+                bytes += kilobytes * 1024;
+        }
+        fclose(smaps);
+    }
+    return PyLong_FromSize_t(bytes);
+}
+
+static PyObject* OOCMap_checkpoint(PyObject* const pySelf) {
+    if(!isOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCMapObject* const self = reinterpret_cast<OOCMapObject*>(pySelf);
+    if(self->envFlags & MDB_RDONLY)
+        Py_RETURN_NONE;
+
+    try {
+        env_sync(OOCMap_env(self));
+        if(self->dense != nullptr)
+            self->dense->sync();
+    } catch(const OocError& error) {
+        error.pythonize();
+        return nullptr;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* OOCMap_compact(PyObject* const pySelf, PyObject* const args, PyObject* const kwds) {
+    if(!isOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCMapObject* const self = reinterpret_cast<OOCMapObject*>(pySelf);
+
+    // parse parameters
+    static const char *kwlist[] = {"dest_path", nullptr};
+    PyObject* destPathObject = Py_None;
+    const int parseSuccess = PyArg_ParseTupleAndKeywords(
+        args,
+        kwds,
+        "|O",
+        const_cast<char**>(kwlist),
+        &destPathObject);
+    if(!parseSuccess)
+        return nullptr;
+    PyObject* destPath = nullptr;
+    if(destPathObject != Py_None && !PyUnicode_FSConverter(destPathObject, &destPath))
+        return nullptr;
+
+    PageStats before;
+    PageStats after;
+    MDB_txn* txn = nullptr;
+    bool lockedOut = false;
+    try {
+        OOCMap_pageStats(OOCMap_env(self), &before);
+
+        if(destPath != nullptr) {
+            // Just write the compacted copy. This map stays as it is.
+            env_copy(self->mdb, PyBytes_AS_STRING(destPath), MDB_CP_COMPACT);
+            if(self->dense != nullptr)
+                self->dense->copyTo((std::string(PyBytes_AS_STRING(destPath)) + "-dense").c_str());
+            OOCMap_pageStatsForFile(PyBytes_AS_STRING(destPath), &after);
+            Py_CLEAR(destPath);
+        } else {
+            // Compact in place. We write the copy next to the original, and then rename it over
+            // the original. This only works if nobody else has the file open, because other
+            // processes would keep using the old file. So we lock everyone else out for as long as
+            // that takes. Read-only processes open the data file before they wait for the lock, so
+            // one that starts opening the map during this still ends up with the old file.
+            if(self->envFlags & MDB_RDONLY) {
+                PyErr_Format(PyExc_RuntimeError, "Cannot compact a read-only OOCMap in place.");
+                throw OocError(OocError::AlreadyPythonizedError);
+            }
+            if(self->liveReadTxns > 0) {
+                PyErr_Format(PyExc_RuntimeError, "Cannot compact an OOCMap while iterators over it are alive.");
+                throw OocError(OocError::AlreadyPythonizedError);
+            }
+            int deadReaders;
+            const int error = mdb_reader_check(self->mdb, &deadReaders);
+            if(error != 0)
+                throw MdbError(error);
+            if(!OOCMap_lockOutOthers(self)) {
+                PyErr_Format(PyExc_RuntimeError, "Cannot compact an OOCMap in place while other processes have it open.");
+                throw OocError(OocError::AlreadyPythonizedError);
+            }
+            lockedOut = true;
+            // Read-only processes don't always hold the lock, but they do hold reader slots.
+            int foreignReaders = 0;
+            mdb_reader_list(self->mdb, countForeignReaders, &foreignReaders);
+            if(foreignReaders > 0) {
+                PyErr_Format(PyExc_RuntimeError, "Cannot compact an OOCMap in place while other processes are reading it.");
+                throw OocError(OocError::AlreadyPythonizedError);
+            }
+
+            const char* const filename = PyBytes_AS_STRING(self->filename);
+            destPath = PyBytes_FromFormat("%s.compact", filename);
+            if(destPath == nullptr) throw OocError(OocError::OutOfMemory);
+            if(unlink(PyBytes_AS_STRING(destPath)) != 0 && errno != ENOENT)
+                throw MdbError(errno);
+
+            // Holding the write transaction keeps writers out until the copy has replaced the
+            // original. Readers keep going.
+            txn = txn_begin(OOCMap_env(self), true);
+            env_copy(self->mdb, PyBytes_AS_STRING(destPath), MDB_CP_COMPACT);
+            if(rename(PyBytes_AS_STRING(destPath), filename) != 0)
+                throw MdbError(errno);
+            Py_CLEAR(destPath);
+            txn_abort(txn);
+            txn = nullptr;
+
+            // Lazy objects only hold on to self, not to the environment, so they survive this.
+            // Closing lets the others in.
+            MDB_envinfo info;
+            mdb_env_info(self->mdb, &info);
+            lockedOut = false;
+            OOCMap_close(self);
+            OOCMap_open(self, info.me_mapsize);
+
+            OOCMap_pageStats(self->mdb, &after);
         }
     } catch(const OocError& error) {
-        if(txn != nullptr) txn_abort(txn);
-        if(error.errorCode == OocError::ImmutableValueNotFound)
-            PyErr_SetObject(PyExc_KeyError, key);
-        else
-            error.pythonize();
+        if(txn != nullptr)
+            txn_abort(txn);
+        Py_XDECREF(destPath);
+        if(lockedOut) {
+            try {
+                OOCMap_letOthersIn(self);
+            } catch(const OocError&) {
+                // The error we already have is the one to report.
+            }
+        }
+        error.pythonize();
+        return nullptr;
+    }
+
+    return Py_BuildValue("{s:N,s:N}", "before", PageStats_toDict(before), "after", PageStats_toDict(after));
+}
+
+
+//
+// OOCMapIter
+//
+
+PyObject* OOCMapIter_fastnew(
+    OOCMapObject* const ooc,
+    PyObject* const lo,
+    PyObject* const hi,
+    const bool reverse,
+    const OOCMapIterMode mode
+) {
+    PyObject* const pySelf = OOCMapIterType.tp_alloc(&OOCMapIterType, 0);
+    if(pySelf == nullptr) return nullptr;
+    OOCMapIterObject* const self = reinterpret_cast<OOCMapIterObject*>(pySelf);
+    self->ooc = ooc;
+    Py_INCREF(ooc);
+    self->txn = nullptr;
+    self->cursor = nullptr;
+    self->lo = lo;
+    Py_XINCREF(lo);
+    self->hi = hi;
+    Py_XINCREF(hi);
+    self->reverse = reverse;
+    self->mode = mode;
+    self->exhausted = false;
+    self->batchSize = 0;
+    self->batchPos = 0;
+    self->nextDenseKey = 0;
+    return pySelf;
+}
+
+static PyObject* OOCMapIter_new(PyTypeObject* const type, PyObject* const args, PyObject* const kwds) {
+    PyObject* const pySelf = type->tp_alloc(type, 0);
+    if(pySelf == nullptr) {
+        PyErr_NoMemory();
+        return nullptr;
+    }
+    OOCMapIterObject* const self = reinterpret_cast<OOCMapIterObject*>(pySelf);
+    self->ooc = nullptr;
+    self->txn = nullptr;
+    self->cursor = nullptr;
+    self->lo = nullptr;
+    self->hi = nullptr;
+    self->reverse = false;
+    self->mode = ITER_KEYS;
+    self->exhausted = true;
+    self->batchSize = 0;
+    self->batchPos = 0;
+    self->nextDenseKey = 0;
+    return pySelf;
+}
+
+static void OOCMapIter_closeTxn(OOCMapIterObject* self, bool commit);
+
+static void OOCMapIter_dealloc(OOCMapIterObject* const self) {
+    if(self->txn != nullptr)
+        OOCMapIter_closeTxn(self, false);
+    Py_XDECREF(self->ooc);
+    Py_XDECREF(self->lo);
+    Py_XDECREF(self->hi);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* OOCMapIter_iter(PyObject* const pySelf) {
+    Py_INCREF(pySelf);
+    return pySelf;
+}
+
+// Ends the read transaction the iterator keeps open between calls.
+static void OOCMapIter_closeTxn(OOCMapIterObject* const self, const bool commit) {
+    if(self->cursor != nullptr)
+        cursor_close(self->cursor);
+    self->cursor = nullptr;
+    self->ooc->liveReadTxns -= 1;
+    if(commit)
+        txn_commit(self->txn);
+    else
+        txn_abort(self->txn);
+    self->txn = nullptr;
+}
+
+static MDB_val bytesToMdbVal(PyObject* const bytes) {
+    return { .mv_size = static_cast<size_t>(PyBytes_GET_SIZE(bytes)), .mv_data = PyBytes_AS_STRING(bytes) };
+}
+
+// Positions the cursor on the first entry in the range. Going backwards, that's the last entry
+// before hi.
+static bool OOCMapIter_seek(OOCMapIterObject* const self, MDB_val* const mdbKey, MDB_val* const mdbValue) {
+    if(!self->reverse) {
+        if(self->lo == nullptr)
+            return cursor_get(self->cursor, mdbKey, mdbValue, MDB_FIRST);
+        *mdbKey = bytesToMdbVal(self->lo);
+        return cursor_get(self->cursor, mdbKey, mdbValue, MDB_SET_RANGE);
+    } else {
+        if(self->hi == nullptr)
+            return cursor_get(self->cursor, mdbKey, mdbValue, MDB_LAST);
+        *mdbKey = bytesToMdbVal(self->hi);
+        if(cursor_get(self->cursor, mdbKey, mdbValue, MDB_SET_RANGE))
+            return cursor_get(self->cursor, mdbKey, mdbValue, MDB_PREV);
+        return cursor_get(self->cursor, mdbKey, mdbValue, MDB_LAST);
+    }
+}
+
+// Reads the next batch of entries. Leaves the batch empty when there are none left.
+static void OOCMapIter_fill(OOCMapIterObject* const self) {
+    OOCMapObject* const ooc = self->ooc;
+    self->batchSize = 0;
+    self->batchPos = 0;
+
+    bool seek = false;
+    if(self->txn == nullptr) {
+        self->txn = txn_begin(OOCMap_env(ooc), false);
+        txn_keep(self->txn);
+        ooc->liveReadTxns += 1;
+        if(ooc->keyEncoding != KEY_ENCODING_DENSE) {
+            self->cursor = cursor_open(self->txn, ooc->rootDb);
+            seek = true;
+        } else if(self->lo != nullptr) {
+            self->nextDenseKey = OOCMapPartition_denseKey(self->lo);
+        }
+    }
+
+    if(ooc->keyEncoding == KEY_ENCODING_DENSE) {
+        const uint64_t end = self->hi == nullptr ? UINT64_MAX : OOCMapPartition_denseKey(self->hi);
+        while(self->batchSize < OOCMAP_ITER_BATCH) {
+            uint64_t denseKey = self->nextDenseKey;
+            if(!ooc->dense->next(&denseKey) || denseKey >= end) {
+                self->exhausted = true;
+                break;
+            }
+            // Another writer in this process could remove the key between next() and get().
+            if(ooc->dense->get(denseKey, &self->batchValues[self->batchSize]))
+                self->batchDenseKeys[self->batchSize++] = denseKey;
+            self->nextDenseKey = denseKey + 1;
+        }
+    } else {
+        MDB_val lo;
+        MDB_val hi;
+        if(self->lo != nullptr) lo = bytesToMdbVal(self->lo);
+        if(self->hi != nullptr) hi = bytesToMdbVal(self->hi);
+        while(self->batchSize < OOCMAP_ITER_BATCH) {
+            MDB_val mdbKey;
+            MDB_val mdbValue;
+            bool found;
+            if(seek)
+                found = OOCMapIter_seek(self, &mdbKey, &mdbValue);
+            else
+                found = cursor_get(self->cursor, &mdbKey, &mdbValue, self->reverse ? MDB_PREV : MDB_NEXT);
+            seek = false;
+
+            // Stop at the far end of the range
+            if(found && !self->reverse && self->hi != nullptr)
+                found = mdb_cmp(self->txn, ooc->rootDb, &mdbKey, &hi) < 0;
+            else if(found && self->reverse && self->lo != nullptr)
+                found = mdb_cmp(self->txn, ooc->rootDb, &mdbKey, &lo) >= 0;
+            if(!found) {
+                self->exhausted = true;
+                break;
+            }
+
+            if(mdbValue.mv_size != sizeof(EncodedValue)) throw OocError(OocError::UnexpectedData);
+            self->batchKeys[self->batchSize] = mdbKey;
+            self->batchValues[self->batchSize] = *static_cast<EncodedValue*>(mdbValue.mv_data);
+            ++self->batchSize;
+        }
+    }
+
+    // Decoding values reads long strings and ints from other tables. Asking for all of the
+    // batch's at once lets the kernel read them in parallel, instead of one fault at a time.
+    if(self->mode != ITER_KEYS && self->batchSize > 0)
+        OOCMap_prefetch(ooc, self->txn, self->batchValues, self->batchSize, true);
+}
+
+static PyObject* OOCMapIter_iternext(PyObject* const pySelf) {
+    if(pySelf->ob_type != &OOCMapIterType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCMapIterObject* const self = reinterpret_cast<OOCMapIterObject*>(pySelf);
+    if(self->ooc == nullptr) return nullptr;
+    OOCMapObject* const ooc = self->ooc;
+
+    try {
+        if(self->batchPos == self->batchSize) {
+            self->batchSize = 0;
+            if(!self->exhausted)
+                OOCMapIter_fill(self);
+            if(self->batchSize == 0) {
+                if(self->txn != nullptr)
+                    OOCMapIter_closeTxn(self, true);
+                Py_CLEAR(self->ooc);
+                return nullptr;
+            }
+        }
+
+        // Keys and values are only decoded when they are asked for.
+        const unsigned int i = self->batchPos++;
+        PyObject* key = nullptr;
+        if(self->mode != ITER_VALUES) {
+            if(ooc->keyEncoding == KEY_ENCODING_DENSE) {
+                key = PyLong_FromUnsignedLongLong(self->batchDenseKeys[i]);
+                if(key == nullptr) throw OocError(OocError::AlreadyPythonizedError);
+            } else {
+                key = OOCMap_decodeRootKey(ooc, &self->batchKeys[i], self->txn);
+            }
+            if(self->mode == ITER_KEYS)
+                return key;
+        }
+
+        PyObject* value;
+        try {
+            value = OOCMap_decode(ooc, &self->batchValues[i], self->txn);
+        } catch(...) {
+            Py_XDECREF(key);
+            throw;
+        }
+        if(self->mode == ITER_VALUES)
+            return value;
+
+        PyObject* const result = PyTuple_Pack(2, key, value);
+        Py_DECREF(key);
+        Py_DECREF(value);
+        if(result == nullptr) throw OocError(OocError::AlreadyPythonizedError);
+        return result;
+    } catch(const OocError& error) {
+        if(self->txn != nullptr)
+            OOCMapIter_closeTxn(self, false);
+        Py_CLEAR(self->ooc);
+        error.pythonize();
+        return nullptr;
+    }
+}
+
+PyTypeObject OOCMapIterType = {
+    PyVarObject_HEAD_INIT(nullptr, 0)
+    .tp_name = "oocmap.OOCMapIter",
+    .tp_basicsize = sizeof(OOCMapIterObject),
+    .tp_itemsize = 0,
+    .tp_dealloc = (destructor)OOCMapIter_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Iterator over an OOCMap",
+    .tp_iter = OOCMapIter_iter,
+    .tp_iternext = OOCMapIter_iternext,
+    .tp_new = OOCMapIter_new,
+};
+
+
+//
+// OOCMapView
+//
+
+static PyObject* OOCMapView_fastnew(OOCMapObject* const ooc, const OOCMapIterMode mode) {
+    PyObject* const pySelf = OOCMapViewType.tp_alloc(&OOCMapViewType, 0);
+    if(pySelf == nullptr) return nullptr;
+    OOCMapViewObject* const self = reinterpret_cast<OOCMapViewObject*>(pySelf);
+    self->ooc = ooc;
+    Py_INCREF(ooc);
+    self->mode = mode;
+    return pySelf;
+}
+
+static void OOCMapView_dealloc(OOCMapViewObject* const self) {
+    Py_DECREF(self->ooc);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static Py_ssize_t OOCMapView_length(PyObject* const pySelf) {
+    if(pySelf->ob_type != &OOCMapViewType) {
+        PyErr_BadArgument();
+        return -1;
+    }
+    OOCMapViewObject* const self = reinterpret_cast<OOCMapViewObject*>(pySelf);
+    return OOCMap_length(reinterpret_cast<PyObject*>(self->ooc));
+}
+
+static PyObject* OOCMapView_iter(PyObject* const pySelf) {
+    if(pySelf->ob_type != &OOCMapViewType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCMapViewObject* const self = reinterpret_cast<OOCMapViewObject*>(pySelf);
+    return OOCMapIter_fastnew(self->ooc, nullptr, nullptr, false, self->mode);
+}
+
+static int OOCMapView_contains(PyObject* const pySelf, PyObject* const item) {
+    if(pySelf->ob_type != &OOCMapViewType) {
+        PyErr_BadArgument();
+        return -1;
+    }
+    OOCMapViewObject* const self = reinterpret_cast<OOCMapViewObject*>(pySelf);
+    if(self->mode == ITER_KEYS)
+        return OOCMap_contains(reinterpret_cast<PyObject*>(self->ooc), item);
+
+    // Values are not indexed, so this has to look at all of them.
+    PyObject* const iterator = OOCMapView_iter(pySelf);
+    if(iterator == nullptr) return -1;
+    PyObject* candidate;
+    int result = 0;
+    while(result == 0 && (candidate = PyIter_Next(iterator)) != nullptr) {
+        result = PyObject_RichCompareBool(candidate, item, Py_EQ);
+        Py_DECREF(candidate);
+    }
+    Py_DECREF(iterator);
+    if(result == 0 && PyErr_Occurred()) return -1;
+    return result;
+}
+
+static PySequenceMethods OOCMapView_sequence_methods = {
+    .sq_length = OOCMapView_length,
+    .sq_contains = OOCMapView_contains,
+};
+
+PyTypeObject OOCMapViewType = {
+    PyVarObject_HEAD_INIT(nullptr, 0)
+    .tp_name = "oocmap.OOCMapView",
+    .tp_basicsize = sizeof(OOCMapViewObject),
+    .tp_itemsize = 0,
+    .tp_dealloc = (destructor)OOCMapView_dealloc,
+    .tp_as_sequence = &OOCMapView_sequence_methods,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "The keys, values, or items of an OOCMap, read straight from the map",
+    .tp_iter = OOCMapView_iter,
+};
+
+static PyObject* OOCMap_keys(PyObject* const pySelf) {
+    if(!isOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    return OOCMapView_fastnew(reinterpret_cast<OOCMapObject*>(pySelf), ITER_KEYS);
+}
+
+static PyObject* OOCMap_values(PyObject* const pySelf) {
+    if(!isOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    return OOCMapView_fastnew(reinterpret_cast<OOCMapObject*>(pySelf), ITER_VALUES);
+}
+
+static PyObject* OOCMap_items(PyObject* const pySelf) {
+    if(!isOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    return OOCMapView_fastnew(reinterpret_cast<OOCMapObject*>(pySelf), ITER_ITEMS);
+}
+
+static PyObject* OOCMap_iter(PyObject* const pySelf) {
+    if(!isOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    return OOCMapIter_fastnew(reinterpret_cast<OOCMapObject*>(pySelf), nullptr, nullptr, false, ITER_KEYS);
+}
+
+static bool OOCMap_requireOrderedKeys(OOCMapObject* const self, const char* const method) {
+    if(self->keyEncoding == KEY_ENCODING_ORDERED) return true;
+    PyErr_Format(PyExc_ValueError, "%s() needs a map that was created with ordered_keys=True", method);
+    return false;
+}
+
+// Returns the ordered encoding of key as bytes, or nullptr for None.
+static PyObject* OOCMap_orderedBound(PyObject* const key, const bool terminate = true) {
+    if(key == Py_None) return nullptr;
+    std::string encoded;
+    OrderedKey_encode(key, encoded, terminate);
+    PyObject* const result = PyBytes_FromStringAndSize(encoded.data(), encoded.size());
+    if(result == nullptr) throw OocError(OocError::AlreadyPythonizedError);
+    return result;
+}
+
+static PyObject* OOCMap_range(PyObject* const pySelf, PyObject* const args, PyObject* const kwds) {
+    if(!isOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCMapObject* const self = reinterpret_cast<OOCMapObject*>(pySelf);
+
+    static const char* kwlist[] = {"lo", "hi", "reverse", nullptr};
+    PyObject* loKey = Py_None;
+    PyObject* hiKey = Py_None;
+    int reverse = 0;
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|OO$p", const_cast<char**>(kwlist), &loKey, &hiKey, &reverse))
+        return nullptr;
+    if(!OOCMap_requireOrderedKeys(self, "range"))
+        return nullptr;
+
+    PyObject* lo = nullptr;
+    PyObject* hi = nullptr;
+    try {
+        lo = OOCMap_orderedBound(loKey);
+        hi = OOCMap_orderedBound(hiKey);
+    } catch(const OocError& error) {
+        Py_XDECREF(lo);
+        error.pythonize();
+        return nullptr;
+    }
+    PyObject* const result = OOCMapIter_fastnew(self, lo, hi, reverse, ITER_ITEMS);
+    Py_XDECREF(lo);
+    Py_XDECREF(hi);
+    return result;
+}
+
+static PyObject* OOCMap_prefix(PyObject* const pySelf, PyObject* const args, PyObject* const kwds) {
+    if(!isOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCMapObject* const self = reinterpret_cast<OOCMapObject*>(pySelf);
+
+    static const char* kwlist[] = {"prefix", "reverse", nullptr};
+    PyObject* prefix;
+    int reverse = 0;
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O|$p", const_cast<char**>(kwlist), &prefix, &reverse))
+        return nullptr;
+    if(!OOCMap_requireOrderedKeys(self, "prefix"))
+        return nullptr;
+
+    // Every key that starts with the prefix sorts between the unterminated encoding of the prefix
+    // and the next byte string that does not start with it.
+    PyObject* lo = nullptr;
+    PyObject* hi = nullptr;
+    try {
+        lo = OOCMap_orderedBound(prefix, false);
+        if(lo == nullptr) {
+            PyErr_SetString(PyExc_TypeError, "prefix must not be None");
+            throw OocError(OocError::AlreadyPythonizedError);
+        }
+        const std::string successor = OrderedKey_successor(
+            std::string(PyBytes_AS_STRING(lo), PyBytes_GET_SIZE(lo)));
+        if(!successor.empty()) {
+            hi = PyBytes_FromStringAndSize(successor.data(), successor.size());
+            if(hi == nullptr) throw OocError(OocError::AlreadyPythonizedError);
+        }
+    } catch(const OocError& error) {
+        Py_XDECREF(lo);
+        error.pythonize();
+        return nullptr;
+    }
+    PyObject* const result = OOCMapIter_fastnew(self, lo, hi, reverse, ITER_ITEMS);
+    Py_DECREF(lo);
+    Py_XDECREF(hi);
+    return result;
+}
+
+static PyObject* OOCMap_reversed(PyObject* const pySelf) {
+    if(!isOOCMap(pySelf)) {
+        PyErr_BadArgument();
         return nullptr;
     }
+    OOCMapObject* const self = reinterpret_cast<OOCMapObject*>(pySelf);
+    if(!OOCMap_requireOrderedKeys(self, "reversed"))
+        return nullptr;
+    return OOCMapIter_fastnew(self, nullptr, nullptr, true, ITER_KEYS);
 }
 
 
@@ -777,9 +2845,79 @@ static PyObject* OOCMap_get(PyObject* pySelf, PyObject* key) {
 //
 
 static PyMethodDef OOCMap_methods[] = {
+        {
+            "__reversed__",
+            (PyCFunction)OOCMap_reversed,
+            METH_NOARGS,
+            PyDoc_STR("iterates over the keys from last to first; needs ordered_keys=True")
+        }, {
+            "checkpoint",
+            (PyCFunction)OOCMap_checkpoint,
+            METH_NOARGS,
+            PyDoc_STR("flushes everything that was written so far to disk")
+        }, {
+            "compact",
+            (PyCFunction)OOCMap_compact,
+            METH_VARARGS | METH_KEYWORDS,
+            PyDoc_STR("rewrites the map without free pages, optionally into a different file; in place, only while no other process has the map open")
+        }, {
+            "huge_page_bytes",
+            (PyCFunction)OOCMap_hugePageBytes,
+            METH_NOARGS,
+            PyDoc_STR("returns how much of the map the kernel currently backs with huge pages")
+        }, {
+            "items",
+            (PyCFunction)OOCMap_items,
+            METH_NOARGS,
+            PyDoc_STR("returns a view of the map's (key, value) pairs")
+        }, {
+            "keys",
+            (PyCFunction)OOCMap_keys,
+            METH_NOARGS,
+            PyDoc_STR("returns a view of the map's keys")
+        }, {
+            "partitions",
+            (PyCFunction)OOCMap_partitions,
+            METH_VARARGS | METH_KEYWORDS,
+            PyDoc_STR("splits the map into at most n ranges of keys that other processes can scan")
+        }, {
+            "prefetch",
+            (PyCFunction)OOCMap_prefetchKeys,
+            METH_O,
+            PyDoc_STR("starts reading the values for the given keys from disk in the background")
+        }, {
+            "prefix",
+            (PyCFunction)OOCMap_prefix,
+            METH_VARARGS | METH_KEYWORDS,
+            PyDoc_STR("iterates over the items whose keys start with the given prefix; needs ordered_keys=True")
+        }, {
+            "range",
+            (PyCFunction)OOCMap_range,
+            METH_VARARGS | METH_KEYWORDS,
+            PyDoc_STR("iterates over the items with lo <= key < hi in key order; needs ordered_keys=True")
+        }, {
+            "save_residency",
+            (PyCFunction)OOCMap_saveResidencyPy,
+            METH_O,
+            PyDoc_STR("writes down which pages of the map are in memory, for warm()")
+        }, {
+            "warm",
+            (PyCFunction)OOCMap_warm,
+            METH_VARARGS | METH_KEYWORDS,
+            PyDoc_STR("reads the pages recorded by save_residency() back into memory")
+        }, {
+            "values",
+            (PyCFunction)OOCMap_values,
+            METH_NOARGS,
+            PyDoc_STR("returns a view of the map's values")
+        },
         {nullptr}, // sentinel
 };
 
+static PySequenceMethods OOCMap_sequence_methods = {
+        .sq_contains = OOCMap_contains
+};
+
 static PyMappingMethods OOCMap_mapping_methods = {
         .mp_length = OOCMap_length,
         .mp_subscript = OOCMap_get,
@@ -792,9 +2930,11 @@ PyTypeObject OOCMapType = {
         .tp_basicsize = sizeof(OOCMapObject),
         .tp_itemsize = 0,
         .tp_dealloc = (destructor)OOCMap_dealloc,
+        .tp_as_sequence = &OOCMap_sequence_methods,
         .tp_as_mapping = &OOCMap_mapping_methods,
         .tp_flags = Py_TPFLAGS_DEFAULT,
         .tp_doc = "The out-of-core map",
+        .tp_iter = OOCMap_iter,
         .tp_methods = OOCMap_methods,
         .tp_init = (initproc)OOCMap_init,
         .tp_new = OOCMap_new,
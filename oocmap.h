@@ -2,13 +2,34 @@
 #define OOCMAP_OOCMAP_H
 
 #include <unordered_map>
+#include <string>
 
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 #include "lmdb.h"
+#include "errors.h"
+#include "db.h"
 
 extern PyTypeObject OOCMapType;
 
+class PeriodicSyncer;
+class Prefetcher;
+class DenseArray;
+
+enum KeyEncoding {
+    KEY_ENCODING_UNSPECIFIED,   // only while opening: use whatever the map already has
+    KEY_ENCODING_VALUES,        // root keys are EncodedValues
+    KEY_ENCODING_ORDERED,       // root keys sort like the Python keys, see orderedkeys.h
+    KEY_ENCODING_DENSE          // root keys are small non-negative ints, see densearray.h
+};
+
+enum AccessPattern {
+    ACCESS_PATTERN_DEFAULT,     // whatever the kernel does
+    ACCESS_PATTERN_RANDOM,      // no readahead
+    ACCESS_PATTERN_SEQUENTIAL,  // aggressive readahead
+    ACCESS_PATTERN_RESIDENT     // keep some or all tables in memory
+};
+
 typedef struct {
     PyObject_HEAD
     MDB_env* mdb;
@@ -18,6 +39,55 @@ typedef struct {
     MDB_dbi listsDb;
     MDB_dbi tuplesDb;
     MDB_dbi dictsDb;
+    MDB_dbi metaDb;     // settings that have to stay the same for the lifetime of the map
+
+    KeyEncoding keyEncoding;
+    DenseArray* dense;  // holds the root values instead of rootDb with KEY_ENCODING_DENSE
+
+    // Whether lists and dicts keep a hash of their items, see contenthash.h. Only while opening, -1
+    // means whatever the map already has.
+    int contentHashes;
+
+    // Whether lists and dicts are stored once for each content, see frozen.h. Only while opening, -1
+    // means whatever the map already has.
+    int frozen;
+
+    // We keep these around so we can open the environment again, for example after compacting it.
+    PyObject* filename;     // bytes, as returned by PyUnicode_FSConverter
+    unsigned int envFlags;
+    unsigned int maxReaders;
+
+    // LMDB environments must not be used across fork(). This is the fork generation mdb was opened
+    // in, so OOCMap_env() can tell when it has to open it again.
+    unsigned int forkGeneration;
+
+    // How to configure the mapping. For ACCESS_PATTERN_RESIDENT, residentTables has one bit for
+    // each table that should stay in memory, in the order the tables are declared above.
+    AccessPattern accessPattern;
+    unsigned int residentTables;
+
+    // Whether to grow the map when a write runs out of space, instead of failing.
+    bool autogrow;
+
+    // mdb's user context, which keeps track of the transactions, so the map is only mapped again
+    // while nobody reads it.
+    EnvContext* envContext;
+
+    // In the "periodic" durability mode, this flushes the map to disk in the background.
+    PeriodicSyncer* syncer;
+    double syncInterval;
+
+    // Walks lists and dicts for prefetch() in the background, once anyone asks it to.
+    Prefetcher* prefetcher;
+
+    // Iterators keep a read transaction open between calls. While any of those are alive, we
+    // must not close or remap the environment.
+    unsigned int liveReadTxns;
+
+    // Our own descriptor of the environment's lock file, or -1. compact() opens it to lock out other
+    // processes. Closing any descriptor of the file drops LMDB's lock on it too, so this one stays
+    // open until the environment closes.
+    int lockFd;
 } OOCMapObject;
 
 #pragma pack(push, 1)
@@ -91,8 +161,9 @@ namespace std {
 }
 
 
-// Mapping PyObjects to EncodedValues so we can avoid encoding the same value twice.
-typedef std::unordered_map<PyObject*, const EncodedValue*> Id2EncodedMap;
+// Mapping PyObjects to EncodedValues so we can avoid encoding the same value twice. This keeps
+// copies, because the places the values were encoded into don't outlive the calls that wrote them.
+typedef std::unordered_map<PyObject*, EncodedValue> Id2EncodedMap;
 // Mapping EncodedValues to PyObjects so we can avoid decoding the same value twice.
 typedef std::unordered_map<EncodedValue, PyObject*> Encoded2IdMap;
 
@@ -106,6 +177,115 @@ void OOCMap_encode(
 );
 PyObject* OOCMap_decode(OOCMapObject* self, EncodedValue* encodedValue, MDB_txn* txn);
 
+// Encodes the key of a dict item. Like Python's dict, a dict treats numbers that are equal as the same
+// key, so bools and floats that equal an int are stored as that int. Numbers inside tuples keep their
+// type, so (1.0,) and (1,) are different keys.
+void OOCMap_encodeDictKey(
+    OOCMapObject* self,
+    PyObject* key,
+    EncodedValue* dest,
+    MDB_txn* txn,
+    Id2EncodedMap& insertedItemsInThisTransaction,
+    bool readonly = false
+);
+
+// Finds an unused list ID, and claims it by writing the length record of a list with that ID. The
+// caller writes the items, and the content hash if the map keeps them.
+uint32_t OOCMap_newListId(OOCMapObject* self, MDB_txn* txn, uint32_t length);
+// Same as above, for the header of a dict
+uint32_t OOCMap_newDictId(OOCMapObject* self, MDB_txn* txn, Py_ssize_t length);
+
+// The key as it is stored in the root table
+struct RootKey {
+    EncodedValue encoded;
+    std::string ordered;    // only used with KEY_ENCODING_ORDERED
+    MDB_val mdbKey;         // points to one of the above
+};
+
+void OOCMap_encodeRootKey(
+    OOCMapObject* self,
+    PyObject* key,
+    RootKey* dest,
+    MDB_txn* txn,
+    Id2EncodedMap& insertedItemsInThisTransaction,
+    bool readonly = false
+);
+PyObject* OOCMap_decodeRootKey(OOCMapObject* self, MDB_val* key, MDB_txn* txn);
+
+// Hashes the encoded form of a key, without looking at the DB. Unlike Python's hash(), this is the
+// same in every process.
+uint64_t OOCMap_hashKey(OOCMapObject* self, PyObject* key);
+
+// Tells the kernel we are about to read value, and everything it refers to. With shallow, it only
+// covers what decoding the values reads, and not the items of containers, and releases the GIL while
+// it works. Otherwise, a background thread walks the values in transactions of its own, and this
+// returns right away. This does not decode anything.
+void OOCMap_prefetch(
+    OOCMapObject* self,
+    MDB_txn* txn,
+    const EncodedValue* values,
+    size_t count = 1,
+    bool shallow = false);
+
+// Returns the environment to start transactions in. In a process that was forked from the one that
+// opened the map, this opens the map again first.
+MDB_env* OOCMap_env(OOCMapObject* self);
+
+// Write transactions that fail because the map is full can be retried after this grows the map.
+// Returns whether it did. The failed transaction must be aborted before calling this.
+bool OOCMap_growIfFull(OOCMapObject* self, const OocError& error);
+
+
+//
+// OOCMapIter
+//
+
+enum OOCMapIterMode {
+    ITER_KEYS,
+    ITER_VALUES,
+    ITER_ITEMS
+};
+
+// How many entries the iterator reads from the cursor at once
+const unsigned int OOCMAP_ITER_BATCH = 64;
+
+typedef struct {
+    PyObject_HEAD
+    OOCMapObject* ooc;
+    MDB_txn* txn;           // open between calls, until the iterator is exhausted
+    MDB_cursor* cursor;     // on rootDb, unless the map is dense
+    PyObject* lo;           // bytes in the root table's key format, inclusive, or nullptr
+    PyObject* hi;           // bytes in the root table's key format, exclusive, or nullptr
+    bool reverse;
+    OOCMapIterMode mode;
+
+    // Entries read ahead of the caller, so that we can prefetch what their values refer to. The
+    // keys point into the map, which stays put while the transaction is open.
+    bool exhausted;
+    unsigned int batchSize;
+    unsigned int batchPos;
+    uint64_t nextDenseKey;
+    MDB_val batchKeys[OOCMAP_ITER_BATCH];
+    uint64_t batchDenseKeys[OOCMAP_ITER_BATCH];
+    EncodedValue batchValues[OOCMAP_ITER_BATCH];
+} OOCMapIterObject;
+
+extern PyTypeObject OOCMapIterType;
+
+PyObject* OOCMapIter_fastnew(OOCMapObject* ooc, PyObject* lo, PyObject* hi, bool reverse, OOCMapIterMode mode);
+
+//
+// OOCMapView, what keys(), values() and items() return
+//
+
+typedef struct {
+    PyObject_HEAD
+    OOCMapObject* ooc;
+    OOCMapIterMode mode;
+} OOCMapViewObject;
+
+extern PyTypeObject OOCMapViewType;
+
 
 const uint8_t TYPE_CODE_HARDCODED = 0;
 const uint8_t TYPE_CODE_SHORT_POSITIVE_INT = 1;
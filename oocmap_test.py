@@ -1,8 +1,11 @@
+import os
+import pickle
 import tempfile
+import threading
 
 import pytest
 
-from oocmap import OOCMap
+from oocmap import OOCMap, ShardedOOCMap
 
 
 SMALL_MAP = 32*1024*1024
@@ -358,4 +361,1242 @@ def test_two_oocmaps():
             assert m2[0] == [["one", "two", "three"], ["eins", "zwei", "drei"], ["一", "二", "三"]]
 
 
+def test_eager_copies_between_oocmaps():
+    with tempfile.NamedTemporaryFile() as f1:
+        m1 = OOCMap(f1.name, max_size=SMALL_MAP)
+        with tempfile.NamedTemporaryFile() as f2:
+            m2 = OOCMap(f2.name, max_size=SMALL_MAP)
+
+            m1[0] = (1, "two")
+            m1[1] = {"x": 1}
+            for _ in range(3):
+                assert m1[0].eager() == (1, "two")
+                assert m1[1].eager() == {"x": 1}
+            for i in range(3):
+                m2[i] = m1[0]
+            assert [m2[i].eager() for i in range(3)] == [(1, "two")] * 3
+
+            # The eager copies are gone once they are stored, and the next ones may reuse their
+            # addresses.
+            for i in range(10):
+                m1[10 + i] = [i, str(i)]
+            m2[10] = [m1[10 + i] for i in range(10)]
+            assert [l.eager() for l in m2[10]] == [[i, str(i)] for i in range(10)]
+
+
+def test_eager_dicts():
+    # Each dict's items are followed by the header of the dict with the next higher ID.
+    with tempfile.NamedTemporaryFile() as f:
+        m = OOCMap(f.name, max_size=SMALL_MAP)
+        for i in range(50):
+            m[i] = {"i": i, str(i): [i]}
+        for i in range(50):
+            eager = m[i].eager()
+            assert len(eager) == 2
+            assert eager["i"] == i
+
+
+
+
+
+def test_compact():
+    with tempfile.NamedTemporaryFile() as f:
+        m = OOCMap(f.name, max_size=SMALL_MAP)
+        for i in range(2000):
+            m[i] = ["Wer lesen kann ist klar im Vorteil.", i, str(i) * 10]
+        for i in range(100, 2000):
+            del m[i]
+        kept = m[42]
+
+        with tempfile.NamedTemporaryFile() as copy:
+            copy.close()
+            stats = m.compact(copy.name)
+            assert stats["after"]["free_pages"] == 0
+            assert stats["after"]["pages"] < stats["before"]["pages"]
+            m_copy = OOCMap(copy.name, max_size=SMALL_MAP)
+            assert len(m_copy) == 100
+            assert m_copy[99] == ["Wer lesen kann ist klar im Vorteil.", 99, "99" * 10]
+
+        stats = m.compact()
+        assert stats["before"]["free_pages"] > 0
+        assert stats["after"]["free_pages"] == 0
+        assert stats["after"]["pages"] < stats["before"]["pages"]
+        assert len(m) == 100
+        assert kept == ["Wer lesen kann ist klar im Vorteil.", 42, "42" * 10]
+        m[5000] = "still writable"
+        assert m[5000] == "still writable"
+
+        it = iter(m[0])
+        next(it)
+        with pytest.raises(RuntimeError):
+            m.compact()
+        del it
+
+        # Another process that has the map open, even without reading it, keeps it from compacting
+        # in place.
+        ready_read, ready_write = os.pipe()
+        done_read, done_write = os.pipe()
+        pid = os.fork()
+        if pid == 0:
+            status = 1
+            try:
+                os.close(ready_read)
+                os.close(done_write)
+                other = OOCMap(f.name, max_size=SMALL_MAP)
+                os.write(ready_write, b"x")
+                os.read(done_read, 1)
+                if other[42] == kept:
+                    status = 0
+            finally:
+                os._exit(status)
+        os.close(ready_write)
+        os.close(done_read)
+        try:
+            assert os.read(ready_read, 1) == b"x"
+            with pytest.raises(RuntimeError):
+                m.compact()
+            m[5001] = "after the refusal"
+        finally:
+            os.close(done_write)
+            _, status = os.waitpid(pid, 0)
+            os.close(ready_read)
+        assert status == 0
+
+        stats = m.compact()
+        assert stats["after"]["free_pages"] == 0
+        assert m[5001] == "after the refusal"
+
+
+def test_nested_lists_across_page_splits():
+    # Storing each inner list writes to the lists table while the outer list is half written, and
+    # splits the pages the outer list's items are on.
+    with tempfile.NamedTemporaryFile() as f:
+        expected = [[i, str(i), [i] * (i % 7), (i, "x")] for i in range(3000)]
+        m = OOCMap(f.name)
+        m[0] = expected
+        m[1] = [expected[:100], expected[:100]]
+        assert m[0].eager() == expected
+        del m
+
+        m = OOCMap(f.name)
+        assert m[0].eager() == expected
+        assert m[1].eager() == [expected[:100], expected[:100]]
+
+
+def test_autogrow():
+    with tempfile.NamedTemporaryFile() as f:
+        m = OOCMap(f.name, max_size=1024*1024)
+        long_string = "Wer lesen kann ist klar im Vorteil. " * 100
+        for i in range(1000):
+            m[i] = [long_string + str(i), i]
+        m[1000] = []
+        m[1000].extend(long_string + str(i) for i in range(1000))
+        assert len(m) == 1001
+        assert m[999] == [long_string + "999", 999]
+        assert len(m[1000]) == 1000
+        assert m[1000][999] == long_string + "999"
+
+    with tempfile.NamedTemporaryFile() as f:
+        m = OOCMap(f.name, max_size=1024*1024, autogrow=False)
+        with pytest.raises(IOError):
+            for i in range(1000):
+                m[i] = "Wer lesen kann ist klar im Vorteil. " * 100 + str(i)
+
+
+def test_durability():
+    for durability in ["fast", "full", "nometasync", "periodic"]:
+        with tempfile.NamedTemporaryFile() as f:
+            m = OOCMap(f.name, durability=durability, sync_interval=0.01)
+            for i in range(100):
+                m[i] = [i, str(i)]
+            m.checkpoint()
+            # Compacting reopens the map, so the background syncer has to come back with it.
+            m.compact()
+            m[100] = "foo"
+            m.checkpoint()
+            del m
+
+            m = OOCMap(f.name)
+            assert len(m) == 101
+            assert m[99] == [99, "99"]
+            assert m[100] == "foo"
+
+    with tempfile.NamedTemporaryFile() as f:
+        with pytest.raises(ValueError):
+            OOCMap(f.name, durability="sometimes")
+
+
+def test_readonly():
+    with tempfile.NamedTemporaryFile() as f:
+        m = OOCMap(f.name)
+        m[0] = [1, "two", (3.0,)]
+        m["foo"] = {"bar": None}
+        del m
+
+        for lock in [True, False]:
+            m = OOCMap(f.name, readonly=True, lock=lock)
+            assert len(m) == 2
+            assert m[0] == [1, "two", (3.0,)]
+            assert list(m[0]) == [1, "two", (3.0,)]
+            with pytest.raises(IOError):
+                m[1] = 1
+            with pytest.raises(IOError):
+                m[0].append(4)
+            with pytest.raises(RuntimeError):
+                m.compact()
+            del m
+
+        with pytest.raises(ValueError):
+            OOCMap(f.name, lock=False)
+
+
+def test_fork():
+    with tempfile.NamedTemporaryFile() as f:
+        m = OOCMap(f.name, max_readers=512)
+        for i in range(100):
+            m[i] = [i, str(i)]
+
+        children = []
+        for child in range(4):
+            pid = os.fork()
+            if pid == 0:
+                status = 1
+                try:
+                    if all(m[i] == [i, str(i)] for i in range(100)):
+                        m[100 + child] = child
+                        status = 0
+                finally:
+                    os._exit(status)
+            children.append(pid)
+        for pid in children:
+            _, status = os.waitpid(pid, 0)
+            assert status == 0
+
+        assert len(m) == 104
+        assert [m[100 + child] for child in range(4)] == list(range(4))
+
+
+def test_forked_ids_dont_collide():
+    # A forked child draws the same random list and dict IDs as its parent.
+    with tempfile.NamedTemporaryFile() as f:
+        m = OOCMap(f.name)
+        pid = os.fork()
+        if pid == 0:
+            status = 1
+            try:
+                m["child"] = [1, 2, 3]
+                m["child dict"] = {"child": 1}
+                status = 0
+            finally:
+                os._exit(status)
+        _, status = os.waitpid(pid, 0)
+        assert status == 0
+
+        m["parent"] = [4, 5, 6, 7]
+        m["parent dict"] = {"parent": 2}
+        assert m["child"] == [1, 2, 3]
+        assert len(m["child"]) == 3
+        assert m["child dict"]["child"] == 1
+        assert m["parent"] == [4, 5, 6, 7]
+        assert m["parent dict"]["parent"] == 2
+
+
+def test_prefetch():
+    with tempfile.NamedTemporaryFile() as f:
+        m = OOCMap(f.name)
+        long_string = "Wer lesen kann ist klar im Vorteil. " * 1000
+        m[0] = [long_string, (1, long_string + "!"), {"foo": [long_string, 2**100]}]
+        m[0].append(m[0])
+        m[1] = {long_string: ("bar",)}
+        m[2] = 3
+
+        m.prefetch([0, 1, 2, "not there", (1, "not there either")])
+        m.prefetch(range(10))
+        m[0].prefetch()
+        m[0][1].prefetch()
+        m[0][2].prefetch()
+        assert m[0][0] == long_string
+        assert m[1][long_string] == ("bar",)
+
+        with pytest.raises(TypeError):
+            m.prefetch(5)
+
+        # Lists and dicts are walked in the background, and closing the map stops that.
+        m[3] = [[i, str(i) * 10, {"i": i}] for i in range(20000)]
+        m[3].prefetch()
+        m.prefetch([3, 0])
+        assert m[3][19999] == [19999, "19999" * 10, {"i": 19999}]
+        del m
+        m = OOCMap(f.name)
+        m.prefetch([3])
+        m[4] = "written while prefetching"
+        assert m[4] == "written while prefetching"
+
+
+def test_access_pattern():
+    with tempfile.NamedTemporaryFile() as f:
+        m = OOCMap(f.name)
+        long_string = "Wer lesen kann ist klar im Vorteil. " * 100
+        for i in range(100):
+            m[i] = [long_string + str(i), (i, float(i))]
+        del m
+
+        for access_pattern in ["default", "random", "sequential", "resident"]:
+            m = OOCMap(f.name, access_pattern=access_pattern)
+            assert m[42] == [long_string + "42", (42, 42.0)]
+            m[100] = access_pattern
+            del m
+
+        m = OOCMap(f.name, access_pattern="resident", resident_tables=["strings", "tuples"])
+        assert m[100] == "resident"
+        assert m[42] == [long_string + "42", (42, 42.0)]
+        del m
+
+        with pytest.raises(ValueError):
+            OOCMap(f.name, access_pattern="resident", resident_tables=["things"])
+        with pytest.raises(ValueError):
+            OOCMap(f.name, resident_tables=["strings"])
+        with pytest.raises(ValueError):
+            OOCMap(f.name, access_pattern="sideways")
+
+    # When another process grows the map, we map it again, and the new mapping has to stay resident too.
+    def locked_kb():
+        with open("/proc/self/status") as status:
+            return next(int(line.split()[1]) for line in status if line.startswith("VmLck:"))
+    with tempfile.NamedTemporaryFile() as f:
+        m = OOCMap(f.name, max_size=1024*1024, access_pattern="resident")
+        m[0] = "small"
+        before = locked_kb()
+        pid = os.fork()
+        if pid == 0:
+            status = 1
+            try:
+                for i in range(1000):
+                    m[i] = long_string + str(i)
+                status = 0
+            finally:
+                os._exit(status)
+        _, status = os.waitpid(pid, 0)
+        assert status == 0
+        assert m[999] == long_string + "999"
+        if before > 0:
+            # Otherwise we aren't allowed to lock anything here.
+            assert locked_kb() > before + 1024
+
+
+def test_residency():
+    with tempfile.NamedTemporaryFile() as f, tempfile.NamedTemporaryFile() as snapshot:
+        m = OOCMap(f.name)
+        long_string = "Wer lesen kann ist klar im Vorteil. " * 100
+        for i in range(100):
+            m[i] = [long_string + str(i), i]
+        assert all(m[i][1] == i for i in range(100))
+        assert m.save_residency(snapshot.name) > 0
+        del m
+
+        m = OOCMap(f.name)
+        assert m.warm(snapshot.name) > 0
+        assert m.warm(snapshot.name, background=True) > 0
+        assert m[42] == [long_string + "42", 42]
+
+        with pytest.raises(AssertionError):
+            m.warm(f.name)
+
+        # Truncated snapshots, and ones with a run count that doesn't match their size
+        with open(snapshot.name, "rb") as s:
+            saved = s.read()
+        for broken in [
+            saved[:-1],
+            saved[:24],
+            saved[:16] + (2**62).to_bytes(8, "little") + saved[24:],
+            saved[:16] + (2**60 + 1).to_bytes(8, "little") + saved[24:],
+        ]:
+            with open(snapshot.name, "wb") as s:
+                s.write(broken)
+            with pytest.raises(AssertionError):
+                m.warm(snapshot.name)
+
+
+def test_huge_pages():
+    with tempfile.NamedTemporaryFile() as f:
+        m = OOCMap(f.name, max_size=1024*1024, huge_pages=True)
+        long_string = "Wer lesen kann ist klar im Vorteil. " * 100
+        for i in range(1000):
+            m[i] = [long_string + str(i), i]
+        assert m[999] == [long_string + "999", 999]
+        # Whether the kernel gives us huge pages depends on its configuration and the file system.
+        assert m.huge_page_bytes() >= 0
+
+
+def test_sharded():
+    with tempfile.TemporaryDirectory() as d:
+        filename = os.path.join(d, "sharded")
+        m = ShardedOOCMap(filename, shards=4, max_size=SMALL_MAP)
+        assert len(m.shards) == 4
+        long_string = "Wer lesen kann ist klar im Vorteil. " * 10
+        keys = list(range(100)) + [str(i) for i in range(100)] + [(i, long_string) for i in range(100)]
+        for key in keys:
+            m[key] = [key]
+        assert len(m) == len(keys)
+        assert set(m) == set(keys)
+        assert len({m.shard_index(key) for key in keys}) == 4
+        assert all(m[key] == [key] for key in keys)
+
+        # Lazy objects write to the shard they came from.
+        m[5].append(6)
+        assert m[5] == [5, 6]
+        assert m.shards[m.shard_index(5)][5] == [5, 6]
+
+        del m[5]
+        assert len(m) == len(keys) - 1
+        with pytest.raises(KeyError):
+            m[5]
+        with pytest.raises(TypeError):
+            m[[1, 2]] = 3
+        del m
+
+        m = ShardedOOCMap(filename)
+        assert len(m.shards) == 4
+        assert m[(7, long_string)] == [(7, long_string)]
+        del m
+        with pytest.raises(ValueError):
+            ShardedOOCMap(filename, shards=3)
+
+
+def test_ordered_keys():
+    with tempfile.NamedTemporaryFile() as f:
+        m = OOCMap(f.name, max_size=SMALL_MAP, ordered_keys=True)
+        ints = [-2**63, -1000, -1, 0, 1, 255, 256, 2**63 - 1]
+        floats = [float("-inf"), -1.5, -0.0, 0.5, 1e300, float("inf")]
+        strings = ["", "\0", "a", "a\0b", "ab", "b", "ü", "€"]
+        tuples = [(), (1,), (1, "a"), (1, "a", 2.0), (1, "b"), (2,)]
+        keys = ints + floats + strings + tuples
+        for key in reversed(keys):
+            m[key] = [key]
+        assert len(m) == len(keys)
+        assert m["a\0b"] == ["a\0b"]
+        assert m[(1, "a")] == [(1, "a")]
+        assert m[0.0] == [-0.0]
+
+        # Ints and floats sort separately, everything else sorts like it does in Python.
+        assert [k for k, v in m.range()] == keys
+        assert list(reversed(m)) == list(reversed(keys))
+        assert [k for k, v in m.range(-1, 256)] == [-1, 0, 1, 255]
+        assert [k for k, v in m.range(-1, 256, reverse=True)] == [255, 1, 0, -1]
+        assert [k for k, v in m.range("a", "b")] == ["a", "a\0b", "ab"]
+        assert [k for k, v in m.range(hi=-1)] == [-2**63, -1000]
+        assert [k for k, v in m.range(lo=(1, "b"))] == [(1, "b"), (2,)]
+        assert list(m.range(1000, 2000)) == []
+        assert [v for k, v in m.range(255, 256)] == [[255]]
+
+        assert [k for k, v in m.prefix("a")] == ["a", "a\0b", "ab"]
+        assert [k for k, v in m.prefix("a\0")] == ["a\0b"]
+        assert [k for k, v in m.prefix((1,))] == [(1,), (1, "a"), (1, "a", 2.0), (1, "b")]
+        assert [k for k, v in m.prefix((1, "a"), reverse=True)] == [(1, "a", 2.0), (1, "a")]
+        assert [k for k, v in m.prefix(0)] == [0]
+
+        with pytest.raises(TypeError):
+            m[[1]] = 1
+        with pytest.raises(TypeError):
+            m[True] = 1
+        with pytest.raises(OverflowError):
+            m[2**64] = 1
+        with pytest.raises(ValueError):
+            m["x" * 1000] = 1
+
+        del m[-1]
+        assert -1 not in [k for k, v in m.range()]
+        del m
+
+        m = OOCMap(f.name)
+        assert [k for k, v in m.range(0, 2)] == [0, 1]
+        del m
+        with pytest.raises(ValueError):
+            OOCMap(f.name, ordered_keys=False)
+
+    with tempfile.NamedTemporaryFile() as f:
+        m = OOCMap(f.name, max_size=SMALL_MAP)
+        m[1] = 1
+        with pytest.raises(ValueError):
+            m.range()
+        del m
+        with pytest.raises(ValueError):
+            OOCMap(f.name, ordered_keys=True)
+
+
+def test_dense():
+    with tempfile.TemporaryDirectory() as d:
+        filename = os.path.join(d, "dense")
+        m = OOCMap(filename, max_size=SMALL_MAP, dense=True)
+        long_string = "Wer lesen kann ist klar im Vorteil. " * 10
+        for i in range(5000):
+            m[i] = i * 2
+        m[5000] = long_string
+        m[5001] = [1, long_string]
+        m[100000] = 2**100
+        assert len(m) == 5003
+        assert m[4999] == 9998
+        assert m[5000] == long_string
+        assert m[5001] == [1, long_string]
+        assert m[100000] == 2**100
+        assert os.path.exists(filename + "-dense")
+
+        m[3] = "three"
+        assert m[3] == "three"
+        assert len(m) == 5003
+        del m[3]
+        assert len(m) == 5002
+        for key in [3, 6000, -1, 2**40, "3"]:
+            with pytest.raises(KeyError):
+                m[key]
+        with pytest.raises(KeyError):
+            del m[3]
+        with pytest.raises(TypeError):
+            m["3"] = 3
+        with pytest.raises(ValueError):
+            m[-1] = 3
+        with pytest.raises(ValueError):
+            m[2**40] = 3
+        del m
+
+        m = OOCMap(filename)
+        assert len(m) == 5002
+        assert m[5001] == [1, long_string]
+        m[5001].append(2)
+        assert m[5001] == [1, long_string, 2]
+        del m
+        with pytest.raises(ValueError):
+            OOCMap(filename, ordered_keys=True)
+        with pytest.raises(ValueError):
+            OOCMap(filename + "2", dense=True, ordered_keys=True)
+
+        m = OOCMap(filename, readonly=True)
+        assert m[100000] == 2**100
+
+    # A write that fails, even in its commit, leaves the key as it was.
+    with tempfile.TemporaryDirectory() as d:
+        m = OOCMap(os.path.join(d, "dense"), max_size=1024*1024, autogrow=False, dense=True)
+        failures = 0
+        for i in range(3000):
+            try:
+                m[i] = [str(j) * 7 + str(i) for j in range(i % 40)]
+            except IOError:
+                failures += 1
+                assert i not in m
+        assert failures > 0
+        assert len(m) == 3000 - failures
+
+
+def test_iteration():
+    with tempfile.NamedTemporaryFile() as f:
+        m = OOCMap(f.name, max_size=SMALL_MAP)
+        assert list(m) == []
+        long_string = "Wer lesen kann ist klar im Vorteil. " * 10
+        expected = {i: [i, long_string + str(i)] for i in range(500)}
+        expected["eins"] = long_string
+        expected[(1, 2)] = 2**100
+        for key, value in expected.items():
+            m[key] = value
+
+        assert len(m.keys()) == len(expected)
+        assert set(m) == set(expected)
+        assert set(m.keys()) == set(expected)
+        assert all(value == expected[key] for key, value in zip(m.keys(), m.values()))
+        assert dict(m.items()) == expected
+        assert 5 in m
+        assert 5 in m.keys()
+        assert 1000 not in m
+        assert "zwei" not in m
+        assert long_string in m.values()
+        assert ((1, 2), 2**100) in m.items()
+
+        # Iterators keep reading from the snapshot they started with.
+        it = iter(m.items())
+        first = next(it)
+        m["new"] = 1
+        assert len([first] + list(it)) == len(expected)
+        with pytest.raises(StopIteration):
+            next(it)
+        assert len(list(m.items())) == len(expected) + 1
+
+    with tempfile.TemporaryDirectory() as d:
+        m = OOCMap(os.path.join(d, "dense"), max_size=SMALL_MAP, dense=True)
+        for i in range(0, 1000, 3):
+            m[i] = str(i)
+        assert list(m) == list(range(0, 1000, 3))
+        assert list(m.values()) == [str(i) for i in range(0, 1000, 3)]
+        assert 3 in m
+        assert 4 not in m
+
+
+def test_partitions():
+    with tempfile.NamedTemporaryFile() as f:
+        m = OOCMap(f.name, max_size=SMALL_MAP)
+        assert [list(p) for p in m.partitions(4)] == [[]]
+        long_string = "Wer lesen kann ist klar im Vorteil. " * 10
+        for i in range(5000):
+            m[i] = [i, long_string]
+        m["eins"] = 1
+
+        partitions = m.partitions(4)
+        assert len(partitions) == 4
+        keys = [list(p.keys()) for p in partitions]
+        assert sum(len(k) for k in keys) == len(m)
+        assert set().union(*keys) == set(m)
+        assert all(len(k) > len(m) / 8 for k in keys)
+        assert [k for k, v in partitions[1]] == keys[1]
+        assert len(m.partitions(1)) == 1
+
+        # Workers get the partition by pickling, and open the map themselves.
+        children = []
+        for partition in partitions:
+            data = pickle.dumps(partition)
+            read_end, write_end = os.pipe()
+            pid = os.fork()
+            if pid == 0:
+                status = 1
+                try:
+                    os.close(read_end)
+                    p = pickle.loads(data)
+                    total = sum(v[0] for v in p.values() if not isinstance(v, int))
+                    os.write(write_end, str(total).encode())
+                    status = 0
+                finally:
+                    os._exit(status)
+            os.close(write_end)
+            children.append((pid, read_end))
+        total = 0
+        for pid, read_end in children:
+            _, status = os.waitpid(pid, 0)
+            assert status == 0
+            total += int(os.read(read_end, 100))
+            os.close(read_end)
+        assert total == sum(range(5000))
+
+    with tempfile.TemporaryDirectory() as d:
+        m = OOCMap(os.path.join(d, "dense"), max_size=SMALL_MAP, dense=True)
+        for i in range(10000):
+            m[i] = i
+        partitions = m.partitions(3)
+        assert len(partitions) == 3
+        assert [k for p in partitions for k in p.keys()] == list(range(10000))
+
+
+def test_list_slices():
+    with tempfile.NamedTemporaryFile() as f:
+        m = OOCMap(f.name, max_size=SMALL_MAP)
+        l = [i * 10 for i in range(50)] + ["fifty", (51,)]
+        m[0] = l
+        m[1] = ["neighbor"]
+        lazy = m[0]
+        slices = [
+            slice(None), slice(3, 17), slice(-5, None), slice(None, -40), slice(40, 3),
+            slice(None, None, 2), slice(1, 45, 3), slice(None, None, -1), slice(30, 5, -4),
+            slice(-1, -30, -11), slice(100, 200), slice(None, None, 20),
+        ]
+
+        # Reads
+        for s in slices:
+            assert lazy[s] == l[s]
+        assert lazy[-1] == l[-1]
+        assert lazy[-52] == l[-52]
+        with pytest.raises(IndexError):
+            lazy[-53]
+        with pytest.raises(TypeError):
+            lazy["one"]
+        with pytest.raises(ValueError):
+            lazy[::0]
+
+        # Writes
+        for s in slices:
+            for items in [[], ["a"], list(range(100, 107))]:
+                expected = list(l)
+                try:
+                    expected[s] = items
+                except ValueError:
+                    with pytest.raises(ValueError):
+                        lazy[s] = items
+                else:
+                    lazy[s] = items
+                assert lazy == expected
+                assert len(lazy) == len(expected)
+
+                expected = list(l)
+                m[0] = l
+                lazy = m[0]
+                del expected[s]
+                del lazy[s]
+                assert lazy == expected
+                assert len(lazy) == len(expected)
+
+                m[0] = l
+                lazy = m[0]
+        lazy[5:5] = lazy
+        assert lazy == l[:5] + l + l[5:]
+        lazy[-1] = "last"
+        del lazy[-2]
+        assert lazy[-2:] == [l[-3], "last"]
+        assert m[1] == ["neighbor"]
+
+
+def test_list_mutations():
+    with tempfile.NamedTemporaryFile() as f:
+        m = OOCMap(f.name, max_size=SMALL_MAP)
+        l = [5, "three", 1.5, 4, 1, 9, 2, 6, 5, 3]
+        m[0] = l
+        m[1] = ["neighbor"]
+        lazy = m[0]
+
+        for index in [0, 3, -2, 100, -100]:
+            l.insert(index, ("inserted", index))
+            lazy.insert(index, ("inserted", index))
+            assert lazy == l
+        assert len(lazy) == len(l)
+
+        assert lazy.pop() == l.pop()
+        assert lazy.pop(0) == l.pop(0)
+        assert lazy.pop(-3) == l.pop(-3)
+        with pytest.raises(IndexError):
+            lazy.pop(100)
+        assert lazy == l
+
+        lazy.remove("three")
+        l.remove("three")
+        lazy.remove(("inserted", 3))
+        l.remove(("inserted", 3))
+        assert lazy == l
+        with pytest.raises(ValueError):
+            lazy.remove("three")
+        with pytest.raises(ValueError):
+            lazy.remove(["not", "there"])
+        # Like list.remove(), this compares with ==, so numbers of other types match.
+        lazy.remove(4.0)
+        l.remove(4.0)
+        lazy.remove(True)
+        l.remove(True)
+        assert lazy == l
+        with pytest.raises(ValueError):
+            lazy.remove(4)
+
+        lazy.reverse()
+        l.reverse()
+        assert lazy == l
+
+        l = [x for x in l if not isinstance(x, tuple)]
+        m[0] = l
+        lazy = m[0]
+        lazy.sort()
+        l.sort()
+        assert lazy == l
+        lazy.sort(key=lambda x: -x, reverse=True)
+        l.sort(key=lambda x: -x, reverse=True)
+        assert lazy == l
+        words = ["b", "A", "c", "a", "B"]
+        m[2] = words
+        m[2].sort(key=str.lower, reverse=True)
+        words.sort(key=str.lower, reverse=True)
+        assert m[2] == words
+        m[2].append(1)
+        with pytest.raises(TypeError):
+            m[2].sort()
+        assert m[2] == words + [1]
+
+        empty = m[3] = []
+        m[3].reverse()
+        m[3].sort()
+        with pytest.raises(IndexError):
+            m[3].pop()
+        m[3].insert(5, "only")
+        assert m[3] == ["only"]
+        assert m[1] == ["neighbor"]
+
+
+def test_list_external_sort():
+    with tempfile.NamedTemporaryFile() as f:
+        m = OOCMap(f.name, max_size=SMALL_MAP)
+        numbers = [7, 2.5, -3, True, 0, 1 << 59, -(1 << 59), 2.0, 2, False, -0.5, 1e300, 11] * 5
+        for run_length in [1, 3, 16, 1000]:
+            for reverse in [False, True]:
+                m[0] = numbers
+                m[0].sort(reverse=reverse, run_length=run_length)
+                expected = sorted(numbers, reverse=reverse)
+                assert m[0] == expected
+                assert [type(x) for x in m[0]] == [type(x) for x in expected]
+
+        words = ["pear", "fig", "apple", "kiwi", "date", "plum", "banana", "lime", "yam"] * 3
+        m[1] = words
+        m[1].sort(key=len, run_length=4)
+        assert m[1] == sorted(words, key=len)
+        m[1].sort(key=len, reverse=True, run_length=5)
+        assert m[1] == sorted(sorted(words, key=len), key=len, reverse=True)
+
+        def failing_key(x):
+            if x == "yam":
+                raise KeyError(x)
+            return x
+        before = list(m[1])
+        with pytest.raises(KeyError):
+            m[1].sort(key=failing_key, run_length=4)
+        assert m[1] == before
+
+        with pytest.raises(ValueError):
+            m[1].sort(run_length=0)
+
+        m[2] = [False, True] * 20
+        m[3] = [[False] * i for i in range(20)]
+        assert m[2] == [False, True] * 20
+        assert m[3] == [[False] * i for i in range(20)]
+
+
+def test_lazy_comparisons():
+    with tempfile.NamedTemporaryFile() as f, tempfile.NamedTemporaryFile() as f2:
+        m = OOCMap(f.name, max_size=SMALL_MAP)
+        other_map = OOCMap(f2.name, max_size=SMALL_MAP)
+        nan = float("nan")
+        values = [
+            [],
+            [1, 2, 3],
+            [1.0, 2, True + 2],
+            [1, 2],
+            [1, 2, 3, 4],
+            [1, 2, 2.5],
+            [True, False, 0.0, -0.0],
+            [1, 0, 0, 0],
+            [2**70, -2**70, 2**59],
+            [float(2**70), float(-2**70), float(2**59)],
+            [2**70 + 1],
+            ["a", "long string " * 3, (1, "x")],
+            ["a", "long string " * 3, (1.0, "x")],
+            ["a", "long string " * 3, (1, "y")],
+            [[1, [2]], (3, (4,))],
+            [[1, [2.0]], (3.0, (4,))],
+            [{"k": 1, 2: [3]}],
+            [{2.0: [3.0], "k": True}],
+            [{"k": 1, 3: [3]}],
+            [{"j": 1, 2: [3]}],
+            [()],
+            [(None,)],
+        ]
+        for i, value in enumerate(values):
+            m[i] = value
+            other_map[i] = value
+
+        for i, a in enumerate(values):
+            for j, b in enumerate(values):
+                for lazy_b in [m[j], other_map[j], b]:
+                    assert (m[i] == lazy_b) == (a == b)
+                    assert (m[i] != lazy_b) == (a != b)
+                    for op in ["<", "<=", ">", ">="]:
+                        assert_equal_including_exceptions(
+                            lambda: eval(f"a {op} b"),
+                            lambda: eval(f"m[i] {op} lazy_b"))
+
+        # A stored item is equal to itself, even if it is NaN.
+        m["nan"] = [nan]
+        m["nan2"] = [float("nan")]
+        assert m["nan"] == m["nan"]
+        assert m["nan"] != m["nan2"]
+        assert m["nan"] != [nan]
+
+        m["t1"] = (1, "two", [3])
+        m["t2"] = (1.0, "two", [3.0])
+        m["t3"] = (1, "two", [4])
+        assert m["t1"] == m["t2"]
+        assert m["t1"] < m["t3"]
+        assert m["t1"] != m["t3"]
+
+        m["d1"] = {"a": {1: "x"}, (1, 2): [1]}
+        m["d2"] = {(1.0, 2): [True], "a": {1.0: "x"}}
+        m["d3"] = {"a": {1: "y"}, (1, 2): [1]}
+        assert m["d1"] == m["d2"]
+        assert m["d1"] != m["d3"]
+        assert m["d1"] == {"a": {1: "x"}, (1, 2): [1]}
+        assert m["d1"] != other_map[16]
+        assert other_map[16] == m[16]
+        with pytest.raises(TypeError):
+            m["d1"] < m["d2"]
+
+
+def test_lazy_tuple_hash():
+    with tempfile.NamedTemporaryFile() as f:
+        m = OOCMap(f.name, max_size=SMALL_MAP)
+        tuples = [
+            (1, "a"),
+            (0, 1, -1, -2, 2**30, 2**59, -2**59, 2**60, 2**61 - 1, 2**61, -2**61, 2**200, -2**200),
+            (True, False, None),
+            (0.0, -0.0, 1.5, 2.0, -2.0, 1e300, float(2**70), float("inf"), float("-inf")),
+            ("", "a", "short", "ä", "€uro", "😀", "long string " * 3, "ä" * 20, "€" * 20, "😀" * 20),
+            ((), (1,), ((2, "b"), (3.0,)), (((((),),),),)),
+        ]
+        for i, t in enumerate(tuples):
+            m[i] = t
+        for i, t in enumerate(tuples):
+            lazy = m[i]
+            assert hash(lazy) == hash(t)
+            assert hash(lazy) == hash(lazy)
+            assert {t: i}[lazy] == i
+            assert {lazy: i}[t] == i
+
+        m["list"] = (1, [2])
+        with pytest.raises(TypeError):
+            hash(m["list"])
+
+
+def test_content_hashes():
+    with tempfile.TemporaryDirectory() as d:
+        m = OOCMap(os.path.join(d, "hashed"), max_size=SMALL_MAP, content_hashes=True)
+        plain = OOCMap(os.path.join(d, "plain"), max_size=SMALL_MAP)
+
+        def check(key, expected):
+            assert m[key] == expected
+            assert len(m[key]) == len(expected)
+            m["fresh"] = expected
+            plain["fresh"] = expected
+            assert m[key].content_hash() == m["fresh"].content_hash()
+            assert m[key].content_hash() == plain["fresh"].content_hash()
+            assert m[key] == m["fresh"]
+
+        l = [1, "two", 3.0, (4, "four"), None, 2**100, "long string " * 3]
+        m["l"] = l
+        check("l", l)
+        mutations = [
+            lambda x: x.append(8),
+            lambda x: x.extend([9, "ten"]),
+            lambda x: x.extend(m["fresh"]),
+            lambda x: x.__setitem__(2, "three"),
+            lambda x: x.__delitem__(0),
+            lambda x: x.insert(3, 3.5),
+            lambda x: x.pop(),
+            lambda x: x.remove(None),
+            lambda x: x.__setitem__(slice(1, 3), [True, False, 0]),
+            lambda x: x.__setitem__(slice(None, None, 2), list(range(len(x[::2])))),
+            lambda x: x.__delitem__(slice(None, None, 3)),
+            lambda x: x.__delitem__(slice(2, 4)),
+            lambda x: x.__imul__(2),
+            lambda x: x.reverse(),
+            lambda x: x.sort(key=hash),
+            lambda x: x.clear(),
+            lambda x: x.extend(range(5)),
+        ]
+        for mutate in mutations:
+            mutate(l)
+            mutate(m["l"])
+            check("l", l)
+
+        d1 = {1: "one", "two": (2.0, 2), (3,): None}
+        m["d"] = d1
+        check("d", d1)
+        for mutate in [
+            lambda x: x.__setitem__("four", 4),
+            lambda x: x.__setitem__(1, "uno"),
+            lambda x: x.__delitem__("two"),
+            lambda x: x.__setitem__((3,), (3, 3)),
+        ]:
+            mutate(d1)
+            mutate(m["d"])
+            check("d", d1)
+        with pytest.raises(KeyError):
+            del m["d"]["two"]
+        with pytest.raises(TypeError):
+            m["d"][[1]] = 1
+
+        # Equal hashes only prove equality without NaN.
+        nan = float("nan")
+        m["n1"] = [nan]
+        m["n2"] = [nan]
+        assert m["n1"] != m["n2"]
+        assert m["n1"].content_hash() == m["n2"].content_hash()
+        m["e1"] = [1]
+        m["e2"] = [1.0]
+        assert m["e1"] == m["e2"]
+        assert m["e1"].content_hash() != m["e2"].content_hash()
+
+        del m
+        with pytest.raises(ValueError):
+            OOCMap(os.path.join(d, "hashed"), content_hashes=False)
+        m = OOCMap(os.path.join(d, "hashed"))
+        check("l", l)
+
+        # Only maps without lists and dicts can start keeping content hashes.
+        del plain
+        with pytest.raises(ValueError):
+            OOCMap(os.path.join(d, "plain"), content_hashes=True)
+
+
+def test_lazy_dict_overwrite():
+    # Without content hashes, only a new key changes the stored header.
+    with tempfile.NamedTemporaryFile() as f:
+        m = OOCMap(f.name, max_size=SMALL_MAP)
+        m[0] = {"a": 1, "b": [2]}
+        d = m[0]
+        d["a"] = "one"
+        d["b"] = [2, 3]
+        assert len(d) == 2
+        assert d == {"a": "one", "b": [2, 3]}
+        d["c"] = 3
+        d["c"] = None
+        assert len(d) == 3
+        assert d == {"a": "one", "b": [2, 3], "c": None}
+        del d["a"]
+        assert len(d) == 2
+        del m, d
+
+        m = OOCMap(f.name, max_size=SMALL_MAP)
+        assert len(m[0]) == 2
+        assert m[0] == {"b": [2, 3], "c": None}
+
+
+def test_lazy_dict_numeric_keys():
+    # Like dict, numbers that are equal are the same key.
+    for frozen in [False, True]:
+        with tempfile.TemporaryDirectory() as d:
+            m = OOCMap(os.path.join(d, "keys"), max_size=SMALL_MAP, frozen=frozen)
+            m[0] = {True: "true", 2.0: "two", 2.5: "two and a half", (1, 2): "tuple"}
+            lazy = m[0]
+            assert lazy[1] == "true"
+            assert lazy[1.0] == "true"
+            assert lazy[2] == "two"
+            assert lazy[2.5] == "two and a half"
+            assert lazy[(1, 2)] == "tuple"
+            with pytest.raises(KeyError):
+                _ = lazy[3]
+
+            lazy[1] = "one"
+            lazy[0.0] = "zero"
+            assert len(lazy) == 5
+            assert lazy[True] == "one"
+            assert lazy[False] == "zero"
+            del lazy[2]
+            with pytest.raises(KeyError):
+                _ = lazy[2.0]
+            assert lazy == {1: "one", 0: "zero", 2.5: "two and a half", (1, 2): "tuple"}
+
+
+def test_frozen():
+    with tempfile.TemporaryDirectory() as d:
+        m = OOCMap(os.path.join(d, "frozen"), max_size=SMALL_MAP, frozen=True)
+        plain = OOCMap(os.path.join(d, "plain"), max_size=SMALL_MAP)
+        doc = {"name": "x", "tags": ["a", "b", [1, 2.5]], "nested": {"k": [None, (1, "one")]}}
+        for i in range(1000):
+            m[i] = doc
+            plain[i] = doc
+        assert m[0] == doc
+        assert m[999].eager() == doc
+        assert m[0] == m[999]
+        assert m[0]["tags"] == m[1]["tags"]
+
+        # Repeated documents are stored once.
+        assert m.compact()["after"]["pages"] * 4 < plain.compact()["after"]["pages"]
+
+        # Changing a frozen list or dict changes a copy of it.
+        tags = m[0]["tags"]
+        tags.append("c")
+        assert tags == ["a", "b", [1, 2.5], "c"]
+        assert m[0]["tags"] == ["a", "b", [1, 2.5]]
+        entry = m[0]
+        entry["tags"] = tags
+        del entry["name"]
+        assert m[0] == doc
+        m[0] = entry
+        assert m[0] == {"tags": ["a", "b", [1, 2.5], "c"], "nested": doc["nested"]}
+        assert m[1] == doc
+
+        # Storing the copy stores a snapshot. The copy keeps changing on its own.
+        tags.pop()
+        assert m[0]["tags"] == ["a", "b", [1, 2.5], "c"]
+        m[1] = {"tags": tags}
+        assert m[1]["tags"] == doc["tags"]
+
+        lst = [1]
+        lst.append(lst)
+        with pytest.raises(RecursionError):
+            m["loop"] = lst
+
+        del m
+        with pytest.raises(ValueError):
+            OOCMap(os.path.join(d, "frozen"), frozen=False)
+        m = OOCMap(os.path.join(d, "frozen"))
+        assert m[999] == doc
+
+        # Only maps without lists and dicts can start freezing them.
+        del plain
+        with pytest.raises(ValueError):
+            OOCMap(os.path.join(d, "plain"), frozen=True)
+
+
+def test_copy():
+    with tempfile.TemporaryDirectory() as d:
+        m = OOCMap(os.path.join(d, "copy"), max_size=SMALL_MAP, content_hashes=True)
+        m["l"] = list(range(5000))
+        m["d"] = {"a": 1, "b": [1, 2]}
+
+        # Changing the original leaves the copy alone, and the other way around.
+        l = m["l"]
+        copy = l.copy()
+        also = copy.copy()
+        assert copy == l
+        l[0] = "changed"
+        assert copy[0] == 0
+        assert copy.eager() == list(range(5000))
+        assert copy.content_hash() != m["l"].content_hash()
+        copy.append(5000)
+        assert len(copy) == 5001
+        assert m["l"][0] == "changed"
+        assert len(m["l"]) == 5000
+        assert also == list(range(5000))
+
+        d_ = m["d"]
+        dcopy = d_.copy()
+        del d_["a"]
+        assert dcopy == {"a": 1, "b": [1, 2]}
+        dcopy["c"] = 3
+        assert dict(dcopy.items()) == {"a": 1, "b": [1, 2], "c": 3}
+        assert m["d"] == {"b": [1, 2]}
+
+        # Storing a copy stores its own list, which is what the copy changes from then on.
+        copy = m["l"].copy()
+        m["copy"] = copy
+        m["l"].pop()
+        copy.append("x")
+        assert m["copy"][-1] == "x"
+        assert len(m["copy"]) == 5001
+        assert len(m["l"]) == 4999
+
+        copy = m["l"].copy()
+        m["l"].sort(key=str)
+        assert copy[0] == "changed"
+
+        # Copies that go away while they still borrow leave nothing behind. Compacting keeps the
+        # pages the way the writes left them, so the count can move by a page or two, while 2000
+        # leftover copies would take about 90.
+        def live_pages():
+            path = os.path.join(d, "measure")
+            pages = m.compact(path)["after"]["pages"]
+            os.remove(path)
+            return pages
+        del copy
+        pages = live_pages()
+        for i in range(2000):
+            m["l"].copy()
+            m["d"].copy()
+            m["l"].stored_repeat(1)
+        assert live_pages() <= pages + 5
+        assert m["l"].copy() == m["l"]
+
+        # Copies of frozen lists are the same list until they change.
+        f = OOCMap(os.path.join(d, "frozen"), max_size=SMALL_MAP, frozen=True)
+        f["l"] = [1, 2]
+        copy = f["l"].copy()
+        copy.append(3)
+        assert f["l"] == [1, 2]
+        assert copy == [1, 2, 3]
+
+
+def test_stored_concat_and_repeat():
+    with tempfile.TemporaryDirectory() as d:
+        m = OOCMap(os.path.join(d, "stored"), max_size=SMALL_MAP, content_hashes=True)
+        m["a"] = [1, "two", (3,)]
+        m["b"] = [4.0, [5]]
+        a = m["a"]
+        b = m["b"]
+
+        c = a.stored_concat(b)
+        assert type(c) == type(a)
+        assert c == [1, "two", (3,), 4.0, [5]]
+        assert a.stored_concat(["x"]).content_hash() == a.stored_concat(iter(["x"])).content_hash()
+        assert a.stored_concat(a) == [1, "two", (3,)] * 2
+        assert a.stored_concat(iter(["x"])) == [1, "two", (3,), "x"]
+
+        assert a.stored_repeat(3) == [1, "two", (3,)] * 3
+        assert a.stored_repeat(0) == []
+        assert a.stored_repeat(-1) == []
+        assert a.stored_repeat(1) == a
+
+        # The new lists are lists of their own.
+        c.append(6)
+        r = a.stored_repeat(2)
+        r.pop()
+        assert m["a"] == [1, "two", (3,)]
+        assert m["b"] == [4.0, [5]]
+        m["c"] = c
+        assert m["c"] == [1, "two", (3,), 4.0, [5], 6]
+
+        # Other maps' lists are encoded again.
+        other = OOCMap(os.path.join(d, "other"), max_size=SMALL_MAP)
+        other["x"] = ["y"]
+        assert a.stored_concat(other["x"]) == [1, "two", (3,), "y"]
+
+        # The + and * operators still make Python lists.
+        assert type(a + [6]) == list
+        assert type(a * 2) == list
+
+
+def test_index_and_count_on_long_lists():
+    with tempfile.TemporaryDirectory() as d:
+        m = OOCMap(os.path.join(d, "scan"), max_size=SMALL_MAP)
+        items = [i % 7 for i in range(1000)] + ["x", 2.5, (1, 2), [1, 2], "x"]
+        m["l"] = items
+        l = m["l"]
+
+        for needle in [0, 6, "x", 2.5, (1, 2), [1, 2], "missing", 7]:
+            assert l.count(needle) == items.count(needle)
+            assert (needle in l) == (needle in items)
+            if needle in items:
+                assert l.index(needle) == items.index(needle)
+        for start, stop in [(0, 1005), (3, 4), (100, 900), (-10, -1), (-2000, 2000), (500, 100), (999, 1005)]:
+            for needle in [3, "x", [1, 2]]:
+                try:
+                    expected = items.index(needle, start, stop)
+                except ValueError:
+                    expected = None
+                try:
+                    assert l.index(needle, start, stop) == expected
+                except ValueError:
+                    assert expected is None
+
+
+def test_index_and_count_compare_numbers_by_value():
+    with tempfile.TemporaryDirectory() as d:
+        m = OOCMap(os.path.join(d, "numbers"), max_size=SMALL_MAP)
+        items = [1.0, 2, True, (1, 2), 2**70, float(2**70), "1"]
+        m["l"] = items
+        l = m["l"]
+
+        assert 1 in l
+        assert l.count(1) == 2
+        assert 2.0 in l
+        assert l.index(True) == 0
+        assert (1.0, 2) in l
+        for needle in [1, 1.0, True, False, 0, 2, 2.0, (1, 2), (1.0, 2), (True, 2.0), 2**70, float(2**70), 2**70 + 1, "1", 7]:
+            assert l.count(needle) == items.count(needle)
+            assert (needle in l) == (needle in items)
+            if needle in items:
+                assert l.index(needle) == items.index(needle)
+
+
+def test_growing_while_other_threads_read():
+    # Growing the map maps it again, so it has to wait for the other threads' reads, including the
+    # ones that let go of the GIL while they scan.
+    with tempfile.TemporaryDirectory() as d:
+        m = OOCMap(os.path.join(d, "grow"), max_size=64*1024*1024)
+        m["l"] = list(range(1000000))
+        l = m["l"]
+        stop = threading.Event()
+        counts = []
+
+        def count():
+            while not stop.is_set():
+                counts.append(l.count(-5))
+        reader = threading.Thread(target=count)
+        reader.start()
+        try:
+            long_string = "x" * 100000
+            for i in range(1000):
+                m[i] = long_string + str(i)
+        finally:
+            stop.set()
+            reader.join()
 
+        assert len(counts) > 0 and set(counts) == {0}
+        assert m[999] == long_string + "999"
+        assert len(m["l"]) == 1000000
@@ -0,0 +1,163 @@
+#include "orderedkeys.h"
+
+#include <cstring>
+
+#include "errors.h"
+
+static const uint8_t ORDERED_TAG_INT = 0x20;
+static const uint8_t ORDERED_TAG_FLOAT = 0x30;
+static const uint8_t ORDERED_TAG_STRING = 0x40;
+static const uint8_t ORDERED_TAG_TUPLE = 0x50;
+
+// Strings and tuples end in bytes that sort before anything that could continue them. Zero bytes
+// inside strings are escaped, so they can't be mistaken for the end.
+static const uint8_t ORDERED_END = 0x00;
+static const uint8_t ORDERED_STRING_END = 0x01;
+static const uint8_t ORDERED_ESCAPED_ZERO = 0xff;
+
+static void appendBigEndian(std::string& dest, const uint64_t value) {
+    for(int shift = 56; shift >= 0; shift -= 8)
+        dest.push_back(static_cast<char>(value >> shift));
+}
+
+static uint64_t readBigEndian(const uint8_t* const data) {
+    uint64_t result = 0;
+    for(int i = 0; i < 8; ++i)
+        result = (result << 8) | data[i];
+    return result;
+}
+
+void OrderedKey_encode(PyObject* const key, std::string& dest, const bool terminate) {
+    if(PyLong_CheckExact(key)) {
+        const long long value = PyLong_AsLongLong(key);
+        if(value == -1 && PyErr_Occurred())
+            throw OocError(OocError::AlreadyPythonizedError);
+        // Flipping the sign bit makes the two's complement order match the unsigned one.
+        dest.push_back(ORDERED_TAG_INT);
+        appendBigEndian(dest, static_cast<uint64_t>(value) ^ (1ull << 63));
+    } else if(PyFloat_CheckExact(key)) {
+        // Positive floats sort like their bits once the sign bit is set. Negative floats sort
+        // backwards, so we flip all of their bits.
+        double value = PyFloat_AS_DOUBLE(key);
+        if(value == 0.0) value = 0.0;   // -0.0 == 0.0, so they have to be the same key
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        bits = (bits & (1ull << 63)) ? ~bits : bits | (1ull << 63);
+        dest.push_back(ORDERED_TAG_FLOAT);
+        appendBigEndian(dest, bits);
+    } else if(PyUnicode_Check(key)) {
+        // UTF-8 sorts by code point, same as Python.
+        Py_ssize_t size;
+        const char* const utf8 = PyUnicode_AsUTF8AndSize(key, &size);
+        if(utf8 == nullptr)
+            throw OocError(OocError::AlreadyPythonizedError);
+        dest.push_back(ORDERED_TAG_STRING);
+        for(Py_ssize_t i = 0; i < size; ++i) {
+            dest.push_back(utf8[i]);
+            if(utf8[i] == ORDERED_END)
+                dest.push_back(ORDERED_ESCAPED_ZERO);
+        }
+        if(terminate) {
+            dest.push_back(ORDERED_END);
+            dest.push_back(ORDERED_STRING_END);
+        }
+    } else if(PyTuple_CheckExact(key)) {
+        dest.push_back(ORDERED_TAG_TUPLE);
+        for(Py_ssize_t i = 0; i < PyTuple_GET_SIZE(key); ++i)
+            OrderedKey_encode(PyTuple_GET_ITEM(key, i), dest);
+        if(terminate)
+            dest.push_back(ORDERED_END);
+    } else {
+        PyErr_Format(
+            PyExc_TypeError,
+            "ordered keys must be ints, floats, strings, or tuples of those, not %s",
+            Py_TYPE(key)->tp_name);
+        throw OocError(OocError::AlreadyPythonizedError);
+    }
+}
+
+static PyObject* OrderedKey_decode(const uint8_t*& data, const uint8_t* const end) {
+    if(data >= end) throw OocError(OocError::UnexpectedData);
+    switch(*data++) {
+    case ORDERED_TAG_INT: {
+        if(end - data < 8) throw OocError(OocError::UnexpectedData);
+        const int64_t value = static_cast<int64_t>(readBigEndian(data) ^ (1ull << 63));
+        data += 8;
+        PyObject* const result = PyLong_FromLongLong(value);
+        if(result == nullptr) throw OocError(OocError::AlreadyPythonizedError);
+        return result;
+    }
+    case ORDERED_TAG_FLOAT: {
+        if(end - data < 8) throw OocError(OocError::UnexpectedData);
+        uint64_t bits = readBigEndian(data);
+        data += 8;
+        bits = (bits & (1ull << 63)) ? bits & ~(1ull << 63) : ~bits;
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        PyObject* const result = PyFloat_FromDouble(value);
+        if(result == nullptr) throw OocError(OocError::AlreadyPythonizedError);
+        return result;
+    }
+    case ORDERED_TAG_STRING: {
+        std::string utf8;
+        while(true) {
+            if(end - data < 2) throw OocError(OocError::UnexpectedData);
+            if(data[0] == ORDERED_END) {
+                if(data[1] == ORDERED_STRING_END) break;
+                if(data[1] != ORDERED_ESCAPED_ZERO) throw OocError(OocError::UnexpectedData);
+                utf8.push_back('\0');
+                data += 2;
+            } else {
+                utf8.push_back(*data++);
+            }
+        }
+        data += 2;
+        PyObject* const result = PyUnicode_DecodeUTF8(utf8.data(), utf8.size(), nullptr);
+        if(result == nullptr) throw OocError(OocError::AlreadyPythonizedError);
+        return result;
+    }
+    case ORDERED_TAG_TUPLE: {
+        PyObject* const items = PyList_New(0);
+        if(items == nullptr) throw OocError(OocError::AlreadyPythonizedError);
+        try {
+            while(true) {
+                if(data >= end) throw OocError(OocError::UnexpectedData);
+                if(*data == ORDERED_END) break;
+                PyObject* const item = OrderedKey_decode(data, end);
+                const int appendError = PyList_Append(items, item);
+                Py_DECREF(item);
+                if(appendError != 0) throw OocError(OocError::AlreadyPythonizedError);
+            }
+        } catch(...) {
+            Py_DECREF(items);
+            throw;
+        }
+        data += 1;
+        PyObject* const result = PyList_AsTuple(items);
+        Py_DECREF(items);
+        if(result == nullptr) throw OocError(OocError::AlreadyPythonizedError);
+        return result;
+    }
+    default:
+        throw OocError(OocError::UnexpectedData);
+    }
+}
+
+PyObject* OrderedKey_decode(const MDB_val* const key) {
+    const uint8_t* data = static_cast<const uint8_t*>(key->mv_data);
+    const uint8_t* const end = data + key->mv_size;
+    PyObject* const result = OrderedKey_decode(data, end);
+    if(data != end) {
+        Py_DECREF(result);
+        throw OocError(OocError::UnexpectedData);
+    }
+    return result;
+}
+
+std::string OrderedKey_successor(std::string prefix) {
+    while(!prefix.empty() && static_cast<uint8_t>(prefix.back()) == 0xff)
+        prefix.pop_back();
+    if(!prefix.empty())
+        prefix.back() = static_cast<char>(static_cast<uint8_t>(prefix.back()) + 1);
+    return prefix;
+}
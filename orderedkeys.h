@@ -0,0 +1,26 @@
+#ifndef OOCMAP_ORDEREDKEYS_H
+#define OOCMAP_ORDEREDKEYS_H
+
+#include <string>
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "lmdb.h"
+
+//
+// An encoding for root keys whose byte order matches the order of the keys in Python, so LMDB
+// keeps them sorted. It covers ints that fit into 64 bits, floats, strings, and tuples of those.
+// Ints and floats are not compared to each other. All ints sort before all floats.
+//
+
+// Appends the encoding of key to dest. Without terminate, strings and tuples are left open, so
+// the result is a prefix of the encoding of every key that starts with key.
+void OrderedKey_encode(PyObject* key, std::string& dest, bool terminate = true);
+
+PyObject* OrderedKey_decode(const MDB_val* key);
+
+// Returns the smallest byte string that is greater than every string starting with prefix, or an
+// empty string if there is none.
+std::string OrderedKey_successor(std::string prefix);
+
+#endif //OOCMAP_ORDEREDKEYS_H
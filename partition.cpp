@@ -0,0 +1,303 @@
+#include "partition.h"
+
+#include <vector>
+#include <cstring>
+#include <structmember.h>
+
+#include "db.h"
+#include "densearray.h"
+#include "errors.h"
+
+PyObject* OOCMapPartition_denseBound(const uint64_t key) {
+    return PyBytes_FromStringAndSize(reinterpret_cast<const char*>(&key), sizeof(key));
+}
+
+uint64_t OOCMapPartition_denseKey(PyObject* const bound) {
+    if(!PyBytes_Check(bound) || PyBytes_GET_SIZE(bound) != sizeof(uint64_t))
+        throw OocError(OocError::UnexpectedData);
+    uint64_t result;
+    memcpy(&result, PyBytes_AS_STRING(bound), sizeof(result));
+    return result;
+}
+
+//
+// Methods that are not directly exposed to Python.
+// These throw exceptions.
+//
+
+static OOCMapPartitionObject* OOCMapPartition_fastnew(
+    OOCMapObject* const ooc,
+    PyObject* const lo,
+    PyObject* const hi
+) {
+    PyObject* const pySelf = OOCMapPartitionType.tp_alloc(&OOCMapPartitionType, 0);
+    if(pySelf == nullptr) throw OocError(OocError::OutOfMemory);
+    OOCMapPartitionObject* const self = reinterpret_cast<OOCMapPartitionObject*>(pySelf);
+    self->filename = ooc->filename;
+    Py_INCREF(self->filename);
+    self->lo = lo;
+    Py_INCREF(lo);
+    self->hi = hi;
+    Py_INCREF(hi);
+    self->ooc = ooc;
+    Py_INCREF(ooc);
+    return self;
+}
+
+// Returns the map to scan, opening it if this partition came from another process.
+static OOCMapObject* OOCMapPartitionObject_map(OOCMapPartitionObject* const self) {
+    if(self->ooc == nullptr) {
+        PyObject* const args = Py_BuildValue("(O)", self->filename);
+        PyObject* const kwds = Py_BuildValue("{s:O}", "readonly", Py_True);
+        PyObject* const ooc = args != nullptr && kwds != nullptr ?
+            PyObject_Call(reinterpret_cast<PyObject*>(&OOCMapType), args, kwds) :
+            nullptr;
+        Py_XDECREF(args);
+        Py_XDECREF(kwds);
+        if(ooc == nullptr) throw OocError(OocError::AlreadyPythonizedError);
+        self->ooc = reinterpret_cast<OOCMapObject*>(ooc);
+    }
+    return self->ooc;
+}
+
+//
+// Methods that are directly exposed to Python
+// These are not allowed to throw exceptions.
+//
+
+PyObject* OOCMap_partitions(PyObject* const pySelf, PyObject* const args, PyObject* const kwds) {
+    if(pySelf->ob_type != &OOCMapType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCMapObject* const self = reinterpret_cast<OOCMapObject*>(pySelf);
+
+    static const char* kwlist[] = {"n", nullptr};
+    unsigned int n;
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "I", const_cast<char**>(kwlist), &n))
+        return nullptr;
+    if(n < 1) {
+        PyErr_Format(PyExc_ValueError, "n must be at least 1");
+        return nullptr;
+    }
+
+    // The bounds between the partitions, as new references
+    std::vector<PyObject*> bounds;
+    MDB_txn* txn = nullptr;
+    PyObject* result = nullptr;
+    try {
+        if(self->keyEncoding == KEY_ENCODING_DENSE) {
+            for(const uint64_t key : self->dense->split(n)) {
+                PyObject* const bound = OOCMapPartition_denseBound(key);
+                if(bound == nullptr) throw OocError(OocError::AlreadyPythonizedError);
+                bounds.push_back(bound);
+            }
+        } else {
+            txn = txn_begin(OOCMap_env(self), false);
+            std::vector<MDB_val> keys(n - 1);
+            unsigned int count = n - 1;
+            const int error = mdb_dbi_split_keys(txn, self->rootDb, keys.data(), &count);
+            if(error != 0) throw MdbError(error);
+            for(unsigned int i = 0; i < count; ++i) {
+                PyObject* const bound = PyBytes_FromStringAndSize(
+                    static_cast<const char*>(keys[i].mv_data), keys[i].mv_size);
+                if(bound == nullptr) throw OocError(OocError::AlreadyPythonizedError);
+                bounds.push_back(bound);
+            }
+            txn_commit(txn);
+        }
+
+        // Small maps don't have enough keys to split, so they get fewer partitions.
+        result = PyList_New(bounds.size() + 1);
+        if(result == nullptr) throw OocError(OocError::AlreadyPythonizedError);
+        for(size_t i = 0; i <= bounds.size(); ++i) {
+            PyObject* const lo = i == 0 ? Py_None : bounds[i - 1];
+            PyObject* const hi = i == bounds.size() ? Py_None : bounds[i];
+            PyList_SET_ITEM(result, i, reinterpret_cast<PyObject*>(OOCMapPartition_fastnew(self, lo, hi)));
+        }
+    } catch(const OocError& error) {
+        if(txn != nullptr)
+            txn_abort(txn);
+        Py_CLEAR(result);
+        error.pythonize();
+    }
+    for(PyObject* const bound : bounds)
+        Py_DECREF(bound);
+    return result;
+}
+
+static PyObject* OOCMapPartition_new(PyTypeObject* const type, PyObject* const args, PyObject* const kwds) {
+    PyObject* const pySelf = type->tp_alloc(type, 0);
+    OOCMapPartitionObject* const self = reinterpret_cast<OOCMapPartitionObject*>(pySelf);
+    if(self == nullptr) {
+        PyErr_NoMemory();
+        return nullptr;
+    }
+    self->filename = nullptr;
+    self->lo = Py_None;
+    Py_INCREF(Py_None);
+    self->hi = Py_None;
+    Py_INCREF(Py_None);
+    self->ooc = nullptr;
+    return pySelf;
+}
+
+static int OOCMapPartition_init(OOCMapPartitionObject* const self, PyObject* const args, PyObject* const kwds) {
+    static const char* kwlist[] = {"filename", "lo", "hi", nullptr};
+    PyObject* filename = nullptr;
+    PyObject* lo = Py_None;
+    PyObject* hi = Py_None;
+    const int parseSuccess = PyArg_ParseTupleAndKeywords(
+        args,
+        kwds,
+        "O&|OO",
+        const_cast<char**>(kwlist),
+        PyUnicode_FSConverter, &filename, &lo, &hi);
+    if(!parseSuccess)
+        return -1;
+    if((lo != Py_None && !PyBytes_Check(lo)) || (hi != Py_None && !PyBytes_Check(hi))) {
+        Py_DECREF(filename);
+        PyErr_Format(PyExc_TypeError, "lo and hi must be bytes or None");
+        return -1;
+    }
+
+    Py_XSETREF(self->filename, filename);
+    Py_INCREF(lo);
+    Py_SETREF(self->lo, lo);
+    Py_INCREF(hi);
+    Py_SETREF(self->hi, hi);
+    Py_CLEAR(self->ooc);
+    return 0;
+}
+
+static void OOCMapPartition_dealloc(OOCMapPartitionObject* const self) {
+    Py_XDECREF(self->filename);
+    Py_XDECREF(self->lo);
+    Py_XDECREF(self->hi);
+    Py_XDECREF(self->ooc);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* OOCMapPartition_scan(PyObject* const pySelf, const OOCMapIterMode mode) {
+    if(pySelf->ob_type != &OOCMapPartitionType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCMapPartitionObject* const self = reinterpret_cast<OOCMapPartitionObject*>(pySelf);
+    if(self->filename == nullptr) {
+        PyErr_Format(PyExc_ValueError, "This partition was never initialized.");
+        return nullptr;
+    }
+
+    try {
+        OOCMapObject* const ooc = OOCMapPartitionObject_map(self);
+        return OOCMapIter_fastnew(
+            ooc,
+            self->lo == Py_None ? nullptr : self->lo,
+            self->hi == Py_None ? nullptr : self->hi,
+            false,
+            mode);
+    } catch(const OocError& error) {
+        error.pythonize();
+        return nullptr;
+    }
+}
+
+static PyObject* OOCMapPartition_iter(PyObject* const pySelf) {
+    return OOCMapPartition_scan(pySelf, ITER_ITEMS);
+}
+
+static PyObject* OOCMapPartition_keys(PyObject* const pySelf) {
+    return OOCMapPartition_scan(pySelf, ITER_KEYS);
+}
+
+static PyObject* OOCMapPartition_values(PyObject* const pySelf) {
+    return OOCMapPartition_scan(pySelf, ITER_VALUES);
+}
+
+static PyObject* OOCMapPartition_items(PyObject* const pySelf) {
+    return OOCMapPartition_scan(pySelf, ITER_ITEMS);
+}
+
+static PyObject* OOCMapPartition_open(PyObject* const pySelf) {
+    if(pySelf->ob_type != &OOCMapPartitionType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCMapPartitionObject* const self = reinterpret_cast<OOCMapPartitionObject*>(pySelf);
+    if(self->filename == nullptr) {
+        PyErr_Format(PyExc_ValueError, "This partition was never initialized.");
+        return nullptr;
+    }
+
+    try {
+        OOCMapObject* const ooc = OOCMapPartitionObject_map(self);
+        Py_INCREF(ooc);
+        return reinterpret_cast<PyObject*>(ooc);
+    } catch(const OocError& error) {
+        error.pythonize();
+        return nullptr;
+    }
+}
+
+static PyObject* OOCMapPartition_reduce(PyObject* const pySelf) {
+    if(pySelf->ob_type != &OOCMapPartitionType) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    OOCMapPartitionObject* const self = reinterpret_cast<OOCMapPartitionObject*>(pySelf);
+    // The map stays behind. The other process opens its own.
+    return Py_BuildValue("(O(OOO))", Py_TYPE(self), self->filename, self->lo, self->hi);
+}
+
+static PyMethodDef OOCMapPartition_methods[] = {
+    {
+        "__reduce__",
+        (PyCFunction)OOCMapPartition_reduce,
+        METH_NOARGS,
+        PyDoc_STR("pickles the partition without its map")
+    }, {
+        "items",
+        (PyCFunction)OOCMapPartition_items,
+        METH_NOARGS,
+        PyDoc_STR("iterates over the (key, value) pairs in the partition")
+    }, {
+        "keys",
+        (PyCFunction)OOCMapPartition_keys,
+        METH_NOARGS,
+        PyDoc_STR("iterates over the keys in the partition")
+    }, {
+        "open",
+        (PyCFunction)OOCMapPartition_open,
+        METH_NOARGS,
+        PyDoc_STR("returns the map the partition belongs to, opening it read-only if necessary")
+    }, {
+        "values",
+        (PyCFunction)OOCMapPartition_values,
+        METH_NOARGS,
+        PyDoc_STR("iterates over the values in the partition")
+    },
+    {nullptr}, // sentinel
+};
+
+static PyMemberDef OOCMapPartition_members[] = {
+    {"filename", T_OBJECT, offsetof(OOCMapPartitionObject, filename), READONLY, PyDoc_STR("the map's file")},
+    {"lo", T_OBJECT, offsetof(OOCMapPartitionObject, lo), READONLY, PyDoc_STR("the first key in the partition, encoded")},
+    {"hi", T_OBJECT, offsetof(OOCMapPartitionObject, hi), READONLY, PyDoc_STR("the first key after the partition, encoded")},
+    {nullptr}, // sentinel
+};
+
+PyTypeObject OOCMapPartitionType = {
+    PyVarObject_HEAD_INIT(nullptr, 0)
+    .tp_name = "oocmap.Partition",
+    .tp_basicsize = sizeof(OOCMapPartitionObject),
+    .tp_itemsize = 0,
+    .tp_dealloc = (destructor)OOCMapPartition_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "A range of an OOCMap's keys that can be scanned in another process",
+    .tp_iter = OOCMapPartition_iter,
+    .tp_methods = OOCMapPartition_methods,
+    .tp_members = OOCMapPartition_members,
+    .tp_init = (initproc)OOCMapPartition_init,
+    .tp_new = OOCMapPartition_new,
+};
@@ -0,0 +1,34 @@
+#ifndef OOCMAP_PARTITION_H
+#define OOCMAP_PARTITION_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "oocmap.h"
+
+//
+// OOCMapPartition
+//
+
+// One contiguous range of an OOCMap's keys, which a worker process can scan on its own. Pickling
+// it keeps only the filename and the bounds. The worker opens the map read-only when it first
+// scans.
+typedef struct {
+    PyObject_HEAD
+    PyObject* filename; // bytes
+    PyObject* lo;       // bytes in the root table's key format, inclusive, or None
+    PyObject* hi;       // bytes in the root table's key format, exclusive, or None
+    OOCMapObject* ooc;  // the map to scan, or nullptr until we have opened it
+} OOCMapPartitionObject;
+
+extern PyTypeObject OOCMapPartitionType;
+
+// Implements OOCMap.partitions(n)
+PyObject* OOCMap_partitions(PyObject* self, PyObject* args, PyObject* kwds);
+
+// Dense maps don't have a root table. Their partitions are bounded by keys, stored in bytes as
+// native uint64s.
+PyObject* OOCMapPartition_denseBound(uint64_t key);
+uint64_t OOCMapPartition_denseKey(PyObject* bound);
+
+#endif //OOCMAP_PARTITION_H
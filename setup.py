@@ -8,6 +8,15 @@ oocmap_module = Extension(
         'lazytuple.cpp',
         'lazylist.cpp',
         'lazydict.cpp',
+        'sharded.cpp',
+        'orderedkeys.cpp',
+        'densearray.cpp',
+        'partition.cpp',
+        'listsort.cpp',
+        'compare.cpp',
+        'contenthash.cpp',
+        'frozen.cpp',
+        'loans.cpp',
         'errors.cpp',
         'db.cpp',
         'mdb.c',
@@ -0,0 +1,263 @@
+#include "sharded.h"
+
+#include <sys/stat.h>
+
+#include "db.h"
+#include "errors.h"
+
+//
+// Methods that are not directly exposed to Python.
+// These throw exceptions.
+//
+
+static OOCMapObject* ShardedOOCMapObject_shardFor(ShardedOOCMapObject* const self, PyObject* const key) {
+    OOCMapObject* const firstShard = reinterpret_cast<OOCMapObject*>(PyTuple_GET_ITEM(self->shards, 0));
+    const uint64_t hash = OOCMap_hashKey(firstShard, key);
+    return reinterpret_cast<OOCMapObject*>(PyTuple_GET_ITEM(self->shards, hash % PyTuple_GET_SIZE(self->shards)));
+}
+
+//
+// Methods that are directly exposed to Python
+// These are not allowed to throw exceptions.
+//
+
+static PyObject* ShardedOOCMap_new(PyTypeObject* const type, PyObject* const args, PyObject* const kwds) {
+    PyObject* const pySelf = type->tp_alloc(type, 0);
+    ShardedOOCMapObject* const self = reinterpret_cast<ShardedOOCMapObject*>(pySelf);
+    if(self == nullptr) {
+        PyErr_NoMemory();
+        return nullptr;
+    }
+    self->shards = nullptr;
+    return pySelf;
+}
+
+static int ShardedOOCMap_init(ShardedOOCMapObject* const self, PyObject* const args, PyObject* const kwds) {
+    // We take the filename and the number of shards. Everything else goes to the shards.
+    PyObject* filenameObject = nullptr;
+    Py_ssize_t shardCount = 0;
+    if(!PyArg_ParseTuple(args, "O&|n", PyUnicode_FSConverter, &filenameObject, &shardCount))
+        return -1;
+    PyObject* shardKwds = kwds == nullptr ? PyDict_New() : PyDict_Copy(kwds);
+    if(shardKwds == nullptr) {
+        Py_DECREF(filenameObject);
+        return -1;
+    }
+    PyObject* const shardsArgument = PyDict_GetItemString(shardKwds, "shards");
+    if(shardsArgument != nullptr) {
+        shardCount = PyLong_AsSsize_t(shardsArgument);
+        PyDict_DelItemString(shardKwds, "shards");
+    }
+
+    // The number of shards decides where each key goes, so it can't change once there are shards.
+    Py_ssize_t existingShards = 0;
+    while(true) {
+        PyObject* const shardFilename = PyBytes_FromFormat(
+            "%s.%zd", PyBytes_AS_STRING(filenameObject), existingShards);
+        if(shardFilename == nullptr) break;
+        struct stat fileStat;
+        const bool exists = stat(PyBytes_AS_STRING(shardFilename), &fileStat) == 0;
+        Py_DECREF(shardFilename);
+        if(!exists) break;
+        existingShards += 1;
+    }
+    if(PyErr_Occurred()) {
+        Py_DECREF(filenameObject);
+        Py_DECREF(shardKwds);
+        return -1;
+    }
+    if(shardCount <= 0)
+        shardCount = existingShards;
+    if(shardCount <= 0 || (existingShards > 0 && existingShards != shardCount)) {
+        if(shardCount <= 0)
+            PyErr_Format(PyExc_ValueError, "shards must be positive");
+        else
+            PyErr_Format(
+                PyExc_ValueError,
+                "%s has %zd shards, not %zd",
+                PyBytes_AS_STRING(filenameObject), existingShards, shardCount);
+        Py_DECREF(filenameObject);
+        Py_DECREF(shardKwds);
+        return -1;
+    }
+
+    PyObject* const shards = PyTuple_New(shardCount);
+    if(shards == nullptr) {
+        Py_DECREF(filenameObject);
+        Py_DECREF(shardKwds);
+        return -1;
+    }
+    for(Py_ssize_t i = 0; i < shardCount; ++i) {
+        PyObject* const shardFilename = PyBytes_FromFormat("%s.%zd", PyBytes_AS_STRING(filenameObject), i);
+        PyObject* const shardArgs = shardFilename == nullptr ? nullptr : PyTuple_Pack(1, shardFilename);
+        Py_XDECREF(shardFilename);
+        PyObject* const shard = shardArgs == nullptr ?
+            nullptr :
+            PyObject_Call(reinterpret_cast<PyObject*>(&OOCMapType), shardArgs, shardKwds);
+        Py_XDECREF(shardArgs);
+        if(shard == nullptr) {
+            Py_DECREF(shards);
+            Py_DECREF(filenameObject);
+            Py_DECREF(shardKwds);
+            return -1;
+        }
+        PyTuple_SET_ITEM(shards, i, shard);
+    }
+    Py_DECREF(filenameObject);
+    Py_DECREF(shardKwds);
+
+    Py_XSETREF(self->shards, shards);
+    return 0;
+}
+
+static void ShardedOOCMap_dealloc(ShardedOOCMapObject* const self) {
+    Py_XDECREF(self->shards);
+    Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+static bool isShardedOOCMap(PyObject* const pySelf) {
+    return pySelf->ob_type == &ShardedOOCMapType && reinterpret_cast<ShardedOOCMapObject*>(pySelf)->shards != nullptr;
+}
+
+static Py_ssize_t ShardedOOCMap_length(PyObject* const pySelf) {
+    if(!isShardedOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return -1;
+    }
+    ShardedOOCMapObject* const self = reinterpret_cast<ShardedOOCMapObject*>(pySelf);
+
+    Py_ssize_t result = 0;
+    for(Py_ssize_t i = 0; i < PyTuple_GET_SIZE(self->shards); ++i) {
+        const Py_ssize_t length = PyObject_Length(PyTuple_GET_ITEM(self->shards, i));
+        if(length < 0) return -1;
+        result += length;
+    }
+    return result;
+}
+
+static PyObject* ShardedOOCMap_get(PyObject* const pySelf, PyObject* const key) {
+    if(!isShardedOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    ShardedOOCMapObject* const self = reinterpret_cast<ShardedOOCMapObject*>(pySelf);
+
+    try {
+        // Lazy objects come back from the shard itself, so they stay bound to it.
+        OOCMapObject* const shard = ShardedOOCMapObject_shardFor(self, key);
+        return PyObject_GetItem(reinterpret_cast<PyObject*>(shard), key);
+    } catch(const OocError& error) {
+        error.pythonize();
+        return nullptr;
+    }
+}
+
+static int ShardedOOCMap_insert(PyObject* const pySelf, PyObject* const key, PyObject* const value) {
+    if(!isShardedOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return -1;
+    }
+    ShardedOOCMapObject* const self = reinterpret_cast<ShardedOOCMapObject*>(pySelf);
+
+    try {
+        OOCMapObject* const shard = ShardedOOCMapObject_shardFor(self, key);
+        if(value == nullptr)
+            return PyObject_DelItem(reinterpret_cast<PyObject*>(shard), key);
+        else
+            return PyObject_SetItem(reinterpret_cast<PyObject*>(shard), key, value);
+    } catch(const OocError& error) {
+        error.pythonize();
+        return -1;
+    }
+}
+
+static PyObject* ShardedOOCMap_iter(PyObject* const pySelf) {
+    if(!isShardedOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    ShardedOOCMapObject* const self = reinterpret_cast<ShardedOOCMapObject*>(pySelf);
+
+    // Iterating over each shard in turn gives us the keys. Shards are independent, so this is
+    // not a snapshot of the whole map, only of each shard.
+    PyObject* const itertools = PyImport_ImportModule("itertools");
+    if(itertools == nullptr) return nullptr;
+    PyObject* const chain = PyObject_GetAttrString(itertools, "chain");
+    Py_DECREF(itertools);
+    if(chain == nullptr) return nullptr;
+    PyObject* const result = PyObject_Call(chain, self->shards, nullptr);
+    Py_DECREF(chain);
+    return result;
+}
+
+static PyObject* ShardedOOCMap_shardIndex(PyObject* const pySelf, PyObject* const key) {
+    if(!isShardedOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    ShardedOOCMapObject* const self = reinterpret_cast<ShardedOOCMapObject*>(pySelf);
+
+    try {
+        OOCMapObject* const shard = ShardedOOCMapObject_shardFor(self, key);
+        for(Py_ssize_t i = 0; i < PyTuple_GET_SIZE(self->shards); ++i)
+            if(PyTuple_GET_ITEM(self->shards, i) == reinterpret_cast<PyObject*>(shard))
+                return PyLong_FromSsize_t(i);
+        throw OocError(OocError::UnexpectedData);
+    } catch(const OocError& error) {
+        error.pythonize();
+        return nullptr;
+    }
+}
+
+static PyObject* ShardedOOCMap_getShards(PyObject* const pySelf, void* const closure) {
+    if(!isShardedOOCMap(pySelf)) {
+        PyErr_BadArgument();
+        return nullptr;
+    }
+    ShardedOOCMapObject* const self = reinterpret_cast<ShardedOOCMapObject*>(pySelf);
+    Py_INCREF(self->shards);
+    return self->shards;
+}
+
+static PyMethodDef ShardedOOCMap_methods[] = {
+    {
+        "shard_index",
+        (PyCFunction)ShardedOOCMap_shardIndex,
+        METH_O,
+        PyDoc_STR("returns the index of the shard that holds the given key")
+    },
+    {nullptr}, // sentinel
+};
+
+static PyGetSetDef ShardedOOCMap_getset[] = {
+    {
+        "shards",
+        (getter)ShardedOOCMap_getShards,
+        nullptr,
+        PyDoc_STR("the OOCMaps that make up this map"),
+        nullptr
+    },
+    {nullptr}, // sentinel
+};
+
+static PyMappingMethods ShardedOOCMap_mapping_methods = {
+    .mp_length = ShardedOOCMap_length,
+    .mp_subscript = ShardedOOCMap_get,
+    .mp_ass_subscript = ShardedOOCMap_insert
+};
+
+PyTypeObject ShardedOOCMapType = {
+    PyVarObject_HEAD_INIT(nullptr, 0)
+    .tp_name = "oocmap.ShardedOOCMap",
+    .tp_basicsize = sizeof(ShardedOOCMapObject),
+    .tp_itemsize = 0,
+    .tp_dealloc = (destructor)ShardedOOCMap_dealloc,
+    .tp_as_mapping = &ShardedOOCMap_mapping_methods,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "An out-of-core map that spreads its keys over several OOCMaps, so they can be written in parallel",
+    .tp_iter = ShardedOOCMap_iter,
+    .tp_methods = ShardedOOCMap_methods,
+    .tp_getset = ShardedOOCMap_getset,
+    .tp_init = (initproc)ShardedOOCMap_init,
+    .tp_new = ShardedOOCMap_new,
+};
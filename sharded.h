@@ -0,0 +1,20 @@
+#ifndef OOCMAP_SHARDED_H
+#define OOCMAP_SHARDED_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "oocmap.h"
+
+//
+// ShardedOOCMap
+//
+
+typedef struct {
+    PyObject_HEAD
+    PyObject* shards;   // a tuple of OOCMaps
+} ShardedOOCMapObject;
+
+extern PyTypeObject ShardedOOCMapType;
+
+#endif //OOCMAP_SHARDED_H
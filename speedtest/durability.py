@@ -0,0 +1,17 @@
+import oocmap, os, sys, tempfile, timeit
+
+# Write throughput of the different durability modes. Every assignment is its own transaction,
+# so this measures the cost of a commit more than anything else.
+
+l = int(sys.argv[1]) if len(sys.argv) > 1 else 2000
+
+for durability in ["fast", "periodic", "nometasync", "full"]:
+  with tempfile.TemporaryDirectory() as d:
+    m = oocmap.OOCMap(os.path.join(d, "durability.ooc"), durability=durability)
+    start = timeit.default_timer()
+    for i in range(l):
+      m[i] = ("ai2", i, [float(i)] * 4)
+    m.checkpoint()
+    elapsed = timeit.default_timer() - start
+    del m
+  print(f"{durability}: {l / elapsed:.0f} writes/s")
@@ -0,0 +1,33 @@
+import oocmap, os, random, sys, tempfile, timeit
+
+# Random-get throughput with and without transparent huge pages. The values are big enough
+# that the map spans far more memory than the TLB covers with normal pages.
+
+l = int(sys.argv[1]) if len(sys.argv) > 1 else 50000
+gets = 500000
+
+with tempfile.TemporaryDirectory() as d:
+  filename = os.path.join(d, "hugepages.ooc")
+  m = oocmap.OOCMap(filename)
+  for i in range(l):
+    m[i] = "ai2" * 1000 + str(i)
+  del m
+
+  for huge_pages in [False, True, False, True]:
+    # Drop the file from the page cache, so the two modes don't share folios.
+    fd = os.open(filename, os.O_RDONLY)
+    os.fsync(fd)
+    os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_DONTNEED)
+    os.close(fd)
+
+    m = oocmap.OOCMap(filename, readonly=True, huge_pages=huge_pages)
+    for i in range(l):
+      m[i]
+    r = random.Random(0)
+    keys = [r.randrange(l) for _ in range(gets)]
+    start = timeit.default_timer()
+    for key in keys:
+      m[key]
+    elapsed = timeit.default_timer() - start
+    print(f"huge_pages={huge_pages}: {gets / elapsed:.0f} gets/s, {m.huge_page_bytes() // (1024 * 1024)} MiB in huge pages")
+    del m
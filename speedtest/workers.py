@@ -0,0 +1,25 @@
+import oocmap, multiprocessing, os, random, sys, tempfile, timeit
+
+# Read throughput with several forked worker processes sharing one map, the way DataLoader
+# workers would.
+
+l = 100000
+reads_per_worker = int(sys.argv[1]) if len(sys.argv) > 1 else 100000
+
+def work(seed):
+  r = random.Random(seed)
+  for _ in range(reads_per_worker):
+    len(m[r.randrange(l)])
+
+with tempfile.TemporaryDirectory() as d:
+  m = oocmap.OOCMap(os.path.join(d, "workers.ooc"))
+  for i in range(l):
+    m[i] = ("ai2", i, [float(i)] * 4)
+
+  context = multiprocessing.get_context("fork")
+  for workers in [1, 2, 4, 8]:
+    with context.Pool(workers) as pool:
+      start = timeit.default_timer()
+      pool.map(work, range(workers))
+      elapsed = timeit.default_timer() - start
+    print(f"{workers} workers: {workers * reads_per_worker / elapsed:.0f} reads/s")